@@ -54,7 +54,6 @@
 #include "app/ui/tabs.h"
 #include "app/ui/toolbar.h"
 #include "app/ui_context.h"
-#include "app/util/boundary.h"
 #include "app/webserver.h"
 #include "base/exception.h"
 #include "base/fs.h"
@@ -244,6 +243,30 @@ void App::initialize(const AppOptions& options)
           if (m_exporter)
             m_exporter->setTexturePack(true);
         }
+        // --sheet-pack-algorithm <name>
+        else if (opt == &options.sheetPackAlgorithm()) {
+          if (m_exporter) {
+            const std::string& name = value.value();
+            if (name == "maxrects")
+              m_exporter->setTexturePackAlgorithm(gfx::PackingRects::MaxRects);
+            else if (name == "maxrects-bssf")
+              m_exporter->setTexturePackAlgorithm(gfx::PackingRects::MaxRectsBestShortSideFit);
+            else if (name == "skyline")
+              m_exporter->setTexturePackAlgorithm(gfx::PackingRects::Skyline);
+            else
+              console.printf("Unknown packing algorithm \"%s\"\n", name.c_str());
+          }
+        }
+        // --sheet-rotate
+        else if (opt == &options.sheetRotate()) {
+          if (m_exporter)
+            m_exporter->setTextureRotation(true);
+        }
+        // --sheet-dedup
+        else if (opt == &options.sheetDedup()) {
+          if (m_exporter)
+            m_exporter->setDeduplicate(true);
+        }
         // --split-layers
         else if (opt == &options.splitLayers()) {
           splitLayers = true;
@@ -517,7 +540,6 @@ App::~App()
 
     // Finalize modules, configuration and core.
     Editor::editor_cursor_exit();
-    boundary_exit();
 
     delete m_legacy;
     delete m_modules;
@@ -35,6 +35,9 @@ AppOptions::AppOptions(int argc, const char* argv[])
   , m_sheetWidth(m_po.add("sheet-width").requiresValue("<pixels>").description("Sprite sheet width"))
   , m_sheetHeight(m_po.add("sheet-height").requiresValue("<pixels>").description("Sprite sheet height"))
   , m_sheetPack(m_po.add("sheet-pack").description("Use a packing algorithm to avoid waste of space\nin the texture"))
+  , m_sheetPackAlgorithm(m_po.add("sheet-pack-algorithm").requiresValue("<name>").description("Packing algorithm used by --sheet-pack:\nmaxrects (default), maxrects-bssf or skyline"))
+  , m_sheetRotate(m_po.add("sheet-rotate").description("Allow rotating frames 90 degrees in the packed\ntexture"))
+  , m_sheetDedup(m_po.add("sheet-dedup").description("Save identical frames just one time in the\ntexture"))
   , m_splitLayers(m_po.add("split-layers").description("Import each layer of the next given sprite as\na separated image in the sheet"))
   , m_importLayer(m_po.add("import-layer").requiresValue("<name>").description("Import just one layer of the next given sprite"))
   , m_ignoreEmpty(m_po.add("ignore-empty").description("Do not export empty frames/cels"))
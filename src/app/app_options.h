@@ -43,6 +43,9 @@ public:
   const Option& sheetWidth() const { return m_sheetWidth; }
   const Option& sheetHeight() const { return m_sheetHeight; }
   const Option& sheetPack() const { return m_sheetPack; }
+  const Option& sheetPackAlgorithm() const { return m_sheetPackAlgorithm; }
+  const Option& sheetRotate() const { return m_sheetRotate; }
+  const Option& sheetDedup() const { return m_sheetDedup; }
   const Option& splitLayers() const { return m_splitLayers; }
   const Option& importLayer() const { return m_importLayer; }
   const Option& ignoreEmpty() const { return m_ignoreEmpty; }
@@ -72,6 +75,9 @@ private:
   Option& m_sheetWidth;
   Option& m_sheetHeight;
   Option& m_sheetPack;
+  Option& m_sheetPackAlgorithm;
+  Option& m_sheetRotate;
+  Option& m_sheetDedup;
   Option& m_splitLayers;
   Option& m_importLayer;
   Option& m_ignoreEmpty;
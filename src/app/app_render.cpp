@@ -20,10 +20,12 @@ namespace app {
 
 AppRender::AppRender()
 {
+  setThreads(0);
 }
 
 AppRender::AppRender(app::Document* doc, doc::PixelFormat pixelFormat)
 {
+  setThreads(0);
   setupBackground(doc, pixelFormat);
 }
 
@@ -72,6 +72,16 @@ size_t Cmd::memSize() const
   return onMemSize();
 }
 
+void Cmd::spillPayloads()
+{
+  onSpillPayloads();
+}
+
+bool Cmd::loadPayloads()
+{
+  return onLoadPayloads();
+}
+
 void Cmd::onExecute()
 {
   // Do nothing
@@ -102,4 +112,14 @@ size_t Cmd::onMemSize() const {
   return sizeof(*this);
 }
 
+void Cmd::onSpillPayloads()
+{
+  // Do nothing
+}
+
+bool Cmd::onLoadPayloads()
+{
+  return true;
+}
+
 } // namespace app
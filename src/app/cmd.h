@@ -29,6 +29,15 @@ namespace app {
     std::string label() const;
     size_t memSize() const;
 
+    // Moves big undo data (e.g. image copies) to disk. Called by
+    // DocumentUndo for commands far from the current undo state.
+    void spillPayloads();
+
+    // Loads the data moved to disk by spillPayloads(). Returns false
+    // if it cannot be loaded (e.g. the temporary file was deleted),
+    // in that case the command cannot be undone/redone.
+    bool loadPayloads();
+
     Context* context() const { return m_ctx; }
 
   protected:
@@ -38,6 +47,8 @@ namespace app {
     virtual void onFireNotifications();
     virtual std::string onLabel() const;
     virtual size_t onMemSize() const;
+    virtual void onSpillPayloads();
+    virtual bool onLoadPayloads();
 
   private:
     Context* m_ctx;
@@ -49,12 +49,12 @@ void AddCel::onUndo()
 
   // Save the CelData only if the cel isn't linked
   bool has_data = (cel->links() == 0);
-  write8(m_stream, has_data ? 1: 0);
+  write8(m_stream.stream(), has_data ? 1: 0);
   if (has_data) {
-    write_image(m_stream, cel->image());
-    write_celdata(m_stream, cel->data());
+    write_image(m_stream.stream(), cel->image());
+    write_celdata(m_stream.stream(), cel->data());
   }
-  write_cel(m_stream, cel);
+  write_cel(m_stream.stream(), cel);
 
   removeCel(layer, cel);
 }
@@ -64,20 +64,19 @@ void AddCel::onRedo()
   Layer* layer = this->layer();
 
   SubObjectsIO io(layer->sprite());
-  bool has_data = (read8(m_stream) != 0);
+  bool has_data = (read8(m_stream.stream()) != 0);
   if (has_data) {
-    ImageRef image(read_image(m_stream));
+    ImageRef image(read_image(m_stream.stream()));
     io.addImageRef(image);
 
-    CelDataRef celdata(read_celdata(m_stream, &io));
+    CelDataRef celdata(read_celdata(m_stream.stream(), &io));
     io.addCelDataRef(celdata);
   }
-  Cel* cel = read_cel(m_stream, &io);
+  Cel* cel = read_cel(m_stream.stream(), &io);
 
   addCel(layer, cel);
 
-  m_stream.str(std::string());
-  m_stream.clear();
+  m_stream.reset();
 }
 
 void AddCel::addCel(Layer* layer, Cel* cel)
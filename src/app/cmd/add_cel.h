@@ -12,8 +12,7 @@
 #include "app/cmd.h"
 #include "app/cmd/with_cel.h"
 #include "app/cmd/with_layer.h"
-
-#include <sstream>
+#include "app/undo_payload.h"
 
 namespace doc {
   class Cel;
@@ -35,15 +34,20 @@ namespace cmd {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override {
-      return sizeof(*this) +
-        (size_t)const_cast<std::stringstream*>(&m_stream)->tellp();
+      return sizeof(*this) + m_stream.memSize();
+    }
+    void onSpillPayloads() override {
+      m_stream.spill();
+    }
+    bool onLoadPayloads() override {
+      return m_stream.load();
     }
 
   private:
     void addCel(Layer* layer, Cel* cel);
     void removeCel(Layer* layer, Cel* cel);
 
-    std::stringstream m_stream;
+    UndoPayload m_stream;
   };
 
 } // namespace cmd
@@ -43,7 +43,7 @@ void AddLayer::onUndo()
   Layer* folder = m_folder.layer();
   Layer* layer = m_newLayer.layer();
 
-  write_layer(m_stream, layer);
+  write_layer(m_stream.stream(), layer);
 
   removeLayer(folder, layer);
 }
@@ -52,13 +52,12 @@ void AddLayer::onRedo()
 {
   Layer* folder = m_folder.layer();
   SubObjectsIO io(folder->sprite());
-  Layer* newLayer = read_layer(m_stream, &io);
+  Layer* newLayer = read_layer(m_stream.stream(), &io);
   Layer* afterThis = m_afterThis.layer();
 
   addLayer(folder, newLayer, afterThis);
 
-  m_stream.str(std::string());
-  m_stream.clear();
+  m_stream.reset();
 }
 
 void AddLayer::addLayer(Layer* folder, Layer* newLayer, Layer* afterThis)
@@ -11,8 +11,7 @@
 
 #include "app/cmd.h"
 #include "app/cmd/with_layer.h"
-
-#include <sstream>
+#include "app/undo_payload.h"
 
 namespace doc {
   class Layer;
@@ -31,8 +30,13 @@ namespace cmd {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override {
-      return sizeof(*this) +
-        (size_t)const_cast<std::stringstream*>(&m_stream)->tellp();
+      return sizeof(*this) + m_stream.memSize();
+    }
+    void onSpillPayloads() override {
+      m_stream.spill();
+    }
+    bool onLoadPayloads() override {
+      return m_stream.load();
     }
 
   private:
@@ -42,7 +46,7 @@ namespace cmd {
     WithLayer m_folder;
     WithLayer m_newLayer;
     WithLayer m_afterThis;
-    std::stringstream m_stream;
+    UndoPayload m_stream;
   };
 
 } // namespace cmd
@@ -12,9 +12,13 @@
 #include "app/cmd/clear_image.h"
 
 #include "app/document.h"
+#include "doc/compressed_io.h"
 #include "doc/image.h"
 #include "doc/primitives.h"
 
+#include <algorithm>
+#include <vector>
+
 namespace app {
 namespace cmd {
 
@@ -28,15 +32,41 @@ ClearImage::ClearImage(Image* image, color_t color)
 
 void ClearImage::onExecute()
 {
-  ASSERT(!m_copy);
-  m_copy.reset(Image::createCopy(image()));
+  Image* image = this->image();
+  int size = image->getRowStrideSize();
+
+  std::vector<uint8_t> pixels(size * image->height());
+  for (int y=0; y<image->height(); ++y) {
+    const uint8_t* row = image->getPixelAddress(0, y);
+    std::copy(row, row+size, pixels.begin()+size*y);
+  }
+
+  ASSERT(m_copy.isEmpty());
+  write_compressed_data(m_copy.stream(), pixels.empty() ? NULL: &pixels[0], pixels.size());
+
+  clear_image(image, m_color);
+}
+
+void ClearImage::onRedo()
+{
+  // The saved pixels are the same (we are redoing from the state
+  // that was restored by onUndo), so they are not compressed again.
   clear_image(image(), m_color);
 }
 
 void ClearImage::onUndo()
 {
-  copy_image(image(), m_copy);
-  m_copy.reset(nullptr);
+  Image* image = this->image();
+  int size = image->getRowStrideSize();
+
+  std::vector<uint8_t> pixels;
+  m_copy.rewind();
+  read_compressed_data(m_copy.stream(), pixels);
+  ASSERT(pixels.size() == std::size_t(size * image->height()));
+
+  for (int y=0; y<image->height(); ++y)
+    std::copy(pixels.begin()+size*y, pixels.begin()+size*(y+1),
+              image->getPixelAddress(0, y));
 }
 
 } // namespace cmd
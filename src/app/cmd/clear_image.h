@@ -11,8 +11,8 @@
 
 #include "app/cmd.h"
 #include "app/cmd/with_image.h"
+#include "app/undo_payload.h"
 #include "doc/color.h"
-#include "doc/image_ref.h"
 
 namespace app {
 namespace cmd {
@@ -26,12 +26,20 @@ namespace cmd {
   protected:
     void onExecute() override;
     void onUndo() override;
+    void onRedo() override;
     size_t onMemSize() const override {
-      return sizeof(*this) + (m_copy ? m_copy->getMemSize(): 0);
+      return sizeof(*this) + m_copy.memSize();
+    }
+    void onSpillPayloads() override {
+      m_copy.spill();
+    }
+    bool onLoadPayloads() override {
+      return m_copy.load();
     }
 
   private:
-    ImageRef m_copy;
+    // Compressed pixels of the image before it was cleared
+    UndoPayload m_copy;
     color_t m_color;
   };
 
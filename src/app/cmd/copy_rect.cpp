@@ -11,9 +11,11 @@
 
 #include "app/cmd/copy_rect.h"
 
+#include "doc/compressed_io.h"
 #include "doc/image.h"
 
 #include <algorithm>
+#include <vector>
 
 namespace app {
 namespace cmd {
@@ -30,9 +32,9 @@ CopyRect::CopyRect(Image* dst, const Image* src, const gfx::Clip& clip)
   // Fill m_data with "src" data
 
   int lineSize = src->getRowStrideSize(m_clip.size.w);
-  m_data.resize(lineSize * m_clip.size.h);
+  std::vector<uint8_t> data(lineSize * m_clip.size.h);
 
-  auto it = m_data.begin();
+  auto it = data.begin();
   for (int v=0; v<m_clip.size.h; ++v) {
     uint8_t* addr = src->getPixelAddress(
       m_clip.dst.x, m_clip.dst.y+v);
@@ -40,41 +42,69 @@ CopyRect::CopyRect(Image* dst, const Image* src, const gfx::Clip& clip)
     std::copy(addr, addr+lineSize, it);
     it += lineSize;
   }
+
+  // Compressed because this command is used to copy whole layers
+  // (e.g. FlattenLayers)
+  write_compressed_data(m_data.stream(), data.empty() ? NULL: &data[0], data.size());
 }
 
 void CopyRect::onExecute()
 {
-  swap();
+  if (m_clip.size.w < 1 || m_clip.size.h < 1)
+    return;
+
+  // Save the original pixels, so undo/redo only have to uncompress
+  // the saved pixels (they are not compressed again).
+  {
+    Image* image = this->image();
+    int lineSize = this->lineSize();
+    std::vector<uint8_t> data(lineSize * m_clip.size.h);
+
+    auto it = data.begin();
+    for (int v=0; v<m_clip.size.h; ++v) {
+      const uint8_t* addr = image->getPixelAddress(
+        m_clip.dst.x, m_clip.dst.y+v);
+
+      std::copy(addr, addr+lineSize, it);
+      it += lineSize;
+    }
+
+    ASSERT(m_oldData.isEmpty());
+    write_compressed_data(m_oldData.stream(), data.empty() ? NULL: &data[0], data.size());
+  }
+
+  restore(m_data);
 }
 
 void CopyRect::onUndo()
 {
-  swap();
+  restore(m_oldData);
 }
 
 void CopyRect::onRedo()
 {
-  swap();
+  restore(m_data);
 }
 
-void CopyRect::swap()
+void CopyRect::restore(UndoPayload& payload)
 {
   if (m_clip.size.w < 1 || m_clip.size.h < 1)
     return;
 
   Image* image = this->image();
   int lineSize = this->lineSize();
-  std::vector<uint8_t> tmp(lineSize);
 
-  auto it = m_data.begin();
+  std::vector<uint8_t> data;
+  payload.rewind();
+  read_compressed_data(payload.stream(), data);
+  ASSERT(data.size() == std::size_t(lineSize * m_clip.size.h));
+
+  auto it = data.begin();
   for (int v=0; v<m_clip.size.h; ++v) {
     uint8_t* addr = image->getPixelAddress(
       m_clip.dst.x, m_clip.dst.y+v);
 
-    std::copy(addr, addr+lineSize, tmp.begin());
     std::copy(it, it+lineSize, addr);
-    std::copy(tmp.begin(), tmp.end(), it);
-
     it += lineSize;
   }
 }
@@ -11,10 +11,9 @@
 
 #include "app/cmd.h"
 #include "app/cmd/with_image.h"
+#include "app/undo_payload.h"
 #include "gfx/clip.h"
 
-#include <vector>
-
 namespace doc {
   class Image;
 }
@@ -33,15 +32,24 @@ namespace cmd {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override {
-      return sizeof(*this) + m_data.size();
+      return sizeof(*this) + m_data.memSize() + m_oldData.memSize();
+    }
+    void onSpillPayloads() override {
+      m_data.spill();
+      m_oldData.spill();
+    }
+    bool onLoadPayloads() override {
+      return (m_data.load() &&
+              m_oldData.load());
     }
 
   private:
-    void swap();
+    void restore(UndoPayload& payload);
     int lineSize();
 
     gfx::Clip m_clip;
-    std::vector<uint8_t> m_data;
+    UndoPayload m_data;         // Compressed pixels to copy
+    UndoPayload m_oldData;      // Compressed pixels before the copy
   };
 
 } // namespace cmd
@@ -11,9 +11,11 @@
 
 #include "app/cmd/copy_region.h"
 
+#include "doc/compressed_io.h"
 #include "doc/image.h"
 
 #include <algorithm>
+#include <vector>
 
 namespace app {
 namespace cmd {
@@ -23,6 +25,7 @@ CopyRegion::CopyRegion(Image* dst, Image* src,
   : WithImage(dst)
 {
   // Save region pixels
+  std::vector<uint8_t> pixels;
   for (const auto& rc : region) {
     gfx::Clip clip(
       rc.x+dst_dx, rc.y+dst_dy,
@@ -35,52 +38,64 @@ CopyRegion::CopyRegion(Image* dst, Image* src,
     m_region.createUnion(m_region, gfx::Region(clip.dstBounds()));
 
     for (int y=0; y<clip.size.h; ++y)  {
-      m_stream.write(
-        (const char*)src->getPixelAddress(clip.src.x, clip.src.y+y),
-        src->getRowStrideSize(clip.size.w));
+      const uint8_t* row = src->getPixelAddress(clip.src.x, clip.src.y+y);
+      pixels.insert(pixels.end(), row, row+src->getRowStrideSize(clip.size.w));
     }
   }
+
+  // Pixels are kept compressed because this command is used to save
+  // the modified regions of each stroke
+  write_compressed_data(m_stream.stream(), pixels.empty() ? NULL: &pixels[0], pixels.size());
 }
 
 void CopyRegion::onExecute()
 {
-  swap();
+  // Save the original pixels, so undo/redo only have to uncompress
+  // the saved pixels (they are not compressed again).
+  {
+    Image* image = this->image();
+    std::vector<uint8_t> pixels;
+    for (const auto& rc : m_region)
+      for (int y=0; y<rc.h; ++y) {
+        const uint8_t* row = image->getPixelAddress(rc.x, rc.y+y);
+        pixels.insert(pixels.end(), row, row+image->getRowStrideSize(rc.w));
+      }
+
+    ASSERT(m_oldStream.isEmpty());
+    write_compressed_data(m_oldStream.stream(), pixels.empty() ? NULL: &pixels[0], pixels.size());
+  }
+
+  restore(m_stream);
 }
 
 void CopyRegion::onUndo()
 {
-  swap();
+  restore(m_oldStream);
 }
 
 void CopyRegion::onRedo()
 {
-  swap();
+  restore(m_stream);
 }
 
-void CopyRegion::swap()
+void CopyRegion::restore(UndoPayload& payload)
 {
   Image* image = this->image();
 
-  // Save current image region in "tmp" stream
-  std::stringstream tmp;
-  for (const auto& rc : m_region)
-    for (int y=0; y<rc.h; ++y)
-      tmp.write(
-        (const char*)image->getPixelAddress(rc.x, rc.y+y),
-        image->getRowStrideSize(rc.w));
+  std::vector<uint8_t> pixels;
+  payload.rewind();
+  read_compressed_data(payload.stream(), pixels);
 
-  // Restore m_stream into the image
+  auto it = pixels.begin();
   for (const auto& rc : m_region) {
     for (int y=0; y<rc.h; ++y) {
-      m_stream.read(
-        (char*)image->getPixelAddress(rc.x, rc.y+y),
-        image->getRowStrideSize(rc.w));
+      int size = image->getRowStrideSize(rc.w);
+      ASSERT(it+size <= pixels.end());
+      std::copy(it, it+size, image->getPixelAddress(rc.x, rc.y+y));
+      it += size;
     }
   }
-
-  // TODO use m_stream.swap(tmp) when clang and gcc support it
-  m_stream.str(tmp.str());
-  m_stream.clear();
+  ASSERT(it == pixels.end());
 }
 
 } // namespace cmd
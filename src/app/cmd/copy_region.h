@@ -11,10 +11,9 @@
 
 #include "app/cmd.h"
 #include "app/cmd/with_image.h"
+#include "app/undo_payload.h"
 #include "gfx/region.h"
 
-#include <sstream>
-
 namespace app {
 namespace cmd {
   using namespace doc;
@@ -30,15 +29,23 @@ namespace cmd {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override {
-      return sizeof(*this) +
-        (size_t)const_cast<std::stringstream*>(&m_stream)->tellp();
+      return sizeof(*this) + m_stream.memSize() + m_oldStream.memSize();
+    }
+    void onSpillPayloads() override {
+      m_stream.spill();
+      m_oldStream.spill();
+    }
+    bool onLoadPayloads() override {
+      return (m_stream.load() &&
+              m_oldStream.load());
     }
 
   private:
-    void swap();
+    void restore(UndoPayload& payload);
 
     gfx::Region m_region;
-    std::stringstream m_stream;
+    UndoPayload m_stream;       // Compressed pixels to copy
+    UndoPayload m_oldStream;    // Compressed pixels before the copy
   };
 
 } // namespace cmd
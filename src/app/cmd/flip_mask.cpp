@@ -41,13 +41,13 @@ void FlipMask::swap()
   Document* document = this->document();
   Mask* mask = document->mask();
 
-  ASSERT(mask->bitmap());
-  if (!mask->bitmap())
+  ASSERT(!mask->isEmpty());
+  if (mask->isEmpty())
     return;
 
   mask->freeze();
-  doc::algorithm::flip_image(mask->bitmap(),
-    mask->bitmap()->bounds(), m_flipType);
+  Image* bitmap = mask->editableBitmap();
+  doc::algorithm::flip_image(bitmap, bitmap->bounds(), m_flipType);
   mask->unfreeze();
 }
 
@@ -32,12 +32,15 @@ ReplaceImage::ReplaceImage(Sprite* sprite, const ImageRef& oldImage, const Image
 
 void ReplaceImage::onExecute()
 {
-  // Save old image in m_copy. We cannot keep an ImageRef to this
-  // image, because there are other undo branches that could try to
-  // modify/re-add this same image ID
+  // Save old and new images in m_oldCopy/m_newCopy. We cannot keep an
+  // ImageRef to the old image, because there are other undo branches
+  // that could try to modify/re-add this same image ID
   ImageRef oldImage = sprite()->getImageRef(m_oldImageId);
   ASSERT(oldImage);
-  m_copy.reset(Image::createCopy(oldImage));
+  ASSERT(m_oldCopy.isEmpty());
+  ASSERT(m_newCopy.isEmpty());
+  write_image(m_oldCopy.stream(), oldImage.get());
+  write_image(m_newCopy.stream(), m_newImage.get());
 
   sprite()->replaceImage(m_oldImageId, m_newImage);
   m_newImage.reset(nullptr);
@@ -45,24 +48,28 @@ void ReplaceImage::onExecute()
 
 void ReplaceImage::onUndo()
 {
-  ImageRef newImage = sprite()->getImageRef(m_newImageId);
-  ASSERT(newImage);
+  ASSERT(sprite()->getImageRef(m_newImageId));
   ASSERT(!sprite()->getImageRef(m_oldImageId));
-  m_copy->setId(m_oldImageId);
+  ImageRef oldImage = restore(m_oldCopy);
+  ASSERT(oldImage->id() == m_oldImageId);
 
-  sprite()->replaceImage(m_newImageId, m_copy);
-  m_copy.reset(Image::createCopy(newImage));
+  sprite()->replaceImage(m_newImageId, oldImage);
 }
 
 void ReplaceImage::onRedo()
 {
-  ImageRef oldImage = sprite()->getImageRef(m_oldImageId);
-  ASSERT(oldImage);
+  ASSERT(sprite()->getImageRef(m_oldImageId));
   ASSERT(!sprite()->getImageRef(m_newImageId));
-  m_copy->setId(m_newImageId);
+  ImageRef newImage = restore(m_newCopy);
+  ASSERT(newImage->id() == m_newImageId);
 
-  sprite()->replaceImage(m_oldImageId, m_copy);
-  m_copy.reset(Image::createCopy(oldImage));
+  sprite()->replaceImage(m_oldImageId, newImage);
+}
+
+ImageRef ReplaceImage::restore(UndoPayload& payload)
+{
+  payload.rewind();
+  return ImageRef(read_image(payload.stream()));
 }
 
 } // namespace cmd
@@ -11,10 +11,9 @@
 
 #include "app/cmd.h"
 #include "app/cmd/with_sprite.h"
+#include "app/undo_payload.h"
 #include "doc/image_ref.h"
 
-#include <sstream>
-
 namespace app {
 namespace cmd {
   using namespace doc;
@@ -29,11 +28,20 @@ namespace cmd {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override {
-      return sizeof(*this) +
-        (m_copy ? m_copy->getMemSize(): 0);
+      return sizeof(*this) + m_oldCopy.memSize() + m_newCopy.memSize();
+    }
+    void onSpillPayloads() override {
+      m_oldCopy.spill();
+      m_newCopy.spill();
+    }
+    bool onLoadPayloads() override {
+      return (m_oldCopy.load() &&
+              m_newCopy.load());
     }
 
   private:
+    ImageRef restore(UndoPayload& payload);
+
     ObjectId m_oldImageId;
     ObjectId m_newImageId;
 
@@ -41,7 +49,11 @@ namespace cmd {
     // ReplaceImage() ctor until the ReplaceImage::onExecute() call.
     // Then the reference is not used anymore.
     ImageRef m_newImage;
-    ImageRef m_copy;
+
+    // Compressed copies of both images, saved only once in
+    // onExecute(), so undo/redo only have to uncompress them.
+    UndoPayload m_oldCopy;
+    UndoPayload m_newCopy;
   };
 
 } // namespace cmd
@@ -12,6 +12,7 @@
 #include "app/cmd/set_cel_data.h"
 
 #include "doc/cel.h"
+#include "doc/cel_data_io.h"
 #include "doc/image.h"
 #include "doc/image_io.h"
 #include "doc/image_ref.h"
@@ -46,13 +47,19 @@ void SetCelData::onUndo()
 {
   Cel* cel = this->cel();
 
-  if (m_dataCopy) {
+  if (!m_dataCopy.isEmpty()) {
     ASSERT(!cel->sprite()->getCelDataRef(m_oldDataId));
-    m_dataCopy->setId(m_oldDataId);
-    m_dataCopy->image()->setId(m_oldImageId);
 
-    cel->setDataRef(m_dataCopy);
-    m_dataCopy.reset(nullptr);
+    SubObjectsIO io(cel->sprite());
+    ImageRef image(read_image(m_dataCopy.stream()));
+    ASSERT(image->id() == m_oldImageId);
+    io.addImageRef(image);
+
+    CelDataRef dataCopy(read_celdata(m_dataCopy.stream(), &io));
+    ASSERT(dataCopy->id() == m_oldDataId);
+
+    cel->setDataRef(dataCopy);
+    m_dataCopy.reset();
   }
   else {
     CelDataRef oldData = cel->sprite()->getCelDataRef(m_oldDataId);
@@ -76,9 +83,11 @@ void SetCelData::createCopy()
 {
   Cel* cel = this->cel();
 
-  ASSERT(!m_dataCopy);
-  m_dataCopy.reset(new CelData(*cel->data()));
-  m_dataCopy->setImage(ImageRef(Image::createCopy(cel->image())));
+  ASSERT(m_dataCopy.isEmpty());
+  ASSERT(cel->data()->id() == m_oldDataId);
+  ASSERT(cel->image()->id() == m_oldImageId);
+  write_image(m_dataCopy.stream(), cel->image());
+  write_celdata(m_dataCopy.stream(), cel->data());
 }
 
 } // namespace cmd
@@ -11,10 +11,9 @@
 
 #include "app/cmd.h"
 #include "app/cmd/with_cel.h"
+#include "app/undo_payload.h"
 #include "doc/cel_data.h"
 
-#include <sstream>
-
 namespace app {
 namespace cmd {
   using namespace doc;
@@ -29,8 +28,13 @@ namespace cmd {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override {
-      return sizeof(*this) +
-        (m_dataCopy ? m_dataCopy->getMemSize(): 0);
+      return sizeof(*this) + m_dataCopy.memSize();
+    }
+    void onSpillPayloads() override {
+      m_dataCopy.spill();
+    }
+    bool onLoadPayloads() override {
+      return m_dataCopy.load();
     }
 
   private:
@@ -39,7 +43,10 @@ namespace cmd {
     ObjectId m_oldDataId;
     ObjectId m_oldImageId;
     ObjectId m_newDataId;
-    CelDataRef m_dataCopy;
+
+    // Serialized copy of the old CelData and its image (only when
+    // the cel isn't linked).
+    UndoPayload m_dataCopy;
 
     // Reference used only to keep the copy of the new CelData from
     // the SetCelData() ctor until the SetCelData::onExecute() call.
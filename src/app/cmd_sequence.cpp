@@ -17,6 +17,12 @@ CmdSequence::CmdSequence()
 {
 }
 
+CmdSequence::~CmdSequence()
+{
+  for (Cmd* cmd : m_cmds)
+    delete cmd;
+}
+
 void CmdSequence::add(Cmd* cmd)
 {
   m_cmds.push_back(cmd);
@@ -50,6 +56,20 @@ size_t CmdSequence::onMemSize() const
   return size;
 }
 
+void CmdSequence::onSpillPayloads()
+{
+  for (Cmd* cmd : m_cmds)
+    cmd->spillPayloads();
+}
+
+bool CmdSequence::onLoadPayloads()
+{
+  for (Cmd* cmd : m_cmds)
+    if (!cmd->loadPayloads())
+      return false;
+  return true;
+}
+
 void CmdSequence::executeAndAdd(Cmd* cmd)
 {
   cmd->execute(context());
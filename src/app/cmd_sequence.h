@@ -18,6 +18,7 @@ namespace app {
   class CmdSequence : public Cmd {
   public:
     CmdSequence();
+    ~CmdSequence();
 
     void add(Cmd* cmd);
 
@@ -26,6 +27,8 @@ namespace app {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override;
+    void onSpillPayloads() override;
+    bool onLoadPayloads() override;
 
     // Helper to create a CmdSequence in the same onExecute() member
     // function.
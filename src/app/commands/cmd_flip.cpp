@@ -110,7 +110,7 @@ void FlipCommand::onExecute(Context* context)
           bounds = bounds.createIntersect(gfx::Rect(mask->bounds()).offset(-x, -y));
 
           // If the mask isn't a rectangular area, we've to flip the mask too.
-          if (mask->bitmap() && !mask->isRectangular()) {
+          if (!mask->isEmpty() && !mask->isRectangular()) {
             // Flip the portion of image specified by the mask.
             transaction.execute(new cmd::FlipMaskedCel(cel, m_flipType));
             alreadyFlipped = true;
@@ -135,8 +135,7 @@ void FlipCommand::onExecute(Context* context)
       }
 
       // Flip the mask.
-      Image* maskBitmap = mask->bitmap();
-      if (maskBitmap) {
+      if (!mask->isEmpty()) {
         transaction.execute(new cmd::FlipMask(document, m_flipType));
         document->generateMaskBoundaries();
       }
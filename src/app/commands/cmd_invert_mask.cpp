@@ -18,7 +18,6 @@
 #include "base/unique_ptr.h"
 #include "doc/image.h"
 #include "doc/mask.h"
-#include "doc/primitives.h"
 #include "doc/sprite.h"
 
 namespace app {
@@ -73,25 +72,7 @@ void InvertMaskCommand::onExecute(Context* context)
     mask->replace(sprite->bounds());
 
     // Remove in the new mask the current sprite marked region
-    const gfx::Rect& maskBounds = document->mask()->bounds();
-    doc::fill_rect(mask->bitmap(),
-      maskBounds.x, maskBounds.y,
-      maskBounds.x + maskBounds.w-1,
-      maskBounds.y + maskBounds.h-1, 0);
-
-    Mask* curMask = document->mask();
-    if (curMask->bitmap()) {
-      // Copy the inverted region in the new mask (we just modify the
-      // document's mask temporaly here)
-      curMask->freeze();
-      curMask->invert();
-      doc::copy_image(mask->bitmap(),
-        curMask->bitmap(),
-        curMask->bounds().x,
-        curMask->bounds().y);
-      curMask->invert();
-      curMask->unfreeze();
-    }
+    mask->subtract(*document->mask());
 
     // We need only need the area inside the sprite
     mask->intersect(sprite->bounds());
@@ -30,6 +30,8 @@
 #include "doc/sprite.h"
 #include "ui/ui.h"
 
+#include <vector>
+
 namespace app {
 
 class RotateCommand : public Command {
@@ -103,25 +105,30 @@ protected:
       }
     }
 
-    // 2) Rotate images
-    int i = 0;
-    for (Cel* cel : m_cels) {
-      Image* image = cel->image();
-      if (image) {
+    // 2) Rotate images (each cel in parallel)
+    std::vector<ImageRef> new_images(m_cels.size());
+    bool completed = parallelFor(
+      int(m_cels.size()),
+      [&](int i) {
+        Image* image = m_cels[i]->image();
+        if (!image)
+          return;
+
         ImageRef new_image(Image::create(image->pixelFormat(),
             m_angle == 180 ? image->width(): image->height(),
             m_angle == 180 ? image->height(): image->width()));
         doc::rotate_image(image, new_image, m_angle);
 
-        api.replaceImage(m_sprite, cel->imageRef(), new_image);
-      }
+        new_images[i] = new_image;
+      });
 
-      jobProgress((float)i / m_cels.size());
-      ++i;
+    // cancel all the operation?
+    if (!completed)
+      return;        // Transaction destructor will undo all operations
 
-      // cancel all the operation?
-      if (isCanceled())
-        return;        // Transaction destructor will undo all operations
+    for (int i=0; i<int(m_cels.size()); ++i) {
+      if (new_images[i])
+        api.replaceImage(m_sprite, m_cels[i]->imageRef(), new_images[i]);
     }
 
     // rotate mask
@@ -151,7 +158,7 @@ protected:
         gfx::Rect(x, y,
           m_angle == 180 ? origBounds.w: origBounds.h,
           m_angle == 180 ? origBounds.h: origBounds.w));
-      doc::rotate_image(origMask->bitmap(), new_mask->bitmap(), m_angle);
+      doc::rotate_image(origMask->bitmap(), new_mask->editableBitmap(), m_angle);
 
       // Copy new mask
       api.copyToCurrentMask(new_mask);
@@ -23,16 +23,22 @@
 #include "app/transaction.h"
 #include "app/ui_context.h"
 #include "base/bind.h"
+#include "base/shared_ptr.h"
 #include "base/unique_ptr.h"
 #include "doc/algorithm/resize_image.h"
 #include "doc/cel.h"
 #include "doc/cels_range.h"
 #include "doc/image.h"
 #include "doc/mask.h"
+#include "doc/palette.h"
 #include "doc/primitives.h"
+#include "doc/rgbmap.h"
 #include "doc/sprite.h"
 #include "ui/ui.h"
 
+#include <map>
+#include <vector>
+
 #define PERC_FORMAT     "%.1f"
 
 namespace app {
@@ -74,41 +80,64 @@ protected:
     Transaction transaction(m_writer.context(), "Sprite Size");
     DocumentApi api = m_writer.document()->getApi(transaction);
 
-    int cels_count = 0;
-    for (Cel* cel : m_sprite->uniqueCels()) { // TODO add size() member function to CelsRange
-      (void)cel;
-      ++cels_count;
+    std::vector<Cel*> cels;
+    for (Cel* cel : m_sprite->uniqueCels())
+      cels.push_back(cel);
+
+    // One RgbMap for each palette, shared by all threads (the
+    // Sprite::rgbMap() is regenerated for the palette of each frame,
+    // so it cannot be used from several threads).
+    std::vector<Palette*> palettes(cels.size());
+    std::vector<RgbMap*> rgbmaps(cels.size());
+    std::map<Palette*, SharedPtr<RgbMap> > palette_rgbmaps;
+    int mask_color = (m_sprite->backgroundLayer() ? -1: m_sprite->transparentColor());
+
+    for (int i=0; i<int(cels.size()); ++i) {
+      Palette* palette = m_sprite->palette(cels[i]->frame());
+      SharedPtr<RgbMap>& rgbmap = palette_rgbmaps[palette];
+      if (!rgbmap) {
+        rgbmap.reset(new RgbMap);
+        rgbmap->regenerate(palette, mask_color);
+      }
+      palettes[i] = palette;
+      rgbmaps[i] = rgbmap.get();
     }
 
-    // For each cel...
-    int progress = 0;
-    for (Cel* cel : m_sprite->uniqueCels()) {
-      // Change its location
-      api.setCelPosition(m_sprite, cel, scale_x(cel->x()), scale_y(cel->y()));
+    // Resize the image of each cel in parallel
+    std::vector<ImageRef> new_images(cels.size());
+    bool completed = parallelFor(
+      int(cels.size()),
+      [&](int i) {
+        Cel* cel = cels[i];
+        Image* image = cel->image();
+        if (!image || cel->link())
+          return;
 
-      // Get cel's image
-      Image* image = cel->image();
-      if (image && !cel->link()) {
-        // Resize the image
         int w = scale_x(image->width());
         int h = scale_y(image->height());
         ImageRef new_image(Image::create(image->pixelFormat(), MAX(1, w), MAX(1, h)));
 
         doc::algorithm::fixup_image_transparent_colors(image);
         doc::algorithm::resize_image(image, new_image,
-          m_resize_method,
-          m_sprite->palette(cel->frame()),
-          m_sprite->rgbMap(cel->frame()));
+          m_resize_method, palettes[i], rgbmaps[i]);
 
-        api.replaceImage(m_sprite, cel->imageRef(), new_image);
-      }
+        new_images[i] = new_image;
+      });
+
+    // cancel all the operation?
+    if (!completed)
+      return;        // Transaction destructor will undo all operations
+
+    // For each cel...
+    for (int i=0; i<int(cels.size()); ++i) {
+      Cel* cel = cels[i];
 
-      jobProgress((float)progress / cels_count);
-      ++progress;
+      // Change its location
+      api.setCelPosition(m_sprite, cel, scale_x(cel->x()), scale_y(cel->y()));
 
-      // cancel all the operation?
-      if (isCanceled())
-        return;        // Transaction destructor will undo all operations
+      // Replace the cel's image with the resized one
+      if (new_images[i])
+        api.replaceImage(m_sprite, cel->imageRef(), new_images[i]);
     }
 
     // Resize mask
@@ -125,7 +154,7 @@ protected:
         gfx::Rect(
           scale_x(m_document->mask()->bounds().x-1),
           scale_y(m_document->mask()->bounds().y-1), MAX(1, w), MAX(1, h)));
-      algorithm::resize_image(old_bitmap, new_mask->bitmap(),
+      algorithm::resize_image(old_bitmap, new_mask->editableBitmap(),
           m_resize_method,
           m_sprite->palette(0), // Ignored
           m_sprite->rgbMap(0)); // Ignored
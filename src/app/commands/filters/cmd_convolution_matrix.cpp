@@ -128,6 +128,7 @@ private:
     SharedPtr<ConvolutionMatrix> matrix = m_stock.getByName(selected->getText().c_str());
     Target newTarget = matrix->getDefaultTarget();
 
+    stopPreview();
     m_filter.setMatrix(matrix);
 
     setNewTarget(newTarget);
@@ -18,8 +18,10 @@
 #include "app/modules/editors.h"
 #include "app/transaction.h"
 #include "app/ui/editor/editor.h"
+#include "base/parallel_for.h"
 #include "doc/cel.h"
 #include "doc/image.h"
+#include "doc/image_ref.h"
 #include "doc/images_collector.h"
 #include "doc/layer.h"
 #include "doc/mask.h"
@@ -29,9 +31,11 @@
 #include "ui/view.h"
 #include "ui/widget.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <set>
+#include <vector>
 
 namespace app {
 
@@ -49,7 +53,6 @@ FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   int offset_x, offset_y;
 
   m_src = NULL;
-  m_row = 0;
   m_offset_x = 0;
   m_offset_y = 0;
   m_mask = NULL;
@@ -92,16 +95,18 @@ void FilterManagerImpl::begin()
 {
   Document* document = m_location.document();
 
-  m_row = 0;
   m_mask = (document->isMaskVisible() ? document->mask(): NULL);
 
   updateMask(m_mask, m_src);
+  updateSpans();
 }
 
-void FilterManagerImpl::beginForPreview()
+bool FilterManagerImpl::beginForPreview()
 {
   Document* document = m_location.document();
 
+  m_previewEngine.reset(NULL);
+
   if (document->isMaskVisible())
     m_preview_mask.reset(new Mask(*document->mask()));
   else {
@@ -112,9 +117,11 @@ void FilterManagerImpl::beginForPreview()
         m_src->height()));
   }
 
-  m_row = 0;
   m_mask = m_preview_mask;
 
+  // Center of the visible area in image coordinates (the tiles near
+  // this point are filtered first)
+  gfx::Point focus;
   {
     Editor* editor = current_editor;
     Sprite* sprite = m_location.sprite();
@@ -124,80 +131,53 @@ void FilterManagerImpl::beginForPreview()
 
     if (vp.isEmpty()) {
       m_preview_mask.reset(NULL);
-      m_row = -1;
-      return;
+      return false;
     }
 
     m_preview_mask->intersect(vp);
+    focus = gfx::Point(vp.x + vp.w/2 - m_offset_x,
+                       vp.y + vp.h/2 - m_offset_y);
   }
 
   if (!updateMask(m_mask, m_src)) {
     m_preview_mask.reset(NULL);
-    m_row = -1;
-    return;
-  }
-}
-
-void FilterManagerImpl::end()
-{
-  m_maskBits.unlock();
-}
-
-bool FilterManagerImpl::applyStep()
-{
-  if (m_row < 0 || m_row >= m_h)
     return false;
-
-  if ((m_mask) && (m_mask->bitmap())) {
-    int x = m_x - m_mask->bounds().x + m_offset_x;
-    int y = m_y - m_mask->bounds().y + m_offset_y + m_row;
-
-    if ((m_w - x < 1) || (m_h - y < 1))
-      return false;
-
-    m_maskBits = m_mask->bitmap()
-      ->lockBits<BitmapTraits>(Image::ReadLock,
-        gfx::Rect(x, y, m_w - x, m_h - y));
-
-    m_maskIterator = m_maskBits.begin();
   }
 
-  switch (m_location.sprite()->pixelFormat()) {
-    case IMAGE_RGB:       m_filter->applyToRgba(this); break;
-    case IMAGE_GRAYSCALE: m_filter->applyToGrayscale(this); break;
-    case IMAGE_INDEXED:   m_filter->applyToIndexed(this); break;
-  }
-  ++m_row;
+  updateSpans();
 
+  // The background thread filters a copy of the source image, and
+  // each finished tile is copied to the destination image (which is
+  // used by the editor to render the preview) in flush().
+  if (!m_previewImage)
+    m_previewImage.reset(Image::createCopy(m_src));
+
+  // The engine is created in the UI thread, so the palette/RgbMap of
+  // the sprite are obtained here.
+  m_previewEngine.reset(new FilterEngine(m_filter, this));
+  m_previewEngine->setTileSize(gfx::Size(64, 64));
+  m_previewEngine->setFocus(focus);
+  m_previewEngine->addImage(m_src, m_previewImage, m_target, m_spans);
   return true;
 }
 
-void FilterManagerImpl::apply(Transaction& transaction)
+void FilterManagerImpl::end()
 {
-  bool cancelled = false;
-
-  begin();
-  while (!cancelled && applyStep()) {
-    if (m_progressDelegate) {
-      // Report progress.
-      m_progressDelegate->reportProgress(m_progressBase + m_progressWidth * (m_row+1) / m_h);
+  m_previewEngine.reset(NULL);
+  m_spans.clear();
+}
 
-      // Does the user cancelled the whole process?
-      cancelled = m_progressDelegate->isCancelled();
-    }
-  }
+void FilterManagerImpl::applyToPreview(const FilterEngine::TileFunc& tileFunc,
+                                       const FilterEngine::ProgressFunc& progress)
+{
+  ASSERT(m_previewEngine);
 
-  if (!cancelled) {
-    // Copy "dst" to "src"
-    transaction.execute(new cmd::CopyRect(
-        m_src, m_dst, gfx::Clip(m_x, m_y, m_x, m_y, m_w, m_h)));
-  }
+  m_previewEngine->setTileFunc(tileFunc);
+  m_previewEngine->apply(progress);
 }
 
 void FilterManagerImpl::applyToTarget()
 {
-  bool cancelled = false;
-
   ImagesCollector images((m_target & TARGET_ALL_LAYERS ?
                           m_location.sprite()->folder():
                           m_location.layer()),
@@ -212,79 +192,97 @@ void FilterManagerImpl::applyToTarget()
   ContextWriter writer(reader);
   Transaction transaction(writer.context(), m_filter->getName(), ModifyDocument);
 
-  m_progressBase = 0.0f;
-  m_progressWidth = 1.0f / images.size();
-
+  // Avoid applying the filter two times to the same image
+  std::vector<ImagesCollector::Item> items;
   std::set<ObjectId> visited;
+  for (auto it = images.begin(); it != images.end(); ++it) {
+    if (visited.insert(it->image()->id()).second)
+      items.push_back(*it);
+  }
 
-  // For each target image
-  for (auto it = images.begin();
-       it != images.end() && !cancelled;
-       ++it) {
-    Image* image = it->image();
-
-    // Avoid applying the filter two times to the same image
-    if (visited.find(image->id()) == visited.end()) {
-      visited.insert(image->id());
-      applyToImage(transaction, it->layer(),
-        image, it->cel()->x(), it->cel()->y());
+  // Each target image is filtered in a copy, the copies are filtered
+  // in parallel, and then they are copied back in the original
+  // images (in the same thread, because we are modifying the
+  // document through the transaction). Images are processed in
+  // batches of one image per thread, so we don't keep a copy of
+  // each image of the sprite at the same time.
+  const int total = int(items.size());
+  const int batchSize = base::parallel_threads();
+
+  for (int first=0; first<total; first+=batchSize) {
+    const int n = std::min(batchSize, total-first);
+    FilterEngine engine(m_filter, this);
+    std::vector<Image*> srcs;
+    std::vector<ImageRef> dsts;
+    std::vector<gfx::Clip> clips;
+
+    for (int i=first; i<first+n; ++i) {
+      const ImagesCollector::Item& item = items[i];
+      init(item.layer(), item.image(), item.cel()->x(), item.cel()->y());
+      begin();
+
+      srcs.push_back(m_src);
+      dsts.push_back(ImageRef(m_dst.release()));
+      clips.push_back(gfx::Clip(m_x, m_y, m_x, m_y, m_w, m_h));
+      engine.addImage(m_src, dsts.back().get(), m_target, m_spans);
     }
 
-    // Is there a delegate to know if the process was cancelled by the user?
-    if (m_progressDelegate)
-      cancelled = m_progressDelegate->isCancelled();
+    bool done = engine.apply(
+      [this, first, n, total](float progress) -> bool {
+        if (m_progressDelegate) {
+          m_progressDelegate->reportProgress((first + progress*n) / total);
+
+          // Does the user cancelled the whole process?
+          if (m_progressDelegate->isCancelled())
+            return false;
+        }
+        return true;
+      });
+
+    // Copy "dst" to "src" (only completely filtered images)
+    for (int i=0; i<n; ++i) {
+      if (engine.isImageDone(i))
+        transaction.execute(new cmd::CopyRect(srcs[i], dsts[i].get(), clips[i]));
+    }
 
-    // Make progress
-    m_progressBase += m_progressWidth;
+    if (!done)
+      break;
   }
 
   transaction.commit();
+  end();
 }
 
-void FilterManagerImpl::flush()
+void FilterManagerImpl::flush(const gfx::Rect& tileBounds)
 {
-  if (m_row >= 0) {
-    Editor* editor = current_editor;
-    gfx::Rect rect(
-      editor->editorToScreen(
-        gfx::Point(
-          m_x+m_offset_x,
-          m_y+m_offset_y+m_row-1)),
-      gfx::Size(
-        editor->zoom().apply(m_w),
-        editor->zoom().apply(1)));
-
-    gfx::Region reg1(rect);
-    gfx::Region reg2;
-    editor->getDrawableRegion(reg2, Widget::kCutTopWindows);
-    reg1.createIntersection(reg1, reg2);
-
-    editor->invalidateRegion(reg1);
+  // Copy the filtered spans of the tile
+  auto it = std::lower_bound(
+    m_spans.begin(), m_spans.end(), tileBounds.y,
+    [](const FilterSpan& span, int y) { return span.y < y; });
+
+  for (; it != m_spans.end() && it->y < tileBounds.y2(); ++it) {
+    int x1 = std::max(it->x, tileBounds.x);
+    int x2 = std::min(it->x + it->w, tileBounds.x2());
+    if (x2 > x1)
+      m_dst->copy(m_previewImage, gfx::Clip(x1, it->y, x1, it->y, x2-x1, 1));
   }
-}
 
-const void* FilterManagerImpl::getSourceAddress()
-{
-  return m_src->getPixelAddress(m_x, m_row+m_y);
-}
-
-void* FilterManagerImpl::getDestinationAddress()
-{
-  return m_dst->getPixelAddress(m_x, m_row+m_y);
-}
-
-bool FilterManagerImpl::skipPixel()
-{
-  bool skip = false;
-
-  if ((m_mask) && (m_mask->bitmap())) {
-    if (!*m_maskIterator)
-      skip = true;
-
-    ++m_maskIterator;
-  }
-
-  return skip;
+  Editor* editor = current_editor;
+  gfx::Rect rect(
+    editor->editorToScreen(
+      gfx::Point(
+        tileBounds.x+m_offset_x,
+        tileBounds.y+m_offset_y)),
+    gfx::Size(
+      editor->zoom().apply(tileBounds.w),
+      editor->zoom().apply(tileBounds.h)));
+
+  gfx::Region reg1(rect);
+  gfx::Region reg2;
+  editor->getDrawableRegion(reg2, Widget::kCutTopWindows);
+  reg1.createIntersection(reg1, reg2);
+
+  editor->invalidateRegion(reg1);
 }
 
 Palette* FilterManagerImpl::getPalette()
@@ -307,7 +305,7 @@ void FilterManagerImpl::init(const Layer* layer, Image* image, int offset_x, int
 
   m_src = image;
   m_dst.reset(crop_image(image, 0, 0, image->width(), image->height(), 0));
-  m_row = -1;
+  m_previewImage.reset(NULL);
   m_mask = NULL;
   m_preview_mask.reset(NULL);
 
@@ -318,10 +316,14 @@ void FilterManagerImpl::init(const Layer* layer, Image* image, int offset_x, int
     m_target &= ~TARGET_ALPHA_CHANNEL;
 }
 
-void FilterManagerImpl::applyToImage(Transaction& transaction, Layer* layer, Image* image, int x, int y)
+void FilterManagerImpl::updateSpans()
 {
-  init(layer, image, x, y);
-  apply(transaction);
+  const Image* bitmap = (m_mask ? m_mask->bitmap(): NULL);
+  gfx::Point origin;
+  if (bitmap)
+    origin = m_mask->bounds().getOrigin() - gfx::Point(m_offset_x, m_offset_y);
+
+  create_filter_spans(gfx::Rect(m_x, m_y, m_w, m_h), bitmap, origin, m_spans);
 }
 
 bool FilterManagerImpl::updateMask(Mask* mask, const Image* image)
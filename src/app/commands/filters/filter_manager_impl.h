@@ -12,11 +12,10 @@
 #include "app/document_location.h"
 #include "base/exception.h"
 #include "base/unique_ptr.h"
+#include "filters/filter_engine.h"
 #include "filters/filter_indexed_data.h"
-#include "filters/filter_manager.h"
-#include "doc/image_bits.h"
-#include "doc/image_traits.h"
 #include "doc/pixel_format.h"
+#include "gfx/rect.h"
 
 #include <cstring>
 
@@ -51,8 +50,9 @@ namespace app {
                       "Please select a layer/cel with an image and try again.") { }
   };
 
-  class FilterManagerImpl : public FilterManager
-                          , public FilterIndexedData {
+  // Applies a filter to the active sprite (or to a preview of it)
+  // using a FilterEngine.
+  class FilterManagerImpl : public FilterIndexedData {
   public:
     // Interface to report progress to the user and take input from him
     // to cancel the whole process.
@@ -75,32 +75,33 @@ namespace app {
     PixelFormat pixelFormat() const;
 
     void setTarget(Target target);
+    Target getTarget() const { return m_target; }
 
     void begin();
-    void beginForPreview();
     void end();
-    bool applyStep();
     void applyToTarget();
 
+    // Prepares the preview of the filter in the visible area of the
+    // current editor. Returns false if there is nothing to preview.
+    bool beginForPreview();
+
+    // Applies the filter to the preview. It's called from a
+    // background thread, "tileFunc" is called when a tile is ready to
+    // be flushed, and the process is cancelled when "progress"
+    // returns false.
+    void applyToPreview(const FilterEngine::TileFunc& tileFunc,
+                        const FilterEngine::ProgressFunc& progress);
+
     Document* document() { return m_location.document(); }
     Sprite* sprite() { return m_location.sprite(); }
     Layer* layer() { return m_location.layer(); }
     frame_t frame() { return m_location.frame(); }
     Image* destinationImage() const { return m_dst; }
 
-    // Updates the current editor to show the progress of the preview.
-    void flush();
-
-    // FilterManager implementation
-    const void* getSourceAddress();
-    void* getDestinationAddress();
-    int getWidth() { return m_w; }
-    Target getTarget() { return m_target; }
-    FilterIndexedData* getIndexedData() { return this; }
-    bool skipPixel();
-    const Image* getSourceImage() { return m_src; }
-    int x() { return m_x; }
-    int y() { return m_y+m_row; }
+    // Copies a tile of the preview filtered in the background thread
+    // to the destination image, and updates the current editor to show
+    // it. Must be called from the UI thread.
+    void flush(const gfx::Rect& tileBounds);
 
     // FilterIndexedData implementation
     Palette* getPalette();
@@ -108,28 +109,25 @@ namespace app {
 
   private:
     void init(const Layer* layer, Image* image, int offset_x, int offset_y);
-    void apply(Transaction& transaction);
-    void applyToImage(Transaction& transaction, Layer* layer, Image* image, int x, int y);
     bool updateMask(Mask* mask, const Image* image);
+    void updateSpans();
 
     Context* m_context;
     DocumentLocation m_location;
     Filter* m_filter;
     Image* m_src;
     base::UniquePtr<Image> m_dst;
-    int m_row;
     int m_x, m_y, m_w, m_h;
     int m_offset_x, m_offset_y;
     Mask* m_mask;
     base::UniquePtr<Mask> m_preview_mask;
-    doc::ImageBits<doc::BitmapTraits> m_maskBits;
-    doc::ImageBits<doc::BitmapTraits>::iterator m_maskIterator;
+    FilterSpans m_spans;          // Pixels where the filter is applied
+    base::UniquePtr<FilterEngine> m_previewEngine;
+    base::UniquePtr<Image> m_previewImage; // Image filtered in background
     Target m_targetOrig;          // Original targets
     Target m_target;              // Filtered targets
 
     // Hooks
-    float m_progressBase;
-    float m_progressWidth;
     IProgressDelegate* m_progressDelegate;
   };
 
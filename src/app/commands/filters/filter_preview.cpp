@@ -13,6 +13,7 @@
 
 #include "app/commands/filters/filter_manager_impl.h"
 #include "app/ui/editor/editor.h"
+#include "base/scoped_lock.h"
 #include "doc/sprite.h"
 #include "ui/manager.h"
 #include "ui/message.h"
@@ -26,7 +27,9 @@ using namespace filters;
 FilterPreview::FilterPreview(FilterManagerImpl* filterMgr)
   : Widget(kGenericWidget)
   , m_filterMgr(filterMgr)
-  , m_timer(1, this)
+  , m_timer(10, this)
+  , m_cancel(false)
+  , m_done(true)
 {
   setVisible(false);
 }
@@ -38,19 +41,38 @@ FilterPreview::~FilterPreview()
 
 void FilterPreview::stop()
 {
-  if (m_timer.isRunning()) {
-    ASSERT(m_filterMgr != NULL);
+  stopPreview();
 
+  if (m_filterMgr)
     m_filterMgr->end();
-  }
 
   m_filterMgr = NULL;
+}
+
+void FilterPreview::stopPreview()
+{
   m_timer.stop();
+
+  if (m_thread) {
+    m_cancel = true;
+    m_thread->join();
+    m_thread.reset(NULL);
+  }
+
+  // Tiles filtered with the old parameters are discarded
+  m_tiles.clear();
 }
 
 void FilterPreview::restartPreview()
 {
-  m_filterMgr->beginForPreview();
+  stopPreview();
+
+  if (!m_filterMgr->beginForPreview())
+    return;
+
+  m_cancel = false;
+  m_done = false;
+  m_thread.reset(new base::thread([this]{ onPreviewThread(); }));
   m_timer.start();
 }
 
@@ -71,18 +93,27 @@ bool FilterPreview::onProcessMessage(Message* msg)
       break;
 
     case kCloseMessage:
-      Editor::renderEngine().removePreviewImage();
+      // Stop the preview thread and timer.
+      stopPreview();
 
-      // Stop the preview timer.
-      m_timer.stop();
+      Editor::renderEngine().removePreviewImage();
       break;
 
     case kTimerMessage:
       if (m_filterMgr) {
-        if (m_filterMgr->applyStep())
-          m_filterMgr->flush();
-        else
-          m_timer.stop();
+        std::vector<gfx::Rect> tiles;
+        bool done;
+        {
+          base::scoped_lock lock(m_mutex);
+          tiles.swap(m_tiles);
+          done = m_done;
+        }
+
+        for (const gfx::Rect& tile : tiles)
+          m_filterMgr->flush(tile);
+
+        if (done)
+          stopPreview();
       }
       break;
   }
@@ -90,4 +121,26 @@ bool FilterPreview::onProcessMessage(Message* msg)
   return Widget::onProcessMessage(msg);
 }
 
+// [preview thread]
+void FilterPreview::onPreviewThread()
+{
+  try {
+    m_filterMgr->applyToPreview(
+      [this](int i, const gfx::Rect& bounds) {
+        base::scoped_lock lock(m_mutex);
+        m_tiles.push_back(bounds);
+      },
+      [this](float progress) -> bool {
+        return !m_cancel;
+      });
+  }
+  catch (const std::exception&) {
+    // Errors are reported when the filter is applied to the sprite,
+    // here we just stop the preview.
+  }
+
+  base::scoped_lock lock(m_mutex);
+  m_done = true;
+}
+
 } // namespace app
@@ -9,20 +9,37 @@
 #define APP_COMMANDS_FILTERS_FILTER_PREVIEW_H_INCLUDED
 #pragma once
 
+#include "base/mutex.h"
+#include "base/thread.h"
+#include "base/unique_ptr.h"
+#include "gfx/rect.h"
 #include "ui/timer.h"
 #include "ui/widget.h"
 
+#include <atomic>
+#include <vector>
+
 namespace app {
 
   class FilterManagerImpl;
 
   // Invisible widget to control a effect-preview in the current editor.
+  // The filter is applied in a background thread (first the tiles
+  // near the center of the editor), and a timer shows the finished
+  // tiles in the editor.
   class FilterPreview : public ui::Widget {
   public:
     FilterPreview(FilterManagerImpl* filterMgr);
     ~FilterPreview();
 
+    // Stops the preview, the filter manager is not used anymore.
     void stop();
+
+    // Cancels the background thread. It must be called before
+    // modifying the parameters of the filter (then the preview can
+    // be restarted with restartPreview()).
+    void stopPreview();
+
     void restartPreview();
     FilterManagerImpl* getFilterManager() const;
 
@@ -30,8 +47,17 @@ namespace app {
     bool onProcessMessage(ui::Message* msg) override;
 
   private:
+    void onPreviewThread();
+
     FilterManagerImpl* m_filterMgr;
     ui::Timer m_timer;
+    base::UniquePtr<base::thread> m_thread;
+    std::atomic<bool> m_cancel;
+
+    // Fields shared with the background thread
+    base::mutex m_mutex;
+    std::vector<gfx::Rect> m_tiles; // Finished tiles to be flushed
+    bool m_done;                    // Was the preview completely filtered?
   };
 
 } // namespace app
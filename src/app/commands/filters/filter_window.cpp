@@ -118,6 +118,13 @@ void FilterWindow::restartPreview()
 {
   if (m_showPreview.isSelected())
     m_preview.restartPreview();
+  else
+    m_preview.stopPreview();
+}
+
+void FilterWindow::stopPreview()
+{
+  m_preview.stopPreview();
 }
 
 void FilterWindow::setNewTarget(Target target)
@@ -145,6 +152,7 @@ void FilterWindow::onShowPreview(Event& ev)
 void FilterWindow::onTargetButtonChange()
 {
   // Change the targets in the filter manager and restart the filter preview.
+  stopPreview();
   m_filterMgr->setTarget(m_targetButton.getTarget());
   restartPreview();
 }
@@ -155,6 +163,7 @@ void FilterWindow::onTiledChange()
 
   // Call derived class implementation of setupTiledMode() so the
   // filter is modified.
+  stopPreview();
   setupTiledMode(m_tiledCheck->isSelected() ?
     TiledMode::BOTH:
     TiledMode::NONE);
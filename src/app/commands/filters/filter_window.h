@@ -44,6 +44,10 @@ namespace app {
     // method each time the user modifies parameters of the Filter.
     void restartPreview();
 
+    // Stops the preview which is being calculated in background. You
+    // must call this method before modifying parameters of the Filter.
+    void stopPreview();
+
   protected:
     // Changes the target buttons. Used by convolution matrix filter
     // which specified different targets for each matrix.
@@ -15,6 +15,7 @@
 #include "app/document.h"
 #include "app/ini_file.h"
 #include "app/ui_context.h"
+#include "app/undo_payload.h"
 #include "base/fs.h"
 #include "base/path.h"
 #include "base/temp_dir.h"
@@ -44,6 +45,9 @@ DataRecovery::DataRecovery(doc::Context* context)
     flush_config_file();
   }
 
+  // Big undo data is moved to this same directory
+  UndoPayload::setSpillDirectory(m_tempDir->path());
+
   m_context->addObserver(this);
   m_context->documents().addObserver(this);
 }
@@ -55,6 +59,8 @@ DataRecovery::~DataRecovery()
 
   delete m_backup;
 
+  UndoPayload::setSpillDirectory("");
+
   if (m_tempDir) {
     delete m_tempDir;
     set_config_string("DataRecovery", "Path", "");
@@ -21,8 +21,6 @@
 #include "app/settings/settings.h"
 #include "app/util/boundary.h"
 #include "base/memory.h"
-#include "base/mutex.h"
-#include "base/scoped_lock.h"
 #include "base/unique_ptr.h"
 #include "doc/cel.h"
 #include "doc/context.h"
@@ -44,9 +42,8 @@ using namespace doc;
 Document::Document(Sprite* sprite)
   : m_undo(new DocumentUndo)
   , m_associated_to_file(false)
-  , m_mutex(new mutex)
-  , m_write_lock(false)
-  , m_read_locks(0)
+  , m_maskBoundary(new MaskBoundary)
+  , m_maskBoundaryFromDocument(true)
     // Information about the file format used to load/save this document
   , m_format_options(NULL)
     // Extra cel
@@ -59,10 +56,6 @@ Document::Document(Sprite* sprite)
 {
   setFilename("Sprite");
 
-  // Boundary stuff
-  m_bound.nseg = 0;
-  m_bound.seg = NULL;
-
   if (sprite)
     sprites().add(sprite);
 }
@@ -76,8 +69,18 @@ Document::~Document()
   // fully created app::Document.
   ASSERT(context() == NULL);
 
-  if (m_bound.seg)
-    base_free(m_bound.seg);
+  // Show the contention of the document locks (if there was some)
+  const base::RWLock::Stats read = lockStats(ReadLock);
+  const base::RWLock::Stats write = lockStats(WriteLock);
+  if (read.contentions > 0 || read.failures > 0 ||
+      write.contentions > 0 || write.failures > 0) {
+    PRINTF("Document \"%s\" locks:\n"
+           " - read: %d locks, %d waited (%.3f secs, max %.3f secs), %d failed, %.3f secs held\n"
+           " - write: %d locks, %d waited (%.3f secs, max %.3f secs), %d failed, %.3f secs held\n",
+           filename().c_str(),
+           read.locks, read.contentions, read.waitTime, read.maxWaitTime, read.failures, read.holdTime,
+           write.locks, write.contentions, write.waitTime, write.maxWaitTime, write.failures, write.holdTime);
+  }
 
   destroyExtraCel();
 }
@@ -134,6 +137,16 @@ void Document::notifySpritePixelsModified(Sprite* sprite, const gfx::Region& reg
   notifyObservers<doc::DocumentEvent&>(&doc::DocumentObserver::onSpritePixelsModified, ev);
 }
 
+// The region is in sprite coordinates.
+void Document::notifyImagePixelsModified(Sprite* sprite, Image* image, const gfx::Region& region)
+{
+  doc::DocumentEvent ev(this);
+  ev.sprite(sprite);
+  ev.image(image);
+  ev.region(region);
+  notifyObservers<doc::DocumentEvent&>(&doc::DocumentObserver::onImagePixelsModified, ev);
+}
+
 void Document::notifyExposeSpritePixels(Sprite* sprite, const gfx::Region& region)
 {
   doc::DocumentEvent ev(this);
@@ -213,48 +226,59 @@ void Document::setFormatOptions(const SharedPtr<FormatOptions>& format_options)
 
 int Document::getBoundariesSegmentsCount() const
 {
-  return m_bound.nseg;
+  return int(m_maskBoundary->segments().size());
 }
 
 const BoundSeg* Document::getBoundariesSegments() const
 {
-  return m_bound.seg;
+  if (m_maskBoundary->isEmpty())
+    return NULL;
+  else
+    return &m_maskBoundary->segments()[0];
+}
+
+int Document::getBoundariesVersion() const
+{
+  return m_maskBoundary->version();
 }
 
 void Document::generateMaskBoundaries(Mask* mask)
 {
-  if (m_bound.seg) {
-    base_free(m_bound.seg);
-    m_bound.seg = NULL;
-    m_bound.nseg = 0;
-  }
+  m_maskBoundaryFromDocument = (mask == NULL);
 
   // No mask specified? Use the current one in the document
   if (!mask) {
-    if (!isMaskVisible())       // The mask is hidden
-      return;                   // Done, without boundaries
+    if (!isMaskVisible()) {     // The mask is hidden
+      m_maskBoundary->clear();  // Done, without boundaries
+      return;
+    }
     else
       mask = this->mask();      // Use the document mask
   }
 
   ASSERT(mask != NULL);
 
-  if (!mask->isEmpty()) {
-    m_bound.seg = find_mask_boundary(mask->bitmap(),
-                                     &m_bound.nseg,
-                                     IgnoreBounds, 0, 0, 0, 0);
-    for (int c=0; c<m_bound.nseg; c++) {
-      m_bound.seg[c].x1 += mask->bounds().x;
-      m_bound.seg[c].y1 += mask->bounds().y;
-      m_bound.seg[c].x2 += mask->bounds().x;
-      m_bound.seg[c].y2 += mask->bounds().y;
-    }
-  }
+  m_maskBoundary->regenerate(mask->spans(), mask->spansOrigin());
 
   // TODO move this to the exact place where selection is modified.
   notifySelectionChanged();
 }
 
+void Document::updateMaskBoundaries(const gfx::Rect& area)
+{
+  if (!m_maskBoundaryFromDocument) {
+    generateMaskBoundaries();
+    return;
+  }
+
+  if (isMaskVisible())
+    m_maskBoundary->update(m_mask->spans(), m_mask->spansOrigin(), area);
+  else
+    m_maskBoundary->clear();
+
+  notifySelectionChanged();
+}
+
 //////////////////////////////////////////////////////////////////////
 // Extra Cel (it is used to draw pen preview, pixels in movement, etc.)
 
@@ -503,74 +527,35 @@ Document* Document::duplicate(DuplicateType type) const
 //////////////////////////////////////////////////////////////////////
 // Multi-threading ("sprite wrappers" use this)
 
-bool Document::lock(LockType lockType)
+static base::RWLock::LockType to_rw_lock_type(Document::LockType lockType)
 {
-  scoped_lock lock(*m_mutex);
-
-  switch (lockType) {
-
-    case ReadLock:
-      // If no body is writting the sprite...
-      if (!m_write_lock) {
-        // We can read it
-        ++m_read_locks;
-        return true;
-      }
-      break;
-
-    case WriteLock:
-      // If no body is reading and writting...
-      if (m_read_locks == 0 && !m_write_lock) {
-        // We can start writting the sprite...
-        m_write_lock = true;
-        return true;
-      }
-      break;
-
-  }
-
-  return false;
+  return (lockType == Document::ReadLock ? base::RWLock::ReadLock:
+                                           base::RWLock::WriteLock);
 }
 
-bool Document::lockToWrite()
+bool Document::lock(LockType lockType, int timeout)
 {
-  scoped_lock lock(*m_mutex);
+  return m_rwLock.lock(to_rw_lock_type(lockType), timeout);
+}
 
-  // this only is possible if there are just one reader
-  if (m_read_locks == 1) {
-    ASSERT(!m_write_lock);
-    m_read_locks = 0;
-    m_write_lock = true;
-    return true;
-  }
-  else
-    return false;
+bool Document::lockToWrite(int timeout)
+{
+  return m_rwLock.upgradeToWrite(timeout);
 }
 
 void Document::unlockToRead()
 {
-  scoped_lock lock(*m_mutex);
-
-  ASSERT(m_read_locks == 0);
-  ASSERT(m_write_lock);
-
-  m_write_lock = false;
-  m_read_locks = 1;
+  m_rwLock.downgradeToRead();
 }
 
 void Document::unlock()
 {
-  scoped_lock lock(*m_mutex);
+  m_rwLock.unlock();
+}
 
-  if (m_write_lock) {
-    m_write_lock = false;
-  }
-  else if (m_read_locks > 0) {
-    --m_read_locks;
-  }
-  else {
-    ASSERT(false);
-  }
+base::RWLock::Stats Document::lockStats(LockType lockType) const
+{
+  return m_rwLock.stats(to_rw_lock_type(lockType));
 }
 
 void Document::onContextChanged()
@@ -12,6 +12,7 @@
 #include "app/file/format_options.h"
 #include "base/disable_copying.h"
 #include "base/observable.h"
+#include "base/rw_lock.h"
 #include "base/shared_ptr.h"
 #include "base/unique_ptr.h"
 #include "doc/color.h"
@@ -24,10 +25,6 @@
 
 #include <string>
 
-namespace base {
-  class mutex;
-}
-
 namespace doc {
   class Cel;
   class Layer;
@@ -42,6 +39,7 @@ namespace gfx {
 namespace app {
   class DocumentApi;
   class DocumentUndo;
+  class MaskBoundary;
   class Transaction;
   struct BoundSeg;
 
@@ -81,6 +79,7 @@ namespace app {
 
     void notifyGeneralUpdate();
     void notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region);
+    void notifyImagePixelsModified(Sprite* sprite, Image* image, const gfx::Region& region);
     void notifyExposeSpritePixels(Sprite* sprite, const gfx::Region& region);
     void notifyLayerMergedDown(Layer* srcLayer, Layer* targetLayer);
     void notifyCelMoved(Layer* fromLayer, frame_t fromFrame, Layer* toLayer, frame_t toFrame);
@@ -112,8 +111,17 @@ namespace app {
     int getBoundariesSegmentsCount() const;
     const BoundSeg* getBoundariesSegments() const;
 
+    // Returns a number that changes each time the boundaries change
+    // (e.g. to know when cached boundaries must be recalculated).
+    int getBoundariesVersion() const;
+
     void generateMaskBoundaries(Mask* mask = NULL);
 
+    // Updates the boundaries of the document mask when it was
+    // modified only inside the given area (in sprite coordinates)
+    // since the last call to generateMaskBoundaries().
+    void updateMaskBoundaries(const gfx::Rect& area);
+
     //////////////////////////////////////////////////////////////////////
     // Extra Cel (it is used to draw pen preview, pixels in movement, etc.)
 
@@ -164,12 +172,14 @@ namespace app {
     // Multi-threading ("sprite wrappers" use this)
 
     // Locks the sprite to read or write on it, returning true if the
-    // sprite can be accessed in the desired mode.
-    bool lock(LockType lockType);
+    // sprite can be accessed in the desired mode. If the sprite is
+    // locked by other thread, it waits at most "timeout" milliseconds
+    // (0 to return immediately).
+    bool lock(LockType lockType, int timeout);
 
     // If you've locked the sprite to read, using this method you can
     // raise your access level to write it.
-    bool lockToWrite();
+    bool lockToWrite(int timeout);
 
     // If you've locked the sprite to write, using this method you can
     // your access level to only read it.
@@ -177,6 +187,10 @@ namespace app {
 
     void unlock();
 
+    // Counters of the locks of this document (to diagnose contention
+    // between threads).
+    base::RWLock::Stats lockStats(LockType lockType) const;
+
   protected:
     virtual void onContextChanged() override;
 
@@ -188,19 +202,14 @@ namespace app {
     bool m_associated_to_file;
 
     // Selected mask region boundaries
-    struct {
-      int nseg;
-      BoundSeg* seg;
-    } m_bound;
-
-    // Mutex to modify the 'locked' flag.
-    base::mutex* m_mutex;
+    base::UniquePtr<MaskBoundary> m_maskBoundary;
 
-    // True if some thread is writing the sprite.
-    bool m_write_lock;
+    // True if m_maskBoundary was generated from the document mask
+    // (and not from other mask given to generateMaskBoundaries()).
+    bool m_maskBoundaryFromDocument;
 
-    // Greater than zero when one or more threads are reading the sprite.
-    int m_read_locks;
+    // Read/write lock of the sprite.
+    base::RWLock m_rwLock;
 
     // Data to save the file in the same format that it was loaded
     SharedPtr<FormatOptions> m_format_options;
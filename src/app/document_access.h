@@ -62,24 +62,24 @@ namespace app {
 
   // Class to view the document's state. Its constructor request a
   // reader-lock of the document, or throws an exception in case that
-  // the lock cannot be obtained.
+  // the lock cannot be obtained in "timeout" milliseconds.
   class DocumentReader : public DocumentAccess {
   public:
     DocumentReader()
     {
     }
 
-    explicit DocumentReader(Document* document)
+    explicit DocumentReader(Document* document, int timeout = 0)
       : DocumentAccess(document)
     {
-      if (m_document && !m_document->lock(Document::ReadLock))
+      if (m_document && !m_document->lock(Document::ReadLock, timeout))
         throw LockedDocumentException();
     }
 
-    explicit DocumentReader(const DocumentReader& copy)
+    explicit DocumentReader(const DocumentReader& copy, int timeout = 0)
       : DocumentAccess(copy)
     {
-      if (m_document && !m_document->lock(Document::ReadLock))
+      if (m_document && !m_document->lock(Document::ReadLock, timeout))
         throw LockedDocumentException();
     }
 
@@ -92,7 +92,7 @@ namespace app {
       DocumentAccess::operator=(copy);
 
       // relock the document
-      if (m_document && !m_document->lock(Document::ReadLock))
+      if (m_document && !m_document->lock(Document::ReadLock, 0))
         throw LockedDocumentException();
 
       return *this;
@@ -109,7 +109,7 @@ namespace app {
 
   // Class to modify the document's state. Its constructor request a
   // writer-lock of the document, or throws an exception in case that
-  // the lock cannot be obtained. Also, it contains a special
+  // the lock cannot be obtained in "timeout" milliseconds. Also, it contains a special
   // constructor that receives a DocumentReader, to elevate the
   // reader-lock to writer-lock.
   class DocumentWriter : public DocumentAccess {
@@ -120,13 +120,13 @@ namespace app {
     {
     }
 
-    explicit DocumentWriter(Document* document)
+    explicit DocumentWriter(Document* document, int timeout = 0)
       : DocumentAccess(document)
       , m_from_reader(false)
       , m_locked(false)
     {
       if (m_document) {
-        if (!m_document->lock(Document::WriteLock))
+        if (!m_document->lock(Document::WriteLock, timeout))
           throw LockedDocumentException();
 
         m_locked = true;
@@ -135,13 +135,13 @@ namespace app {
 
     // Constructor that can be used to elevate the given reader-lock to
     // writer permission.
-    explicit DocumentWriter(const DocumentReader& document)
+    explicit DocumentWriter(const DocumentReader& document, int timeout = 0)
       : DocumentAccess(document)
       , m_from_reader(true)
       , m_locked(false)
     {
       if (m_document) {
-        if (!m_document->lockToWrite())
+        if (!m_document->lockToWrite(timeout))
           throw LockedDocumentException();
 
         m_locked = true;
@@ -162,7 +162,7 @@ namespace app {
       if (m_document) {
         m_from_reader = true;
 
-        if (!m_document->lockToWrite())
+        if (!m_document->lockToWrite(0))
           throw LockedDocumentException();
 
         m_locked = true;
@@ -18,12 +18,16 @@
 #include "app/filename_formatter.h"
 #include "app/ui_context.h"
 #include "base/convert_to.h"
+#include "base/parallel_for.h"
 #include "base/path.h"
+#include "base/sha1.h"
 #include "base/unique_ptr.h"
 #include "doc/algorithm/shrink_bounds.h"
 #include "doc/cel.h"
 #include "doc/dithering_method.h"
 #include "doc/image.h"
+#include "doc/image_buffer.h"
+#include "doc/image_ref.h"
 #include "doc/layer.h"
 #include "doc/palette.h"
 #include "doc/primitives.h"
@@ -32,9 +36,12 @@
 #include "gfx/size.h"
 #include "render/render.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <map>
 
 using namespace doc;
 
@@ -51,7 +58,9 @@ public:
     m_filename(filename),
     m_originalSize(sprite->width(), sprite->height()),
     m_trimmedBounds(0, 0, sprite->width(), sprite->height()),
-    m_inTextureBounds(0, 0, sprite->width(), sprite->height()) {
+    m_inTextureBounds(0, 0, sprite->width(), sprite->height()),
+    m_rotated(false),
+    m_duplicateOf(NULL) {
   }
 
   Document* document() const { return m_document; }
@@ -63,6 +72,19 @@ public:
   const gfx::Rect& trimmedBounds() const { return m_trimmedBounds; }
   const gfx::Rect& inTextureBounds() const { return m_inTextureBounds; }
 
+  // True if the sample is rotated 90 degrees clockwise in the
+  // texture (so inTextureBounds() has the width/height swapped).
+  bool rotated() const { return m_rotated; }
+
+  // Original sample with the same pixels (in the texture this sample
+  // uses the same bounds as the original one).
+  const Sample* duplicateOf() const { return m_duplicateOf; }
+  bool isDuplicated() const { return m_duplicateOf != NULL; }
+
+  // Render of the trimmed bounds made in captureSamples() (if it was
+  // needed to trim/compare the sample), to avoid rendering it again.
+  const ImageRef& renderedImage() const { return m_renderedImage; }
+
   bool trimmed() const {
     return m_trimmedBounds.x > 0
       || m_trimmedBounds.y > 0
@@ -73,6 +95,9 @@ public:
   void setOriginalSize(const gfx::Size& size) { m_originalSize = size; }
   void setTrimmedBounds(const gfx::Rect& bounds) { m_trimmedBounds = bounds; }
   void setInTextureBounds(const gfx::Rect& bounds) { m_inTextureBounds = bounds; }
+  void setRotated(bool state) { m_rotated = state; }
+  void setDuplicateOf(const Sample* sample) { m_duplicateOf = sample; }
+  void setRenderedImage(const ImageRef& image) { m_renderedImage = image; }
 
 private:
   Document* m_document;
@@ -83,6 +108,9 @@ private:
   gfx::Size m_originalSize;
   gfx::Rect m_trimmedBounds;
   gfx::Rect m_inTextureBounds;
+  bool m_rotated;
+  const Sample* m_duplicateOf;
+  ImageRef m_renderedImage;
 };
 
 class DocumentExporter::Samples {
@@ -93,8 +121,9 @@ public:
 
   bool empty() const { return m_samples.empty(); }
 
-  void addSample(const Sample& sample) {
+  Sample& addSample(const Sample& sample) {
     m_samples.push_back(sample);
+    return m_samples.back();
   }
 
   iterator begin() { return m_samples.begin(); }
@@ -123,6 +152,9 @@ public:
     gfx::Size rowSize(0, 0);
 
     for (auto& sample : samples) {
+      if (sample.isDuplicated())
+        continue;
+
       const Sprite* sprite = sample.sprite();
       const Layer* layer = sample.layer();
       gfx::Size size = sample.trimmedBounds().getSize();
@@ -163,11 +195,20 @@ public:
 class DocumentExporter::BestFitLayoutSamples :
     public DocumentExporter::LayoutSamples {
 public:
+  BestFitLayoutSamples(gfx::PackingRects::Algorithm algorithm, bool rotation)
+    : m_algorithm(algorithm)
+    , m_rotation(rotation) {
+  }
+
   void layoutSamples(Samples& samples, int& width, int& height) override {
     gfx::PackingRects pr;
+    pr.setAlgorithm(m_algorithm);
+    pr.setRotation(m_rotation);
 
-    for (auto& sample : samples)
-      pr.add(sample.trimmedBounds().getSize());
+    for (auto& sample : samples) {
+      if (!sample.isDuplicated())
+        pr.add(sample.trimmedBounds().getSize());
+    }
 
     if (width == 0 || height == 0) {
       gfx::Size sz = pr.bestFit();
@@ -178,12 +219,19 @@ public:
       pr.pack(gfx::Size(width, height));
 
     auto it = samples.begin();
-    for (auto& rc : pr) {
+    for (std::size_t i=0; i<pr.size(); ++i, ++it) {
+      while (it->isDuplicated())
+        ++it;
+
       ASSERT(it != samples.end());
-      it->setInTextureBounds(rc);
-      ++it;
+      it->setInTextureBounds(pr[i]);
+      it->setRotated(pr.isRotated(i));
     }
   }
+
+private:
+  gfx::PackingRects::Algorithm m_algorithm;
+  bool m_rotation;
 };
 
 DocumentExporter::DocumentExporter()
@@ -192,10 +240,13 @@ DocumentExporter::DocumentExporter()
  , m_textureWidth(0)
  , m_textureHeight(0)
  , m_texturePack(false)
+ , m_texturePackAlgorithm(gfx::PackingRects::DefaultAlgorithm)
+ , m_textureRotation(false)
  , m_scale(1.0)
  , m_scaleMode(DefaultScaleMode)
  , m_ignoreEmptyCels(false)
  , m_trimCels(false)
+ , m_deduplicate(false)
 {
 }
 
@@ -224,7 +275,7 @@ void DocumentExporter::exportSheet()
 
   // 2) Layout those samples in a texture field.
   if (m_texturePack) {
-    BestFitLayoutSamples layout;
+    BestFitLayoutSamples layout(m_texturePackAlgorithm, m_textureRotation);
     layout.layoutSamples(samples, m_textureWidth, m_textureHeight);
   }
   else {
@@ -232,6 +283,14 @@ void DocumentExporter::exportSheet()
     layout.layoutSamples(samples, m_textureWidth, m_textureHeight);
   }
 
+  // Duplicated samples use the same place of the original ones.
+  for (auto& sample : samples) {
+    if (sample.isDuplicated()) {
+      sample.setInTextureBounds(sample.duplicateOf()->inTextureBounds());
+      sample.setRotated(sample.duplicateOf()->rotated());
+    }
+  }
+
   // 3) Create and render the texture.
   base::UniquePtr<Document> textureDocument(
     createEmptyTexture(samples));
@@ -252,9 +311,49 @@ void DocumentExporter::exportSheet()
   }
 }
 
+// Copies "src" rotated 90 degrees clockwise in the given position of
+// "dst".
+static void copy_rotated_image(Image* dst, const Image* src, const gfx::Point& pt)
+{
+  for (int y=0; y<src->height(); ++y)
+    for (int x=0; x<src->width(); ++x)
+      put_pixel(dst,
+                pt.x + src->height()-1-y,
+                pt.y + x,
+                get_pixel(src, x, y));
+}
+
+// Hash of the pixels of the given bounds (and the palette of indexed
+// images, so samples with different colors aren't merged).
+static base::Sha1 calculate_sample_hash(const Image* image,
+                                        const gfx::Rect& bounds,
+                                        const Palette* palette)
+{
+  int rowSize = image->getRowStrideSize(bounds.w);
+  std::vector<uint8_t> data;
+  data.reserve(16 + rowSize*bounds.h + 4*palette->size());
+
+  int header[] = { int(image->pixelFormat()), bounds.w, bounds.h };
+  data.insert(data.end(), (const uint8_t*)header, (const uint8_t*)(header+3));
+
+  for (int y=0; y<bounds.h; ++y) {
+    const uint8_t* row = image->getPixelAddress(bounds.x, bounds.y+y);
+    data.insert(data.end(), row, row+rowSize);
+  }
+
+  if (image->pixelFormat() == IMAGE_INDEXED) {
+    for (int i=0; i<palette->size(); ++i) {
+      color_t c = palette->getEntry(i);
+      data.insert(data.end(), (const uint8_t*)&c, (const uint8_t*)(&c+1));
+    }
+  }
+
+  return base::Sha1::calculateFromMemory(&data[0], data.size());
+}
+
 void DocumentExporter::captureSamples(Samples& samples)
 {
-  std::vector<char> buf(32);
+  std::vector<Sample> allSamples;
 
   for (auto& item : m_documents) {
     Document* doc = item.doc;
@@ -277,50 +376,111 @@ void DocumentExporter::captureSamples(Samples& samples)
 
     for (frame_t frame=frame_t(0);
          frame<sprite->totalFrames(); ++frame) {
+      if ((m_ignoreEmptyCels || m_trimCels) &&
+          layer && layer->isImage() && !layer->cel(frame)) {
+        // Empty cel this sample completely
+        continue;
+      }
+
       std::string filename =
         filename_formatter(format,
           doc->filename(),
           layer ? layer->name(): "",
           (sprite->totalFrames() > frame_t(1)) ? frame: frame_t(-1));
 
-      Sample sample(doc, sprite, layer, frame, filename);
+      allSamples.push_back(Sample(doc, sprite, layer, frame, filename));
+    }
+  }
 
-      if (m_ignoreEmptyCels || m_trimCels) {
-        if (layer && layer->isImage() && !layer->cel(frame)) {
-          // Empty cel this sample completely
-          continue;
-        }
+  if (!m_ignoreEmptyCels && !m_trimCels && !m_deduplicate) {
+    for (const auto& sample : allSamples)
+      samples.addSample(sample);
+    return;
+  }
+
+  // Render, trim and hash all samples in parallel. Each worker takes
+  // the next sample to render and uses its own image buffer.
+  int n = int(allSamples.size());
+  std::vector<char> emptySamples(n, 0);
+  std::vector<base::Sha1> hashes(n);
+  std::atomic<int> next(0);
+
+  // If there is just one sample, it's rendered with all CPU cores.
+  int renderThreads = (n > 1 ? 1: 0);
+
+  base::parallel_for(0, base::parallel_threads(),
+    [&](int) {
+      ImageBufferPtr renderBuf(new ImageBuffer);
+      int i;
+      while ((i = next++) < n) {
+        Sample& sample = allSamples[i];
+        Sprite* sprite = sample.sprite();
 
         base::UniquePtr<Image> sampleRender(
           Image::create(sprite->pixelFormat(),
             sprite->width(),
             sprite->height(),
-            m_sampleRenderBuf));
+            renderBuf));
 
         sampleRender->setMaskColor(sprite->transparentColor());
         clear_image(sampleRender, sprite->transparentColor());
-        renderSample(sample, sampleRender);
+        renderSample(sample, sampleRender, renderThreads);
+
+        if (m_ignoreEmptyCels || m_trimCels) {
+          gfx::Rect frameBounds;
+          doc::color_t refColor = 0;
+
+          if (m_trimCels)
+            refColor = get_pixel(sampleRender, 0, 0);
+          else if (m_ignoreEmptyCels)
+            refColor = sprite->transparentColor();
+
+          if (!algorithm::shrink_bounds(sampleRender, frameBounds, refColor)) {
+            // If shrink_bounds returns false, it's because the whole
+            // image is transparent (equal to the mask color).
+            emptySamples[i] = 1;
+            continue;
+          }
 
-        gfx::Rect frameBounds;
-        doc::color_t refColor = 0;
+          if (m_trimCels)
+            sample.setTrimmedBounds(frameBounds);
+        }
 
-        if (m_trimCels)
-          refColor = get_pixel(sampleRender, 0, 0);
-        else if (m_ignoreEmptyCels)
-          refColor = sprite->transparentColor();
+        const gfx::Rect& bounds = sample.trimmedBounds();
 
-        if (!algorithm::shrink_bounds(sampleRender, frameBounds, refColor)) {
-          // If shrink_bounds returns false, it's because the whole
-          // image is transparent (equal to the mask color).
-          continue;
-        }
+        if (m_deduplicate)
+          hashes[i] = calculate_sample_hash(
+            sampleRender, bounds, sprite->palette(sample.frame()));
 
-        if (m_trimCels)
-          sample.setTrimmedBounds(frameBounds);
+        sample.setRenderedImage(
+          ImageRef(crop_image(sampleRender,
+                              bounds.x, bounds.y, bounds.w, bounds.h,
+                              sprite->transparentColor())));
       }
+    });
 
-      samples.addSample(sample);
+  // Add the samples in order (the first sample with a hash is the
+  // original one, the rest are duplicates).
+  std::map<base::Sha1, const Sample*> originals;
+
+  for (int i=0; i<n; ++i) {
+    if (emptySamples[i])
+      continue;
+
+    Sample& sample = allSamples[i];
+
+    if (m_deduplicate) {
+      auto it = originals.find(hashes[i]);
+      if (it != originals.end()) {
+        sample.setDuplicateOf(it->second);
+        sample.setRenderedImage(ImageRef());
+        samples.addSample(sample);
+      }
+      else
+        originals[hashes[i]] = &samples.addSample(sample);
     }
+    else
+      samples.addSample(sample);
   }
 }
 
@@ -371,7 +531,12 @@ void DocumentExporter::renderTexture(const Samples& samples, Image* textureImage
 {
   textureImage->clear(0);
 
+  std::vector<const Sample*> samplesToRender;
+
   for (const auto& sample : samples) {
+    if (sample.isDuplicated())
+      continue;
+
     // Make the sprite compatible with the texture so the render()
     // works correctly.
     if (sample.sprite()->pixelFormat() != textureImage->pixelFormat()) {
@@ -381,8 +546,36 @@ void DocumentExporter::renderTexture(const Samples& samples, Image* textureImage
         DitheringMethod::NONE).execute(UIContext::instance());
     }
 
-    renderSample(sample, textureImage);
+    samplesToRender.push_back(&sample);
   }
+
+  // Each sample is in a different place of the texture, so they can
+  // be rendered at the same time. If there is just one sample, it's
+  // rendered with all CPU cores.
+  int renderThreads = (samplesToRender.size() > 1 ? 1: 0);
+
+  base::parallel_for(0, int(samplesToRender.size()),
+    [&](int i) {
+      const Sample& sample = *samplesToRender[i];
+      const Image* rendered = sample.renderedImage().get();
+
+      // The render from captureSamples() is equal to the texture
+      // render if the pixel format wasn't changed, and if the
+      // background where the layer was rendered was 0 too.
+      if (rendered &&
+          rendered->pixelFormat() == textureImage->pixelFormat() &&
+          (!sample.layer() || sample.sprite()->transparentColor() == 0)) {
+        const gfx::Rect& texBounds = sample.inTextureBounds();
+        if (sample.rotated())
+          copy_rotated_image(textureImage, rendered, texBounds.getOrigin());
+        else
+          textureImage->copy(rendered,
+            gfx::Clip(texBounds.x, texBounds.y, 0, 0,
+                      rendered->width(), rendered->height()));
+      }
+      else
+        renderSample(sample, textureImage, renderThreads);
+    });
 }
 
 void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os, Image* textureImage)
@@ -396,13 +589,18 @@ void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os,
     gfx::Rect spriteSourceBounds = sample.trimmedBounds();
     gfx::Rect frameBounds = sample.inTextureBounds();
 
+    // Like other texture packers, the frame size of a rotated sample
+    // is the unrotated one.
+    if (sample.rotated())
+      std::swap(frameBounds.w, frameBounds.h);
+
     os << "   \"" << sample.filename() << "\": {\n"
        << "    \"frame\": { "
        << "\"x\": " << frameBounds.x << ", "
        << "\"y\": " << frameBounds.y << ", "
        << "\"w\": " << frameBounds.w << ", "
        << "\"h\": " << frameBounds.h << " },\n"
-       << "    \"rotated\": false,\n"
+       << "    \"rotated\": " << (sample.rotated() ? "true": "false") << ",\n"
        << "    \"trimmed\": " << (sample.trimmed() ? "true": "false") << ",\n"
        << "    \"spriteSourceSize\": { "
        << "\"x\": " << spriteSourceBounds.x << ", "
@@ -436,9 +634,31 @@ void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os,
      << "}\n";
 }
 
-void DocumentExporter::renderSample(const Sample& sample, doc::Image* dst)
+void DocumentExporter::renderSample(const Sample& sample, doc::Image* dst, int threads)
 {
+  // Rotated samples are rendered in a temporary image and then copied
+  // rotated 90 degrees clockwise in the texture.
+  if (sample.rotated()) {
+    const gfx::Rect& bounds = sample.trimmedBounds();
+    const gfx::Rect& texBounds = sample.inTextureBounds();
+
+    Sample unrotated(sample);
+    unrotated.setInTextureBounds(gfx::Rect(0, 0, bounds.w, bounds.h));
+    unrotated.setRotated(false);
+
+    base::UniquePtr<Image> tmp(
+      Image::create(dst->pixelFormat(), bounds.w, bounds.h));
+    tmp->setMaskColor(dst->maskColor());
+    tmp->clear(0);
+    renderSample(unrotated, tmp, threads);
+
+    copy_rotated_image(dst, tmp, texBounds.getOrigin());
+    return;
+  }
+
   render::Render render;
+  render.setThreads(threads);
+
   gfx::Clip clip(
     sample.inTextureBounds().x,
     sample.inTextureBounds().y, sample.trimmedBounds());
@@ -10,8 +10,8 @@
 #pragma once
 
 #include "base/disable_copying.h"
-#include "doc/image_buffer.h"
 #include "gfx/fwd.h"
+#include "gfx/packing_rects.h"
 
 #include <iosfwd>
 #include <string>
@@ -71,6 +71,16 @@ namespace app {
       m_texturePack = state;
     }
 
+    // Algorithm used to pack the samples when setTexturePack(true)
+    void setTexturePackAlgorithm(gfx::PackingRects::Algorithm algorithm) {
+      m_texturePackAlgorithm = algorithm;
+    }
+
+    // Allows rotating samples 90 degrees to pack them better
+    void setTextureRotation(bool state) {
+      m_textureRotation = state;
+    }
+
     void setScale(double scale) {
       m_scale = scale;
     }
@@ -87,6 +97,12 @@ namespace app {
       m_trimCels = trim;
     }
 
+    // Frames with the same (trimmed) pixels are saved just one time
+    // in the texture. The data file still lists all of them.
+    void setDeduplicate(bool state) {
+      m_deduplicate = state;
+    }
+
     void setFilenameFormat(const std::string& format) {
       m_filenameFormat = format;
     }
@@ -108,7 +124,7 @@ namespace app {
     Document* createEmptyTexture(const Samples& samples);
     void renderTexture(const Samples& samples, doc::Image* textureImage);
     void createDataFile(const Samples& samples, std::ostream& os, doc::Image* textureImage);
-    void renderSample(const Sample& sample, doc::Image* dst);
+    void renderSample(const Sample& sample, doc::Image* dst, int threads);
 
     class Item {
     public:
@@ -127,13 +143,15 @@ namespace app {
     int m_textureWidth;
     int m_textureHeight;
     bool m_texturePack;
+    gfx::PackingRects::Algorithm m_texturePackAlgorithm;
+    bool m_textureRotation;
     double m_scale;
     ScaleMode m_scaleMode;
     bool m_ignoreEmptyCels;
     bool m_trimCels;
+    bool m_deduplicate;
     Items m_documents;
     std::string m_filenameFormat;
-    doc::ImageBufferPtr m_sampleRenderBuf;
 
     DISABLE_COPYING(DocumentExporter);
   };
@@ -15,19 +15,29 @@
 #include "app/cmd.h"
 #include "app/cmd_transaction.h"
 #include "app/pref/preferences.h"
+#include "base/exception.h"
 #include "doc/context.h"
 #include "undo/undo_history.h"
 #include "undo/undo_state.h"
 
+#include <algorithm>
 #include <cassert>
 #include <stdexcept>
 
 namespace app {
 
+// Number of states before and after the current one that are kept in
+// memory. Big payloads of other states are moved to disk (see
+// UndoPayload) because it's unlikely that the user will undo/redo
+// them soon.
+static const int kHotStates = 16;
+
 DocumentUndo::DocumentUndo()
-  : m_ctx(NULL)
+  : m_undoHistory(this)
+  , m_ctx(NULL)
   , m_savedCounter(0)
   , m_savedStateIsLost(false)
+  , m_totalUndoSize(0)
 {
 }
 
@@ -47,6 +57,15 @@ void DocumentUndo::add(CmdTransaction* cmd)
   }
 
   m_undoHistory.add(cmd);
+  m_totalUndoSize += cmd->memSize();
+  spillColdStates();
+
+  // Limit the memory used by the undo history (the preference is
+  // specified in megabytes)
+  if (App::instance()) {
+    limitUndoSize(
+      size_t(App::instance()->preferences().undo.sizeLimit()) * 1024 * 1024);
+  }
 }
 
 bool DocumentUndo::canUndo() const
@@ -61,12 +80,32 @@ bool DocumentUndo::canRedo() const
 
 void DocumentUndo::undo()
 {
-  return m_undoHistory.undo();
+  const undo::UndoState* state = nextUndo();
+  ASSERT(state);
+  Cmd* cmd = static_cast<Cmd*>(state->cmd());
+  size_t oldSize = cmd->memSize();
+  loadPayloads(cmd);
+
+  m_undoHistory.undo();
+
+  // The payload of the command could be loaded from disk, or its
+  // compressed data could be different now.
+  updateUndoSize(oldSize, cmd->memSize());
+  spillColdStates();
 }
 
 void DocumentUndo::redo()
 {
-  return m_undoHistory.redo();
+  const undo::UndoState* state = nextRedo();
+  ASSERT(state);
+  Cmd* cmd = static_cast<Cmd*>(state->cmd());
+  size_t oldSize = cmd->memSize();
+  loadPayloads(cmd);
+
+  m_undoHistory.redo();
+
+  updateUndoSize(oldSize, cmd->memSize());
+  spillColdStates();
 }
 
 void DocumentUndo::clearRedo()
@@ -137,6 +176,71 @@ Cmd* DocumentUndo::lastExecutedCmd() const
     return NULL;
 }
 
+void DocumentUndo::limitUndoSize(size_t maxSize)
+{
+  // The oldest states are discarded (the current state is always
+  // kept, so we can undo at least the last action)
+  while (m_totalUndoSize > maxSize &&
+         m_undoHistory.deleteFirstState())
+    ;
+}
+
+// Loads the data of the command that was moved to disk before the
+// command modifies the document, so an error (e.g. a deleted
+// temporary file) doesn't leave the document half-reverted.
+void DocumentUndo::loadPayloads(Cmd* cmd)
+{
+  if (!cmd->loadPayloads())
+    throw base::Exception("The undo information of \"%s\" cannot be read from disk.",
+                          cmd->label().c_str());
+}
+
+void DocumentUndo::spillColdStates()
+{
+  // Only the states that have just left the hot range are spilled,
+  // the older ones were spilled in previous calls.
+  const undo::UndoState* cur = m_undoHistory.currentState();
+  const undo::UndoState* state = cur;
+  for (int i=0; state && i<kHotStates; ++i)
+    state = state->prev();
+  if (state)
+    spillState(state->prev());
+
+  state = (cur ? cur->next(): m_undoHistory.firstState());
+  for (int i=0; state && i<kHotStates; ++i)
+    state = state->next();
+  if (state)
+    spillState(state);
+}
+
+void DocumentUndo::spillState(const undo::UndoState* state)
+{
+  if (!state)
+    return;
+
+  Cmd* cmd = static_cast<Cmd*>(state->cmd());
+  size_t oldSize = cmd->memSize();
+  cmd->spillPayloads();
+  updateUndoSize(oldSize, cmd->memSize());
+}
+
+void DocumentUndo::updateUndoSize(size_t oldSize, size_t newSize)
+{
+  m_totalUndoSize -= std::min(m_totalUndoSize, oldSize);
+  m_totalUndoSize += newSize;
+}
+
+void DocumentUndo::onDeleteUndoState(undo::UndoState* state)
+{
+  Cmd* cmd = static_cast<Cmd*>(state->cmd());
+
+  // The size of some commands can change after undo/redo (e.g.
+  // compressed pixels), so we avoid an underflow here.
+  m_totalUndoSize -= std::min(m_totalUndoSize, cmd->memSize());
+
+  delete cmd;
+}
+
 const undo::UndoState* DocumentUndo::nextUndo() const
 {
   return m_undoHistory.currentState();
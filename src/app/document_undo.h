@@ -26,7 +26,7 @@ namespace app {
   class Cmd;
   class CmdTransaction;
 
-  class DocumentUndo {
+  class DocumentUndo : public undo::UndoHistoryDelegate {
   public:
     DocumentUndo();
 
@@ -55,9 +55,21 @@ namespace app {
 
     int* savedCounter() { return &m_savedCounter; }
 
+    // Approximated memory used by the commands in the history (the
+    // data spilled to disk isn't included).
+    size_t totalUndoSize() const { return m_totalUndoSize; }
+
   private:
     const undo::UndoState* nextUndo() const;
     const undo::UndoState* nextRedo() const;
+    void limitUndoSize(size_t maxSize);
+    void loadPayloads(Cmd* cmd);
+    void spillColdStates();
+    void spillState(const undo::UndoState* state);
+    void updateUndoSize(size_t oldSize, size_t newSize);
+
+    // undo::UndoHistoryDelegate impl
+    void onDeleteUndoState(undo::UndoState* state) override;
 
     undo::UndoHistory m_undoHistory;
     doc::Context* m_ctx;
@@ -73,6 +85,10 @@ namespace app {
     // way. E.g. If the save process fails.
     bool m_savedStateIsLost;
 
+    // Sum of memSize() of all commands in m_undoHistory (when they
+    // were added).
+    size_t m_totalUndoSize;
+
     DISABLE_COPYING(DocumentUndo);
   };
 
@@ -16,10 +16,13 @@
 #include "base/cfile.h"
 #include "base/exception.h"
 #include "base/file_handle.h"
+#include "base/parallel_for.h"
 #include "doc/doc.h"
 #include "zlib.h"
 
+#include <map>
 #include <stdio.h>
+#include <vector>
 
 #define ASE_FILE_MAGIC                  0xA5E0
 #define ASE_FILE_FRAME_MAGIC            0xF1FA
@@ -79,8 +82,11 @@ static void ase_file_read_frame_header(FILE* f, ASE_FrameHeader* frame_header);
 static void ase_file_prepare_frame_header(FILE* f, ASE_FrameHeader* frame_header);
 static void ase_file_write_frame_header(FILE* f, ASE_FrameHeader* frame_header);
 
+class AsePendingImages;
+class AseCompressedCels;
+
 static void ase_file_write_layers(FILE* f, ASE_FrameHeader* frame_header, Layer* layer);
-static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, frame_t frame);
+static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, frame_t frame, AseCompressedCels* compressed);
 
 static void ase_file_read_padding(FILE* f, int bytes);
 static void ase_file_write_padding(FILE* f, int bytes);
@@ -95,8 +101,8 @@ static Palette* ase_file_read_color2_chunk(FILE* f, Sprite* sprite, frame_t fram
 static void ase_file_write_color2_chunk(FILE* f, ASE_FrameHeader* frame_header, Palette* pal);
 static Layer* ase_file_read_layer_chunk(FILE* f, Sprite* sprite, Layer** previous_layer, int* current_level);
 static void ase_file_write_layer_chunk(FILE* f, ASE_FrameHeader* frame_header, Layer* layer);
-static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame, PixelFormat pixelFormat, FileOp* fop, ASE_Header* header, size_t chunk_end);
-static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite);
+static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame, PixelFormat pixelFormat, FileOp* fop, ASE_Header* header, size_t chunk_end, AsePendingImages* pending);
+static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite, AseCompressedCels* compressed);
 static Mask* ase_file_read_mask_chunk(FILE* f);
 #if 0
 static void ase_file_write_mask_chunk(FILE* f, ASE_FrameHeader* frame_header, Mask* mask);
@@ -119,6 +125,57 @@ private:
   ASE_Chunk m_chunk;
 };
 
+// The zlib (de)compression of cel images is the slowest part of
+// loading/saving .ase files, so it's done in batches of several cels
+// using all CPU cores. Chunks are still read/written one after
+// another, so the file content doesn't change.
+
+// Compressed cels read from the file that are waiting to be
+// decompressed in their images.
+class AsePendingImages {
+public:
+  AsePendingImages() : m_bytes(0) { }
+
+  // Reads the compressed data of the image from the current file
+  // position to the end of the chunk.
+  void add(const ImageRef& image, FILE* f, size_t chunk_end);
+
+  // Returns true if we should call decode() before reading more cels.
+  bool isFull() const;
+
+  // Decompresses all pending images. Errors are reported with
+  // fop_error() (as we continue loading the rest of the cels).
+  void decode(FileOp* fop);
+
+private:
+  struct Item {
+    ImageRef image;
+    std::vector<uint8_t> data;
+    std::string error;
+  };
+
+  std::vector<Item> m_items;
+  std::size_t m_bytes;
+};
+
+// Compressed pixels of the cels of the next frames to be saved.
+class AseCompressedCels {
+public:
+  AseCompressedCels() : m_nextFrame(0) { }
+
+  // Compresses the cels of the given frame (and some of the next
+  // frames) if they weren't compressed yet.
+  void prepare(Sprite* sprite, frame_t frame);
+
+  const std::vector<uint8_t>& get(const Cel* cel) const;
+
+private:
+  typedef std::map<const Cel*, std::vector<uint8_t> > Data;
+
+  Data m_data;
+  frame_t m_nextFrame;
+};
+
 class AseFormat : public FileFormat {
   const char* onGetName() const { return "ase"; }
   const char* onGetExtensions() const { return "ase,aseprite"; }
@@ -174,6 +231,8 @@ bool AseFormat::onLoad(FileOp* fop)
   Layer* last_layer = sprite->folder();
   int current_level = -1;
 
+  AsePendingImages pending;
+
   /* read frame by frame to end-of-file */
   for (frame_t frame(0); frame<sprite->totalFrames(); ++frame) {
     /* start frame position */
@@ -232,7 +291,9 @@ bool AseFormat::onLoad(FileOp* fop)
 
             ase_file_read_cel_chunk(f, sprite, frame,
                                     sprite->pixelFormat(), fop, &header,
-                                    chunk_pos+chunk_size);
+                                    chunk_pos+chunk_size, &pending);
+            if (pending.isFull())
+              pending.decode(fop);
             break;
           }
 
@@ -279,6 +340,8 @@ bool AseFormat::onLoad(FileOp* fop)
       break;
   }
 
+  pending.decode(fop);
+
   fop->createDocument(sprite);
   sprite.release();
 
@@ -302,6 +365,8 @@ bool AseFormat::onSave(FileOp* fop)
   ase_file_prepare_header(f, &header, sprite);
   ase_file_write_header(f, &header);
 
+  AseCompressedCels compressed;
+
   // Write frames
   for (frame_t frame(0); frame<sprite->totalFrames(); ++frame) {
     // Prepare the frame header
@@ -333,7 +398,8 @@ bool AseFormat::onSave(FileOp* fop)
     }
 
     // Write cel chunks
-    ase_file_write_cels(f, &frame_header, sprite, sprite->folder(), frame);
+    compressed.prepare(sprite, frame);
+    ase_file_write_cels(f, &frame_header, sprite, sprite->folder(), frame, &compressed);
 
     // Write the frame header
     ase_file_write_frame_header(f, &frame_header);
@@ -496,7 +562,7 @@ static void ase_file_write_layers(FILE* f, ASE_FrameHeader* frame_header, Layer*
   }
 }
 
-static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, frame_t frame)
+static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, frame_t frame, AseCompressedCels* compressed)
 {
   if (layer->isImage()) {
     Cel* cel = layer->cel(frame);
@@ -504,7 +570,7 @@ static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite*
 /*       fop_error(fop, "New cel in frame %d, in layer %d\n", */
 /*                   frame, sprite_layer2index(sprite, layer)); */
 
-      ase_file_write_cel_chunk(f, frame_header, cel, static_cast<LayerImage*>(layer), sprite);
+      ase_file_write_cel_chunk(f, frame_header, cel, static_cast<LayerImage*>(layer), sprite, compressed);
     }
   }
 
@@ -513,7 +579,7 @@ static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite*
     LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
 
     for (; it != end; ++it)
-      ase_file_write_cels(f, frame_header, sprite, *it, frame);
+      ase_file_write_cels(f, frame_header, sprite, *it, frame, compressed);
   }
 }
 
@@ -866,7 +932,7 @@ static void write_raw_image(FILE* f, Image* image)
 //////////////////////////////////////////////////////////////////////
 
 template<typename ImageTraits>
-static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileOp* fop, ASE_Header* header)
+static void read_compressed_image(const std::vector<uint8_t>& compressed, Image* image)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -882,38 +948,28 @@ static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileO
 
   std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->width()));
   std::vector<uint8_t> uncompressed(image->height() * ImageTraits::getRowStrideBytes(image->width()));
-  std::vector<uint8_t> compressed(4096);
   int uncompressed_offset = 0;
 
-  while (true) {
-    size_t input_bytes;
-
-    if (ftell(f)+compressed.size() > chunk_end) {
-      input_bytes = chunk_end - ftell(f); // Remaining bytes
-      ASSERT(input_bytes < compressed.size());
-
-      if (input_bytes == 0)
-        break;                  // Done, we consumed all chunk
-    }
-    else
-      input_bytes = compressed.size();
-
-    size_t bytes_read = fread(&compressed[0], 1, input_bytes, f);
+  if (!compressed.empty()) {
     zstream.next_in = (Bytef*)&compressed[0];
-    zstream.avail_in = bytes_read;
+    zstream.avail_in = compressed.size();
 
     do {
       zstream.next_out = (Bytef*)&scanline[0];
       zstream.avail_out = scanline.size();
 
       err = inflate(&zstream, Z_NO_FLUSH);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+        inflateEnd(&zstream);
         throw base::Exception("ZLib error %d in inflate().", err);
+      }
 
       size_t uncompressed_bytes = scanline.size() - zstream.avail_out;
       if (uncompressed_bytes > 0) {
-        if (uncompressed_offset+uncompressed_bytes > uncompressed.size())
+        if (uncompressed_offset+uncompressed_bytes > uncompressed.size()) {
+          inflateEnd(&zstream);
           throw base::Exception("Bad compressed image.");
+        }
 
         std::copy(scanline.begin(), scanline.begin()+uncompressed_bytes,
                   uncompressed.begin()+uncompressed_offset);
@@ -921,8 +977,6 @@ static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileO
         uncompressed_offset += uncompressed_bytes;
       }
     } while (zstream.avail_out == 0);
-
-    fop_progress(fop, (float)ftell(f) / (float)header->size);
   }
 
   uncompressed_offset = 0;
@@ -941,7 +995,7 @@ static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileO
 }
 
 template<typename ImageTraits>
-static void write_compressed_image(FILE* f, Image* image)
+static void write_compressed_image(const Image* image, std::vector<uint8_t>& output)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -973,15 +1027,14 @@ static void write_compressed_image(FILE* f, Image* image)
 
       // Compress
       err = deflate(&zstream, flush);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+        deflateEnd(&zstream);
         throw base::Exception("ZLib error %d in deflate().", err);
+      }
 
       int output_bytes = compressed.size() - zstream.avail_out;
-      if (output_bytes > 0) {
-        if ((fwrite(&compressed[0], 1, output_bytes, f) != (size_t)output_bytes)
-            || ferror(f))
-          throw base::Exception("Error writing compressed image pixels.\n");
-      }
+      if (output_bytes > 0)
+        output.insert(output.end(), compressed.begin(), compressed.begin()+output_bytes);
     } while (zstream.avail_out == 0);
   }
 
@@ -990,13 +1043,206 @@ static void write_compressed_image(FILE* f, Image* image)
     throw base::Exception("ZLib error %d in deflateEnd().", err);
 }
 
+static void decompress_image(const std::vector<uint8_t>& compressed, Image* image)
+{
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB:
+      read_compressed_image<RgbTraits>(compressed, image);
+      break;
+    case IMAGE_GRAYSCALE:
+      read_compressed_image<GrayscaleTraits>(compressed, image);
+      break;
+    case IMAGE_INDEXED:
+      read_compressed_image<IndexedTraits>(compressed, image);
+      break;
+  }
+}
+
+static void compress_image(const Image* image, std::vector<uint8_t>& output)
+{
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB:
+      write_compressed_image<RgbTraits>(image, output);
+      break;
+    case IMAGE_GRAYSCALE:
+      write_compressed_image<GrayscaleTraits>(image, output);
+      break;
+    case IMAGE_INDEXED:
+      write_compressed_image<IndexedTraits>(image, output);
+      break;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Batches of compressed cels
+//////////////////////////////////////////////////////////////////////
+
+// Limits of each batch of cels (de)compressed in parallel
+static const std::size_t kMaxBatchBytes = 32*1024*1024;
+static int max_batch_cels()
+{
+  return 4*base::parallel_threads();
+}
+
+void AsePendingImages::add(const ImageRef& image, FILE* f, size_t chunk_end)
+{
+  m_items.push_back(Item());
+  Item& item = m_items.back();
+  item.image = image;
+
+  long pos = ftell(f);
+  if (pos >= 0 && size_t(pos) < chunk_end) {
+    item.data.resize(chunk_end - pos);
+    item.data.resize(fread(&item.data[0], 1, item.data.size(), f));
+  }
+  m_bytes += item.data.size() + image->getMemSize();
+}
+
+bool AsePendingImages::isFull() const
+{
+  return (int(m_items.size()) >= max_batch_cels() ||
+          m_bytes >= kMaxBatchBytes);
+}
+
+void AsePendingImages::decode(FileOp* fop)
+{
+  base::parallel_for(
+    0, int(m_items.size()),
+    [this](int i) {
+      Item& item = m_items[i];
+      try {
+        decompress_image(item.data, item.image.get());
+      }
+      catch (const std::exception& e) {
+        item.error = e.what();
+      }
+    });
+
+  // OK, in case of error we can show the problem, but continue
+  // loading more cels.
+  for (const Item& item : m_items)
+    if (!item.error.empty())
+      fop_error(fop, item.error.c_str());
+
+  m_items.clear();
+  m_bytes = 0;
+}
+
+// Decompresses the pixels of a cel the first time it's used (when
+// the file is loaded with FILE_LOAD_LAZY).
+class AseImageLoader : public doc::ImageLoader {
+public:
+  AseImageLoader(PixelFormat pixelFormat, int width, int height, color_t maskColor)
+    : m_pixelFormat(pixelFormat)
+    , m_width(width)
+    , m_height(height)
+    , m_maskColor(maskColor) {
+  }
+
+  // Reads the compressed data of the image from the current file
+  // position to the end of the chunk.
+  void read(FILE* f, size_t chunk_end) {
+    long pos = ftell(f);
+    if (pos >= 0 && size_t(pos) < chunk_end) {
+      m_data.resize(chunk_end - pos);
+      m_data.resize(fread(&m_data[0], 1, m_data.size(), f));
+    }
+  }
+
+  Image* loadImage() override {
+    base::UniquePtr<Image> image(Image::create(m_pixelFormat, m_width, m_height));
+    image->setMaskColor(m_maskColor);
+    try {
+      decompress_image(m_data, image);
+    }
+    catch (const std::exception&) {
+      // We cannot report the error here (the file was loaded some
+      // time ago), so the cel will be empty.
+      clear_image(image, m_maskColor);
+    }
+    return image.release();
+  }
+
+  int getMemSize() const override {
+    return sizeof(*this) + int(m_data.size());
+  }
+
+private:
+  PixelFormat m_pixelFormat;
+  int m_width;
+  int m_height;
+  color_t m_maskColor;
+  std::vector<uint8_t> m_data;
+};
+
+static void collect_cels_to_compress(Layer* layer, frame_t frame, std::vector<Cel*>& cels)
+{
+  if (layer->isImage()) {
+    Cel* cel = layer->cel(frame);
+    if (cel && !cel->link())
+      cels.push_back(cel);
+  }
+
+  if (layer->isFolder()) {
+    LayerIterator it = static_cast<LayerFolder*>(layer)->getLayerBegin();
+    LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
+
+    for (; it != end; ++it)
+      collect_cels_to_compress(*it, frame, cels);
+  }
+}
+
+void AseCompressedCels::prepare(Sprite* sprite, frame_t frame)
+{
+  if (frame < m_nextFrame)
+    return;
+
+  m_data.clear();
+
+  // Collect the cels of the next frames until we fill the batch
+  std::vector<Cel*> cels;
+  std::size_t bytes = 0;
+  for (m_nextFrame=frame; m_nextFrame<sprite->totalFrames(); ++m_nextFrame) {
+    if (m_nextFrame > frame &&
+        (int(cels.size()) >= max_batch_cels() || bytes >= kMaxBatchBytes))
+      break;
+
+    std::size_t i = cels.size();
+    collect_cels_to_compress(sprite->folder(), m_nextFrame, cels);
+    for (; i<cels.size(); ++i)
+      bytes += cels[i]->data()->getMemSize();
+  }
+
+  // Create the entries before compressing so each thread can
+  // modify its own std::vector without locking the map.
+  std::vector<std::vector<uint8_t>*> outputs(cels.size());
+  for (std::size_t i=0; i<cels.size(); ++i)
+    outputs[i] = &m_data[cels[i]];
+
+  base::parallel_for(
+    0, int(cels.size()),
+    [&cels, &outputs](int i) {
+      compress_image(cels[i]->image(), *outputs[i]);
+    });
+}
+
+const std::vector<uint8_t>& AseCompressedCels::get(const Cel* cel) const
+{
+  Data::const_iterator it = m_data.find(cel);
+  ASSERT(it != m_data.end());
+  if (it == m_data.end())
+    throw base::Exception("Error compressing cel pixels.\n");
+  return it->second;
+}
+
 //////////////////////////////////////////////////////////////////////
 // Cel Chunk
 //////////////////////////////////////////////////////////////////////
 
 static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame,
                                     PixelFormat pixelFormat,
-                                    FileOp* fop, ASE_Header* header, size_t chunk_end)
+                                    FileOp* fop, ASE_Header* header, size_t chunk_end,
+                                    AsePendingImages* pending)
 {
   /* read chunk data */
   LayerIndex layer_index = LayerIndex(fgetw(f));
@@ -1070,6 +1316,9 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame,
           cel->setFrame(frame);
         }
         else {
+          // The pixels of the linked cel could be still compressed
+          pending->decode(fop);
+
           cel.reset(Cel::createCopy(link));
           cel->setFrame(frame);
           cel->setPosition(x, y);
@@ -1089,32 +1338,24 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame,
       int h = fgetw(f);
 
       if (w > 0 && h > 0) {
-        ImageRef image(Image::create(pixelFormat, w, h));
-
-        // Try to read pixel data
-        try {
-          switch (image->pixelFormat()) {
-
-            case IMAGE_RGB:
-              read_compressed_image<RgbTraits>(f, image, chunk_end, fop, header);
-              break;
+        if (fop->lazy) {
+          // Pixel data is decompressed when the cel is used
+          base::UniquePtr<AseImageLoader> loader(
+            new AseImageLoader(pixelFormat, w, h, sprite->transparentColor()));
+          loader->read(f, chunk_end);
+
+          CelDataRef celData(new CelData(loader, gfx::Size(w, h)));
+          loader.release();
+          cel.reset(new Cel(frame, celData));
+        }
+        else {
+          ImageRef image(Image::create(pixelFormat, w, h));
 
-            case IMAGE_GRAYSCALE:
-              read_compressed_image<GrayscaleTraits>(f, image, chunk_end, fop, header);
-              break;
+          // Pixel data is decompressed later (see AsePendingImages)
+          pending->add(image, f, chunk_end);
 
-            case IMAGE_INDEXED:
-              read_compressed_image<IndexedTraits>(f, image, chunk_end, fop, header);
-              break;
-          }
+          cel.reset(new Cel(frame, image));
         }
-        // OK, in case of error we can show the problem, but continue
-        // loading more cels.
-        catch (const std::exception& e) {
-          fop_error(fop, e.what());
-        }
-
-        cel.reset(new Cel(frame, image));
         cel->setPosition(x, y);
         cel->setOpacity(opacity);
       }
@@ -1130,7 +1371,7 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame,
   return cel.release();
 }
 
-static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite)
+static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite, AseCompressedCels* compressed)
 {
   ChunkWriter chunk(f, frame_header, ASE_FILE_CHUNK_CEL);
 
@@ -1192,21 +1433,12 @@ static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel
         fputw(image->width(), f);
         fputw(image->height(), f);
 
-        // Pixel data
-        switch (image->pixelFormat()) {
-
-          case IMAGE_RGB:
-            write_compressed_image<RgbTraits>(f, image);
-            break;
-
-          case IMAGE_GRAYSCALE:
-            write_compressed_image<GrayscaleTraits>(f, image);
-            break;
-
-          case IMAGE_INDEXED:
-            write_compressed_image<IndexedTraits>(f, image);
-            break;
-        }
+        // Pixel data (already compressed by AseCompressedCels)
+        const std::vector<uint8_t>& data = compressed->get(cel);
+        if (!data.empty() &&
+            ((fwrite(&data[0], 1, data.size(), f) != data.size())
+             || ferror(f)))
+          throw base::Exception("Error writing compressed image pixels.\n");
       }
       else {
         // Width and height
@@ -1236,11 +1468,12 @@ static Mask* ase_file_read_mask_chunk(FILE* f)
   mask->replace(gfx::Rect(x, y, w, h));
 
   // Read image data
+  Image* bitmap = mask->editableBitmap();
   for (v=0; v<h; v++)
     for (u=0; u<(w+7)/8; u++) {
       byte = fgetc(f);
       for (c=0; c<8; c++)
-        put_pixel(mask->bitmap(), u*8+c, v, byte & (1<<(7-c)));
+        put_pixel(bitmap, u*8+c, v, byte & (1<<(7-c)));
     }
 
   return mask;
@@ -219,6 +219,9 @@ FileOp* fop_to_load_document(Context* context, const char* filename, int flags)
   if (flags & FILE_LOAD_ONE_FRAME)
     fop->oneframe = true;
 
+  if (flags & FILE_LOAD_LAZY)
+    fop->lazy = true;
+
 done:;
   return fop;
 }
@@ -850,6 +853,7 @@ static FileOp* fop_new(FileOpType type, Context* context)
   fop->done = false;
   fop->stop = false;
   fop->oneframe = false;
+  fop->lazy = false;
 
   fop->seq.palette = NULL;
   fop->seq.image.reset(NULL);
@@ -22,6 +22,7 @@
 #define FILE_LOAD_SEQUENCE_ASK          0x00000002
 #define FILE_LOAD_SEQUENCE_YES          0x00000004
 #define FILE_LOAD_ONE_FRAME             0x00000008
+#define FILE_LOAD_LAZY                  0x00000010
 
 namespace base {
   class mutex;
@@ -80,6 +81,8 @@ namespace app {
     bool oneframe;                // Load just one frame (in formats
                                   // that support animation like
                                   // GIF/FLI/ASE).
+    bool lazy;                    // Images can be decoded when they
+                                  // are used (see doc::ImageLoader).
 
     // Data for sequences.
     struct {
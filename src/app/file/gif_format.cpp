@@ -20,6 +20,8 @@
 #include "app/modules/gui.h"
 #include "app/util/autocrop.h"
 #include "base/file_handle.h"
+#include "base/parallel_for.h"
+#include "base/thread.h"
 #include "base/unique_ptr.h"
 #include "doc/doc.h"
 #include "render/quantization.h"
@@ -31,6 +33,10 @@
 
 #include <gif_lib.h>
 
+#include <algorithm>
+#include <exception>
+#include <vector>
+
 namespace app {
 
 using namespace base;
@@ -101,6 +107,15 @@ FileFormat* CreateGifFormat()
   return new GifFormat;
 }
 
+#ifdef ENABLE_SAVE
+// A frame rendered and converted to indexed, ready to be written in
+// the GIF file.
+struct GifRenderedFrame {
+  ImageRef image;
+  SharedPtr<Palette> palette;
+};
+#endif
+
 static int interlaced_offset[] = { 0, 4, 2, 1 };
 static int interlaced_jumps[] = { 8, 8, 4, 2 };
 
@@ -541,7 +556,6 @@ bool GifFormat::onSave(FileOp* fop)
 
   Palette current_palette = *sprite->palette(frame_t(0));
   Palette previous_palette(current_palette);
-  RgbMap rgbmap;
 
   // The color map must be a power of two.
   int color_map_size = current_palette.size();
@@ -583,190 +597,277 @@ bool GifFormat::onSave(FileOp* fop)
                         background_color, color_map) == GIF_ERROR)
     throw Exception("Error writing GIF header.\n");
 
-  UniquePtr<Image> buffer_image;
-  UniquePtr<Image> current_image(Image::create(IMAGE_INDEXED, sprite_w, sprite_h));
   UniquePtr<Image> previous_image(Image::create(IMAGE_INDEXED, sprite_w, sprite_h));
   int frame_x, frame_y, frame_w, frame_h;
   int u1, v1, u2, v2;
   int i1, j1, i2, j2;
 
-  // If the sprite is not Indexed type, we will need a temporary
-  // buffer to render the full RGB or Grayscale sprite.
-  if (sprite_format != IMAGE_INDEXED)
-    buffer_image.reset(Image::create(sprite_format, sprite_w, sprite_h));
-
-  clear_image(current_image, background_color);
   clear_image(previous_image, background_color);
 
   ColorMapObject* image_color_map = NULL;
 
-  render::Render render;
-  render.setBgType(render::BgType::NONE);
+  // Palette for all frames (only used with QuantizeAll)
+  Palette all_frames_palette(current_palette);
+  RgbMap all_frames_rgbmap;
+
+  // Frames are rendered/converted in parallel in windows of
+  // "window_size" frames. While the frames of a window are being
+  // written in the file (LZW compression is serial), the frames of
+  // the next window are prepared by other threads.
+  const frame_t total_frames = sprite->totalFrames();
+  const int window_size = base::parallel_threads();
 
   // Check if the user wants one optimized palette for all frames.
   if (sprite_format != IMAGE_INDEXED &&
       gif_options->quantize() == GifOptions::QuantizeAll) {
     // Feed the optimizer with all rendered frames.
     render::PaletteOptimizer optimizer;
-    for (frame_t frame_num(0); frame_num<sprite->totalFrames(); ++frame_num) {
-      clear_image(buffer_image, background_color);
-      render.renderSprite(buffer_image, sprite, frame_num);
-      optimizer.feedWithImage(buffer_image);
+    std::vector<ImageRef> buffers(window_size);
+
+    for (frame_t first(0); first<total_frames; first+=window_size) {
+      int n = std::min<int>(window_size, total_frames-first);
+      base::parallel_for(0, n,
+        [&](int i) {
+          if (!buffers[i])
+            buffers[i].reset(Image::create(sprite_format, sprite_w, sprite_h));
+
+          render::Render render;
+          render.setBgType(render::BgType::NONE);
+          clear_image(buffers[i].get(), background_color);
+          render.renderSprite(buffers[i].get(), sprite, first+i);
+        }, window_size);
+
+      for (int i=0; i<n; ++i)
+        optimizer.feedWithImage(buffers[i].get());
     }
 
-    current_palette.makeBlack();
-    optimizer.calculate(&current_palette, has_background);
+    all_frames_palette.makeBlack();
+    optimizer.calculate(&all_frames_palette, has_background);
 
-    rgbmap.regenerate(&current_palette, transparent_index);
+    all_frames_rgbmap.regenerate(&all_frames_palette, transparent_index);
   }
 
-  for (frame_t frame_num(0); frame_num<sprite->totalFrames(); ++frame_num) {
-    // If the sprite is RGB or Grayscale, we must to convert it to Indexed on the fly.
-    if (sprite_format != IMAGE_INDEXED) {
-      clear_image(buffer_image, background_color);
-      render.renderSprite(buffer_image, sprite, frame_num);
-
-      switch (gif_options->quantize()) {
-        case GifOptions::NoQuantize:
-          sprite->palette(frame_num)->copyColorsTo(&current_palette);
-          rgbmap.regenerate(&current_palette, transparent_index);
-          break;
-        case GifOptions::QuantizeEach:
-          {
-            current_palette.makeBlack();
-
-            std::vector<Image*> imgarray(1);
-            imgarray[0] = buffer_image;
-            render::create_palette_from_images(imgarray, &current_palette, has_background);
-            rgbmap.regenerate(&current_palette, transparent_index);
+  // Renders the given frame and converts it to indexed (if the sprite
+  // is RGB or Grayscale). Can be called from several threads at the
+  // same time.
+  auto prepare_frame =
+    [&](frame_t frame_num, GifRenderedFrame& frame) {
+      frame.image.reset(Image::create(IMAGE_INDEXED, sprite_w, sprite_h));
+
+      render::Render render;
+      render.setBgType(render::BgType::NONE);
+
+      // If the sprite is RGB or Grayscale, we must to convert it to Indexed on the fly.
+      if (sprite_format != IMAGE_INDEXED) {
+        UniquePtr<Image> buffer_image(Image::create(sprite_format, sprite_w, sprite_h));
+        clear_image(buffer_image, background_color);
+        render.renderSprite(buffer_image, sprite, frame_num);
+
+        RgbMap rgbmap;
+        const RgbMap* frame_rgbmap = &rgbmap;
+
+        switch (gif_options->quantize()) {
+          case GifOptions::NoQuantize:
+            frame.palette.reset(new Palette(current_palette));
+            sprite->palette(frame_num)->copyColorsTo(frame.palette.get());
+            rgbmap.regenerate(frame.palette.get(), transparent_index);
+            break;
+          case GifOptions::QuantizeEach:
+            {
+              frame.palette.reset(new Palette(current_palette));
+              frame.palette->makeBlack();
+
+              std::vector<Image*> imgarray(1);
+              imgarray[0] = buffer_image;
+              render::create_palette_from_images(imgarray, frame.palette.get(), has_background);
+              rgbmap.regenerate(frame.palette.get(), transparent_index);
+            }
+            break;
+          case GifOptions::QuantizeAll:
+            // We've already calculate the palette for all frames.
+            frame.palette.reset(new Palette(all_frames_palette));
+            frame_rgbmap = &all_frames_rgbmap;
+            break;
+        }
+
+        render::convert_pixel_format(
+          buffer_image,
+          frame.image.get(),
+          IMAGE_INDEXED,
+          gif_options->dithering(),
+          frame_rgbmap,
+          frame.palette.get(),
+          has_background);
+      }
+      // If the sprite is Indexed, we can render directly into the frame image.
+      else {
+        frame.palette.reset(new Palette(current_palette));
+        clear_image(frame.image.get(), background_color);
+        render.renderSprite(frame.image.get(), sprite, frame_num);
+      }
+    };
+
+  // Writes the given frame in the GIF file. Frames must be written in
+  // order (they are compared with the previous one).
+  auto write_frame =
+    [&](frame_t frame_num, GifRenderedFrame& frame) {
+      Image* current_image = frame.image.get();
+      const Palette& current_palette = *frame.palette;
+
+      if (frame_num == 0) {
+        frame_x = 0;
+        frame_y = 0;
+        frame_w = sprite->width();
+        frame_h = sprite->height();
+      }
+      else {
+        // Get the rectangle where start differences with the previous frame.
+        if (get_shrink_rect2(&u1, &v1, &u2, &v2, current_image, previous_image)) {
+          // Check the minimal area with the background color.
+          if (get_shrink_rect(&i1, &j1, &i2, &j2, current_image, background_color)) {
+            frame_x = MIN(u1, i1);
+            frame_y = MIN(v1, j1);
+            frame_w = MAX(u2, i2) - MIN(u1, i1) + 1;
+            frame_h = MAX(v2, j2) - MIN(v1, j1) + 1;
           }
-          break;
-        case GifOptions::QuantizeAll:
-          // Do nothing, we've already calculate the palette for all frames.
-          break;
+        }
       }
 
-      render::convert_pixel_format(
-        buffer_image,
-        current_image,
-        IMAGE_INDEXED,
-        gif_options->dithering(),
-        &rgbmap,
-        &current_palette,
-        has_background);
-    }
-    // If the sprite is Indexed, we can render directly into "current_image".
-    else {
-      clear_image(current_image, background_color);
-      render.renderSprite(current_image, sprite, frame_num);
-    }
+      // Specify loop extension.
+      if (frame_num == 0 && loop >= 0) {
+        if (EGifPutExtensionLeader(gif_file, APPLICATION_EXT_FUNC_CODE) == GIF_ERROR)
+          throw Exception("Error writing GIF graphics extension record (header section).");
 
-    if (frame_num == 0) {
-      frame_x = 0;
-      frame_y = 0;
-      frame_w = sprite->width();
-      frame_h = sprite->height();
-    }
-    else {
-      // Get the rectangle where start differences with the previous frame.
-      if (get_shrink_rect2(&u1, &v1, &u2, &v2, current_image, previous_image)) {
-        // Check the minimal area with the background color.
-        if (get_shrink_rect(&i1, &j1, &i2, &j2, current_image, background_color)) {
-          frame_x = MIN(u1, i1);
-          frame_y = MIN(v1, j1);
-          frame_w = MAX(u2, i2) - MIN(u1, i1) + 1;
-          frame_h = MAX(v2, j2) - MIN(v1, j1) + 1;
-        }
-      }
-    }
+        unsigned char extension_bytes[11];
+        memcpy(extension_bytes, "NETSCAPE2.0", 11);
+        if (EGifPutExtensionBlock(gif_file, 11, extension_bytes) == GIF_ERROR)
+          throw Exception("Error writing GIF graphics extension record (first block).");
 
-    // Specify loop extension.
-    if (frame_num == 0 && loop >= 0) {
-      if (EGifPutExtensionLeader(gif_file, APPLICATION_EXT_FUNC_CODE) == GIF_ERROR)
-        throw Exception("Error writing GIF graphics extension record (header section).");
+        extension_bytes[0] = 1;
+        extension_bytes[1] = (loop & 0xff);
+        extension_bytes[2] = (loop >> 8) & 0xff;
+        if (EGifPutExtensionBlock(gif_file, 3, extension_bytes) == GIF_ERROR)
+          throw Exception("Error writing GIF graphics extension record (second block).");
 
-      unsigned char extension_bytes[11];
-      memcpy(extension_bytes, "NETSCAPE2.0", 11);
-      if (EGifPutExtensionBlock(gif_file, 11, extension_bytes) == GIF_ERROR)
-        throw Exception("Error writing GIF graphics extension record (first block).");
+        if (EGifPutExtensionTrailer(gif_file) == GIF_ERROR)
+          throw Exception("Error writing GIF graphics extension record (trailer section).");
+      }
 
-      extension_bytes[0] = 1;
-      extension_bytes[1] = (loop & 0xff);
-      extension_bytes[2] = (loop >> 8) & 0xff;
-      if (EGifPutExtensionBlock(gif_file, 3, extension_bytes) == GIF_ERROR)
-        throw Exception("Error writing GIF graphics extension record (second block).");
+      // Write graphics extension record (to save the duration of the
+      // frame and maybe the transparency index).
+      {
+        unsigned char extension_bytes[5];
+        int disposal_method = (sprite->backgroundLayer() ? DISPOSAL_METHOD_DO_NOT_DISPOSE:
+                                                           DISPOSAL_METHOD_RESTORE_BGCOLOR);
+        int frame_delay = sprite->frameDuration(frame_num) / 10;
+
+        extension_bytes[0] = (((disposal_method & 7) << 2) |
+                              (transparent_index >= 0 ? 1: 0));
+        extension_bytes[1] = (frame_delay & 0xff);
+        extension_bytes[2] = (frame_delay >> 8) & 0xff;
+        extension_bytes[3] = (transparent_index >= 0 ? transparent_index: 0);
+
+        if (EGifPutExtension(gif_file, GRAPHICS_EXT_FUNC_CODE, 4, extension_bytes) == GIF_ERROR)
+          throw Exception("Error writing GIF graphics extension record for frame %d.\n", (int)frame_num);
+      }
 
-      if (EGifPutExtensionTrailer(gif_file) == GIF_ERROR)
-        throw Exception("Error writing GIF graphics extension record (trailer section).");
-    }
+      // Image color map
+      if ((!color_map && frame_num == 0) ||
+          (current_palette.countDiff(&previous_palette, NULL, NULL) > 0)) {
+        if (!image_color_map) {
+          image_color_map = GifMakeMapObject(current_palette.size(), NULL);
+          if (image_color_map == NULL)
+            throw std::bad_alloc();
+        }
 
-    // Write graphics extension record (to save the duration of the
-    // frame and maybe the transparency index).
-    {
-      unsigned char extension_bytes[5];
-      int disposal_method = (sprite->backgroundLayer() ? DISPOSAL_METHOD_DO_NOT_DISPOSE:
-                                                         DISPOSAL_METHOD_RESTORE_BGCOLOR);
-      int frame_delay = sprite->frameDuration(frame_num) / 10;
-
-      extension_bytes[0] = (((disposal_method & 7) << 2) |
-                            (transparent_index >= 0 ? 1: 0));
-      extension_bytes[1] = (frame_delay & 0xff);
-      extension_bytes[2] = (frame_delay >> 8) & 0xff;
-      extension_bytes[3] = (transparent_index >= 0 ? transparent_index: 0);
-
-      if (EGifPutExtension(gif_file, GRAPHICS_EXT_FUNC_CODE, 4, extension_bytes) == GIF_ERROR)
-        throw Exception("Error writing GIF graphics extension record for frame %d.\n", (int)frame_num);
-    }
+        for (int i = 0; i < current_palette.size(); ++i) {
+          image_color_map->Colors[i].Red   = rgba_getr(current_palette.getEntry(i));
+          image_color_map->Colors[i].Green = rgba_getg(current_palette.getEntry(i));
+          image_color_map->Colors[i].Blue  = rgba_getb(current_palette.getEntry(i));
+        }
 
-    // Image color map
-    if ((!color_map && frame_num == 0) ||
-        (current_palette.countDiff(&previous_palette, NULL, NULL) > 0)) {
-      if (!image_color_map) {
-        image_color_map = GifMakeMapObject(current_palette.size(), NULL);
-        if (image_color_map == NULL)
-          throw std::bad_alloc();
+        current_palette.copyColorsTo(&previous_palette);
       }
 
-      for (int i = 0; i < current_palette.size(); ++i) {
-        image_color_map->Colors[i].Red   = rgba_getr(current_palette.getEntry(i));
-        image_color_map->Colors[i].Green = rgba_getg(current_palette.getEntry(i));
-        image_color_map->Colors[i].Blue  = rgba_getb(current_palette.getEntry(i));
+      // Write the image record.
+      if (EGifPutImageDesc(gif_file,
+                           frame_x, frame_y,
+                           frame_w, frame_h, interlaced ? 1: 0,
+                           image_color_map) == GIF_ERROR)
+        throw Exception("Error writing GIF frame %d.\n", (int)frame_num);
+
+      // Write the image data (pixels).
+      if (interlaced) {
+        // Need to perform 4 passes on the images.
+        for (int i=0; i<4; ++i)
+          for (int y = interlaced_offset[i]; y < frame_h; y += interlaced_jumps[i]) {
+            IndexedTraits::address_t addr =
+              (IndexedTraits::address_t)current_image->getPixelAddress(frame_x, frame_y + y);
+
+            if (EGifPutLine(gif_file, addr, frame_w) == GIF_ERROR)
+              throw Exception("Error writing GIF image scanlines for frame %d.\n", (int)frame_num);
+          }
       }
-
-      current_palette.copyColorsTo(&previous_palette);
-    }
-
-    // Write the image record.
-    if (EGifPutImageDesc(gif_file,
-                         frame_x, frame_y,
-                         frame_w, frame_h, interlaced ? 1: 0,
-                         image_color_map) == GIF_ERROR)
-      throw Exception("Error writing GIF frame %d.\n", (int)frame_num);
-
-    // Write the image data (pixels).
-    if (interlaced) {
-      // Need to perform 4 passes on the images.
-      for (int i=0; i<4; ++i)
-        for (int y = interlaced_offset[i]; y < frame_h; y += interlaced_jumps[i]) {
+      else {
+        // Write all image scanlines (not interlaced in this case).
+        for (int y=0; y<frame_h; ++y) {
           IndexedTraits::address_t addr =
             (IndexedTraits::address_t)current_image->getPixelAddress(frame_x, frame_y + y);
 
           if (EGifPutLine(gif_file, addr, frame_w) == GIF_ERROR)
             throw Exception("Error writing GIF image scanlines for frame %d.\n", (int)frame_num);
         }
+      }
+
+      copy_image(previous_image, current_image);
+
+      // Release the frame memory as soon as possible
+      frame.image.reset();
+      frame.palette.reset();
+    };
+
+  // Two windows of frames: one is written while the other is prepared.
+  std::vector<GifRenderedFrame> writing(window_size);
+  std::vector<GifRenderedFrame> preparing(window_size);
+
+  for (frame_t first(0); first<total_frames; first+=window_size) {
+    // Prepare the first window
+    int n = std::min<int>(window_size, total_frames-first);
+    if (first == 0) {
+      base::parallel_for(0, n,
+        [&](int i) {
+          prepare_frame(first+i, writing[i]);
+        }, window_size);
     }
-    else {
-      // Write all image scanlines (not interlaced in this case).
-      for (int y=0; y<frame_h; ++y) {
-        IndexedTraits::address_t addr =
-          (IndexedTraits::address_t)current_image->getPixelAddress(frame_x, frame_y + y);
 
-        if (EGifPutLine(gif_file, addr, frame_w) == GIF_ERROR)
-          throw Exception("Error writing GIF image scanlines for frame %d.\n", (int)frame_num);
-      }
+    frame_t next = first+window_size;
+    int next_n = std::max<int>(0, std::min<int>(window_size, total_frames-next));
+    std::exception_ptr write_error;
+    {
+      base::thread writer(
+        [&]{
+          try {
+            for (int i=0; i<n; ++i)
+              write_frame(first+i, writing[i]);
+          }
+          catch (...) {
+            write_error = std::current_exception();
+          }
+        });
+      base::thread_guard guard(writer);
+
+      // Meanwhile, the next window is rendered with all the remaining
+      // CPU cores.
+      base::parallel_for(0, next_n,
+        [&](int i) {
+          prepare_frame(next+i, preparing[i]);
+        }, std::max(1, window_size-1));
     }
 
-    copy_image(previous_image, current_image);
+    if (write_error)
+      std::rethrow_exception(write_error);
+
+    std::swap(writing, preparing);
   }
 
   return true;
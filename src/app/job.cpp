@@ -14,12 +14,15 @@
 #include "app/app.h"
 #include "app/ui/status_bar.h"
 #include "base/mutex.h"
+#include "base/parallel_for.h"
 #include "base/scoped_lock.h"
 #include "base/thread.h"
 #include "ui/alert.h"
 #include "ui/widget.h"
 #include "ui/window.h"
 
+#include <atomic>
+
 static const int kMonitoringPeriod = 100;
 
 namespace app {
@@ -102,6 +105,23 @@ bool Job::isCanceled()
   return m_canceled_flag;
 }
 
+bool Job::parallelFor(int n, const std::function<void(int i)>& func)
+{
+  std::atomic<int> done(0);
+
+  base::parallel_for(
+    0, n,
+    [&](int i) {
+      if (isCanceled())
+        return;
+
+      func(i);
+      jobProgress(double(++done) / n);
+    });
+
+  return !isCanceled();
+}
+
 void Job::onMonitoringTick()
 {
   base::scoped_lock hold(*m_mutex);
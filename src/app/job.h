@@ -13,6 +13,8 @@
 #include "ui/alert.h"
 #include "ui/timer.h"
 
+#include <functional>
+
 namespace base {
   class thread;
   class mutex;
@@ -41,6 +43,14 @@ namespace app {
     // check this variable periodically to stop working.
     bool isCanceled();
 
+    // The onJob() can use this function to call func(i) for each i in
+    // [0, n) from several worker threads (so "func" must be safe to be
+    // called concurrently for different items). The progress of the
+    // whole loop is reported with jobProgress(), and the remaining
+    // items are skipped if the job is canceled. Returns false if the
+    // job was canceled.
+    bool parallelFor(int n, const std::function<void(int i)>& func);
+
   protected:
 
     // This member function is called from another dedicated thread
@@ -45,7 +45,7 @@ public:
       if (x2 > maskOrigin.x+maskBounds.w-1)
         x2 = maskOrigin.x+maskBounds.w-1;
 
-      if (Image* bitmap = loop->getMask()->bitmap()) {
+      if (const Image* bitmap = loop->getMask()->bitmap()) {
         static_cast<Derived*>(this)->initIterators(loop, x1, y);
 
         for (x=x1; x<=x2; ++x) {
@@ -263,6 +263,7 @@ public:
 class SelectionInk : public Ink {
   bool m_modify_selection;
   Mask m_mask;
+  gfx::Rect m_modifiedArea;
 
 public:
   SelectionInk() { m_modify_selection = false; }
@@ -273,16 +274,19 @@ public:
   {
     if (m_modify_selection) {
       Point offset = loop->getOffset();
+      gfx::Rect rc(x1-offset.x, y-offset.y, x2-x1+1, 1);
 
       switch (loop->getSelectionMode()) {
         case kDefaultSelectionMode:
         case kAddSelectionMode:
-          m_mask.add(gfx::Rect(x1-offset.x, y-offset.y, x2-x1+1, 1));
+          m_mask.add(rc);
           break;
         case kSubtractSelectionMode:
-          m_mask.subtract(gfx::Rect(x1-offset.x, y-offset.y, x2-x1+1, 1));
+          m_mask.subtract(rc);
           break;
       }
+
+      m_modifiedArea = m_modifiedArea.createUnion(rc);
     }
     // TODO show the selection-preview with a XOR color or something like that
     else {
@@ -299,11 +303,13 @@ public:
       m_mask.copyFrom(loop->getMask());
       m_mask.freeze();
       m_mask.reserve(loop->sprite()->bounds());
+      m_modifiedArea = gfx::Rect();
     }
     else {
       m_mask.unfreeze();
 
       loop->setMask(&m_mask);
+      loop->addModifiedMaskArea(m_modifiedArea);
       loop->getDocument()->setTransformation(Transformation(m_mask.bounds()));
 
       m_mask.clear();
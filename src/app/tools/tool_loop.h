@@ -117,6 +117,11 @@ namespace app {
       virtual Mask* getMask() = 0;
       virtual void setMask(Mask* newMask) = 0;
 
+      // Adds an area (in sprite coordinates) where the mask was
+      // modified by the selection ink (only the boundaries of this
+      // area are regenerated at the end of the loop).
+      virtual void addModifiedMaskArea(const gfx::Rect& area) = 0;
+
       // Gets mask X,Y origin coordinates
       virtual gfx::Point getMaskOrigin() = 0;
 
@@ -48,9 +48,8 @@ static struct {
   int brush_type;
   int brush_size;
   int brush_angle;
-  int nseg;
-  BoundSeg* seg;
-} cursor_bound = { 0, 0, 0, 0, NULL };
+  BoundSegs segs;
+} cursor_bound;
 
 enum {
   CURSOR_THINCROSS   = 1,
@@ -181,9 +180,6 @@ void Editor::editor_cursor_exit()
 {
   set_config_color("Tools", "CursorColor", cursor_color);
 
-  if (cursor_bound.seg != NULL)
-    base_free(cursor_bound.seg);
-
   delete current_brush;
   current_brush = NULL;
 }
@@ -404,7 +400,7 @@ static void generate_cursor_boundaries(Editor* editor)
       ->getToolSettings(tool)
       ->getBrush();
 
-  if (cursor_bound.seg == NULL ||
+  if (cursor_bound.segs.empty() ||
       cursor_bound.brush_type != brush_settings->getType() ||
       cursor_bound.brush_size != brush_settings->getSize() ||
       cursor_bound.brush_angle != brush_settings->getAngle()) {
@@ -412,9 +408,6 @@ static void generate_cursor_boundaries(Editor* editor)
     cursor_bound.brush_size = brush_settings->getSize();
     cursor_bound.brush_angle = brush_settings->getAngle();
 
-    if (cursor_bound.seg != NULL)
-      base_free(cursor_bound.seg);
-
     Brush* brush;
 
     if (brush_settings) {
@@ -425,9 +418,7 @@ static void generate_cursor_boundaries(Editor* editor)
     else
       brush = new Brush();
 
-    cursor_bound.seg = find_mask_boundary(brush->image(),
-                                          &cursor_bound.nseg,
-                                          IgnoreBounds, 0, 0, 0, 0);
+    find_mask_boundary(brush->image(), cursor_bound.segs);
     delete brush;
   }
 }
@@ -538,21 +529,17 @@ static void trace_brush_bounds(ui::Graphics* g, Editor* editor,
 {
   Data data = { g, color, pixelDelegate };
   gfx::Point pt1, pt2;
-  BoundSeg* seg;
-  int c;
-
-  for (c=0; c<cursor_bound.nseg; c++) {
-    seg = cursor_bound.seg+c;
 
-    pt1.x = pos.x + seg->x1 - cursor_bound.brush_size/2;
-    pt1.y = pos.y + seg->y1 - cursor_bound.brush_size/2;
-    pt2.x = pos.x + seg->x2 - cursor_bound.brush_size/2;
-    pt2.y = pos.y + seg->y2 - cursor_bound.brush_size/2;
+  for (const BoundSeg& seg : cursor_bound.segs) {
+    pt1.x = pos.x + seg.x1 - cursor_bound.brush_size/2;
+    pt1.y = pos.y + seg.y1 - cursor_bound.brush_size/2;
+    pt2.x = pos.x + seg.x2 - cursor_bound.brush_size/2;
+    pt2.y = pos.y + seg.y2 - cursor_bound.brush_size/2;
 
     pt1 = editor->editorToScreen(pt1);
     pt2 = editor->editorToScreen(pt2);
 
-    if (seg->open) {            // Outside
+    if (seg.open) {            // Outside
       if (pt1.x == pt2.x) {
         pt1.x--;
         pt2.x--;
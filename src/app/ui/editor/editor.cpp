@@ -51,6 +51,7 @@
 #include "she/system.h"
 #include "ui/ui.h"
 
+#include <algorithm>
 #include <cstdio>
 
 namespace app {
@@ -152,6 +153,8 @@ Editor::Editor(Document* document, EditorFlags flags)
   , m_offset_y(0)
   , m_mask_timer(100, this)
   , m_offset_count(0)
+  , m_maskLinesZoom(1, 1)
+  , m_maskLinesVersion(-1)
   , m_customizationDelegate(NULL)
   , m_docView(NULL)
   , m_flags(flags)
@@ -177,12 +180,14 @@ Editor::Editor(Document* document, EditorFlags flags)
   m_onionskinConn = docPref.onionskin.AfterChange.connect(Bind<void>(&Editor::invalidate, this));
 
   m_document->addObserver(this);
+  m_document->addObserver(&m_renderCache);
 
   m_state->onAfterChangeState(this);
 }
 
 Editor::~Editor()
 {
+  m_document->removeObserver(&m_renderCache);
   m_document->removeObserver(this);
 
   setCustomizationDelegate(NULL);
@@ -421,9 +426,11 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
       m_document->getExtraCelBlendMode(),
       m_layer, m_frame);
 
+    m_renderEngine.setCache(&m_renderCache);
     m_renderEngine.renderSprite(rendered, m_sprite, m_frame,
       gfx::Clip(0, 0, rc), m_zoom);
 
+    m_renderEngine.removeCache();
     m_renderEngine.removeExtraImage();
   }
   catch (const std::exception& e) {
@@ -601,16 +608,45 @@ void Editor::drawMask(Graphics* g)
   if ((m_flags & kShowMask) == 0)
     return;
 
-  int x1, y1, x2, y2;
+  updateMaskLines();
+
   int x = m_offset_x;
   int y = m_offset_y;
 
+  // Only the lines inside the clipping area are drawn
+  gfx::Rect clip = g->getClipBounds();
+  clip.offset(-x, -y);
+
+  CheckedDrawMode checked(g, m_offset_count);
+
+  for (const gfx::Rect& line : m_maskLines) {
+    if (!clip.intersects(line))
+      continue;
+
+    // The color doesn't matter, we are using CheckedDrawMode
+    g->drawLine(gfx::rgba(0, 0, 0),
+      gfx::Point(x+line.x, y+line.y),
+      gfx::Point(x+line.x2()-1, y+line.y2()-1));
+  }
+}
+
+void Editor::updateMaskLines()
+{
+  if (m_maskLinesVersion == m_document->getBoundariesVersion() &&
+      m_maskLinesZoom == m_zoom)
+    return;
+
+  m_maskLinesVersion = m_document->getBoundariesVersion();
+  m_maskLinesZoom = m_zoom;
+  m_maskLines.clear();
+
+  int x1, y1, x2, y2;
   int nseg = m_document->getBoundariesSegmentsCount();
   const BoundSeg* seg = m_document->getBoundariesSegments();
 
-  for (int c=0; c<nseg; ++c, ++seg) {
-    CheckedDrawMode checked(g, m_offset_count);
+  m_maskLines.reserve(nseg);
 
+  for (int c=0; c<nseg; ++c, ++seg) {
     x1 = m_zoom.apply(seg->x1);
     y1 = m_zoom.apply(seg->y1);
     x2 = m_zoom.apply(seg->x2);
@@ -642,9 +678,10 @@ void Editor::drawMask(Graphics* g)
       }
     }
 
-    // The color doesn't matter, we are using CheckedDrawMode
-    g->drawLine(gfx::rgba(0, 0, 0),
-      gfx::Point(x+x1, y+y1), gfx::Point(x+x2, y+y2));
+    // Each line is stored as the rectangle of pixels it covers
+    m_maskLines.push_back(
+      gfx::Rect(gfx::Point(std::min(x1, x2), std::min(y1, y2)),
+                gfx::Point(std::max(x1, x2)+1, std::max(y1, y2)+1)));
   }
 }
 
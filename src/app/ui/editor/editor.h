@@ -22,11 +22,14 @@
 #include "doc/image_buffer.h"
 #include "filters/tiled_mode.h"
 #include "gfx/fwd.h"
+#include "render/render_cache.h"
 #include "render/zoom.h"
 #include "ui/base.h"
 #include "ui/timer.h"
 #include "ui/widget.h"
 
+#include <vector>
+
 namespace doc {
   class Sprite;
   class Layer;
@@ -223,6 +226,7 @@ namespace app {
 
     void drawMaskSafe();
     void drawMask(ui::Graphics* g);
+    void updateMaskLines();
     void drawGrid(ui::Graphics* g, const gfx::Rect& spriteBounds, const gfx::Rect& gridBounds,
       const app::Color& color, int alpha);
 
@@ -276,6 +280,13 @@ namespace app {
     ui::Timer m_mask_timer;
     int m_offset_count;
 
+    // Lines of the mask boundaries to draw the marching ants (in sprite
+    // coordinates scaled with m_maskLinesZoom). They are regenerated
+    // when the zoom or the boundaries of the document change.
+    std::vector<gfx::Rect> m_maskLines;
+    render::Zoom m_maskLinesZoom;
+    int m_maskLinesVersion;
+
     // This slot is used to disconnect the Editor from CurrentToolChange
     // signal (because the editor can be destroyed and the application
     // still continue running and generating CurrentToolChange
@@ -304,6 +315,10 @@ namespace app {
 
     bool m_secondaryButton;
 
+    // Already rendered tiles of this editor's sprite (it's
+    // invalidated observing m_document).
+    render::RenderCache m_renderCache;
+
     static doc::ImageBufferPtr m_renderBuffer;
     static AppRender m_renderEngine;
   };
@@ -23,19 +23,66 @@
 #include "app/snap_to_grid.h"
 #include "app/ui_context.h"
 #include "app/util/expand_cel_canvas.h"
+#include "base/thread.h"
 #include "base/vector2d.h"
 #include "doc/algorithm/flip_image.h"
 #include "doc/algorithm/rotate.h"
 #include "doc/algorithm/rotsprite.h"
 #include "doc/cel.h"
 #include "doc/image.h"
+#include "doc/image_ref.h"
 #include "doc/mask.h"
+#include "doc/primitives.h"
 #include "doc/sprite.h"
 #include "gfx/region.h"
 #include "render/render.h"
 
+#include <atomic>
+
 namespace app {
 
+// Milliseconds that the mouse must be stopped to start the
+// calculation of the RotSprite version of the image (the same timer
+// is used to check if the calculation has finished).
+static const int kRotSpriteDelay = 100;
+
+// RotSprite transformation of a copy of the original image calculated
+// in a background thread.
+struct PixelsMovement::RotSpriteTask {
+  ImageRef src;
+  ImageRef dst;
+  gfx::Transformation::Corners corners;
+  std::atomic<bool> canceled;
+  std::atomic<bool> done;
+  base::UniquePtr<base::thread> thread;
+
+  RotSpriteTask() : canceled(false), done(false) { }
+
+  void start() {
+    thread.reset(new base::thread([this]{ run(); }));
+  }
+
+  void join() {
+    thread->join();
+  }
+
+private:
+  // [background thread]
+  void run() {
+    doc::algorithm::rotsprite_image(dst.get(), src.get(),
+      int(corners.leftTop().x),
+      int(corners.leftTop().y),
+      int(corners.rightTop().x),
+      int(corners.rightTop().y),
+      int(corners.rightBottom().x),
+      int(corners.rightBottom().y),
+      int(corners.leftBottom().x),
+      int(corners.leftBottom().y),
+      &canceled);
+    done = true;
+  }
+};
+
 template<typename T>
 static inline const base::Vector2d<double> point2Vector(const gfx::PointT<T>& pt) {
   return base::Vector2d<double>(pt.x, pt.y);
@@ -57,10 +104,14 @@ PixelsMovement::PixelsMovement(Context* context,
   , m_handle(NoHandle)
   , m_originalImage(Image::createCopy(moveThis))
   , m_maskColor(m_sprite->transparentColor())
+  , m_fastPreview(false)
+  , m_rotSpriteTimer(kRotSpriteDelay)
 {
   m_initialData = gfx::Transformation(gfx::Rect(initialPos, gfx::Size(moveThis->width(), moveThis->height())));
   m_currentData = m_initialData;
 
+  m_rotSpriteTimer.Tick.connect(&PixelsMovement::onRotSpriteTick, this);
+
   ContextWriter writer(m_reader);
   m_document->prepareExtraCel(m_sprite->bounds(), opacity);
 
@@ -76,6 +127,13 @@ PixelsMovement::~PixelsMovement()
 {
   UIContext::instance()->settings()->selection()->removeObserver(this);
 
+  m_rotSpriteTimer.stop();
+  if (m_rotSpriteTask) {
+    // The task stops after the tiles that are being drawn
+    m_rotSpriteTask->canceled = true;
+    m_rotSpriteTask->join();
+  }
+
   delete m_originalImage;
   delete m_initialMask;
   delete m_currentMask;
@@ -91,7 +149,7 @@ void PixelsMovement::flipImage(doc::algorithm::FlipType flipType)
                                 flipType);
 
   // Flip the mask.
-  doc::algorithm::flip_image(m_initialMask->bitmap(),
+  doc::algorithm::flip_image(m_initialMask->editableBitmap(),
     gfx::Rect(gfx::Point(0, 0), m_initialMask->bounds().getSize()),
     flipType);
 
@@ -422,7 +480,7 @@ Image* PixelsMovement::getDraggedImageCopy(gfx::Point& origin)
   int height = rightBottom.y - leftTop.y;
   base::UniquePtr<Image> image(Image::create(m_sprite->pixelFormat(), width, height));
 
-  drawImage(image, leftTop);
+  drawImage(image, leftTop, rotationAlgorithm(m_originalImage));
 
   origin = leftTop;
 
@@ -438,6 +496,15 @@ void PixelsMovement::stampImage()
 
   {
     ContextWriter writer(m_reader);
+
+    // Replace the fast preview with the final image.
+    if (m_fastPreview) {
+      cancelRotSpriteTask();
+      m_fastPreview = false;
+      drawImage(m_document->getExtraCelImage(), gfx::Point(0, 0),
+                rotationAlgorithm(m_originalImage));
+    }
+
     {
       // Expand the canvas to paste the image in the fully visible
       // portion of sprite.
@@ -456,6 +523,13 @@ void PixelsMovement::stampImage()
         cel->opacity(), BLEND_MODE_NORMAL);
 
       expand.commit();
+
+      // The extra cel hides the stamped pixels now, but they must be
+      // rendered again when the extra cel is moved.
+      const Cel* stampedCel = expand.getCel();
+      m_document->notifyImagePixelsModified(
+        m_sprite, stampedCel->image(),
+        gfx::Region(stampedCel->bounds()));
     }
     // TODO
     // m_transaction.commit();
@@ -523,6 +597,8 @@ void PixelsMovement::dropImage()
 void PixelsMovement::discardImage(bool commit)
 {
   m_isDragging = false;
+  m_fastPreview = false;
+  cancelRotSpriteTask();
 
   // Deselect the mask (here we don't stamp the image)
   m_transaction.execute(new cmd::DeselectMask(m_document));
@@ -570,9 +646,22 @@ void PixelsMovement::setMaskColor(color_t mask_color)
 
 void PixelsMovement::redrawExtraImage()
 {
+  RotationAlgorithm rotAlgo = rotationAlgorithm(m_originalImage);
+
+  // The previous RotSprite calculation is for an old transformation.
+  cancelRotSpriteTask();
+
+  // RotSprite is too slow to be used in each mouse movement, so while
+  // the image is being dragged we show a fast preview.
+  m_fastPreview = (m_isDragging && rotAlgo == kRotSpriteRotationAlgorithm);
+  if (m_fastPreview) {
+    rotAlgo = kFastRotationAlgorithm;
+    startRotSpriteTimer();
+  }
+
   // Draw the transformed pixels in the extra-cel which is the chunk
   // of pixels that the user is moving.
-  drawImage(m_document->getExtraCelImage(), gfx::Point(0, 0));
+  drawImage(m_document->getExtraCelImage(), gfx::Point(0, 0), rotAlgo);
 }
 
 void PixelsMovement::redrawCurrentMask()
@@ -584,14 +673,15 @@ void PixelsMovement::redrawCurrentMask()
 
   m_currentMask->replace(m_sprite->bounds());
   m_currentMask->freeze();
-  clear_image(m_currentMask->bitmap(), 0);
-  drawParallelogram(m_currentMask->bitmap(), m_initialMask->bitmap(),
-    corners, gfx::Point(0, 0));
+  clear_image(m_currentMask->editableBitmap(), 0);
+  drawParallelogram(m_currentMask->editableBitmap(), m_initialMask->bitmap(),
+    corners, gfx::Point(0, 0), rotationAlgorithm(m_initialMask->bitmap()));
 
   m_currentMask->unfreeze();
 }
 
-void PixelsMovement::drawImage(doc::Image* dst, const gfx::Point& pt)
+void PixelsMovement::drawImage(doc::Image* dst, const gfx::Point& pt,
+  RotationAlgorithm rotAlgo)
 {
   gfx::Transformation::Corners corners;
   m_currentData.transformBox(corners);
@@ -600,23 +690,14 @@ void PixelsMovement::drawImage(doc::Image* dst, const gfx::Point& pt)
   clear_image(dst, dst->maskColor());
 
   m_originalImage->setMaskColor(m_maskColor);
-  drawParallelogram(dst, m_originalImage, corners, pt);
+  drawParallelogram(dst, m_originalImage, corners, pt, rotAlgo);
 }
 
-void PixelsMovement::drawParallelogram(doc::Image* dst, doc::Image* src,
+void PixelsMovement::drawParallelogram(doc::Image* dst, const doc::Image* src,
   const gfx::Transformation::Corners& corners,
-  const gfx::Point& leftTop)
+  const gfx::Point& leftTop,
+  RotationAlgorithm rotAlgo)
 {
-  RotationAlgorithm rotAlgo = UIContext::instance()->settings()->selection()->getRotationAlgorithm();
-
-  // If the angle and the scale weren't modified, we should use the
-  // fast rotation algorithm, as it's pixel-perfect match with the
-  // original selection when just a translation is applied.
-  if (m_currentData.angle() == 0.0 &&
-      m_currentData.bounds().getSize() == src->size()) {
-    rotAlgo = kFastRotationAlgorithm;
-  }
-
   switch (rotAlgo) {
 
     case kFastRotationAlgorithm:
@@ -632,6 +713,10 @@ void PixelsMovement::drawParallelogram(doc::Image* dst, doc::Image* src,
       break;
 
     case kRotSpriteRotationAlgorithm:
+      // Don't run this RotSprite calculation at the same time as the
+      // one in the background thread.
+      cancelRotSpriteTask();
+
       doc::algorithm::rotsprite_image(dst, src,
         int(corners.leftTop().x-leftTop.x),
         int(corners.leftTop().y-leftTop.y),
@@ -646,6 +731,84 @@ void PixelsMovement::drawParallelogram(doc::Image* dst, doc::Image* src,
   }
 }
 
+RotationAlgorithm PixelsMovement::rotationAlgorithm(const doc::Image* src) const
+{
+  // If the angle and the scale weren't modified, we should use the
+  // fast rotation algorithm, as it's pixel-perfect match with the
+  // original selection when just a translation is applied.
+  if (m_currentData.angle() == 0.0 &&
+      m_currentData.bounds().getSize() == src->size()) {
+    return kFastRotationAlgorithm;
+  }
+
+  return UIContext::instance()->settings()->selection()->getRotationAlgorithm();
+}
+
+void PixelsMovement::startRotSpriteTimer()
+{
+  // Each mouse movement restarts the delay.
+  m_rotSpriteTimer.start();
+}
+
+void PixelsMovement::cancelRotSpriteTask()
+{
+  if (!m_rotSpriteTask)
+    return;
+
+  // The task stops after the tiles that are being drawn, so we can
+  // wait it here (its result is discarded).
+  m_rotSpriteTask->canceled = true;
+  m_rotSpriteTask->join();
+  m_rotSpriteTask.reset(nullptr);
+
+  // The fast preview is still in the extra cel, so the RotSprite
+  // version must be calculated again.
+  if (m_fastPreview)
+    startRotSpriteTimer();
+}
+
+void PixelsMovement::onRotSpriteTick()
+{
+  if (m_rotSpriteTask) {
+    if (!m_rotSpriteTask->done)
+      return;                   // Check again in the next tick
+
+    m_rotSpriteTask->join();
+    base::UniquePtr<RotSpriteTask> task(m_rotSpriteTask.release());
+
+    if (m_fastPreview) {
+      Image* extraImage = m_document->getExtraCelImage();
+      if (extraImage->size() == task->dst->size()) {
+        copy_image(extraImage, task->dst.get());
+        m_fastPreview = false;
+        update_screen_for_document(m_document);
+      }
+    }
+  }
+
+  // The mouse has been stopped (or the image dropped) and the extra
+  // cel still contains the fast preview, so we start the calculation
+  // of the RotSprite version.
+  if (m_fastPreview) {
+    gfx::Transformation::Corners corners;
+    m_currentData.transformBox(corners);
+
+    Image* extraImage = m_document->getExtraCelImage();
+    m_rotSpriteTask.reset(new RotSpriteTask);
+    m_rotSpriteTask->src.reset(Image::createCopy(m_originalImage));
+    m_rotSpriteTask->src->setMaskColor(m_maskColor);
+    m_rotSpriteTask->dst.reset(Image::create(extraImage->pixelFormat(),
+                                             extraImage->width(),
+                                             extraImage->height()));
+    m_rotSpriteTask->dst->setMaskColor(m_sprite->transparentColor());
+    clear_image(m_rotSpriteTask->dst.get(), m_rotSpriteTask->dst->maskColor());
+    m_rotSpriteTask->corners = corners;
+    m_rotSpriteTask->start();
+  }
+  else
+    m_rotSpriteTimer.stop();
+}
+
 void PixelsMovement::onSetRotationAlgorithm(RotationAlgorithm algorithm)
 {
   redrawExtraImage();
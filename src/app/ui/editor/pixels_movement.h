@@ -14,8 +14,10 @@
 #include "app/ui/editor/handle_type.h"
 #include "app/transaction.h"
 #include "base/shared_ptr.h"
+#include "base/unique_ptr.h"
 #include "gfx/size.h"
 #include "doc/algorithm/flip_type.h"
+#include "ui/timer.h"
 
 namespace doc {
   class Image;
@@ -34,6 +36,11 @@ namespace app {
   // feedback, drag, and drop the specified image in the constructor
   // (which generally would be the selected region or the clipboard
   // content).
+  //
+  // When the RotSprite algorithm is selected, the extra cel shows a
+  // fast preview (nearest neighbor) while the user drags the image,
+  // and the RotSprite version is calculated in a background thread
+  // when the mouse stops.
   class PixelsMovement : public SelectionSettingsObserver {
   public:
     enum MoveModifier {
@@ -95,13 +102,23 @@ namespace app {
     void onSetRotationAlgorithm(RotationAlgorithm algorithm) override;
 
   private:
+    struct RotSpriteTask;
+
     void redrawExtraImage();
     void redrawCurrentMask();
-    void drawImage(doc::Image* dst, const gfx::Point& pos);
-    void drawParallelogram(doc::Image* dst, doc::Image* src,
+    void drawImage(doc::Image* dst, const gfx::Point& pos,
+      RotationAlgorithm rotAlgo);
+    void drawParallelogram(doc::Image* dst, const doc::Image* src,
       const gfx::Transformation::Corners& corners,
-      const gfx::Point& leftTop);
+      const gfx::Point& leftTop,
+      RotationAlgorithm rotAlgo);
     void updateDocumentMask();
+    RotationAlgorithm rotationAlgorithm(const doc::Image* src) const;
+
+    // Fast preview/RotSprite in background
+    void startRotSpriteTimer();
+    void cancelRotSpriteTask();
+    void onRotSpriteTick();
 
     const ContextReader m_reader;
     DocumentLocation m_location;
@@ -120,6 +137,12 @@ namespace app {
     Mask* m_initialMask;
     Mask* m_currentMask;
     color_t m_maskColor;
+
+    // True if the extra cel contains the fast preview of a RotSprite
+    // transformation.
+    bool m_fastPreview;
+    ui::Timer m_rotSpriteTimer;
+    base::UniquePtr<RotSpriteTask> m_rotSpriteTask;
   };
 
   inline PixelsMovement::MoveModifier& operator|=(PixelsMovement::MoveModifier& a,
@@ -64,6 +64,7 @@ class ToolLoopImpl : public tools::ToolLoop,
   bool m_useMask;
   Mask* m_mask;
   gfx::Point m_maskOrigin;
+  gfx::Rect m_modifiedMaskArea;
   int m_opacity;
   int m_tolerance;
   bool m_contiguous;
@@ -161,6 +162,11 @@ public:
     if (getInk()->isSelection() &&
         (!m_document->isMaskVisible() ||
           getSelectionMode() == kDefaultSelectionMode)) {
+      // The previous mask is removed (so its boundaries must be
+      // regenerated too)
+      if (m_document->isMaskVisible())
+        addModifiedMaskArea(m_document->mask()->bounds());
+
       Mask emptyMask;
       m_transaction.execute(new cmd::SetMask(m_document, &emptyMask));
     }
@@ -194,7 +200,7 @@ public:
       }
       // Selection ink
       else if (getInk()->isSelection()) {
-        m_document->generateMaskBoundaries();
+        m_document->updateMaskBoundaries(m_modifiedMaskArea);
         redraw = true;
       }
 
@@ -247,6 +253,9 @@ public:
   void setMask(Mask* newMask) override {
     m_transaction.execute(new cmd::SetMask(m_document, newMask));
   }
+  void addModifiedMaskArea(const gfx::Rect& area) override {
+    m_modifiedMaskArea = m_modifiedMaskArea.createUnion(area);
+  }
   gfx::Point getMaskOrigin() override { return m_maskOrigin; }
   const render::Zoom& zoom() override { return m_editor->zoom(); }
   ToolLoop::Button getMouseButton() override { return m_button; }
@@ -293,6 +302,7 @@ public:
   void updateDirtyArea() override
   {
     m_editor->hideDrawingCursor();
+    m_document->notifyImagePixelsModified(m_sprite, getDstImage(), m_dirtyArea);
     m_document->notifySpritePixelsModified(m_sprite, m_dirtyArea);
     m_editor->showDrawingCursor();
   }
@@ -0,0 +1,162 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/undo_payload.h"
+
+#include "base/convert_to.h"
+#include "base/exception.h"
+#include "base/file_handle.h"
+#include "base/fs.h"
+#include "base/path.h"
+#include "base/temp_dir.h"
+#include "base/unique_ptr.h"
+
+#include <cstdio>
+
+namespace app {
+
+namespace {
+
+std::string spill_dir;
+base::UniquePtr<base::TempDir> default_spill_dir;
+int spill_files = 0;
+
+std::string new_spill_filename()
+{
+  std::string dir = spill_dir;
+  if (dir.empty()) {
+    if (!default_spill_dir)
+      default_spill_dir.reset(new base::TempDir(PACKAGE));
+    dir = default_spill_dir->path();
+  }
+  return base::join_path(
+    dir, "undo" + base::convert_to<std::string>(++spill_files) + ".tmp");
+}
+
+} // anonymous namespace
+
+// static
+void UndoPayload::setSpillDirectory(const std::string& path)
+{
+  spill_dir = path;
+}
+
+UndoPayload::UndoPayload()
+  : m_fileSize(0)
+{
+}
+
+UndoPayload::~UndoPayload()
+{
+  deleteFile();
+}
+
+std::stringstream& UndoPayload::stream()
+{
+  load();
+  return m_stream;
+}
+
+void UndoPayload::reset()
+{
+  deleteFile();
+  m_stream.str(std::string());
+  m_stream.clear();
+}
+
+void UndoPayload::rewind()
+{
+  if (isSpilled())
+    m_readPos = 0;
+  else {
+    m_stream.clear();
+    m_stream.seekg(0);
+  }
+}
+
+std::size_t UndoPayload::memSize() const
+{
+  return (std::size_t)const_cast<std::stringstream*>(&m_stream)->tellp();
+}
+
+void UndoPayload::spill()
+{
+  if (isSpilled() || !m_stream)
+    return;
+
+  std::string data = m_stream.str();
+  if (data.size() < kMinSpillSize)
+    return;
+
+  std::string filename = new_spill_filename();
+  try {
+    base::FileHandle handle(base::open_file_with_exception(filename, "wb"));
+    if (std::fwrite(data.data(), 1, data.size(), handle.get()) != data.size())
+      throw base::Exception("Error writing undo data in %s", filename.c_str());
+  }
+  catch (const std::exception&) {
+    // Keep the data in memory (e.g. the disk is full)
+    if (base::is_file(filename))
+      base::delete_file(filename);
+    return;
+  }
+
+  m_filename = filename;
+  m_fileSize = data.size();
+  m_readPos = m_stream.tellg();
+  m_writePos = m_stream.tellp();
+  m_stream.str(std::string());
+  m_stream.clear();
+}
+
+bool UndoPayload::load()
+{
+  if (!isSpilled())
+    return true;
+
+  std::string data;
+  try {
+    if (base::file_size(m_filename) != m_fileSize)
+      return false;
+
+    data.resize(m_fileSize);
+    base::FileHandle handle(base::open_file_with_exception(m_filename, "rb"));
+    if (!data.empty() &&
+        std::fread(&data[0], 1, data.size(), handle.get()) != data.size())
+      return false;
+  }
+  catch (const std::exception&) {
+    return false;
+  }
+  deleteFile();
+
+  m_stream.str(data);
+  m_stream.clear();
+  m_stream.seekg(m_readPos);
+  m_stream.seekp(m_writePos);
+  return true;
+}
+
+void UndoPayload::deleteFile()
+{
+  if (m_filename.empty())
+    return;
+
+  try {
+    base::delete_file(m_filename);
+  }
+  catch (const std::exception&) {
+    // Ignore errors, it's a temporary file anyway
+  }
+  m_filename.clear();
+}
+
+} // namespace app
@@ -0,0 +1,78 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifndef APP_UNDO_PAYLOAD_H_INCLUDED
+#define APP_UNDO_PAYLOAD_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+
+#include <sstream>
+#include <string>
+
+namespace app {
+
+  // Serialized data of an undo command (e.g. pixels of a replaced
+  // image). It's used as a std::stringstream, but the data can be
+  // moved to a temporary file with spill() when the command is far
+  // from the current undo state (see DocumentUndo). The data is
+  // loaded again from the file when the stream is used.
+  class UndoPayload {
+  public:
+    // Smaller payloads are not worth a file
+    static const std::size_t kMinSpillSize = 64*1024;
+
+    UndoPayload();
+    ~UndoPayload();
+
+    // Returns the stream to read/write the data (it is loaded from
+    // disk if it was spilled). If the data cannot be loaded, the
+    // stream is empty, so load() should be called before (e.g. to
+    // check that a command can be undone).
+    std::stringstream& stream();
+
+    // Discards all the data.
+    void reset();
+
+    // Moves the read position to the beginning of the data (e.g. to
+    // read the same data in each undo/redo).
+    void rewind();
+
+    // Memory used by the payload (zero if it's on disk).
+    std::size_t memSize() const;
+
+    bool isSpilled() const { return !m_filename.empty(); }
+    bool isEmpty() const { return !isSpilled() && memSize() == 0; }
+
+    // Moves the data to a temporary file. If the data is small or
+    // cannot be saved, it's kept in memory.
+    void spill();
+
+    // Loads the data from disk if it was spilled. Returns false if
+    // the file cannot be read (e.g. it was deleted), the data is
+    // kept on disk in that case.
+    bool load();
+
+    // Directory where payloads are spilled (e.g. the DataRecovery
+    // directory). If it's empty, a new temporary directory is used.
+    static void setSpillDirectory(const std::string& path);
+
+  private:
+    void deleteFile();
+
+    std::stringstream m_stream;
+    std::string m_filename;
+    std::size_t m_fileSize;
+    std::streampos m_readPos;
+    std::streampos m_writePos;
+
+    DISABLE_COPYING(UndoPayload);
+  };
+
+} // namespace app
+
+#endif
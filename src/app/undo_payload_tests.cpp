@@ -0,0 +1,62 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#include "tests/test.h"
+
+#include "app/undo_payload.h"
+#include "base/temp_dir.h"
+
+#include <string>
+
+using namespace app;
+
+TEST(UndoPayload, SmallDataIsNotSpilled)
+{
+  UndoPayload payload;
+  payload.stream() << "abc";
+  payload.spill();
+  EXPECT_FALSE(payload.isSpilled());
+  EXPECT_EQ(3u, payload.memSize());
+}
+
+TEST(UndoPayload, SpillAndLoad)
+{
+  base::TempDir dir("undo_payload_tests");
+  UndoPayload::setSpillDirectory(dir.path());
+
+  std::string data(UndoPayload::kMinSpillSize*2, 0);
+  for (std::size_t i=0; i<data.size(); ++i)
+    data[i] = char(i*7);
+
+  {
+    UndoPayload payload;
+    EXPECT_TRUE(payload.isEmpty());
+
+    payload.stream().write(data.data(), data.size());
+    char half[16];
+    payload.stream().read(half, sizeof(half));
+
+    payload.spill();
+    EXPECT_TRUE(payload.isSpilled());
+    EXPECT_FALSE(payload.isEmpty());
+    EXPECT_EQ(0u, payload.memSize());
+
+    // Keeps reading from the same position
+    std::string rest(data.size()-sizeof(half), 0);
+    payload.stream().read(&rest[0], rest.size());
+    EXPECT_FALSE(payload.isSpilled());
+    EXPECT_EQ(data.substr(sizeof(half)), rest);
+    EXPECT_EQ(data.size(), payload.memSize());
+
+    payload.spill();
+    EXPECT_TRUE(payload.isSpilled());
+    payload.reset();
+    EXPECT_TRUE(payload.isEmpty());
+  }
+
+  UndoPayload::setSpillDirectory("");
+}
@@ -1,44 +1,90 @@
-// The GIMP -- an image manipulation program
-// Copyright (C) 1995 Spencer Kimball and Peter Mattis
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
 //
 // This program is free software; you can redistribute it and/or modify
 // it under the terms of the GNU General Public License version 2 as
 // published by the Free Software Foundation.
-//
-// --
-//
-// Adapted to Aseprite by David Capello (2001-2012)
 
 #ifndef APP_UTIL_BOUNDARY_H_INCLUDED
 #define APP_UTIL_BOUNDARY_H_INCLUDED
 #pragma once
 
-namespace doc {
-  class Image;
-}
+#include "doc/mask.h"
+#include "gfx/point.h"
+#include "gfx/rect.h"
+
+#include <vector>
 
 namespace app {
   using namespace doc;
 
-  enum BoundaryType {
-    WithinBounds,
-    IgnoreBounds
-  };
-
+  // Horizontal or vertical segment of the boundary between selected
+  // and unselected pixels. "open" is true for the top and left sides
+  // of the selected pixels, and false for the bottom and right sides.
   struct BoundSeg {
     int x1, y1, x2, y2;
-    unsigned open : 1;
-    unsigned visited : 1;
+    bool open;
+
+    BoundSeg(int x1, int y1, int x2, int y2, bool open)
+      : x1(x1), y1(y1), x2(x2), y2(y2), open(open) { }
   };
 
-  // The returned pointer must be freed using base_free() function.
-  BoundSeg* find_mask_boundary(const Image* maskPR, int* num_elems,
-                               BoundaryType type, int x1, int y1, int x2, int y2);
+  typedef std::vector<BoundSeg> BoundSegs;
+
+  // Boundary of the selected pixels of a bitmap. Each row of the
+  // bitmap is kept as a list of runs of selected pixels, so when only
+  // some rows of the bitmap are modified, the rest of rows don't need
+  // to be read again. All the state is inside the object, so
+  // different boundaries can be generated at the same time from
+  // different threads.
+  class MaskBoundary {
+  public:
+    MaskBoundary();
+
+    bool isEmpty() const { return m_segs.empty(); }
+    const BoundSegs& segments() const { return m_segs; }
 
-  BoundSeg* sort_boundary(BoundSeg* segs, int num_segs, int* num_groups);
+    // Number changed each time the segments are modified.
+    int version() const { return m_version; }
+
+    void clear();
+
+    // Generates the boundary of "bitmap" located at "origin" (a NULL
+    // bitmap is an empty mask).
+    void regenerate(const Image* bitmap, const gfx::Point& origin);
+
+    // Generates the boundary of the given spans (relative to
+    // "origin"), so the bitmap of a mask isn't needed.
+    void regenerate(const MaskSpans& spans, const gfx::Point& origin);
+
+    // Updates the boundary when the given bitmap (located at "origin")
+    // is equal to the previous one, except in "area". The bitmap
+    // bounds can be different from the previous one.
+    void update(const Image* bitmap, const gfx::Point& origin,
+                const gfx::Rect& area);
+    void update(const MaskSpans& spans, const gfx::Point& origin,
+                const gfx::Rect& area);
+
+  private:
+    // Pairs of x1/x2 coordinates ([x1, x2) ranges) of selected pixels
+    typedef std::vector<int> Runs;
+
+    void readRows(const Image* bitmap, const gfx::Point& origin,
+                  int y1, int y2);
+    void readRows(const MaskSpans& spans, const gfx::Point& origin,
+                  int y1, int y2);
+    bool addRows(int y1, int y2);
+    void trimRows();
+    void generateSegments();
+
+    int m_y;                    // Y coordinate of m_rows[0]
+    std::vector<Runs> m_rows;
+    BoundSegs m_segs;
+    int m_version;
+  };
 
-  // Call this function when you don't use find_mask_boundary() anymore (e.g. atexit()).
-  void boundary_exit();
+  // Returns the boundary segments of the given bitmap (located at 0,0).
+  void find_mask_boundary(const Image* bitmap, BoundSegs& segs);
 
 } // namespace app
 
@@ -0,0 +1,176 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "app/util/boundary.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/mask.h"
+#include "doc/primitives.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <tuple>
+#include <vector>
+
+using namespace app;
+using namespace doc;
+
+// Segment of one pixel of length (x, y, vertical, open)
+typedef std::tuple<int, int, bool, bool> UnitSeg;
+
+static std::vector<UnitSeg> split_segments(const BoundSegs& segs)
+{
+  std::vector<UnitSeg> units;
+  for (const BoundSeg& seg : segs) {
+    EXPECT_TRUE(seg.x1 == seg.x2 || seg.y1 == seg.y2);
+    if (seg.x1 == seg.x2) {
+      EXPECT_LT(seg.y1, seg.y2);
+      for (int y=seg.y1; y<seg.y2; ++y)
+        units.push_back(UnitSeg(seg.x1, y, true, seg.open));
+    }
+    else {
+      EXPECT_LT(seg.x1, seg.x2);
+      for (int x=seg.x1; x<seg.x2; ++x)
+        units.push_back(UnitSeg(x, seg.y1, false, seg.open));
+    }
+  }
+  std::sort(units.begin(), units.end());
+  return units;
+}
+
+// Sides of each selected pixel next to an unselected pixel.
+static std::vector<UnitSeg> expected_boundary(const Mask& mask)
+{
+  std::vector<UnitSeg> units;
+  const gfx::Rect& bounds = mask.bounds();
+  for (int y=bounds.y; y<bounds.y2(); ++y) {
+    for (int x=bounds.x; x<bounds.x2(); ++x) {
+      if (!mask.containsPoint(x, y))
+        continue;
+      if (!mask.containsPoint(x, y-1)) units.push_back(UnitSeg(x, y, false, true));
+      if (!mask.containsPoint(x, y+1)) units.push_back(UnitSeg(x, y+1, false, false));
+      if (!mask.containsPoint(x-1, y)) units.push_back(UnitSeg(x, y, true, true));
+      if (!mask.containsPoint(x+1, y)) units.push_back(UnitSeg(x+1, y, true, false));
+    }
+  }
+  std::sort(units.begin(), units.end());
+  return units;
+}
+
+static void random_mask(Mask& mask, int x, int y, int w, int h)
+{
+  mask.replace(gfx::Rect(x, y, w, h));
+
+  Image* bitmap = mask.editableBitmap();
+  for (int v=0; v<h; ++v)
+    for (int u=0; u<w; ++u)
+      if (std::rand() % 3 == 0)
+        put_pixel(bitmap, u, v, 0);
+}
+
+TEST(Boundary, Pixels)
+{
+  ImageRef image(Image::create(IMAGE_BITMAP, 4, 3));
+  clear_image(image.get(), 0);
+  put_pixel(image.get(), 1, 1, 1);
+  put_pixel(image.get(), 2, 1, 1);
+  put_pixel(image.get(), 2, 2, 1);
+
+  BoundSegs segs;
+  find_mask_boundary(image.get(), segs);
+  ASSERT_EQ(6, int(segs.size()));
+
+  // Segments are joined, so the right side is only one segment
+  int rightSides = 0;
+  for (const BoundSeg& seg : segs) {
+    if (seg.x1 == 3 && seg.x2 == 3) {
+      EXPECT_EQ(1, seg.y1);
+      EXPECT_EQ(3, seg.y2);
+      EXPECT_FALSE(seg.open);
+      ++rightSides;
+    }
+  }
+  EXPECT_EQ(1, rightSides);
+}
+
+TEST(Boundary, RandomMasks)
+{
+  std::srand(1);
+
+  // Widths around multiples of 8 to test the bytes of the bitmap
+  int widths[] = { 1, 7, 8, 9, 31, 64, 67 };
+  for (int w : widths) {
+    Mask mask;
+    random_mask(mask, -3, 5, w, 20);
+
+    MaskBoundary boundary;
+    boundary.regenerate(mask.bitmap(), mask.bounds().getOrigin());
+    EXPECT_TRUE(expected_boundary(mask) == split_segments(boundary.segments()))
+      << "width " << w;
+
+    MaskBoundary fromSpans;
+    fromSpans.regenerate(mask.spans(), mask.spansOrigin());
+    EXPECT_TRUE(expected_boundary(mask) == split_segments(fromSpans.segments()))
+      << "width " << w;
+  }
+}
+
+TEST(Boundary, Update)
+{
+  std::srand(2);
+
+  Mask mask;
+  random_mask(mask, 10, 10, 50, 40);
+
+  MaskBoundary boundary, fromSpans;
+  boundary.regenerate(mask.bitmap(), mask.bounds().getOrigin());
+  fromSpans.regenerate(mask.spans(), mask.spansOrigin());
+  int version = boundary.version();
+
+  gfx::Rect rects[] = {
+    gfx::Rect(20, 20, 10, 5),   // Inside the mask bounds
+    gfx::Rect(0, 45, 70, 20),   // Growing the mask bounds
+    gfx::Rect(-5, -5, 3, 3),    // Far from the mask
+    gfx::Rect(0, 0, 100, 30),   // Removing the top part
+  };
+
+  for (int i=0; i<4; ++i) {
+    if (i < 3)
+      mask.add(rects[i]);
+    else
+      mask.subtract(rects[i]);
+
+    boundary.update(mask.bitmap(), mask.bounds().getOrigin(), rects[i]);
+    EXPECT_NE(version, boundary.version());
+    version = boundary.version();
+
+    EXPECT_TRUE(expected_boundary(mask) == split_segments(boundary.segments()))
+      << "step " << i;
+
+    fromSpans.update(mask.spans(), mask.spansOrigin(), rects[i]);
+    EXPECT_TRUE(expected_boundary(mask) == split_segments(fromSpans.segments()))
+      << "step " << i;
+  }
+
+  mask.subtract(mask.bounds());
+  boundary.update(mask.bitmap(), mask.bounds().getOrigin(), gfx::Rect(-5, -5, 200, 200));
+  EXPECT_TRUE(boundary.isEmpty());
+  fromSpans.update(mask.spans(), mask.spansOrigin(), gfx::Rect(-5, -5, 200, 200));
+  EXPECT_TRUE(fromSpans.isEmpty());
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
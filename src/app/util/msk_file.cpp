@@ -46,7 +46,7 @@ Mask* load_msk_file(const char* filename)
     if (image != NULL && (image->pixelFormat() == IMAGE_BITMAP)) {
       mask = new Mask();
       mask->replace(gfx::Rect(x, y, image->width(), image->height()));
-      mask->bitmap()->copy(image, gfx::Clip(image->bounds()));
+      mask->editableBitmap()->copy(image, gfx::Clip(image->bounds()));
       mask->shrink();
     }
   }
@@ -55,11 +55,12 @@ Mask* load_msk_file(const char* filename)
     mask = new Mask();
     mask->replace(gfx::Rect(0, 0, 320, 200));
 
+    Image* bitmap = mask->editableBitmap();
     u = v = 0;
     for (i=0; i<8000; i++) {
       byte = getc(f);
       for (c=0; c<8; c++) {
-        mask->bitmap()->putPixel(u, v, byte & (1<<(7-c)));
+        bitmap->putPixel(u, v, byte & (1<<(7-c)));
         u++;
         if (u == 320) {
           u = 0;
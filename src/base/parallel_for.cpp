@@ -0,0 +1,132 @@
+// Aseprite Base Library
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "base/parallel_for.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace base {
+namespace details {
+
+namespace {
+
+// Threads that help the calling threads of parallel_for(). Each
+// parallel_for() call is queued as a request for "slots" threads, so
+// several calls (e.g. from different threads, or nested calls) can be
+// served at the same time. The calling thread never waits for a
+// helper that didn't start, because it processes the items too.
+class ThreadPool {
+public:
+  ThreadPool() : m_exit(false) {
+  }
+
+  ~ThreadPool() {
+    {
+      std::unique_lock<std::mutex> hold(m_mutex);
+      m_exit = true;
+      m_workAvailable.notify_all();
+    }
+    for (thread* t : m_threads) {
+      t->join();
+      delete t;
+    }
+  }
+
+  void run(parallel_for_job* job, int helpers) {
+    Request request(job, helpers);
+    {
+      std::unique_lock<std::mutex> hold(m_mutex);
+      addThreads(helpers);
+      m_requests.push_back(&request);
+      m_workAvailable.notify_all();
+    }
+
+    job->work();
+
+    std::unique_lock<std::mutex> hold(m_mutex);
+    request.slots = 0;
+    auto it = std::find(m_requests.begin(), m_requests.end(), &request);
+    if (it != m_requests.end())
+      m_requests.erase(it);
+    m_jobDone.wait(hold, [&request]{ return request.running == 0; });
+  }
+
+private:
+  struct Request {
+    parallel_for_job* job;
+    int slots;                  // Threads that can still join the job
+    int running;                // Threads running job->work()
+
+    Request(parallel_for_job* job, int slots)
+      : job(job), slots(slots), running(0) {
+    }
+  };
+
+  // Creates the threads needed to have at least "n" threads in the
+  // pool. If a thread cannot be created, the jobs are done by the
+  // threads that we already have (and by the calling thread).
+  void addThreads(int n) {
+    while (int(m_threads.size()) < n) {
+      thread* t;
+      try {
+        t = new thread([this]{ workerLoop(); });
+      }
+      catch (...) {
+        break;
+      }
+      m_threads.push_back(t);
+    }
+  }
+
+  void workerLoop() {
+    std::unique_lock<std::mutex> hold(m_mutex);
+    while (!m_exit) {
+      if (m_requests.empty()) {
+        m_workAvailable.wait(hold);
+        continue;
+      }
+
+      Request* request = m_requests.front();
+      if (--request->slots == 0)
+        m_requests.pop_front();
+      ++request->running;
+
+      hold.unlock();
+      request->job->work();
+      hold.lock();
+
+      if (--request->running == 0)
+        m_jobDone.notify_all();
+    }
+  }
+
+  std::mutex m_mutex;
+  std::condition_variable m_workAvailable;
+  std::condition_variable m_jobDone;
+  std::deque<Request*> m_requests;
+  std::vector<thread*> m_threads;
+  bool m_exit;
+};
+
+ThreadPool pool;
+
+} // anonymous namespace
+
+void run_parallel_for_job(parallel_for_job* job, int helpers)
+{
+  pool.run(job, helpers);
+}
+
+} // namespace details
+} // namespace base
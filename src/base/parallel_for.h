@@ -0,0 +1,122 @@
+// Aseprite Base Library
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef BASE_PARALLEL_FOR_H_INCLUDED
+#define BASE_PARALLEL_FOR_H_INCLUDED
+#pragma once
+
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+#include "base/thread.h"
+
+#include <atomic>
+#include <exception>
+
+namespace base {
+
+  namespace details {
+
+    // Work shared by the calling thread and the threads of the pool.
+    class parallel_for_job {
+    public:
+      virtual ~parallel_for_job() { }
+      virtual void work() = 0;
+    };
+
+    // Calls job->work() in the calling thread and in up to "helpers"
+    // threads of a pool of threads (which are created the first time
+    // they are needed and reused in the next calls). Returns when all
+    // the calls to job->work() have finished.
+    void run_parallel_for_job(parallel_for_job* job, int helpers);
+
+    template<typename Func>
+    class parallel_for_worker : public parallel_for_job {
+    public:
+      parallel_for_worker(int begin, int end, const Func* func)
+        : m_next(begin), m_end(end), m_failed(false), m_func(func) {
+      }
+
+      void work() override {
+        int i;
+        while (next(i)) {
+          try {
+            (*m_func)(i);
+          }
+          catch (...) {
+            set_error(std::current_exception());
+          }
+        }
+      }
+
+      void rethrow_error() {
+        if (m_failed)
+          std::rethrow_exception(m_error);
+      }
+
+    private:
+      // Returns false when there are no more items to process (or
+      // when some item has thrown an exception).
+      bool next(int& i) {
+        if (m_failed)
+          return false;
+        i = m_next++;
+        return (i < m_end);
+      }
+
+      void set_error(const std::exception_ptr& error) {
+        scoped_lock hold(m_mutex);
+        if (!m_failed) {
+          m_error = error;
+          m_failed = true;
+        }
+      }
+
+      std::atomic<int> m_next;
+      int m_end;
+      std::atomic<bool> m_failed;
+      mutex m_mutex;
+      std::exception_ptr m_error;
+      const Func* m_func;
+    };
+
+  } // namespace details
+
+  // Returns the number of threads to be used by parallel_for() when
+  // it is called with threads=0 (one per CPU core).
+  inline int parallel_threads(int threads = 0) {
+    return (threads > 0 ? threads: thread::hardware_concurrency());
+  }
+
+  // Calls func(i) for each i in [begin, end) using "threads" threads
+  // (the calling thread is one of them, the others are taken from a
+  // pool that is reused between calls, and 0 means one per CPU
+  // core). Items are taken in order by the first available thread, so
+  // "func" must be safe to be called concurrently for different
+  // items. If func() throws an exception, the remaining items are
+  // skipped and the exception is re-thrown in the calling thread.
+  template<typename Func>
+  void parallel_for(int begin, int end, const Func& func, int threads = 0) {
+    if (begin >= end)
+      return;
+
+    threads = parallel_threads(threads);
+    if (threads > end - begin)
+      threads = end - begin;
+
+    if (threads <= 1) {
+      for (int i=begin; i<end; ++i)
+        func(i);
+      return;
+    }
+
+    details::parallel_for_worker<Func> worker(begin, end, &func);
+    details::run_parallel_for_job(&worker, threads-1);
+    worker.rethrow_error();
+  }
+
+} // namespace base
+
+#endif
@@ -0,0 +1,84 @@
+// Aseprite Base Library
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "base/parallel_for.h"
+#include "base/thread.h"
+
+#include <stdexcept>
+#include <vector>
+
+using namespace base;
+
+TEST(ParallelFor, AllItemsOnce)
+{
+  for (int threads=1; threads<=8; ++threads) {
+    std::vector<int> items(1000, 0);
+    parallel_for(0, int(items.size()),
+                 [&items](int i) { ++items[i]; },
+                 threads);
+
+    for (int value : items)
+      EXPECT_EQ(1, value);
+  }
+}
+
+TEST(ParallelFor, EmptyRange)
+{
+  int calls = 0;
+  parallel_for(5, 5, [&calls](int i) { ++calls; }, 4);
+  parallel_for(5, 2, [&calls](int i) { ++calls; }, 4);
+  EXPECT_EQ(0, calls);
+}
+
+TEST(ParallelFor, RethrowsException)
+{
+  EXPECT_THROW(
+    parallel_for(0, 100,
+                 [](int i) {
+                   if (i == 50)
+                     throw std::runtime_error("error");
+                 }, 4),
+    std::runtime_error);
+}
+
+TEST(ParallelFor, NestedCalls)
+{
+  std::vector<int> items(100, 0);
+  parallel_for(0, 10,
+               [&items](int i) {
+                 parallel_for(0, 10,
+                              [&items, i](int j) { ++items[i*10+j]; },
+                              3);
+               }, 4);
+
+  for (int value : items)
+    EXPECT_EQ(1, value);
+}
+
+TEST(ParallelFor, CallsFromSeveralThreads)
+{
+  std::vector<int> a(500, 0), b(500, 0);
+  thread t([&a]{
+      for (int k=0; k<50; ++k)
+        parallel_for(0, int(a.size()), [&a](int i) { ++a[i]; }, 3);
+    });
+  for (int k=0; k<50; ++k)
+    parallel_for(0, int(b.size()), [&b](int i) { ++b[i]; }, 3);
+  t.join();
+
+  for (int i=0; i<int(a.size()); ++i) {
+    EXPECT_EQ(50, a[i]);
+    EXPECT_EQ(50, b[i]);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,253 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "base/rw_lock.h"
+
+#include "base/debug.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace base {
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds(const Clock::duration& duration)
+{
+  return std::chrono::duration<double>(duration).count();
+}
+
+class RWLock::RWLockImpl {
+public:
+  RWLockImpl()
+    : m_writeLock(false)
+    , m_readLocks(0)
+    , m_waitingWriters(0)
+    , m_upgrading(false)
+    , m_lastReadChange(Clock::now()) {
+  }
+
+  bool lock(LockType lockType, bool upgrade, int timeout) {
+    std::unique_lock<std::mutex> hold(m_mutex);
+    const Clock::time_point start = Clock::now();
+    bool waited = false;
+
+    ASSERT(!upgrade || (lockType == WriteLock && m_readLocks > 0));
+
+    if (!canLock(lockType, upgrade)) {
+      // Two readers waiting to upgrade their locks would wait each
+      // other forever, so the second one fails.
+      if (timeout == NoWait || (upgrade && m_upgrading)) {
+        ++m_stats[lockType].failures;
+        return false;
+      }
+
+      // Waiting writers don't let new readers to acquire the lock
+      if (lockType == WriteLock)
+        ++m_waitingWriters;
+      if (upgrade)
+        m_upgrading = true;
+
+      auto pred = [&]{ return canLock(lockType, upgrade); };
+      bool ok = true;
+      if (timeout < 0)
+        m_cond.wait(hold, pred);
+      else
+        ok = m_cond.wait_until(hold, start + std::chrono::milliseconds(timeout), pred);
+
+      if (upgrade)
+        m_upgrading = false;
+      if (lockType == WriteLock) {
+        --m_waitingWriters;
+
+        // Readers that were waiting for us can continue
+        if (!ok)
+          m_cond.notify_all();
+      }
+
+      if (!ok) {
+        addWaitTime(lockType, Clock::now() - start);
+        ++m_stats[lockType].failures;
+        return false;
+      }
+      waited = true;
+    }
+
+    const Clock::time_point now = Clock::now();
+    if (lockType == ReadLock) {
+      updateReadHoldTime(now);
+      ++m_readLocks;
+    }
+    else {
+      if (upgrade) {
+        updateReadHoldTime(now);
+        m_readLocks = 0;
+      }
+      m_writeLock = true;
+      m_writeStart = now;
+    }
+
+    Stats& stats = m_stats[lockType];
+    ++stats.locks;
+    if (waited) {
+      ++stats.contentions;
+      addWaitTime(lockType, now - start);
+    }
+    return true;
+  }
+
+  void downgradeToRead() {
+    std::unique_lock<std::mutex> hold(m_mutex);
+    const Clock::time_point now = Clock::now();
+
+    ASSERT(m_writeLock);
+    ASSERT(m_readLocks == 0);
+
+    m_stats[WriteLock].holdTime += seconds(now - m_writeStart);
+    m_writeLock = false;
+
+    updateReadHoldTime(now);
+    m_readLocks = 1;
+
+    m_cond.notify_all();
+  }
+
+  void unlock() {
+    std::unique_lock<std::mutex> hold(m_mutex);
+    const Clock::time_point now = Clock::now();
+
+    if (m_writeLock) {
+      m_stats[WriteLock].holdTime += seconds(now - m_writeStart);
+      m_writeLock = false;
+    }
+    else if (m_readLocks > 0) {
+      updateReadHoldTime(now);
+      --m_readLocks;
+    }
+    else {
+      ASSERT(false);
+      return;
+    }
+
+    m_cond.notify_all();
+  }
+
+  Stats stats(LockType lockType) {
+    std::unique_lock<std::mutex> hold(m_mutex);
+    const Clock::time_point now = Clock::now();
+
+    // Include the time of the current locks
+    updateReadHoldTime(now);
+    Stats stats = m_stats[lockType];
+    if (lockType == WriteLock && m_writeLock)
+      stats.holdTime += seconds(now - m_writeStart);
+    return stats;
+  }
+
+  void resetStats() {
+    std::unique_lock<std::mutex> hold(m_mutex);
+    const Clock::time_point now = Clock::now();
+
+    m_stats[ReadLock] = m_stats[WriteLock] = Stats();
+    m_lastReadChange = now;
+    if (m_writeLock)
+      m_writeStart = now;
+  }
+
+private:
+  bool canLock(LockType lockType, bool upgrade) const {
+    if (m_writeLock)
+      return false;
+    else if (lockType == ReadLock)
+      return (m_waitingWriters == 0);
+    else if (upgrade)
+      return (m_readLocks == 1);
+    else
+      return (m_readLocks == 0);
+  }
+
+  void addWaitTime(LockType lockType, const Clock::duration& duration) {
+    Stats& stats = m_stats[lockType];
+    double t = seconds(duration);
+    stats.waitTime += t;
+    if (stats.maxWaitTime < t)
+      stats.maxWaitTime = t;
+  }
+
+  // Adds the time that each current reader had the lock since the
+  // last time that the number of readers changed.
+  void updateReadHoldTime(const Clock::time_point& now) {
+    m_stats[ReadLock].holdTime += m_readLocks * seconds(now - m_lastReadChange);
+    m_lastReadChange = now;
+  }
+
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  bool m_writeLock;
+  int m_readLocks;
+  int m_waitingWriters;
+  bool m_upgrading;             // A reader is waiting to upgrade its lock
+  Clock::time_point m_writeStart;
+  Clock::time_point m_lastReadChange;
+  Stats m_stats[2];
+};
+
+RWLock::Stats::Stats()
+  : locks(0)
+  , contentions(0)
+  , failures(0)
+  , waitTime(0.0)
+  , maxWaitTime(0.0)
+  , holdTime(0.0)
+{
+}
+
+RWLock::RWLock()
+  : m_impl(new RWLockImpl)
+{
+}
+
+RWLock::~RWLock()
+{
+  delete m_impl;
+}
+
+bool RWLock::lock(LockType lockType, int timeout)
+{
+  return m_impl->lock(lockType, false, timeout);
+}
+
+bool RWLock::upgradeToWrite(int timeout)
+{
+  return m_impl->lock(WriteLock, true, timeout);
+}
+
+void RWLock::downgradeToRead()
+{
+  m_impl->downgradeToRead();
+}
+
+void RWLock::unlock()
+{
+  m_impl->unlock();
+}
+
+RWLock::Stats RWLock::stats(LockType lockType) const
+{
+  return m_impl->stats(lockType);
+}
+
+void RWLock::resetStats()
+{
+  m_impl->resetStats();
+}
+
+} // namespace base
@@ -0,0 +1,76 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef BASE_RW_LOCK_H_INCLUDED
+#define BASE_RW_LOCK_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+
+namespace base {
+
+  // A lock with several readers or one writer. Threads can wait a
+  // limited time to get the lock, and new readers wait for the
+  // writers that are already waiting (so a sequence of readers cannot
+  // starve a writer).
+  class RWLock {
+  public:
+    enum LockType {
+      ReadLock,
+      WriteLock
+    };
+
+    // Values for the "timeout" argument (milliseconds to wait)
+    enum {
+      NoWait = 0,
+      WaitForever = -1
+    };
+
+    // Counters to diagnose the contention of each type of lock. All
+    // times are in seconds.
+    struct Stats {
+      int locks;                // Acquired locks
+      int contentions;          // Acquired locks that had to wait
+      int failures;             // Locks that weren't acquired
+      double waitTime;          // Time waiting for the lock
+      double maxWaitTime;       // Longest wait for the lock
+      double holdTime;          // Time with the lock acquired (for each reader)
+
+      Stats();
+    };
+
+    RWLock();
+    ~RWLock();
+
+    // Locks to read or write. Returns false if the lock cannot be
+    // acquired after "timeout" milliseconds.
+    bool lock(LockType lockType, int timeout);
+
+    // Converts the read lock of the calling thread in a write lock
+    // (it's possible only when there are no other readers). If other
+    // reader is already waiting to upgrade its lock, it fails without
+    // waiting (both readers would wait each other forever), so the
+    // caller should unlock its read lock and try again later.
+    bool upgradeToWrite(int timeout);
+
+    // Converts the write lock to a read lock.
+    void downgradeToRead();
+
+    void unlock();
+
+    Stats stats(LockType lockType) const;
+    void resetStats();
+
+  private:
+    class RWLockImpl;
+    RWLockImpl* m_impl;
+
+    DISABLE_COPYING(RWLock);
+  };
+
+} // namespace base
+
+#endif
@@ -0,0 +1,169 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "base/rw_lock.h"
+#include "base/thread.h"
+
+#include <atomic>
+
+using namespace base;
+
+TEST(RWLock, WithoutWaiting)
+{
+  RWLock a;
+
+  EXPECT_TRUE(a.lock(RWLock::ReadLock, RWLock::NoWait));
+  EXPECT_TRUE(a.lock(RWLock::ReadLock, RWLock::NoWait));
+  EXPECT_FALSE(a.lock(RWLock::WriteLock, RWLock::NoWait));
+  EXPECT_FALSE(a.upgradeToWrite(RWLock::NoWait));
+  a.unlock();
+
+  EXPECT_TRUE(a.upgradeToWrite(RWLock::NoWait));
+  EXPECT_FALSE(a.lock(RWLock::ReadLock, RWLock::NoWait));
+  a.downgradeToRead();
+  EXPECT_TRUE(a.lock(RWLock::ReadLock, RWLock::NoWait));
+  a.unlock();
+  a.unlock();
+
+  EXPECT_TRUE(a.lock(RWLock::WriteLock, RWLock::NoWait));
+  EXPECT_FALSE(a.lock(RWLock::WriteLock, RWLock::NoWait));
+  a.unlock();
+
+  RWLock::Stats read = a.stats(RWLock::ReadLock);
+  RWLock::Stats write = a.stats(RWLock::WriteLock);
+  EXPECT_EQ(3, read.locks);
+  EXPECT_EQ(1, read.failures);
+  EXPECT_EQ(0, read.contentions);
+  EXPECT_EQ(2, write.locks);
+  EXPECT_EQ(3, write.failures);
+  EXPECT_EQ(0, write.contentions);
+
+  a.resetStats();
+  EXPECT_EQ(0, a.stats(RWLock::ReadLock).locks);
+  EXPECT_EQ(0, a.stats(RWLock::WriteLock).failures);
+}
+
+TEST(RWLock, WaitForWriter)
+{
+  RWLock a;
+  ASSERT_TRUE(a.lock(RWLock::WriteLock, RWLock::NoWait));
+
+  thread t([&a]{
+      this_thread::sleep_for(0.05);
+      a.unlock();
+    });
+
+  EXPECT_TRUE(a.lock(RWLock::ReadLock, 5000));
+  t.join();
+  a.unlock();
+
+  RWLock::Stats read = a.stats(RWLock::ReadLock);
+  EXPECT_EQ(1, read.locks);
+  EXPECT_EQ(1, read.contentions);
+  EXPECT_GE(read.waitTime, 0.03);
+  EXPECT_EQ(read.waitTime, read.maxWaitTime);
+  EXPECT_GE(a.stats(RWLock::WriteLock).holdTime, 0.03);
+}
+
+TEST(RWLock, Timeout)
+{
+  RWLock a;
+  ASSERT_TRUE(a.lock(RWLock::ReadLock, RWLock::NoWait));
+
+  thread t([&a]{
+      EXPECT_FALSE(a.lock(RWLock::WriteLock, 20));
+    });
+  t.join();
+
+  // The reader can continue after the writer gives up
+  EXPECT_TRUE(a.lock(RWLock::ReadLock, RWLock::NoWait));
+  a.unlock();
+  a.unlock();
+
+  RWLock::Stats write = a.stats(RWLock::WriteLock);
+  EXPECT_EQ(0, write.locks);
+  EXPECT_EQ(1, write.failures);
+  EXPECT_GE(write.waitTime, 0.015);
+}
+
+TEST(RWLock, WriterPreference)
+{
+  RWLock a;
+  ASSERT_TRUE(a.lock(RWLock::ReadLock, RWLock::NoWait));
+
+  std::atomic<bool> written(false);
+  thread t([&a, &written]{
+      EXPECT_TRUE(a.lock(RWLock::WriteLock, RWLock::WaitForever));
+      written = true;
+      a.unlock();
+    });
+
+  // Wait the writer
+  for (int i=0; i<100 && a.lock(RWLock::ReadLock, RWLock::NoWait); ++i) {
+    a.unlock();
+    this_thread::sleep_for(0.01);
+  }
+
+  // New readers cannot get the lock while the writer is waiting
+  EXPECT_FALSE(a.lock(RWLock::ReadLock, RWLock::NoWait));
+  EXPECT_FALSE(written);
+  a.unlock();
+
+  EXPECT_TRUE(a.lock(RWLock::ReadLock, 5000));
+  EXPECT_TRUE(written);
+  a.unlock();
+  t.join();
+}
+
+TEST(RWLock, TwoUpgrades)
+{
+  RWLock a;
+  ASSERT_TRUE(a.lock(RWLock::ReadLock, RWLock::NoWait));
+
+  std::atomic<bool> waiting(false);
+  thread t([&a, &waiting]{
+      EXPECT_TRUE(a.lock(RWLock::ReadLock, RWLock::NoWait));
+      waiting = true;
+      EXPECT_TRUE(a.upgradeToWrite(RWLock::WaitForever));
+      a.unlock();
+    });
+
+  while (!waiting)
+    this_thread::sleep_for(0.001);
+  this_thread::sleep_for(0.02);
+
+  // The other reader is waiting to upgrade its lock (it waits until
+  // we unlock our read lock), so our upgrade fails without waiting
+  EXPECT_FALSE(a.upgradeToWrite(RWLock::WaitForever));
+  a.unlock();
+  t.join();
+
+  EXPECT_EQ(1, a.stats(RWLock::WriteLock).locks);
+  EXPECT_EQ(1, a.stats(RWLock::WriteLock).failures);
+}
+
+TEST(RWLock, HoldTime)
+{
+  RWLock a;
+
+  // Two readers at the same time
+  ASSERT_TRUE(a.lock(RWLock::ReadLock, RWLock::NoWait));
+  ASSERT_TRUE(a.lock(RWLock::ReadLock, RWLock::NoWait));
+  this_thread::sleep_for(0.02);
+  a.unlock();
+  a.unlock();
+
+  EXPECT_GE(a.stats(RWLock::ReadLock).holdTime, 0.04);
+  EXPECT_EQ(0.0, a.stats(RWLock::WriteLock).holdTime);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
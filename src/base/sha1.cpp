@@ -11,6 +11,7 @@
 #include "base/sha1.h"
 #include "base/sha1_rfc3174.h"
 
+#include <algorithm>
 #include <fstream>
 #include <cassert>
 
@@ -53,6 +54,26 @@ Sha1 Sha1::calculateFromFile(const std::string& fileName)
   return Sha1(digest);
 }
 
+Sha1 Sha1::calculateFromMemory(const void* data, std::size_t size)
+{
+  SHA1Context sha;
+  SHA1Reset(&sha);
+
+  // SHA1Input() receives the length as an unsigned int
+  const uint8_t* ptr = (const uint8_t*)data;
+  while (size > 0) {
+    unsigned int len = (unsigned int)std::min<std::size_t>(size, 1024*1024);
+    SHA1Input(&sha, ptr, len);
+    ptr += len;
+    size -= len;
+  }
+
+  std::vector<uint8_t> digest(HashSize);
+  SHA1Result(&sha, &digest[0]);
+
+  return Sha1(digest);
+}
+
 bool Sha1::operator==(const Sha1& other) const
 {
   return m_digest == other.m_digest;
@@ -63,4 +84,9 @@ bool Sha1::operator!=(const Sha1& other) const
   return m_digest != other.m_digest;
 }
 
+bool Sha1::operator<(const Sha1& other) const
+{
+  return m_digest < other.m_digest;
+}
+
 } // namespace base
@@ -0,0 +1,52 @@
+// Aseprite Base Library
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "base/sha1.h"
+
+#include <cstring>
+
+using namespace base;
+
+static std::string to_hex(const Sha1& sha1)
+{
+  static const char* digits = "0123456789abcdef";
+  std::string str;
+  for (int i=0; i<Sha1::HashSize; ++i) {
+    str.push_back(digits[sha1[i] >> 4]);
+    str.push_back(digits[sha1[i] & 15]);
+  }
+  return str;
+}
+
+TEST(Sha1, CalculateFromMemory)
+{
+  // Test vectors from RFC 3174
+  const char* abc = "abc";
+  EXPECT_EQ("a9993e364706816aba3e25717850c26c9cd0d89d",
+            to_hex(Sha1::calculateFromMemory(abc, std::strlen(abc))));
+
+  std::string million(1000000, 'a');
+  EXPECT_EQ("34aa973cd4c4daa4f61eeb2bdbad27316534016f",
+            to_hex(Sha1::calculateFromMemory(million.c_str(), million.size())));
+}
+
+TEST(Sha1, Compare)
+{
+  Sha1 a = Sha1::calculateFromMemory("a", 1);
+  Sha1 b = Sha1::calculateFromMemory("b", 1);
+  EXPECT_TRUE(a == Sha1::calculateFromMemory("a", 1));
+  EXPECT_TRUE(a != b);
+  EXPECT_TRUE(a < b || b < a);
+  EXPECT_FALSE(a < a);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -89,6 +89,23 @@ base::thread::native_handle_type base::thread::native_handle()
   return m_native_handle;
 }
 
+// static
+int base::thread::hardware_concurrency()
+{
+#ifdef _WIN32
+
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  return (info.dwNumberOfProcessors > 0 ? int(info.dwNumberOfProcessors): 1);
+
+#else
+
+  long n = ::sysconf(_SC_NPROCESSORS_ONLN);
+  return (n > 0 ? int(n): 1);
+
+#endif
+}
+
 void base::thread::launch_thread(func_wrapper* f)
 {
   m_native_handle = (native_handle_type)0;
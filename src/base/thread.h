@@ -43,6 +43,10 @@ namespace base {                // Based on C++0x threads lib
 
     native_handle_type native_handle();
 
+    // Returns the number of threads that can run concurrently in this
+    // machine (number of CPU cores), or 1 if it cannot be detected.
+    static int hardware_concurrency();
+
     class details {
     public:
       static void thread_proxy(void* data);
@@ -0,0 +1,140 @@
+// Aseprite Benchmarks
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "benchmarks/benchmark_runner.h"
+
+#include "base/chrono.h"
+#include "base/convert_to.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+namespace benchmarks {
+
+namespace {
+
+std::string json_string(const std::string& str)
+{
+  std::string result = "\"";
+  for (char chr : str) {
+    switch (chr) {
+      case '"': result += "\\\""; break;
+      case '\\': result += "\\\\"; break;
+      case '\n': result += "\\n"; break;
+      default:
+        if ((unsigned char)chr < 32) {
+          char buf[8];
+          std::sprintf(buf, "\\u%04x", chr);
+          result += buf;
+        }
+        else
+          result += chr;
+        break;
+    }
+  }
+  result += "\"";
+  return result;
+}
+
+std::string json_number(double value)
+{
+  char buf[64];
+  std::sprintf(buf, "%.10g", value);
+  return buf;
+}
+
+} // anonymous namespace
+
+BenchmarkRunner::BenchmarkRunner(int iterations, const std::string& filter)
+  : m_iterations(std::max(1, iterations))
+  , m_filter(filter)
+{
+}
+
+bool BenchmarkRunner::accepts(const std::string& name) const
+{
+  return (m_filter.empty() ||
+          name.find(m_filter) != std::string::npos);
+}
+
+void BenchmarkRunner::run(const std::string& name, double pixels, const Func& func)
+{
+  if (!accepts(name))
+    return;
+
+  func();                       // Warm-up
+
+  std::vector<double> times(m_iterations);
+  base::Chrono chrono;
+  for (int i=0; i<m_iterations; ++i) {
+    chrono.reset();
+    func();
+    times[i] = chrono.elapsed();
+  }
+  std::sort(times.begin(), times.end());
+
+  Result result;
+  result.name = name;
+  result.iterations = m_iterations;
+  result.pixels = pixels;
+  result.min = times.front();
+  result.max = times.back();
+  result.median = (m_iterations & 1 ?
+                   times[m_iterations/2]:
+                   (times[m_iterations/2-1] + times[m_iterations/2]) / 2.0);
+  result.mean = 0.0;
+  for (double t : times)
+    result.mean += t;
+  result.mean /= m_iterations;
+  m_results.push_back(result);
+
+  std::fprintf(stderr, "%-48s %10.3f ms %10.1f Mpx/s\n",
+               name.c_str(), result.median * 1000.0,
+               result.median > 0.0 ? pixels / result.median / 1000000.0: 0.0);
+}
+
+void BenchmarkRunner::addConfig(const std::string& key, int value)
+{
+  m_config.push_back(std::make_pair(key, base::convert_to<std::string>(value)));
+}
+
+void BenchmarkRunner::addConfig(const std::string& key, const std::string& value)
+{
+  m_config.push_back(std::make_pair(key, json_string(value)));
+}
+
+void BenchmarkRunner::writeJson(std::ostream& os) const
+{
+  os << "{\n  \"config\": {";
+  for (std::size_t i=0; i<m_config.size(); ++i) {
+    os << (i > 0 ? ",": "") << "\n    "
+       << json_string(m_config[i].first) << ": " << m_config[i].second;
+  }
+  os << "\n  },\n  \"benchmarks\": [";
+
+  for (std::size_t i=0; i<m_results.size(); ++i) {
+    const Result& r = m_results[i];
+    os << (i > 0 ? ",": "") << "\n    {"
+       << "\"name\": " << json_string(r.name) << ", "
+       << "\"iterations\": " << r.iterations << ", "
+       << "\"pixels\": " << json_number(r.pixels) << ", "
+       << "\"min_ms\": " << json_number(r.min * 1000.0) << ", "
+       << "\"median_ms\": " << json_number(r.median * 1000.0) << ", "
+       << "\"mean_ms\": " << json_number(r.mean * 1000.0) << ", "
+       << "\"max_ms\": " << json_number(r.max * 1000.0) << ", "
+       << "\"mpx_per_sec\": "
+       << json_number(r.median > 0.0 ? r.pixels / r.median / 1000000.0: 0.0)
+       << "}";
+  }
+  os << "\n  ]\n}\n";
+}
+
+} // namespace benchmarks
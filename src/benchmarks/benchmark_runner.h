@@ -0,0 +1,63 @@
+// Aseprite Benchmarks
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef BENCHMARKS_BENCHMARK_RUNNER_H_INCLUDED
+#define BENCHMARKS_BENCHMARK_RUNNER_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace benchmarks {
+
+  // Times benchmark functions and collects their results to be
+  // written as JSON (so they can be compared between builds).
+  class BenchmarkRunner {
+  public:
+    typedef std::function<void()> Func;
+
+    struct Result {
+      std::string name;
+      int iterations;
+      double pixels;            // Pixels processed in each iteration
+      double min, median, mean, max; // In seconds
+    };
+
+    // Only the benchmarks which name contains the "filter" substring
+    // are executed (an empty filter runs all of them).
+    BenchmarkRunner(int iterations, const std::string& filter);
+
+    bool accepts(const std::string& name) const;
+
+    // Runs the function once to warm-up caches and then the
+    // configured number of iterations.
+    void run(const std::string& name, double pixels, const Func& func);
+
+    // Extra information saved in the "config" object of the JSON output.
+    void addConfig(const std::string& key, int value);
+    void addConfig(const std::string& key, const std::string& value);
+
+    const std::vector<Result>& results() const { return m_results; }
+
+    void writeJson(std::ostream& os) const;
+
+  private:
+    int m_iterations;
+    std::string m_filter;
+    std::vector<std::pair<std::string, std::string> > m_config;
+    std::vector<Result> m_results;
+
+    DISABLE_COPYING(BenchmarkRunner);
+  };
+
+} // namespace benchmarks
+
+#endif
@@ -0,0 +1,613 @@
+// Aseprite Benchmarks
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+// Micro-benchmarks of the most expensive image operations (sprite
+// rendering, composition, resize, rotation, filters, flood fill, and
+// color quantization) over reproducible synthetic sprites. Results
+// are written as JSON so they can be compared between builds.
+//
+// Usage: aseprite_benchmarks [--size 256x256] [--layers 4] [--frames 4]
+//                            [--iterations 5] [--threads 1]
+//                            [--long-frames 5000]
+//                            [--filter render_sprite] [--output file.json]
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "base/base.h"
+#include "base/convert_to.h"
+#include "base/program_options.h"
+#include "base/unique_ptr.h"
+#include "benchmarks/benchmark_runner.h"
+#include "benchmarks/synthetic_sprite.h"
+#include "doc/algorithm/floodfill.h"
+#include "doc/algorithm/resize_image.h"
+#include "doc/algorithm/rotsprite.h"
+#include "doc/blend.h"
+#include "doc/cel.h"
+#include "doc/cels_range.h"
+#include "doc/image.h"
+#include "doc/layer.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "doc/sprite.h"
+#include "filters/convolution_matrix.h"
+#include "filters/convolution_matrix_filter.h"
+#include "filters/filter_engine.h"
+#include "filters/median_filter.h"
+#include "gfx/packing_rects.h"
+#include "render/quantization.h"
+#include "render/render.h"
+#include "render/zoom.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+using namespace benchmarks;
+using namespace doc;
+using namespace render;
+
+typedef base::ProgramOptions PO;
+
+static const char* pixel_format_name(PixelFormat pixelFormat)
+{
+  switch (pixelFormat) {
+    case IMAGE_RGB: return "rgb";
+    case IMAGE_GRAYSCALE: return "grayscale";
+    case IMAGE_INDEXED: return "indexed";
+  }
+  return "unknown";
+}
+
+static int int_option(const PO& po, const PO::Option& opt, int defaultValue)
+{
+  if (!po.enabled(opt))
+    return defaultValue;
+
+  int value = base::convert_to<int>(po.value_of(opt));
+  if (value < 1)
+    throw std::runtime_error("invalid --" + opt.name() + " value");
+  return value;
+}
+
+// The first cel image of the first layer, used as input for the
+// benchmarks that work with a single image.
+static const Image* first_image(const Sprite* sprite)
+{
+  return static_cast<LayerImage*>(sprite->folder()->getFirstLayer())
+    ->cel(frame_t(0))->image();
+}
+
+static void bench_render_sprite(BenchmarkRunner& runner,
+                                const Sprite* sprite, int threads)
+{
+  static const struct {
+    int num, den;
+  } zooms[] = {
+    { 1, 1 }, { 2, 1 }, { 4, 1 }, { 1, 2 }
+  };
+
+  for (const auto& z : zooms) {
+    Zoom zoom(z.num, z.den);
+    std::string name =
+      std::string("render_sprite/") + pixel_format_name(sprite->pixelFormat())
+      + "/zoom_" + base::convert_to<std::string>(z.num)
+      + "_" + base::convert_to<std::string>(z.den);
+    if (!runner.accepts(name))
+      continue;
+
+    int w = zoom.apply(sprite->width());
+    int h = zoom.apply(sprite->height());
+    base::UniquePtr<Image> dst(Image::create(IMAGE_RGB, w, h));
+
+    Render render;
+    render.setBgType(BgType::CHECKED);
+    render.setThreads(threads);
+
+    runner.run(name, double(w) * h * sprite->totalFrames(),
+      [&]{
+        for (frame_t frame(0); frame<sprite->totalFrames(); ++frame)
+          render.renderSprite(dst, sprite, frame,
+                              gfx::Clip(0, 0, 0, 0, w, h), zoom);
+      });
+  }
+}
+
+static void bench_composite_image(BenchmarkRunner& runner, const Sprite* sprite)
+{
+  std::string name =
+    std::string("composite_image/") + pixel_format_name(sprite->pixelFormat());
+
+  base::UniquePtr<Image> dst(
+    Image::create(sprite->pixelFormat(), sprite->width(), sprite->height()));
+
+  double pixels = 0.0;
+  for (const Cel* cel : sprite->cels(frame_t(0)))
+    pixels += double(cel->image()->width()) * cel->image()->height();
+
+  runner.run(name, pixels,
+    [&]{
+      clear_image(dst, 0);
+      for (const Cel* cel : sprite->cels(frame_t(0)))
+        composite_image(dst, cel->image(), cel->x(), cel->y(),
+                        cel->opacity(), BLEND_MODE_NORMAL);
+    });
+}
+
+// Normal blend of two RGB images with the per-pixel blender function
+// calls and with the span blenders used by the renderer.
+static void bench_blend_normal(BenchmarkRunner& runner, const Sprite* sprite)
+{
+  const int w = sprite->width(), h = sprite->height();
+  base::UniquePtr<Image> back(Image::create(IMAGE_RGB, w, h));
+  base::UniquePtr<Image> front(Image::create(IMAGE_RGB, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      put_pixel(back, x, y, rgba(x, y, x+y, 255));
+      put_pixel(front, x, y, rgba(y, x, x^y, (x*y) & 255));
+    }
+
+  base::UniquePtr<Image> dst(Image::createCopy(back));
+
+  runner.run("blend_normal/per_pixel", double(w) * h,
+    [&]{
+      BLEND_COLOR blender = rgba_blenders[BLEND_MODE_NORMAL];
+      for (int y=0; y<h; ++y) {
+        uint32_t* d = (uint32_t*)dst->getPixelAddress(0, y);
+        const uint32_t* f = (const uint32_t*)front->getPixelAddress(0, y);
+        for (int x=0; x<w; ++x)
+          if (f[x] != 0)
+            d[x] = (*blender)(d[x], f[x], 200);
+      }
+    });
+
+  runner.run("blend_normal/spans", double(w) * h,
+    [&]{
+      Render().renderImage(dst, front, NULL, 0, 0, Zoom(1, 1),
+                           200, BLEND_MODE_NORMAL);
+    });
+}
+
+static void bench_resize_image(BenchmarkRunner& runner, const Sprite* sprite)
+{
+  static const struct {
+    algorithm::ResizeMethod method;
+    const char* name;
+  } methods[] = {
+    { algorithm::RESIZE_METHOD_NEAREST_NEIGHBOR, "nearest" },
+    { algorithm::RESIZE_METHOD_BILINEAR, "bilinear" },
+  };
+
+  const Image* src = first_image(sprite);
+  const Palette* palette = sprite->palette(frame_t(0));
+  RgbMap rgbmap;
+  rgbmap.regenerate(palette, 0);
+
+  base::UniquePtr<Image> dst(
+    Image::create(src->pixelFormat(), src->width()*2, src->height()*2));
+
+  for (const auto& m : methods) {
+    std::string name =
+      std::string("resize_image/") + pixel_format_name(sprite->pixelFormat())
+      + "/" + m.name;
+
+    runner.run(name, double(dst->width()) * dst->height(),
+      [&]{
+        algorithm::resize_image(src, dst, m.method, palette, &rgbmap);
+      });
+  }
+}
+
+static void bench_rotsprite_image(BenchmarkRunner& runner, const Sprite* sprite)
+{
+  std::string name =
+    std::string("rotsprite_image/") + pixel_format_name(sprite->pixelFormat());
+
+  const Image* src = first_image(sprite);
+  base::UniquePtr<Image> dst(
+    Image::create(sprite->pixelFormat(), sprite->width(), sprite->height()));
+
+  // Corners of the source image rotated 30 degrees around the center
+  // of the destination image.
+  double cx = dst->width() / 2.0;
+  double cy = dst->height() / 2.0;
+  double hw = src->width() / 2.0;
+  double hh = src->height() / 2.0;
+  double angle = 30.0 * PI / 180.0;
+  double c = std::cos(angle), s = std::sin(angle);
+  int corners[8];
+  const double pts[4][2] = { { -hw, -hh }, { hw, -hh }, { hw, hh }, { -hw, hh } };
+  for (int i=0; i<4; ++i) {
+    corners[i*2  ] = int(cx + pts[i][0]*c - pts[i][1]*s);
+    corners[i*2+1] = int(cy + pts[i][0]*s + pts[i][1]*c);
+  }
+
+  runner.run(name, double(dst->width()) * dst->height(),
+    [&]{
+      clear_image(dst, dst->maskColor());
+      algorithm::rotsprite_image(dst, src,
+        corners[0], corners[1], corners[2], corners[3],
+        corners[4], corners[5], corners[6], corners[7]);
+    });
+}
+
+static void bench_convert_pixel_format(BenchmarkRunner& runner, const Sprite* sprite)
+{
+  static const PixelFormat formats[] = {
+    IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED
+  };
+
+  const Image* src = first_image(sprite);
+  const Palette* palette = sprite->palette(frame_t(0));
+  RgbMap rgbmap;
+  rgbmap.regenerate(palette, 0);
+
+  for (PixelFormat dstFormat : formats) {
+    if (dstFormat == src->pixelFormat())
+      continue;
+
+    for (int d=0; d<2; ++d) {
+      DitheringMethod dithering = (d == 0 ? DitheringMethod::NONE:
+                                            DitheringMethod::ORDERED);
+
+      // Dithering is used only from RGB to Indexed
+      if (dithering == DitheringMethod::ORDERED &&
+          (src->pixelFormat() != IMAGE_RGB || dstFormat != IMAGE_INDEXED))
+        continue;
+
+      std::string name =
+        std::string("convert_pixel_format/")
+        + pixel_format_name(src->pixelFormat()) + "_to_"
+        + pixel_format_name(dstFormat)
+        + (dithering == DitheringMethod::ORDERED ? "/ordered": "");
+
+      base::UniquePtr<Image> dst(
+        Image::create(dstFormat, src->width(), src->height()));
+
+      runner.run(name, double(src->width()) * src->height(),
+        [&]{
+          convert_pixel_format(src, dst, dstFormat, dithering,
+                               &rgbmap, palette, false);
+        });
+    }
+  }
+}
+
+// Blur filter (one of the big stock matrices, which is applied as two
+// separable terms) and a sharpen filter (applied directly).
+static void bench_convolution_matrix(BenchmarkRunner& runner, const Sprite* sprite)
+{
+  using namespace filters;
+
+  SharedPtr<ConvolutionMatrix> blur(new ConvolutionMatrix(17, 17));
+  int div = 0;
+  for (int y=0; y<17; ++y)
+    for (int x=0; x<17; ++x) {
+      blur->value(x, y) = 17 - std::abs(x-8) - std::abs(y-8);
+      div += blur->value(x, y);
+    }
+  blur->setDiv(div);
+
+  SharedPtr<ConvolutionMatrix> sharpen(new ConvolutionMatrix(3, 3));
+  for (int y=0; y<3; ++y)
+    for (int x=0; x<3; ++x)
+      sharpen->value(x, y) = (x == 1 && y == 1 ? 16: -1);
+  sharpen->setDiv(8);
+
+  const struct {
+    SharedPtr<ConvolutionMatrix> matrix;
+    const char* name;
+  } matrices[] = {
+    { blur, "blur-17x17" },
+    { sharpen, "sharpen-3x3" },
+  };
+
+  const Image* src = first_image(sprite);
+  base::UniquePtr<Image> dst(Image::createCopy(src));
+  FilterSpans spans;
+  create_filter_spans(src->bounds(), NULL, gfx::Point(0, 0), spans);
+
+  for (const auto& m : matrices) {
+    std::string name =
+      std::string("convolution_matrix/") + pixel_format_name(sprite->pixelFormat())
+      + "/" + m.name;
+
+    ConvolutionMatrixFilter filter;
+    filter.setMatrix(m.matrix);
+
+    runner.run(name, double(src->width()) * src->height(),
+      [&]{
+        FilterEngine engine(&filter, NULL);
+        engine.setThreads(1);
+        engine.addImage(src, dst, TARGET_ALL_CHANNELS, spans);
+        engine.apply();
+      });
+  }
+}
+
+static void bench_median_filter(BenchmarkRunner& runner, const Sprite* sprite)
+{
+  using namespace filters;
+
+  const Image* src = first_image(sprite);
+  base::UniquePtr<Image> dst(Image::createCopy(src));
+  FilterSpans spans;
+  create_filter_spans(src->bounds(), NULL, gfx::Point(0, 0), spans);
+
+  static const int sizes[] = { 3, 5, 7, 15 };
+  for (int size : sizes) {
+    std::string name =
+      std::string("median_filter/") + pixel_format_name(sprite->pixelFormat())
+      + "/" + base::convert_to<std::string>(size)
+      + "x" + base::convert_to<std::string>(size);
+
+    MedianFilter filter;
+    filter.setSize(size, size);
+
+    runner.run(name, double(src->width()) * src->height(),
+      [&]{
+        FilterEngine engine(&filter, NULL);
+        engine.setThreads(1);
+        engine.addImage(src, dst, TARGET_ALL_CHANNELS, spans);
+        engine.apply();
+      });
+  }
+}
+
+static void count_hline(int x1, int y, int x2, void* data)
+{
+  *reinterpret_cast<int*>(data) += x2 - x1 + 1;
+}
+
+static void bench_floodfill(BenchmarkRunner& runner, const Sprite* sprite)
+{
+  const Image* src = first_image(sprite);
+  std::string format = pixel_format_name(sprite->pixelFormat());
+
+  // With the maximum tolerance all pixels are filled
+  static const int tolerances[] = { 0, 255 };
+  for (int tolerance : tolerances) {
+    for (int contiguous=0; contiguous<2; ++contiguous) {
+      std::string name =
+        std::string("floodfill/") + format
+        + (contiguous ? "/contiguous": "/global")
+        + "/tolerance" + base::convert_to<std::string>(tolerance);
+
+      runner.run(name, double(src->width()) * src->height(),
+        [&]{
+          int pixels = 0;
+          doc::algorithm::floodfill(
+            const_cast<Image*>(src), src->width()/2, src->height()/2,
+            src->bounds(), tolerance, contiguous ? true: false,
+            &pixels, count_hline);
+        });
+    }
+  }
+}
+
+static void bench_rgbmap_regenerate(BenchmarkRunner& runner, const Sprite* sprite)
+{
+  const Palette* palette = sprite->palette(frame_t(0));
+  RgbMap rgbmap;
+
+  // The whole RGB map (32x32x32 entries) is regenerated each time
+  // (entries are calculated lazily, so we map all colors).
+  runner.run("rgbmap_regenerate", 32*32*32,
+    [&]{
+      rgbmap.regenerate(palette, 0);
+      for (int r=0; r<256; r+=8)
+        for (int g=0; g<256; g+=8)
+          for (int b=0; b<256; b+=8)
+            rgbmap.mapColor(r, g, b);
+    });
+}
+
+// Export of a long animation (e.g. a cutscene): each frame of a
+// small sprite is rendered, so the time is dominated by the cel
+// lookup of each layer/frame instead of the composition.
+static void bench_long_animation(BenchmarkRunner& runner, int frames)
+{
+  std::string suffix = "/" + base::convert_to<std::string>(frames) + "_frames";
+  std::string lookupName = "cel_lookup" + suffix;
+  std::string exportName = "export_animation" + suffix;
+  if (!runner.accepts(lookupName) && !runner.accepts(exportName))
+    return;
+
+  SyntheticSpriteSpec spec;
+  spec.width = spec.height = 32;
+  spec.layers = 4;
+  spec.frames = frames;
+  base::UniquePtr<Sprite> sprite(create_synthetic_sprite(spec));
+
+  std::vector<Layer*> layers;
+  sprite->getLayersList(layers);
+
+  runner.run(lookupName, double(frames) * layers.size(),
+    [&]{
+      int found = 0;
+      for (frame_t frame(0); frame<frames; ++frame)
+        for (const Layer* layer : layers)
+          if (layer->cel(frame))
+            ++found;
+      if (found != frames * int(layers.size()))
+        throw std::runtime_error("missing cels in " + lookupName);
+    });
+
+  base::UniquePtr<Image> dst(
+    Image::create(IMAGE_RGB, sprite->width(), sprite->height()));
+  Render render;
+
+  runner.run(exportName, double(sprite->width()) * sprite->height() * frames,
+    [&]{
+      for (frame_t frame(0); frame<frames; ++frame)
+        render.renderSprite(dst, sprite, frame);
+    });
+}
+
+// Sprite sheet packing (--sheet-pack) of the given number of frames
+// with random sizes. The texture size and density of each algorithm
+// are saved in the configuration of the results.
+static void bench_sheet_pack(BenchmarkRunner& runner, int frames)
+{
+  static const struct {
+    const char* name;
+    gfx::PackingRects::Algorithm algorithm;
+  } algorithms[] = {
+    { "maxrects", gfx::PackingRects::MaxRects },
+    { "maxrects_bssf", gfx::PackingRects::MaxRectsBestShortSideFit },
+    { "skyline", gfx::PackingRects::Skyline }
+  };
+
+  // Same sizes for all algorithms
+  std::vector<gfx::Size> sizes;
+  uint32_t seed = 1;
+  double area = 0.0;
+  for (int i=0; i<frames; ++i) {
+    seed = seed*1103515245 + 12345;
+    int w = 4 + int((seed >> 16) % 60);
+    seed = seed*1103515245 + 12345;
+    int h = 4 + int((seed >> 16) % 60);
+    sizes.push_back(gfx::Size(w, h));
+    area += w*h;
+  }
+
+  for (const auto& item : algorithms) {
+    for (int rotation=0; rotation<2; ++rotation) {
+      std::string name = std::string("sheet_pack/") + item.name
+        + (rotation ? "_rotate": "") + "/"
+        + base::convert_to<std::string>(frames) + "_frames";
+      if (!runner.accepts(name))
+        continue;
+
+      gfx::Size texture;
+      runner.run(name, double(frames),
+        [&]{
+          gfx::PackingRects pr;
+          pr.setAlgorithm(item.algorithm);
+          pr.setRotation(rotation == 1);
+          for (const auto& sz : sizes)
+            pr.add(sz);
+          texture = pr.bestFit();
+        });
+
+      runner.addConfig(name + "/texture",
+                       base::convert_to<std::string>(texture.w) + "x" +
+                       base::convert_to<std::string>(texture.h));
+      runner.addConfig(name + "/density_percent",
+                       int(100.0 * area / (double(texture.w) * texture.h)));
+    }
+  }
+}
+
+static void run(int argc, const char* argv[])
+{
+  PO po;
+  PO::Option& sizeOpt = po.add("size").requiresValue("<width>x<height>")
+    .description("Size of the synthetic sprites (256x256 by default)");
+  PO::Option& layersOpt = po.add("layers").requiresValue("<n>")
+    .description("Number of layers of each sprite (4 by default)");
+  PO::Option& framesOpt = po.add("frames").requiresValue("<n>")
+    .description("Number of frames of each sprite (4 by default)");
+  PO::Option& iterationsOpt = po.add("iterations").requiresValue("<n>")
+    .description("Timed iterations of each benchmark (5 by default)");
+  PO::Option& threadsOpt = po.add("threads").requiresValue("<n>")
+    .description("Threads used by Render (1 by default)");
+  PO::Option& longFramesOpt = po.add("long-frames").requiresValue("<n>")
+    .description("Frames of the long animation benchmarks (5000 by default)");
+  PO::Option& filterOpt = po.add("filter").requiresValue("<text>")
+    .description("Run only the benchmarks that contain the given text");
+  PO::Option& outputOpt = po.add("output").requiresValue("<filename>")
+    .description("Save the JSON results in the given file (stdout by default)");
+  PO::Option& helpOpt = po.add("help").mnemonic('?')
+    .description("Display this help and exits");
+  po.parse(argc, argv);
+
+  if (po.enabled(helpOpt)) {
+    std::cout << "Usage: aseprite_benchmarks [OPTIONS]\n\n" << po;
+    return;
+  }
+
+  SyntheticSpriteSpec spec;
+  if (po.enabled(sizeOpt)) {
+    if (std::sscanf(po.value_of(sizeOpt).c_str(), "%dx%d",
+                    &spec.width, &spec.height) != 2 ||
+        spec.width < 1 || spec.height < 1)
+      throw std::runtime_error("invalid --size value");
+  }
+  spec.layers = int_option(po, layersOpt, spec.layers);
+  spec.frames = int_option(po, framesOpt, spec.frames);
+
+  int threads = int_option(po, threadsOpt, 1);
+  int longFrames = int_option(po, longFramesOpt, 5000);
+  BenchmarkRunner runner(int_option(po, iterationsOpt, 5),
+                         po.value_of(filterOpt));
+
+  runner.addConfig("width", spec.width);
+  runner.addConfig("height", spec.height);
+  runner.addConfig("layers", spec.layers);
+  runner.addConfig("frames", spec.frames);
+  runner.addConfig("threads", threads);
+  runner.addConfig("seed", int(spec.seed));
+  runner.addConfig("simd", blend_span_uses_simd() ? "sse2": "none");
+
+  static const PixelFormat formats[] = {
+    IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED
+  };
+
+  for (PixelFormat pixelFormat : formats) {
+    spec.pixelFormat = pixelFormat;
+    base::UniquePtr<Sprite> sprite(create_synthetic_sprite(spec));
+
+    bench_render_sprite(runner, sprite, threads);
+    bench_composite_image(runner, sprite);
+    bench_resize_image(runner, sprite);
+    bench_rotsprite_image(runner, sprite);
+    bench_convert_pixel_format(runner, sprite);
+    bench_floodfill(runner, sprite);
+
+    // Indexed images need a palette and a RgbMap (FilterIndexedData)
+    if (pixelFormat != IMAGE_INDEXED) {
+      bench_convolution_matrix(runner, sprite);
+      bench_median_filter(runner, sprite);
+    }
+
+    if (pixelFormat == IMAGE_RGB) {
+      bench_blend_normal(runner, sprite);
+      bench_rgbmap_regenerate(runner, sprite);
+    }
+  }
+
+  bench_long_animation(runner, longFrames);
+  bench_sheet_pack(runner, 1000);
+
+  if (po.enabled(outputOpt)) {
+    std::ofstream file(po.value_of(outputOpt).c_str());
+    if (!file)
+      throw std::runtime_error("cannot open " + po.value_of(outputOpt));
+    runner.writeJson(file);
+  }
+  else
+    runner.writeJson(std::cout);
+}
+
+int main(int argc, const char* argv[])
+{
+  try {
+    run(argc, argv);
+    return 0;
+  }
+  catch (const std::exception& e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+}
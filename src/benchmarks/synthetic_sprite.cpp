@@ -0,0 +1,144 @@
+// Aseprite Benchmarks
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "benchmarks/synthetic_sprite.h"
+
+#include "base/unique_ptr.h"
+#include "doc/cel.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/layer.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/sprite.h"
+
+#include <algorithm>
+
+namespace benchmarks {
+
+using namespace doc;
+
+namespace {
+
+// Small xorshift generator, we don't use std::rand() because its
+// sequence depends on the C library.
+class Random {
+public:
+  Random(uint32_t seed) : m_state(seed ? seed: 0x9e3779b9) { }
+
+  uint32_t next() {
+    m_state ^= m_state << 13;
+    m_state ^= m_state >> 17;
+    m_state ^= m_state << 5;
+    return m_state;
+  }
+
+  // Returns a number in [lo, hi] range
+  int range(int lo, int hi) {
+    return lo + int(next() % uint32_t(hi - lo + 1));
+  }
+
+private:
+  uint32_t m_state;
+};
+
+// Hash of a block of pixels, used to generate 8x8 blocks of the same
+// color (similar to pixel-art) without storing anything.
+uint32_t block_hash(uint32_t seed, int u, int v)
+{
+  uint32_t h = seed ^ (uint32_t(u) * 0x8da6b343) ^ (uint32_t(v) * 0xd8163841);
+  h ^= h >> 13;
+  h *= 0x5bd1e995;
+  h ^= h >> 15;
+  return h;
+}
+
+color_t block_color(PixelFormat pixelFormat, uint32_t h)
+{
+  // 1/8 of the blocks are transparent holes, 1/8 semi-transparent
+  bool transparent = ((h & 7) == 0);
+  int alpha = ((h & 7) == 1 ? 64 + int((h >> 3) & 127): 255);
+
+  switch (pixelFormat) {
+    case IMAGE_RGB:
+      if (transparent)
+        return rgba(0, 0, 0, 0);
+      return rgba((h >> 8) & 255, (h >> 16) & 255, (h >> 24) & 255, alpha);
+    case IMAGE_GRAYSCALE:
+      if (transparent)
+        return graya(0, 0);
+      return graya((h >> 8) & 255, alpha);
+    case IMAGE_INDEXED:
+      if (transparent)
+        return 0;
+      return 1 + ((h >> 8) % 255);
+  }
+  return 0;
+}
+
+void fill_image(Image* image, uint32_t seed)
+{
+  PixelFormat pixelFormat = image->pixelFormat();
+  for (int y=0; y<image->height(); ++y)
+    for (int x=0; x<image->width(); ++x)
+      put_pixel(image, x, y,
+                block_color(pixelFormat, block_hash(seed, x/8, y/8)));
+}
+
+} // anonymous namespace
+
+Sprite* create_synthetic_sprite(const SyntheticSpriteSpec& spec)
+{
+  Random rand(spec.seed);
+  base::UniquePtr<Sprite> sprite(
+    new Sprite(spec.pixelFormat, spec.width, spec.height, 256));
+  sprite->setTotalFrames(frame_t(spec.frames));
+
+  // Random palette (the entry 0 is the transparent color of indexed
+  // images). Grayscale sprites keep their gray ramp.
+  if (spec.pixelFormat != IMAGE_GRAYSCALE) {
+    Palette pal(frame_t(0), 256);
+    pal.setEntry(0, rgba(0, 0, 0, 255));
+    for (int i=1; i<256; ++i) {
+      uint32_t c = rand.next();
+      pal.setEntry(i, rgba(c & 255, (c >> 8) & 255, (c >> 16) & 255, 255));
+    }
+    sprite->setPalette(&pal, true);
+  }
+
+  int dx = std::max(1, spec.width/8);
+  int dy = std::max(1, spec.height/8);
+
+  for (int l=0; l<spec.layers; ++l) {
+    base::UniquePtr<LayerImage> layer(new LayerImage(sprite));
+
+    for (frame_t f(0); f<spec.frames; ++f) {
+      int w = std::max(1, spec.width*3/4 + rand.range(0, spec.width/4));
+      int h = std::max(1, spec.height*3/4 + rand.range(0, spec.height/4));
+
+      ImageRef image(Image::create(spec.pixelFormat, w, h));
+      fill_image(image.get(), rand.next());
+
+      base::UniquePtr<Cel> cel(new Cel(f, image));
+      cel->setPosition(rand.range(-dx, dx), rand.range(-dy, dy));
+      if (l > 0)
+        cel->setOpacity(rand.range(128, 255));
+
+      layer->addCel(cel);
+      cel.release();
+    }
+
+    sprite->folder()->addLayer(layer.release());
+  }
+
+  return sprite.release();
+}
+
+} // namespace benchmarks
@@ -0,0 +1,44 @@
+// Aseprite Benchmarks
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef BENCHMARKS_SYNTHETIC_SPRITE_H_INCLUDED
+#define BENCHMARKS_SYNTHETIC_SPRITE_H_INCLUDED
+#pragma once
+
+#include "doc/pixel_format.h"
+
+#include <stdint.h>
+
+namespace doc {
+  class Sprite;
+}
+
+namespace benchmarks {
+
+  struct SyntheticSpriteSpec {
+    doc::PixelFormat pixelFormat;
+    int width, height;
+    int layers, frames;
+    uint32_t seed;
+
+    SyntheticSpriteSpec()
+      : pixelFormat(doc::IMAGE_RGB)
+      , width(256), height(256)
+      , layers(4), frames(4)
+      , seed(1) {
+    }
+  };
+
+  // Creates a sprite with the given number of layers and frames
+  // filled with pseudo-random content (blocks of colors, holes of
+  // transparent pixels, semi-transparent areas, cels with different
+  // positions/opacities). The same spec always generates the same
+  // sprite on every platform.
+  doc::Sprite* create_synthetic_sprite(const SyntheticSpriteSpec& spec);
+
+} // namespace benchmarks
+
+#endif
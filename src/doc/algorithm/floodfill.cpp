@@ -1,404 +1,392 @@
-// The floodfill routine.
-// By Shawn Hargreaves.
-//
-// Adapted to Aseprite by David Capello
-// Added non-contiguous mode by David Capello
+// Aseprite Document Library
+// Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
-//
-// TODO rewrite this algorithm from scratch
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
-#include "doc/algo.h"
+#include "doc/algorithm/floodfill.h"
+
+#include "base/parallel_for.h"
 #include "doc/image.h"
+#include "doc/image_traits.h"
 #include "doc/primitives.h"
+#include "doc/primitives_fast.h"
+#include "gfx/rect.h"
 
-#include <climits>
-#include <cmath>
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 
 namespace doc {
 namespace algorithm {
 
-struct FLOODED_LINE {   // store segments which have been flooded
-  short flags;          // status of the segment
-  short lpos, rpos;     // left and right ends of segment
-  short y;              // y coordinate of the segment
-  int next;             // linked list if several per line
-};
-
-/* Note: a 'short' is not sufficient for 'next' above in some corner cases. */
-
-
-static std::vector<FLOODED_LINE> flood_buf;
-static int flood_count;          /* number of flooded segments */
-
-#define FLOOD_IN_USE             1
-#define FLOOD_TODO_ABOVE         2
-#define FLOOD_TODO_BELOW         4
-
-#define FLOOD_LINE(c)            (&flood_buf[c])
+namespace {
 
-static inline bool color_equal_32(color_t c1, color_t c2, int tolerance)
-{
-  if (tolerance == 0)
-    return (c1 == c2) || (rgba_geta(c1) == 0 && rgba_geta(c2) == 0);
-  else {
-    int r1 = rgba_getr(c1);
-    int g1 = rgba_getg(c1);
-    int b1 = rgba_getb(c1);
-    int a1 = rgba_geta(c1);
-    int r2 = rgba_getr(c2);
-    int g2 = rgba_getg(c2);
-    int b2 = rgba_getb(c2);
-    int a2 = rgba_geta(c2);
-
-    if (a1 == 0 && a2 == 0)
-      return true;
-
-    return ((ABS(r1-r2) <= tolerance) &&
-            (ABS(g1-g2) <= tolerance) &&
-            (ABS(b1-b2) <= tolerance) &&
-            (ABS(a1-a2) <= tolerance));
-  }
-}
-
-static inline bool color_equal_16(color_t c1, color_t c2, int tolerance)
-{
-  if (tolerance == 0)
-    return (c1 == c2) || (graya_geta(c1) == 0 && graya_geta(c2) == 0);
-  else {
-    int k1 = graya_getv(c1);
-    int a1 = graya_geta(c1);
-    int k2 = graya_getv(c2);
-    int a2 = graya_geta(c2);
-
-    if (a1 == 0 && a2 == 0)
-      return true;
-
-    return ((ABS(k1-k2) <= tolerance) &&
-            (ABS(a1-a2) <= tolerance));
-  }
-}
+// Horizontal segment [x1, x2] of the row y.
+struct Segment {
+  int x1, x2, y;
+  Segment() { }
+  Segment(int x1, int x2, int y) : x1(x1), x2(x2), y(y) { }
+};
 
-static inline bool color_equal_8(color_t c1, color_t c2, int tolerance)
+// Returns a word with the 16-bit lanes "lo" and "hi" (used to compare
+// two channels with one subtraction).
+inline uint32_t lanes(int lo, int hi)
 {
-  if (tolerance == 0)
-    return (c1 == c2);
-  else
-    return ABS((int)c1 - (int)c2) <= tolerance;
+  return uint32_t(lo) | (uint32_t(hi) << 16);
 }
 
+// Compares a pixel with the color where the flood fill started. With
+// tolerance, the channels of RGB and grayscale pixels are spread in
+// 16-bit lanes, so all channels of the pixel are compared with the
+// tolerance range at the same time (and without branches) using
+// packed subtractions.
 template<typename ImageTraits>
-static inline bool color_equal(color_t c1, color_t c2, int tolerance)
-{
-  static_assert(false && sizeof(ImageTraits), "Invalid color comparison");
-  return false;
-}
+class ColorMatcher;
 
 template<>
-inline bool color_equal<RgbTraits>(color_t c1, color_t c2, int tolerance)
-{
-  return color_equal_32(c1, c2, tolerance);
-}
-
-template<>
-inline bool color_equal<GrayscaleTraits>(color_t c1, color_t c2, int tolerance)
-{
-  return color_equal_16(c1, c2, tolerance);
-}
+class ColorMatcher<RgbTraits> {
+public:
+  ColorMatcher(color_t color, int tolerance)
+    : m_color(color)
+    , m_exact(tolerance == 0)
+    , m_transparent(rgba_geta(color) == 0) {
+    int lo[4], hi[4];
+    for (int i=0; i<4; ++i) {
+      int v = (color >> (8*i)) & 0xff;
+      lo[i] = std::max(0, v - tolerance);
+      hi[i] = std::min(255, v + tolerance) | 0x8000;
+    }
+    m_loRB = lanes(lo[0], lo[2]);
+    m_loGA = lanes(lo[1], lo[3]);
+    m_hiRB = lanes(hi[0], hi[2]);
+    m_hiGA = lanes(hi[1], hi[3]);
+  }
 
-template<>
-inline bool color_equal<IndexedTraits>(color_t c1, color_t c2, int tolerance)
-{
-  return color_equal_8(c1, c2, tolerance);
-}
+  bool operator()(uint32_t c) const {
+    if (m_exact)
+      return (c == m_color || (m_transparent && (c & rgba_a_mask) == 0));
+
+    uint32_t rb = c & 0x00ff00ff;
+    uint32_t ga = (c >> 8) & 0x00ff00ff;
+    // Bit 15 of each lane is kept only if lo <= channel <= hi
+    uint32_t t =
+      ((rb | 0x80008000) - m_loRB) & (m_hiRB - rb) &
+      ((ga | 0x80008000) - m_loGA) & (m_hiGA - ga);
+    return ((t & 0x80008000) == 0x80008000 ||
+            // Two transparent pixels are always equal
+            (m_transparent && (c & rgba_a_mask) == 0));
+  }
 
+private:
+  uint32_t m_color;
+  uint32_t m_loRB, m_loGA;
+  uint32_t m_hiRB, m_hiGA;
+  bool m_exact;
+  bool m_transparent;
+};
 
+template<>
+class ColorMatcher<GrayscaleTraits> {
+public:
+  ColorMatcher(color_t color, int tolerance)
+    : m_color(color)
+    , m_exact(tolerance == 0)
+    , m_transparent(graya_geta(color) == 0) {
+    int v = graya_getv(color);
+    int a = graya_geta(color);
+    m_lo = lanes(std::max(0, v - tolerance),
+                 std::max(0, a - tolerance));
+    m_hi = lanes(std::min(255, v + tolerance) | 0x8000,
+                 std::min(255, a + tolerance) | 0x8000);
+  }
 
-/* flooder:
- *  Fills a horizontal line around the specified position, and adds it
- *  to the list of drawn segments. Returns the first x coordinate after
- *  the part of the line which it has dealt with.
- */
-static int flooder(Image *image, int x, int y,
-  const gfx::Rect& bounds,
-  color_t src_color, int tolerance, void *data, AlgoHLine proc)
-{
-  FLOODED_LINE *p;
-  int left = 0, right = 0;
-  int c;
+  bool operator()(uint16_t c) const {
+    if (m_exact)
+      return (c == m_color || (m_transparent && (c & graya_a_mask) == 0));
 
-  switch (image->pixelFormat()) {
+    uint32_t va = (c & graya_v_mask) | (uint32_t(c & graya_a_mask) << 8);
+    uint32_t t = ((va | 0x80008000) - m_lo) & (m_hi - va);
+    return ((t & 0x80008000) == 0x80008000 ||
+            (m_transparent && (c & graya_a_mask) == 0));
+  }
 
-    case IMAGE_RGB:
-      {
-        uint32_t* address = reinterpret_cast<uint32_t*>(image->getPixelAddress(0, y));
+private:
+  uint16_t m_color;
+  uint32_t m_lo, m_hi;
+  bool m_exact;
+  bool m_transparent;
+};
 
-        // Check start pixel
-        if (!color_equal_32((int)*(address+x), src_color, tolerance))
-          return x+1;
+template<>
+class ColorMatcher<IndexedTraits> {
+public:
+  ColorMatcher(color_t color, int tolerance)
+    : m_lo(std::max(0, int(color) - tolerance))
+    , m_range(unsigned(std::min(255, int(color) + tolerance) - m_lo)) {
+  }
 
-        // Work left from starting point
-        for (left=x-1; left>=bounds.x; left--) {
-          if (!color_equal_32((int)*(address+left), src_color, tolerance))
-            break;
-        }
+  bool operator()(uint8_t c) const {
+    return (unsigned(c - m_lo) <= m_range);
+  }
 
-        // Work right from starting point
-        for (right=x+1; right<bounds.x2(); right++) {
-          if (!color_equal_32((int)*(address+right), src_color, tolerance))
-            break;
-        }
-      }
-      break;
+private:
+  int m_lo;
+  unsigned m_range;
+};
 
-    case IMAGE_GRAYSCALE:
-      {
-        uint16_t* address = reinterpret_cast<uint16_t*>(image->getPixelAddress(0, y));
+template<>
+class ColorMatcher<BitmapTraits> {
+public:
+  ColorMatcher(color_t color, int tolerance) : m_color(color) { }
 
-        // Check start pixel
-        if (!color_equal_16((int)*(address+x), src_color, tolerance))
-          return x+1;
+  bool operator()(color_t c) const {
+    return (c == m_color);
+  }
 
-        // Work left from starting point
-        for (left=x-1; left>=bounds.x; left--) {
-          if (!color_equal_16((int)*(address+left), src_color, tolerance))
-            break;
-        }
+private:
+  color_t m_color;
+};
 
-        // Work right from starting point
-        for (right=x+1; right<bounds.x2(); right++) {
-          if (!color_equal_16((int)*(address+right), src_color, tolerance))
-            break;
-        }
-      }
-      break;
+// Access to the pixels of one row of the image.
+template<typename ImageTraits>
+class RowReader {
+public:
+  RowReader(const Image* image, int y)
+    : m_row(reinterpret_cast<typename ImageTraits::const_address_t>(
+              image->getPixelAddress(0, y))) {
+  }
 
-    case IMAGE_INDEXED:
-      {
-        uint8_t* address = image->getPixelAddress(0, y);
+  typename ImageTraits::pixel_t operator[](int x) const {
+    return m_row[x];
+  }
 
-        // Check start pixel
-        if (!color_equal_8((int)*(address+x), src_color, tolerance))
-          return x+1;
+private:
+  typename ImageTraits::const_address_t m_row;
+};
 
-        // Work left from starting point
-        for (left=x-1; left>=bounds.x; left--) {
-          if (!color_equal_8((int)*(address+left), src_color, tolerance))
-            break;
-        }
+template<>
+class RowReader<BitmapTraits> {
+public:
+  RowReader(const Image* image, int y) : m_image(image), m_y(y) { }
 
-        // Work right from starting point
-        for (right=x+1; right<bounds.x2(); right++) {
-          if (!color_equal_8((int)*(address+right), src_color, tolerance))
-            break;
-        }
-      }
-      break;
+  color_t operator[](int x) const {
+    return get_pixel_fast<BitmapTraits>(m_image, x, m_y);
+  }
 
-    default:
-      // Check start pixel
-      if (get_pixel(image, x, y) != src_color)
-        return x+1;
+private:
+  const Image* m_image;
+  int m_y;
+};
 
-      // Work left from starting point
-      for (left=x-1; left>=bounds.x; left--) {
-        if (get_pixel(image, left, y) != src_color)
-          break;
-      }
+// Bit-packed set of the pixels already filled. Coordinates are
+// relative to the origin of the bounds.
+class VisitedPixels {
+public:
+  void reset(int w, int h) {
+    m_wordsPerRow = (w+63) / 64;
+    m_words.assign(std::size_t(m_wordsPerRow) * h, 0);
+  }
 
-      // Work right from starting point
-      for (right=x+1; right<bounds.x2(); right++) {
-        if (get_pixel(image, right, y) != src_color)
-          break;
+  // Returns the first not visited pixel in [x, x2] (or x2+1).
+  int nextNotVisited(int x, int x2, int y) const {
+    const uint64_t* words = row(y);
+    while (x <= x2) {
+      uint64_t bits = ~words[x >> 6] >> (x & 63);
+      if (bits) {
+        while (!(bits & 1)) {
+          bits >>= 1;
+          ++x;
+        }
+        return std::min(x, x2+1);
       }
-      break;
+      x = (x | 63) + 1;
+    }
+    return x2+1;
   }
 
-  left++;
-  right--;
-
-  /* draw the line */
-  (*proc)(left, y, right, data);
-
-  /* store it in the list of flooded segments */
-  c = y;
-  p = FLOOD_LINE(c);
-
-  if (p->flags) {
-    while (p->next) {
-      c = p->next;
-      p = FLOOD_LINE(c);
+  void visit(int x1, int x2, int y) {
+    uint64_t* words = row(y);
+    for (int x=x1; x<=x2; ) {
+      int bit = (x & 63);
+      int n = std::min(64 - bit, x2 - x + 1);
+      uint64_t mask = (n == 64 ? ~uint64_t(0): ((uint64_t(1) << n) - 1));
+      words[x >> 6] |= (mask << bit);
+      x += n;
     }
-
-    p->next = c = flood_count++;
-    flood_buf.resize(flood_count);
-    p = FLOOD_LINE(c);
   }
 
-  p->flags = FLOOD_IN_USE;
-  p->lpos = left;
-  p->rpos = right;
-  p->y = y;
-  p->next = 0;
+private:
+  const uint64_t* row(int y) const { return &m_words[std::size_t(m_wordsPerRow) * y]; }
+  uint64_t* row(int y) { return &m_words[std::size_t(m_wordsPerRow) * y]; }
 
-  if (y > bounds.y)
-    p->flags |= FLOOD_TODO_ABOVE;
-
-  if (y+1 < bounds.y2())
-    p->flags |= FLOOD_TODO_BELOW;
+  int m_wordsPerRow;
+  std::vector<uint64_t> m_words;
+};
 
-  return right+2;
-}
+// Buffers reused between calls to floodfill() to avoid allocating
+// them for each click of the paint bucket (floodfill() isn't
+// reentrant, as it was never).
+VisitedPixels flood_visited;
+std::vector<Segment> flood_stack;
+std::vector<std::vector<Segment> > flood_rows;
+
+// Scanline flood fill: each segment in the stack is a range of a row
+// where we have to look for pixels to fill, the pixels found are
+// extended to the left/right to fill the whole segment and the rows
+// above and below it are pushed in the stack.
+template<typename ImageTraits>
+void fill_contiguous(const Image* image, int x, int y,
+                     const gfx::Rect& bounds,
+                     const ColorMatcher<ImageTraits>& match,
+                     void* data, AlgoHLine proc)
+{
+  flood_visited.reset(bounds.w, bounds.h);
+  flood_stack.clear();
+  flood_stack.push_back(Segment(x, x, y));
 
+  while (!flood_stack.empty()) {
+    Segment seg = flood_stack.back();
+    flood_stack.pop_back();
 
+    RowReader<ImageTraits> row(image, seg.y);
+    int v = seg.y - bounds.y;
 
-/* check_flood_line:
- *  Checks a line segment, using the scratch buffer is to store a list of
- *  segments which have already been drawn in order to minimise the required
- *  number of tests.
- */
-static int check_flood_line(Image* image, int y, int left, int right,
-  const gfx::Rect& bounds,
-  int src_color, int tolerance, void *data, AlgoHLine proc)
-{
-  int c;
-  FLOODED_LINE *p;
-  int ret = false;
+    for (int u=seg.x1; u<=seg.x2; ++u) {
+      u = bounds.x + flood_visited.nextNotVisited(u - bounds.x, seg.x2 - bounds.x, v);
+      if (u > seg.x2)
+        break;
 
-  while (left <= right) {
-    c = y;
+      if (!match(row[u]))
+        continue;
 
-    for (;;) {
-      p = FLOOD_LINE(c);
+      int left = u, right = u;
+      while (left > bounds.x && match(row[left-1]))
+        --left;
+      while (right < bounds.x2()-1 && match(row[right+1]))
+        ++right;
 
-      if ((left >= p->lpos) && (left <= p->rpos)) {
-        left = p->rpos+2;
-        break;
-      }
+      flood_visited.visit(left - bounds.x, right - bounds.x, v);
+      (*proc)(left, seg.y, right, data);
 
-      c = p->next;
+      if (seg.y > bounds.y)
+        flood_stack.push_back(Segment(left, right, seg.y-1));
+      if (seg.y < bounds.y2()-1)
+        flood_stack.push_back(Segment(left, right, seg.y+1));
 
-      if (!c) {
-        left = flooder(image, left, y, bounds, src_color, tolerance, data, proc);
-        ret = true;
-        break;
-      }
+      u = right+1;
     }
   }
-
-  return ret;
 }
 
+// Adds the segments of the row "y" with pixels similar to the
+// reference color.
 template<typename ImageTraits>
-static void replace_color(Image* image, const gfx::Rect& bounds, int src_color, int tolerance, void *data, AlgoHLine proc)
+void find_row_segments(const Image* image, int y,
+                       const gfx::Rect& bounds,
+                       const ColorMatcher<ImageTraits>& match,
+                       std::vector<Segment>& segments)
 {
-  typename ImageTraits::address_t address;
+  RowReader<ImageTraits> row(image, y);
+  int x2 = bounds.x2();
+
+  for (int x=bounds.x; x<x2; ++x) {
+    if (match(row[x])) {
+      int x1 = x;
+      while (x+1 < x2 && match(row[x+1]))
+        ++x;
+      segments.push_back(Segment(x1, x, y));
+    }
+  }
+}
 
-  for (int y=bounds.y; y<bounds.y2(); ++y) {
-    address = reinterpret_cast<typename ImageTraits::address_t>(image->getPixelAddress(bounds.x, y));
+// Fills all pixels similar to the reference color. The rows are
+// compared in parallel in batches, and the "proc" is called from this
+// thread in the same order as rows (because "proc" is used to draw
+// with an ink, which is not thread-safe).
+template<typename ImageTraits>
+void fill_non_contiguous(const Image* image,
+                         const gfx::Rect& bounds,
+                         const ColorMatcher<ImageTraits>& match,
+                         void* data, AlgoHLine proc)
+{
+  const int rowsPerChunk = 16;
+  int threads = 1;
+  if (bounds.w * bounds.h >= 256*256)
+    threads = base::parallel_threads();
+
+  int chunksPerBatch = 2*threads;
+  flood_rows.resize(chunksPerBatch);
+
+  for (int batchY=bounds.y; batchY<bounds.y2();
+       batchY += chunksPerBatch*rowsPerChunk) {
+    int chunks = std::min(chunksPerBatch,
+                          (bounds.y2() - batchY + rowsPerChunk-1) / rowsPerChunk);
+
+    base::parallel_for(
+      0, chunks,
+      [&](int i) {
+        std::vector<Segment>& segments = flood_rows[i];
+        segments.clear();
+
+        int y1 = batchY + i*rowsPerChunk;
+        int y2 = std::min(y1 + rowsPerChunk, bounds.y2());
+        for (int y=y1; y<y2; ++y)
+          find_row_segments<ImageTraits>(image, y, bounds, match, segments);
+      },
+      threads);
+
+    for (int i=0; i<chunks; ++i)
+      for (const Segment& seg : flood_rows[i])
+        (*proc)(seg.x1, seg.y, seg.x2, data);
+  }
+}
 
-    for (int x=bounds.x; x<bounds.x2(); ++x, ++address) {
-      int right = -1;
+template<typename ImageTraits>
+void floodfill_templ(const Image* image, int x, int y,
+                     const gfx::Rect& bounds,
+                     int tolerance, bool contiguous,
+                     void* data, AlgoHLine proc)
+{
+  ColorMatcher<ImageTraits> match(get_pixel_fast<ImageTraits>(image, x, y), tolerance);
 
-      if (color_equal<ImageTraits>((int)(*address), src_color, tolerance)) {
-        ++address;
-        for (right=x+1; right<bounds.x2(); ++right, ++address) {
-          if (!color_equal<ImageTraits>((int)(*address), src_color, tolerance))
-            break;
-        }
-        (*proc)(x, y, right-1, data);
-        x = right;
-      }
-    }
-  }
+  if (contiguous)
+    fill_contiguous<ImageTraits>(image, x, y, bounds, match, data, proc);
+  else
+    fill_non_contiguous<ImageTraits>(image, bounds, match, data, proc);
 }
 
-/* floodfill:
- *  Fills an enclosed area (starting at point x, y) with the specified color.
- */
+} // anonymous namespace
+
 void floodfill(Image* image, int x, int y,
   const gfx::Rect& bounds,
   int tolerance, bool contiguous,
   void* data, AlgoHLine proc)
 {
-  // Make sure we have a valid starting point
-  if ((x < 0) || (x >= image->width()) ||
-      (y < 0) || (y >= image->height()))
-    return;
+  gfx::Rect rc = bounds.createIntersect(image->bounds());
 
-  // What color to replace?
-  color_t src_color = get_pixel(image, x, y);
-
-  // Non-contiguous case, we replace colors in the whole image.
-  if (!contiguous) {
-    switch (image->pixelFormat()) {
-      case IMAGE_RGB:
-        replace_color<RgbTraits>(image, bounds, src_color, tolerance, data, proc);
-        break;
-      case IMAGE_GRAYSCALE:
-        replace_color<GrayscaleTraits>(image, bounds, src_color, tolerance, data, proc);
-        break;
-      case IMAGE_INDEXED:
-        replace_color<IndexedTraits>(image, bounds, src_color, tolerance, data, proc);
-        break;
-    }
+  // Make sure we have a valid starting point
+  if (!rc.contains(gfx::Point(x, y)))
     return;
-  }
 
-  /* set up the list of flooded segments */
-  flood_buf.resize(image->height());
-  flood_count = image->height();
-  FLOODED_LINE* p = (FLOODED_LINE*)&flood_buf[0];
-  for (int c=0; c<flood_count; c++) {
-    p[c].flags = 0;
-    p[c].lpos = SHRT_MAX;
-    p[c].rpos = SHRT_MIN;
-    p[c].y = y;
-    p[c].next = 0;
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB:
+      floodfill_templ<RgbTraits>(image, x, y, rc, tolerance, contiguous, data, proc);
+      break;
+    case IMAGE_GRAYSCALE:
+      floodfill_templ<GrayscaleTraits>(image, x, y, rc, tolerance, contiguous, data, proc);
+      break;
+    case IMAGE_INDEXED:
+      floodfill_templ<IndexedTraits>(image, x, y, rc, tolerance, contiguous, data, proc);
+      break;
+    case IMAGE_BITMAP:
+      floodfill_templ<BitmapTraits>(image, x, y, rc, tolerance, contiguous, data, proc);
+      break;
   }
-
-  // Start up the flood algorithm
-  flooder(image, x, y, bounds, src_color, tolerance, data, proc);
-
-  // Continue as long as there are some segments still to test
-  bool done;
-  do {
-    done = true;
-
-    // For each line on the screen
-    for (int c=0; c<flood_count; c++) {
-
-      p = FLOOD_LINE(c);
-
-      // Check below the segment?
-      if (p->flags & FLOOD_TODO_BELOW) {
-        p->flags &= ~FLOOD_TODO_BELOW;
-        if (check_flood_line(image, p->y+1, p->lpos, p->rpos, bounds,
-            src_color, tolerance, data, proc)) {
-          done = false;
-          p = FLOOD_LINE(c);
-        }
-      }
-
-      // Check above the segment?
-      if (p->flags & FLOOD_TODO_ABOVE) {
-        p->flags &= ~FLOOD_TODO_ABOVE;
-        if (check_flood_line(image, p->y-1, p->lpos, p->rpos, bounds,
-                             src_color, tolerance, data, proc)) {
-          done = false;
-          // Special case shortcut for going backwards
-          if ((c > bounds.y) && (c < bounds.y2()))
-            c -= 2;
-        }
-      }
-    }
-  } while (!done);
 }
 
 } // namespace algorithm
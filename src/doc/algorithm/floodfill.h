@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2014 David Capello
+// Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -17,6 +17,10 @@ namespace doc {
 
   namespace algorithm {
 
+    // Calls "proc" for each horizontal line of pixels similar to the
+    // pixel in (x, y) (with the given "tolerance" for each channel).
+    // If "contiguous" is true, only pixels connected to (x, y) are
+    // filled, in other case all similar pixels inside "bounds".
     void floodfill(Image* image, int x, int y,
       const gfx::Rect& bounds,
       int tolerance, bool contiguous,
@@ -25,7 +25,7 @@ namespace algorithm {
 
 using namespace fixmath;
 
-static void ase_parallelogram_map_standard(Image *bmp, Image *sprite, fixed xs[4], fixed ys[4]);
+static void ase_parallelogram_map_standard(Image *bmp, const Image *sprite, fixed xs[4], fixed ys[4]);
 static void ase_rotate_scale_flip_coordinates(fixed w, fixed h,
                                               fixed x, fixed y,
                                               fixed cx, fixed cy,
@@ -117,7 +117,7 @@ void rotate_image(Image *dst, Image *src, int x, int y, int w, int h,
       |     |
       4-----3
  */
-void parallelogram(Image *bmp, Image *sprite,
+void parallelogram(Image *bmp, const Image *sprite,
   int x1, int y1, int x2, int y2,
   int x3, int y3, int x4, int y4)
 {
@@ -138,7 +138,7 @@ void parallelogram(Image *bmp, Image *sprite,
 // Scanline drawers.
 
 template<class Traits, class Delegate>
-static void draw_scanline(Image *bmp, Image *spr,
+static void draw_scanline(Image *bmp, const Image *spr,
   fixed l_bmp_x, int bmp_y_i,
   fixed r_bmp_x,
   fixed l_spr_x, fixed l_spr_y,
@@ -187,7 +187,7 @@ public:
     m_mask_color = mask_color;
   }
 
-  void feedLine(Image* spr, int spr_x, int spr_y) {
+  void feedLine(const Image* spr, int spr_x, int spr_y) {
     ASSERT(m_it != m_end);
 
     int c = spr->getPixel(spr_x, spr_y);
@@ -209,7 +209,7 @@ public:
     m_mask_color = mask_color;
   }
 
-  void feedLine(Image* spr, int spr_x, int spr_y) {
+  void feedLine(const Image* spr, int spr_x, int spr_y) {
     ASSERT(m_it != m_end);
 
     int c = spr->getPixel(spr_x, spr_y);
@@ -230,7 +230,7 @@ public:
     m_mask_color(mask_color) {
   }
 
-  void feedLine(Image* spr, int spr_x, int spr_y) {
+  void feedLine(const Image* spr, int spr_x, int spr_y) {
     ASSERT(m_it != m_end);
 
     color_t c = spr->getPixel(spr_x, spr_y);
@@ -245,7 +245,7 @@ private:
 
 class BitmapDelegate : public GenericDelegate<BitmapTraits> {
 public:
-  void feedLine(Image* spr, int spr_x, int spr_y) {
+  void feedLine(const Image* spr, int spr_x, int spr_y) {
     ASSERT(m_it != m_end);
 
     int c = spr->getPixel(spr_x, spr_y);
@@ -281,7 +281,7 @@ public:
  */
 template<class Traits, class Delegate>
 static void ase_parallelogram_map(
-  Image *bmp, Image *spr, fixed xs[4], fixed ys[4],
+  Image *bmp, const Image *spr, fixed xs[4], fixed ys[4],
   int sub_pixel_accuracy, Delegate delegate)
 {
   /* Index in xs[] and ys[] to topmost point. */
@@ -684,7 +684,7 @@ static void ase_parallelogram_map(
  *  _parallelogram_map() function since then you can bypass it and define
  *  your own scanline drawer, eg. for anti-aliased rotations.
  */
-static void ase_parallelogram_map_standard(Image *bmp, Image *sprite,
+static void ase_parallelogram_map_standard(Image *bmp, const Image *sprite,
                                            fixed xs[4], fixed ys[4])
 {
   switch (bmp->pixelFormat()) {
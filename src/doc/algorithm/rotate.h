@@ -20,7 +20,7 @@ namespace doc {
       int x, int y, int w, int h,
       int cx, int cy, double angle);
 
-    void parallelogram(Image* bmp, Image* sprite,
+    void parallelogram(Image* bmp, const Image* sprite,
       int x1, int y1, int x2, int y2,
       int x3, int y3, int x4, int y4);
 
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2014 David Capello
+// Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -8,188 +8,383 @@
 #include "config.h"
 #endif
 
-#include "base/unique_ptr.h"
-#include "doc/algorithm/rotate.h"
+#include "doc/algorithm/rotsprite.h"
+
+#include "base/parallel_for.h"
 #include "doc/blend.h"
 #include "doc/image.h"
-#include "doc/image_bits.h"
+#include "doc/image_traits.h"
 #include "doc/primitives.h"
 #include "doc/primitives_fast.h"
+#include "gfx/rect.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
 
 namespace doc {
 namespace algorithm {
 
+namespace {
+
+// The source image is scaled three times with Scale2x.
+const int kScaleLevels = 3;
+const int kScale = (1 << kScaleLevels);
+
+// Size of destination tiles processed by each thread.
+const int kTileSize = 64;
+
+// Maximum number of source pixels (before the 8x scale) used by one
+// tile. Bigger tiles (e.g. when the image is scaled down) are split.
+const int kMaxTileSourcePixels = 96*96;
+
+// Number of extra source pixels around the area used by one tile, so
+// Scale2x produces the same pixels in the area as if the whole image
+// was scaled. Scale2x reads the 4-neighbors of each pixel, so the
+// wrong pixels produced by the clamped borders of a cropped area
+// grow one pixel in each level (1, 3, and 7 scaled pixels, i.e. less
+// than 2 source pixels after the three levels).
+const int kScale2xMargin = 2;
+
+// Pixels of a part of an image in a plain buffer (used for all pixel
+// formats).
+struct Pixels {
+  int w, h;
+  std::vector<color_t> data;
+
+  void resize(int w, int h) {
+    this->w = w;
+    this->h = h;
+    data.resize(std::size_t(w) * h);
+  }
+
+  color_t* row(int y) { return &data[std::size_t(w) * y]; }
+  const color_t* row(int y) const { return &data[std::size_t(w) * y]; }
+};
+
 // More information about EPX/Scale2x:
 // http://en.wikipedia.org/wiki/Pixel_art_scaling_algorithms#EPX.2FScale2.C3.97.2FAdvMAME2.C3.97
 // http://scale2x.sourceforge.net/algorithm.html
 // http://scale2x.sourceforge.net/scale2xandepx.html
-template<typename ImageTraits>
-static void image_scale2x_tpl(Image* dst, const Image* src, int src_w, int src_h)
+//
+// Neighbors of each pixel P:
+//   A
+// C P B
+//   D
+inline void scale2x_pixel(color_t A, color_t B, color_t C, color_t D, color_t P,
+                          color_t* dst0, color_t* dst1)
 {
-#if 0      // TODO complete this implementation that should be faster
-           // than using a lot of get/put_pixel_fast calls.
-  int dst_w = src_w*2;
-  int dst_h = src_h*2;
-
-  LockImageBits<ImageTraits> dstBits(dst, Image::WriteLock, gfx::Rect(0, 0, dst_w, dst_h));
-  const LockImageBits<ImageTraits> srcBits(src);
-
-  LockImageBits<ImageTraits>::iterator dstRow0_it = dstBits.begin();
-  LockImageBits<ImageTraits>::iterator dstRow1_it = dstBits.begin();
-  LockImageBits<ImageTraits>::iterator dstRow0_end = dstBits.end();
-  LockImageBits<ImageTraits>::iterator dstRow1_end = dstBits.end();
-
-  // Iterators:
-  //   A
-  // C P B
-  //   D
-  //
-  // These iterators are displaced through src image and are modified in this way:
-  //
-  // P: is the simplest one, we just start from (0, 0) to srcEnd.
-  // A: starts from row 0 (so A = P in the first row), then we start
-  //    again from the row 0.
-  // B: It starts from (1, row) and in the last pixel we don't moved it.
-  // C: It starts from (0, 0) and then it is moved with a delay.
-  // D: It starts from row 1 and continues until we reach the last
-  //    row, in that case we start D iterator again.
-  //
-  LockImageBits<ImageTraits>::const_iterator itP, itA, itB, itC, itD, savedD;
-  LockImageBits<ImageTraits>::const_iterator srcEnd = srcBits.end();
-  color_t P, A, B, C, D;
-
-  // Adjust iterators
-  itP = itA = itB = itC = itD = savedD = srcBits.begin();
-  dstRow1_it += dst_w;
-  itD += src->width();
-
-  for (int y=0; y<src_h; ++y) {
-    if (y == 1) itA = srcBits.begin();
-    if (y == src_h-2) savedD = itD;
-    if (y == src_h-1) itD = savedD;
-    ++itB;
-
-    for (int x=0; x<src_w; ++x) {
-      ASSERT(itP != srcEnd);
-      ASSERT(itA != srcEnd);
-      ASSERT(itB != srcEnd);
-      ASSERT(itC != srcEnd);
-      ASSERT(itD != srcEnd);
-      ASSERT(dstRow0_it != dstRow0_end);
-      ASSERT(dstRow1_it != dstRow1_end);
-
-      P = *itP;
-      A = *itA;                 // y-1
-      B = *itB;                 // x+1
-      C = *itC;                 // x-1
-      D = *itD;                 // y+1
-
-      *dstRow0_it = (C == A && C != D && A != B ? A: P);
-      ++dstRow0_it;
-      *dstRow0_it = (A == B && A != C && B != D ? B: P);
-      ++dstRow0_it;
-
-      *dstRow1_it = (D == C && D != B && C != A ? C: P);
-      ++dstRow1_it;
-      *dstRow1_it = (B == D && B != A && D != C ? D: P);
-      ++dstRow1_it;
-
-      ++itP;
-      ++itA;
-      if (x < src_w-2) ++itB;
-      if (x > 0) ++itC;
-      ++itD;
+  dst0[0] = (C == A && C != D && A != B ? A: P);
+  dst0[1] = (A == B && A != C && B != D ? B: P);
+  dst1[0] = (D == C && D != B && C != A ? C: P);
+  dst1[1] = (B == D && B != A && D != C ? D: P);
+}
+
+// Pixels outside "src" are the same as the closest pixel in the border.
+void scale2x(const Pixels& src, Pixels& dst)
+{
+  const int w = src.w;
+  const int h = src.h;
+  dst.resize(w*2, h*2);
+
+  for (int y=0; y<h; ++y) {
+    const color_t* up = src.row(y > 0 ? y-1: y);
+    const color_t* row = src.row(y);
+    const color_t* down = src.row(y < h-1 ? y+1: y);
+    color_t* dst0 = dst.row(2*y);
+    color_t* dst1 = dst.row(2*y+1);
+
+    if (w == 1) {
+      scale2x_pixel(up[0], row[0], row[0], down[0], row[0], dst0, dst1);
+      continue;
     }
 
-    // Adjust iterators for the next two rows.
-    ++itB;
-    ++itC;
-    dstRow0_it += dst_w;
-    if (y < src_h-1)
-      dstRow1_it += dst_w;
-  }
-
-  // ASSERT(itP == srcEnd);
-  // ASSERT(itA == srcEnd);
-  // ASSERT(itB == srcEnd);
-  // ASSERT(itC == srcEnd);
-  // ASSERT(itD == srcEnd);
-  ASSERT(dstRow0_it == dstRow0_end);
-  ASSERT(dstRow1_it == dstRow1_end);
-#else
-
-#define A c[0]
-#define B c[1]
-#define C c[2]
-#define D c[3]
-#define P c[4]
-
-  color_t c[5];
-  for (int y=0; y<src_h; ++y) {
-    for (int x=0; x<src_w; ++x) {
-      P = get_pixel_fast<ImageTraits>(src, x, y);
-      A = (y > 0 ? get_pixel_fast<ImageTraits>(src, x, y-1): P);
-      B = (x < src_w-1 ? get_pixel_fast<ImageTraits>(src, x+1, y): P);
-      C = (x > 0 ? get_pixel_fast<ImageTraits>(src, x-1, y): P);
-      D = (y < src_h-1 ? get_pixel_fast<ImageTraits>(src, x, y+1): P);
-
-      put_pixel_fast<ImageTraits>(dst, 2*x,   2*y,   (C == A && C != D && A != B ? A: P));
-      put_pixel_fast<ImageTraits>(dst, 2*x+1, 2*y,   (A == B && A != C && B != D ? B: P));
-      put_pixel_fast<ImageTraits>(dst, 2*x,   2*y+1, (D == C && D != B && C != A ? C: P));
-      put_pixel_fast<ImageTraits>(dst, 2*x+1, 2*y+1, (B == D && B != A && D != C ? D: P));
+    scale2x_pixel(up[0], row[1], row[0], down[0], row[0], dst0, dst1);
+
+    // Pixels with all neighbors inside the row (a loop without
+    // special cases that the compiler can vectorize)
+    for (int x=1; x<w-1; ++x)
+      scale2x_pixel(up[x], row[x+1], row[x-1], down[x], row[x],
+                    dst0+2*x, dst1+2*x);
+
+    scale2x_pixel(up[w-1], row[w-1], row[w-2], down[w-1], row[w-1],
+                  dst0+2*(w-1), dst1+2*(w-1));
+  }
+}
+
+// Affine transformation from destination pixels to source pixels,
+// where the source image is mapped to the given parallelogram.
+class InverseMapping {
+public:
+  InverseMapping(int srcW, int srcH,
+                 int x1, int y1, int x2, int y2, int x4, int y4)
+    : m_x1(x1), m_y1(y1) {
+    // Displacement in the destination for each source pixel
+    double ax = double(x2 - x1) / srcW;
+    double ay = double(y2 - y1) / srcW;
+    double bx = double(x4 - x1) / srcH;
+    double by = double(y4 - y1) / srcH;
+    double det = ax*by - ay*bx;
+
+    m_valid = (det != 0.0);
+    if (m_valid) {
+      m_sx = by / det;
+      m_sy = -bx / det;
+      m_tx = -ay / det;
+      m_ty = ax / det;
     }
   }
 
-#endif
-}
+  bool isValid() const { return m_valid; }
+
+  // Source position (in source pixels) of the destination point (x, y).
+  void map(double x, double y, double& s, double& t) const {
+    x -= m_x1;
+    y -= m_y1;
+    s = x*m_sx + y*m_sy;
+    t = x*m_tx + y*m_ty;
+  }
+
+  // Pixel of the 8x scaled source image which is used for the
+  // destination pixel (x, y), i.e. the first sub-pixel of (x, y) if
+  // the destination were scaled 8x too.
+  void mapPixel(int x, int y, int& S, int& T) const {
+    double s, t;
+    map(x + 0.5/kScale, y + 0.5/kScale, s, t);
+    S = int(std::floor(s * kScale));
+    T = int(std::floor(t * kScale));
+  }
+
+  // Source pixels used by the destination pixels in "bounds".
+  gfx::Rect sourceBounds(const gfx::Rect& bounds) const {
+    double s, t;
+    double s1 = 0, t1 = 0, s2 = 0, t2 = 0;
+    for (int i=0; i<4; ++i) {
+      map(i & 1 ? bounds.x2(): bounds.x,
+          i & 2 ? bounds.y2(): bounds.y, s, t);
+      if (i == 0 || s < s1) s1 = s;
+      if (i == 0 || t < t1) t1 = t;
+      if (i == 0 || s > s2) s2 = s;
+      if (i == 0 || t > t2) t2 = t;
+    }
+    // One extra pixel for rounding errors
+    int u1 = int(std::floor(s1)) - 1;
+    int v1 = int(std::floor(t1)) - 1;
+    int u2 = int(std::ceil(s2)) + 1;
+    int v2 = int(std::ceil(t2)) + 1;
+    return gfx::Rect(u1, v1, u2-u1+1, v2-v1+1);
+  }
+
+private:
+  int m_x1, m_y1;
+  double m_sx, m_sy, m_tx, m_ty;
+  bool m_valid;
+};
+
+// Draws a pixel of the source image in the destination, skipping the
+// mask color of the source.
+template<typename ImageTraits>
+class PixelDrawer;
 
-static void image_scale2x(Image* dst, const Image* src, int src_w, int src_h)
+template<>
+class PixelDrawer<RgbTraits> {
+public:
+  PixelDrawer(color_t maskColor)
+    : m_maskColor(maskColor)
+    , m_blender(rgba_blenders[BLEND_MODE_NORMAL]) {
+  }
+
+  color_t operator()(color_t dst, color_t src) const {
+    if (rgba_geta(m_maskColor) == 0 ||
+        (src & rgba_rgb_mask) != (m_maskColor & rgba_rgb_mask))
+      return m_blender(dst, src, 255);
+    else
+      return dst;
+  }
+
+private:
+  color_t m_maskColor;
+  BLEND_COLOR m_blender;
+};
+
+template<>
+class PixelDrawer<GrayscaleTraits> {
+public:
+  PixelDrawer(color_t maskColor)
+    : m_maskColor(maskColor)
+    , m_blender(graya_blenders[BLEND_MODE_NORMAL]) {
+  }
+
+  color_t operator()(color_t dst, color_t src) const {
+    if (graya_geta(m_maskColor) == 0 ||
+        (src & graya_v_mask) != (m_maskColor & graya_v_mask))
+      return m_blender(dst, src, 255);
+    else
+      return dst;
+  }
+
+private:
+  color_t m_maskColor;
+  BLEND_COLOR m_blender;
+};
+
+template<>
+class PixelDrawer<IndexedTraits> {
+public:
+  PixelDrawer(color_t maskColor) : m_maskColor(maskColor) { }
+
+  color_t operator()(color_t dst, color_t src) const {
+    return (src != m_maskColor ? src: dst);
+  }
+
+private:
+  color_t m_maskColor;
+};
+
+template<>
+class PixelDrawer<BitmapTraits> {
+public:
+  PixelDrawer(color_t maskColor) { }
+
+  color_t operator()(color_t dst, color_t src) const {
+    return (src != 0 ? src: dst);
+  }
+};
+
+// Adds the part of the given grid cell inside "bounds" to the list of
+// tiles, splitting the cell if it uses too many source pixels. Cells
+// are aligned to multiples of 8 pixels, so two threads never write
+// in the same byte of a bitmap image.
+void add_tile(const InverseMapping& mapping,
+              const gfx::Rect& srcBounds,
+              const gfx::Rect& bounds,
+              const gfx::Rect& cell,
+              std::vector<gfx::Rect>& tiles)
 {
-  switch (src->pixelFormat()) {
-    case IMAGE_RGB:       image_scale2x_tpl<RgbTraits>(dst, src, src_w, src_h); break;
-    case IMAGE_GRAYSCALE: image_scale2x_tpl<GrayscaleTraits>(dst, src, src_w, src_h); break;
-    case IMAGE_INDEXED:   image_scale2x_tpl<IndexedTraits>(dst, src, src_w, src_h); break;
-    case IMAGE_BITMAP:    image_scale2x_tpl<BitmapTraits>(dst, src, src_w, src_h); break;
+  gfx::Rect tile = cell.createIntersect(bounds);
+  if (tile.isEmpty())
+    return;
+
+  gfx::Rect area = mapping.sourceBounds(tile).createIntersect(srcBounds);
+  if (area.isEmpty())
+    return;
+
+  if (area.w * area.h > kMaxTileSourcePixels &&
+      (cell.w > 8 || cell.h > 8)) {
+    int w = std::max(8, (cell.w/2) & ~7);
+    int h = std::max(8, (cell.h/2) & ~7);
+    for (int y=cell.y; y<cell.y2(); y+=h)
+      for (int x=cell.x; x<cell.x2(); x+=w)
+        add_tile(mapping, srcBounds, bounds,
+                 gfx::Rect(x, y, w, h).createIntersect(cell), tiles);
   }
+  else
+    tiles.push_back(tile);
 }
-  
-void rotsprite_image(Image* bmp, Image* spr,
-  int x1, int y1, int x2, int y2,
-  int x3, int y3, int x4, int y4)
+
+template<typename ImageTraits>
+void draw_tile(Image* bmp, const Image* spr,
+               const InverseMapping& mapping,
+               const gfx::Rect& tile)
 {
-  static ImageBufferPtr buf1, buf2, buf3; // TODO non-thread safe
+  // Source pixels used by this tile plus the margin needed by Scale2x
+  gfx::Rect area = mapping.sourceBounds(tile);
+  area.enlarge(kScale2xMargin);
+  area = area.createIntersect(spr->bounds());
+  if (area.isEmpty())
+    return;
 
-  if (!buf1) buf1.reset(new ImageBuffer(1));
-  if (!buf2) buf2.reset(new ImageBuffer(1));
-  if (!buf3) buf3.reset(new ImageBuffer(1));
+  Pixels a, b;
+  a.resize(area.w, area.h);
+  for (int y=0; y<area.h; ++y) {
+    color_t* row = a.row(y);
+    for (int x=0; x<area.w; ++x)
+      row[x] = get_pixel_fast<ImageTraits>(spr, area.x+x, area.y+y);
+  }
 
-  int scale = 8;
-  base::UniquePtr<Image> bmp_copy(Image::create(bmp->pixelFormat(), bmp->width()*scale, bmp->height()*scale, buf1));
-  base::UniquePtr<Image> tmp_copy(Image::create(spr->pixelFormat(), spr->width()*scale, spr->height()*scale, buf2));
-  base::UniquePtr<Image> spr_copy(Image::create(spr->pixelFormat(), spr->width()*scale, spr->height()*scale, buf3));
+  for (int i=0; i<kScaleLevels; ++i) {
+    scale2x(a, b);
+    std::swap(a, b);
+  }
 
-  color_t maskColor = spr->maskColor();
+  // Sample the 8x scaled source image
+  const int scaledX = area.x * kScale;
+  const int scaledY = area.y * kScale;
+  const int scaledW = spr->width() * kScale;
+  const int scaledH = spr->height() * kScale;
+  PixelDrawer<ImageTraits> draw(spr->maskColor());
 
-  bmp_copy->setMaskColor(maskColor);
-  tmp_copy->setMaskColor(maskColor);
-  spr_copy->setMaskColor(maskColor);
+  for (int y=tile.y; y<tile.y2(); ++y) {
+    for (int x=tile.x; x<tile.x2(); ++x) {
+      int S, T;
+      mapping.mapPixel(x, y, S, T);
+      if (S < 0 || T < 0 || S >= scaledW || T >= scaledH)
+        continue;
 
-  bmp_copy->clear(bmp->maskColor());
-  spr_copy->clear(maskColor);
-  spr_copy->copy(spr, gfx::Clip(spr->bounds()));
+      S -= scaledX;
+      T -= scaledY;
+      if (S < 0 || T < 0 || S >= a.w || T >= a.h) {
+        ASSERT(false);          // sourceBounds() should include this pixel
+        continue;
+      }
 
-  for (int i=0; i<3; ++i) {
-    tmp_copy->clear(maskColor);
-    image_scale2x(tmp_copy, spr_copy, spr->width()*(1<<i), spr->height()*(1<<i));
-    spr_copy->copy(tmp_copy, gfx::Clip(tmp_copy->bounds()));
+      put_pixel_fast<ImageTraits>(bmp, x, y,
+        draw(get_pixel_fast<ImageTraits>(bmp, x, y), a.row(T)[S]));
+    }
   }
+}
+
+template<typename ImageTraits>
+void rotsprite_image_templ(Image* bmp, const Image* spr,
+                           const InverseMapping& mapping,
+                           const gfx::Rect& bounds,
+                           const std::atomic<bool>* cancel)
+{
+  // "bounds" is inside the destination image, so the grid starts in a
+  // non-negative multiple of kTileSize
+  std::vector<gfx::Rect> tiles;
+  for (int y=bounds.y - bounds.y%kTileSize; y<bounds.y2(); y+=kTileSize)
+    for (int x=bounds.x - bounds.x%kTileSize; x<bounds.x2(); x+=kTileSize)
+      add_tile(mapping, spr->bounds(), bounds,
+               gfx::Rect(x, y, kTileSize, kTileSize), tiles);
 
-  doc::algorithm::parallelogram(bmp_copy, spr_copy,
-    x1*scale, y1*scale, x2*scale, y2*scale,
-    x3*scale, y3*scale, x4*scale, y4*scale);
+  // Each tile is drawn in its own part of the destination image
+  base::parallel_for(
+    0, int(tiles.size()),
+    [&](int i) {
+      if (!cancel || !*cancel)
+        draw_tile<ImageTraits>(bmp, spr, mapping, tiles[i]);
+    });
+}
 
-  doc::algorithm::scale_image(bmp, bmp_copy,
-    0, 0, bmp->width(), bmp->height());
+} // anonymous namespace
+
+void rotsprite_image(Image* bmp, const Image* spr,
+  int x1, int y1, int x2, int y2,
+  int x3, int y3, int x4, int y4,
+  const std::atomic<bool>* cancel)
+{
+  InverseMapping mapping(spr->width(), spr->height(),
+                         x1, y1, x2, y2, x4, y4);
+  if (!mapping.isValid())
+    return;
+
+  // Destination pixels inside the parallelogram
+  int u1 = std::min(std::min(x1, x2), std::min(x3, x4));
+  int v1 = std::min(std::min(y1, y2), std::min(y3, y4));
+  int u2 = std::max(std::max(x1, x2), std::max(x3, x4));
+  int v2 = std::max(std::max(y1, y2), std::max(y3, y4));
+  gfx::Rect bounds = gfx::Rect(u1, v1, u2-u1+1, v2-v1+1)
+    .createIntersect(bmp->bounds());
+  if (bounds.isEmpty())
+    return;
+
+  switch (bmp->pixelFormat()) {
+    case IMAGE_RGB:       rotsprite_image_templ<RgbTraits>(bmp, spr, mapping, bounds, cancel); break;
+    case IMAGE_GRAYSCALE: rotsprite_image_templ<GrayscaleTraits>(bmp, spr, mapping, bounds, cancel); break;
+    case IMAGE_INDEXED:   rotsprite_image_templ<IndexedTraits>(bmp, spr, mapping, bounds, cancel); break;
+    case IMAGE_BITMAP:    rotsprite_image_templ<BitmapTraits>(bmp, spr, mapping, bounds, cancel); break;
+  }
 }
 
 } // namespace algorithm
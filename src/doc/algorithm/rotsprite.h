@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2014 David Capello
+// Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -8,14 +8,23 @@
 #define DOC_ALGORITHM_ROTSPRITE_H_INCLUDED
 #pragma once
 
+#include <atomic>
+
 namespace doc {
   class Image;
 
   namespace algorithm {
 
-    void rotsprite_image(Image* bmp, Image* spr,
+    // Draws "spr" (scaled with Scale2x three times) in the
+    // parallelogram (x1,y1)-(x2,y2)-(x3,y3)-(x4,y4) of "bmp". The
+    // destination is processed in tiles (in parallel), and each tile
+    // only scales the part of "spr" that it needs. If "cancel" is
+    // set to true (e.g. from other thread), the remaining tiles are
+    // not drawn.
+    void rotsprite_image(Image* bmp, const Image* spr,
       int x1, int y1, int x2, int y2,
-      int x3, int y3, int x4, int y4);
+      int x3, int y3, int x4, int y4,
+      const std::atomic<bool>* cancel = nullptr);
 
   } // namespace algorithm
 } // namespace doc
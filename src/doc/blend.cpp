@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2014 David Capello
+// Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -11,6 +11,12 @@
 #include "doc/blend.h"
 #include "doc/image.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_BLEND_SSE2 1
+  #include <emmintrin.h>
+#endif
+
 namespace doc {
 
 BLEND_COLOR rgba_blenders[] =
@@ -314,4 +320,231 @@ int indexed_blend_direct(int back, int front, int opacity)
   return front;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Span blenders
+
+template<typename Pixel, typename Blender>
+static inline void blend_span_scalar(Pixel* dst, const Pixel* back, const Pixel* front,
+                                     int n, int opacity, Pixel mask, Blender blender)
+{
+  for (int i=0; i<n; ++i) {
+    if (front[i] != mask)
+      dst[i] = blender(back[i], front[i], opacity);
+    else
+      dst[i] = back[i];
+  }
+}
+
+#ifdef DOC_BLEND_SSE2
+
+// Multiplies 32-bit integers (the result must fit in 24 bits, so it
+// can be calculated exactly with floats).
+static inline __m128i mul_epi32(__m128i a, __m128i b)
+{
+  return _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(a), _mm_cvtepi32_ps(b)));
+}
+
+// INT_MULT() for 4 integers (a and b must be in [-255, 255])
+static inline __m128i int_mult_epi32(__m128i a, __m128i b)
+{
+  __m128i t = _mm_add_epi32(mul_epi32(a, b), _mm_set1_epi32(0x80));
+  return _mm_srai_epi32(_mm_add_epi32(_mm_srai_epi32(t, 8), t), 8);
+}
+
+static inline __m128i select_epi32(__m128i cond, __m128i a, __m128i b)
+{
+  return _mm_or_si128(_mm_and_si128(cond, a), _mm_andnot_si128(cond, b));
+}
+
+// Same as rgba_blend_normal() for 4 pixels
+static inline __m128i rgba_blend_normal_sse2(__m128i b, __m128i f, __m128i opacity)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ff = _mm_set1_epi32(0xff);
+
+  __m128i B_r = _mm_and_si128(b, ff);
+  __m128i B_g = _mm_and_si128(_mm_srli_epi32(b, 8), ff);
+  __m128i B_b = _mm_and_si128(_mm_srli_epi32(b, 16), ff);
+  __m128i B_a = _mm_srli_epi32(b, 24);
+
+  __m128i F_r = _mm_and_si128(f, ff);
+  __m128i F_g = _mm_and_si128(_mm_srli_epi32(f, 8), ff);
+  __m128i F_b = _mm_and_si128(_mm_srli_epi32(f, 16), ff);
+  __m128i F_a = _mm_srli_epi32(f, 24);
+  F_a = int_mult_epi32(F_a, opacity);
+
+  __m128i D_a = _mm_sub_epi32(_mm_add_epi32(B_a, F_a), int_mult_epi32(B_a, F_a));
+
+  // D_a is zero only in pixels where the back alpha is zero (which
+  // are discarded below), so we avoid the division by zero using 1.
+  __m128 D_af = _mm_cvtepi32_ps(
+    _mm_sub_epi32(D_a, _mm_cmpeq_epi32(D_a, zero)));
+  __m128 F_af = _mm_cvtepi32_ps(F_a);
+
+  // (F-B) * F_a / D_a truncated towards zero. The quotient is exact
+  // enough in floats because |(F-B) * F_a| <= 255*255.
+#define BLEND_CHANNEL(B, F)                                             \
+  _mm_add_epi32(B,                                                      \
+    _mm_cvttps_epi32(                                                   \
+      _mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(F, B)), F_af), \
+                 D_af)))
+
+  __m128i D_r = BLEND_CHANNEL(B_r, F_r);
+  __m128i D_g = BLEND_CHANNEL(B_g, F_g);
+  __m128i D_b = BLEND_CHANNEL(B_b, F_b);
+
+#undef BLEND_CHANNEL
+
+  __m128i result =
+    _mm_or_si128(
+      _mm_or_si128(D_r, _mm_slli_epi32(D_g, 8)),
+      _mm_or_si128(_mm_slli_epi32(D_b, 16), _mm_slli_epi32(D_a, 24)));
+
+  // Front alpha == 0 -> back
+  result = select_epi32(_mm_cmpeq_epi32(_mm_srli_epi32(f, 24), zero), b, result);
+
+  // Back alpha == 0 -> front with the opacity applied
+  result = select_epi32(
+    _mm_cmpeq_epi32(B_a, zero),
+    _mm_or_si128(_mm_and_si128(f, _mm_set1_epi32(0xffffff)),
+                 _mm_slli_epi32(F_a, 24)),
+    result);
+
+  return result;
+}
+
+// Same as rgba_blend_merge() for 4 pixels
+static inline __m128i rgba_blend_merge_sse2(__m128i b, __m128i f, __m128i opacity)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ff = _mm_set1_epi32(0xff);
+
+  __m128i B_r = _mm_and_si128(b, ff);
+  __m128i B_g = _mm_and_si128(_mm_srli_epi32(b, 8), ff);
+  __m128i B_b = _mm_and_si128(_mm_srli_epi32(b, 16), ff);
+  __m128i B_a = _mm_srli_epi32(b, 24);
+
+  __m128i F_r = _mm_and_si128(f, ff);
+  __m128i F_g = _mm_and_si128(_mm_srli_epi32(f, 8), ff);
+  __m128i F_b = _mm_and_si128(_mm_srli_epi32(f, 16), ff);
+  __m128i F_a = _mm_srli_epi32(f, 24);
+
+  __m128i D_r = _mm_add_epi32(B_r, int_mult_epi32(_mm_sub_epi32(F_r, B_r), opacity));
+  __m128i D_g = _mm_add_epi32(B_g, int_mult_epi32(_mm_sub_epi32(F_g, B_g), opacity));
+  __m128i D_b = _mm_add_epi32(B_b, int_mult_epi32(_mm_sub_epi32(F_b, B_b), opacity));
+  __m128i D_a = _mm_add_epi32(B_a, int_mult_epi32(_mm_sub_epi32(F_a, B_a), opacity));
+
+  __m128i D_rgb =
+    _mm_or_si128(D_r,
+      _mm_or_si128(_mm_slli_epi32(D_g, 8), _mm_slli_epi32(D_b, 16)));
+
+  // Front alpha == 0 -> back RGB, back alpha == 0 -> front RGB
+  D_rgb = select_epi32(_mm_cmpeq_epi32(F_a, zero),
+                       _mm_and_si128(b, _mm_set1_epi32(0xffffff)), D_rgb);
+  D_rgb = select_epi32(_mm_cmpeq_epi32(B_a, zero),
+                       _mm_and_si128(f, _mm_set1_epi32(0xffffff)), D_rgb);
+
+  // Result alpha == 0 -> RGB = 0
+  D_rgb = _mm_andnot_si128(_mm_cmpeq_epi32(D_a, zero), D_rgb);
+
+  return _mm_or_si128(D_rgb, _mm_slli_epi32(D_a, 24));
+}
+
+template<__m128i (*Blend)(__m128i, __m128i, __m128i), typename Blender>
+static void rgba_blend_span_sse2(uint32_t* dst, const uint32_t* back, const uint32_t* front,
+                                 int n, int opacity, uint32_t mask, Blender blender)
+{
+  const __m128i opacity4 = _mm_set1_epi32(opacity);
+  const __m128i mask4 = _mm_set1_epi32(mask);
+  int i = 0;
+
+  for (; i+4<=n; i+=4) {
+    __m128i b = _mm_loadu_si128((const __m128i*)(back+i));
+    __m128i f = _mm_loadu_si128((const __m128i*)(front+i));
+    __m128i d = select_epi32(_mm_cmpeq_epi32(f, mask4), b, Blend(b, f, opacity4));
+    _mm_storeu_si128((__m128i*)(dst+i), d);
+  }
+
+  blend_span_scalar(dst+i, back+i, front+i, n-i, opacity, mask, blender);
+}
+
+#endif // DOC_BLEND_SSE2
+
+void rgba_blend_span(int blend_mode,
+                     uint32_t* dst, const uint32_t* back, const uint32_t* front,
+                     int n, int opacity, uint32_t mask)
+{
+  switch (blend_mode) {
+
+    case BLEND_MODE_NORMAL:
+#ifdef DOC_BLEND_SSE2
+      rgba_blend_span_sse2<rgba_blend_normal_sse2>(
+        dst, back, front, n, opacity, mask, rgba_blend_normal);
+#else
+      blend_span_scalar(dst, back, front, n, opacity, mask, rgba_blend_normal);
+#endif
+      break;
+
+    case BLEND_MODE_COPY:
+      blend_span_scalar(dst, back, front, n, opacity, mask, rgba_blend_copy);
+      break;
+
+    case BLEND_MODE_MERGE:
+#ifdef DOC_BLEND_SSE2
+      rgba_blend_span_sse2<rgba_blend_merge_sse2>(
+        dst, back, front, n, opacity, mask, rgba_blend_merge);
+#else
+      blend_span_scalar(dst, back, front, n, opacity, mask, rgba_blend_merge);
+#endif
+      break;
+
+    case BLEND_MODE_RED_TINT:
+      blend_span_scalar(dst, back, front, n, opacity, mask, rgba_blend_red_tint);
+      break;
+
+    case BLEND_MODE_BLUE_TINT:
+      blend_span_scalar(dst, back, front, n, opacity, mask, rgba_blend_blue_tint);
+      break;
+
+    case BLEND_MODE_BLACKANDWHITE:
+      blend_span_scalar(dst, back, front, n, opacity, mask, rgba_blend_blackandwhite);
+      break;
+
+    default:
+      ASSERT(false);
+      break;
+  }
+}
+
+void graya_blend_span(int blend_mode,
+                      uint16_t* dst, const uint16_t* back, const uint16_t* front,
+                      int n, int opacity, uint16_t mask)
+{
+  switch (blend_mode) {
+
+    case BLEND_MODE_NORMAL:
+      blend_span_scalar(dst, back, front, n, opacity, mask, graya_blend_normal);
+      break;
+
+    case BLEND_MODE_BLACKANDWHITE:
+      blend_span_scalar(dst, back, front, n, opacity, mask, graya_blend_blackandwhite);
+      break;
+
+    // All other modes use the "copy" blender for grayscale images
+    // (see graya_blenders[]).
+    default:
+      blend_span_scalar(dst, back, front, n, opacity, mask, graya_blend_copy);
+      break;
+  }
+}
+
+bool blend_span_uses_simd()
+{
+#ifdef DOC_BLEND_SSE2
+  return true;
+#else
+  return false;
+#endif
+}
+
 } // namespace doc
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2014 David Capello
+// Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -8,6 +8,8 @@
 #define DOC_BLEND_H_INCLUDED
 #pragma once
 
+#include "base/base.h"
+
 #define INT_MULT(a, b, t)                               \
   ((t) = (a) * (b) + 0x80, ((((t) >> 8) + (t)) >> 8))
 
@@ -44,6 +46,23 @@ namespace doc {
 
   int indexed_blend_direct(int back, int front, int opacity);
 
+  // Span blenders: They blend "n" pixels of "front" on "back" and
+  // put the result in "dst" (which can be equal to "back"). Pixels of
+  // "front" equal to "mask" are not blended (the "back" pixel is
+  // used). The result is exactly the same as calling the
+  // rgba_blenders[blend_mode]/graya_blenders[blend_mode] function for
+  // each pixel, but some modes (normal and merge) are vectorized when
+  // SSE2 instructions are available.
+  void rgba_blend_span(int blend_mode,
+                       uint32_t* dst, const uint32_t* back, const uint32_t* front,
+                       int n, int opacity, uint32_t mask);
+  void graya_blend_span(int blend_mode,
+                        uint16_t* dst, const uint16_t* back, const uint16_t* front,
+                        int n, int opacity, uint16_t mask);
+
+  // Returns true if rgba_blend_span() uses SIMD instructions.
+  bool blend_span_uses_simd();
+
 } // namespace doc
 
 #endif
@@ -0,0 +1,107 @@
+// Aseprite Document Library
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/blend.h"
+#include "doc/color.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace doc;
+
+static uint32_t random_rgba()
+{
+  // Use special alpha values more frequently
+  int a;
+  switch (std::rand() % 4) {
+    case 0: a = 0; break;
+    case 1: a = 255; break;
+    default: a = std::rand() % 256; break;
+  }
+  return rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, a);
+}
+
+static uint16_t random_graya()
+{
+  int a;
+  switch (std::rand() % 4) {
+    case 0: a = 0; break;
+    case 1: a = 255; break;
+    default: a = std::rand() % 256; break;
+  }
+  return graya(std::rand() % 256, a);
+}
+
+TEST(Blend, RgbaSpanEqualsPixelBlenders)
+{
+  std::srand(1);
+
+  const int n = 1031;           // Not a multiple of 4
+  std::vector<uint32_t> back(n), front(n), dst(n);
+  const uint32_t mask = rgba(1, 2, 3, 4);
+
+  for (int mode=0; mode<BLEND_MODE_MAX; ++mode) {
+    for (int opacity=0; opacity<=255; opacity+=15) {
+      for (int i=0; i<n; ++i) {
+        back[i] = random_rgba();
+        front[i] = (i % 50 == 0 ? mask: random_rgba());
+      }
+
+      rgba_blend_span(mode, &dst[0], &back[0], &front[0], n, opacity, mask);
+
+      for (int i=0; i<n; ++i) {
+        uint32_t expected = (front[i] != mask ?
+          rgba_blenders[mode](back[i], front[i], opacity): back[i]);
+        ASSERT_EQ(expected, dst[i])
+          << "mode=" << mode << " opacity=" << opacity
+          << " back=" << std::hex << back[i] << " front=" << front[i];
+      }
+
+      // In-place blending
+      std::vector<uint32_t> inplace = back;
+      rgba_blend_span(mode, &inplace[0], &inplace[0], &front[0], n, opacity, mask);
+      EXPECT_TRUE(dst == inplace);
+    }
+  }
+}
+
+TEST(Blend, GrayaSpanEqualsPixelBlenders)
+{
+  std::srand(2);
+
+  const int n = 517;
+  std::vector<uint16_t> back(n), front(n), dst(n);
+  const uint16_t mask = graya(0, 0);
+
+  for (int mode=0; mode<BLEND_MODE_MAX; ++mode) {
+    for (int opacity=0; opacity<=255; opacity+=15) {
+      for (int i=0; i<n; ++i) {
+        back[i] = random_graya();
+        front[i] = random_graya();
+      }
+
+      graya_blend_span(mode, &dst[0], &back[0], &front[0], n, opacity, mask);
+
+      for (int i=0; i<n; ++i) {
+        uint16_t expected = (front[i] != mask ?
+          graya_blenders[mode](back[i], front[i], opacity): back[i]);
+        ASSERT_EQ(expected, dst[i]);
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -128,14 +128,8 @@ std::size_t Cel::links() const
 
 gfx::Rect Cel::bounds() const
 {
-  Image* image = this->image();
-  ASSERT(image);
-  if (image)
-    return gfx::Rect(
-      position().x, position().y,
-      image->width(), image->height());
-  else
-    return gfx::Rect();
+  // We don't use image() to avoid loading the image
+  return gfx::Rect(position(), m_data->imageSize());
 }
 
 void Cel::setParentLayer(LayerImage* layer)
@@ -146,8 +140,10 @@ void Cel::setParentLayer(LayerImage* layer)
 
 void Cel::fixupImage()
 {
-  // Change the mask color to the sprite mask color
-  if (m_layer && image())
+  // Change the mask color to the sprite mask color (images that
+  // aren't loaded yet must be created with the right mask color by
+  // their ImageLoader)
+  if (m_layer && m_data->isImageLoaded() && image())
     image()->setMaskColor(m_layer->sprite()->transparentColor());
 }
 
@@ -10,6 +10,8 @@
 
 #include "doc/cel_data.h"
 
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
 #include "gfx/rect.h"
 #include "doc/image.h"
 #include "doc/layer.h"
@@ -17,9 +19,21 @@
 
 namespace doc {
 
+// Images can be loaded from several threads (e.g. when a sprite is
+// rendered in parallel bands), so we use a mutex to call the loader
+// just once. Instead of one mutex per CelData, we use a small set of
+// mutexes so different images can be loaded at the same time.
+static base::mutex loader_mutexes[16];
+
+static base::mutex& loader_mutex(const CelData* celData)
+{
+  return loader_mutexes[(std::size_t(celData) / sizeof(CelData)) % 16];
+}
+
 CelData::CelData(const ImageRef& image)
   : Object(ObjectType::CelData)
   , m_image(image)
+  , m_pending(false)
   , m_position(0, 0)
   , m_opacity(255)
 {
@@ -27,17 +41,61 @@ CelData::CelData(const ImageRef& image)
 
 CelData::CelData(const CelData& celData)
   : Object(ObjectType::CelData)
-  , m_image(celData.m_image)
+  , m_image(celData.imageRef())
+  , m_pending(false)
   , m_position(celData.m_position)
   , m_opacity(celData.m_opacity)
 {
 }
 
+CelData::CelData(ImageLoader* loader, const gfx::Size& imageSize)
+  : Object(ObjectType::CelData)
+  , m_loader(loader)
+  , m_pending(true)
+  , m_imageSize(imageSize)
+  , m_position(0, 0)
+  , m_opacity(255)
+{
+  ASSERT(loader);
+}
+
+gfx::Size CelData::imageSize() const
+{
+  if (m_pending)
+    return m_imageSize;
+  else
+    return m_image->size();
+}
+
 void CelData::setImage(const ImageRef& image)
 {
   ASSERT(image.get());
 
+  base::scoped_lock lock(loader_mutex(this));
   m_image = image;
+  m_loader.reset(nullptr);
+  m_pending = false;
+}
+
+int CelData::getMemSize() const
+{
+  base::scoped_lock lock(loader_mutex(this));
+  if (m_pending)
+    return sizeof(CelData) + m_loader->getMemSize();
+
+  ASSERT(m_image);
+  return sizeof(CelData) + m_image->getMemSize();
+}
+
+void CelData::loadImage() const
+{
+  base::scoped_lock lock(loader_mutex(this));
+  if (!m_pending)               // Loaded by other thread
+    return;
+
+  m_image.reset(m_loader->loadImage());
+  m_loader.reset(nullptr);
+  m_pending = false;
 }
 
 } // namespace doc
@@ -9,8 +9,13 @@
 #pragma once
 
 #include "base/shared_ptr.h"
+#include "base/unique_ptr.h"
+#include "doc/image_loader.h"
 #include "doc/image_ref.h"
 #include "doc/object.h"
+#include "gfx/size.h"
+
+#include <atomic>
 
 namespace doc {
 
@@ -19,10 +24,29 @@ namespace doc {
     CelData(const ImageRef& image);
     CelData(const CelData& celData);
 
+    // Creates a CelData which image will be created by the given
+    // loader the first time it's used (the loader is deleted then).
+    CelData(ImageLoader* loader, const gfx::Size& imageSize);
+
     const gfx::Point& position() const { return m_position; }
     int opacity() const { return m_opacity; }
-    Image* image() const { return const_cast<Image*>(m_image.get()); };
-    ImageRef imageRef() const { return m_image; }
+
+    // These functions load the image if it wasn't loaded yet.
+    Image* image() const {
+      if (m_pending)
+        loadImage();
+      return const_cast<Image*>(m_image.get());
+    };
+    ImageRef imageRef() const {
+      if (m_pending)
+        loadImage();
+      return m_image;
+    }
+
+    // Returns the size of the image without loading it.
+    gfx::Size imageSize() const;
+
+    bool isImageLoaded() const { return !m_pending; }
 
     void setImage(const ImageRef& image);
     void setPosition(int x, int y) {
@@ -32,13 +56,15 @@ namespace doc {
     void setPosition(const gfx::Point& pos) { m_position = pos; }
     void setOpacity(int opacity) { m_opacity = opacity; }
 
-    virtual int getMemSize() const override {
-      ASSERT(m_image);
-      return sizeof(CelData) + m_image->getMemSize();
-    }
+    virtual int getMemSize() const override;
 
   private:
-    ImageRef m_image;
+    void loadImage() const;
+
+    mutable ImageRef m_image;
+    mutable base::UniquePtr<ImageLoader> m_loader;
+    mutable std::atomic<bool> m_pending;
+    gfx::Size m_imageSize;      // Image size when it isn't loaded yet
     gfx::Point m_position;      // X/Y screen position
     int m_opacity;              // Opacity level
   };
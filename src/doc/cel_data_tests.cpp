@@ -0,0 +1,85 @@
+// Aseprite Document Library
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/parallel_for.h"
+#include "base/unique_ptr.h"
+#include "doc/cel.h"
+#include "doc/image.h"
+#include "doc/image_loader.h"
+#include "doc/layer.h"
+#include "doc/primitives.h"
+#include "doc/sprite.h"
+#include "gfx/rect_io.h"
+
+using namespace doc;
+
+class TestLoader : public ImageLoader {
+public:
+  TestLoader(int* calls) : m_calls(calls) { }
+
+  Image* loadImage() override {
+    ++(*m_calls);
+    Image* image = Image::create(IMAGE_RGB, 8, 4);
+    clear_image(image, rgba(255, 0, 0, 255));
+    return image;
+  }
+
+  int getMemSize() const override { return 10; }
+
+private:
+  int* m_calls;
+};
+
+TEST(CelData, LazyImage)
+{
+  base::UniquePtr<Sprite> spr(new Sprite(IMAGE_RGB, 32, 32, 256));
+  LayerImage* lay = new LayerImage(spr);
+  spr->folder()->addLayer(lay);
+
+  int calls = 0;
+  CelDataRef data(new CelData(new TestLoader(&calls), gfx::Size(8, 4)));
+  Cel* cel = new Cel(frame_t(0), data);
+  cel->setPosition(2, 3);
+  lay->addCel(cel);
+
+  // Bounds and memory don't need the image
+  EXPECT_EQ(gfx::Rect(2, 3, 8, 4), cel->bounds());
+  EXPECT_EQ(int(sizeof(CelData) + 10), data->getMemSize());
+  EXPECT_EQ(ImageRef(nullptr), spr->getImageRef(12345));
+  EXPECT_FALSE(data->isImageLoaded());
+  EXPECT_EQ(0, calls);
+
+  // Linked cels share the non-loaded image
+  Cel* link = Cel::createLink(cel);
+  link->setFrame(frame_t(1));
+  spr->setTotalFrames(frame_t(2));
+  lay->addCel(link);
+  EXPECT_EQ(0, calls);
+
+  // Loaded only once (even from several threads)
+  base::parallel_for(
+    0, 16,
+    [&cel](int i) {
+      EXPECT_EQ(8, cel->image()->width());
+    });
+  EXPECT_TRUE(data->isImageLoaded());
+  EXPECT_EQ(1, calls);
+  EXPECT_EQ(cel->image(), link->image());
+  EXPECT_EQ(rgba(255, 0, 0, 255), get_pixel(cel->image(), 7, 3));
+  EXPECT_EQ(cel->imageRef(), spr->getImageRef(cel->image()->id()));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -8,15 +8,18 @@
 #define DOC_CEL_LIST_H_INCLUDED
 #pragma once
 
-#include <list>
+#include <vector>
 
 namespace doc {
 
   class Cel;
 
-  typedef std::list<Cel*> CelList;
-  typedef std::list<Cel*>::iterator CelIterator;
-  typedef std::list<Cel*>::const_iterator CelConstIterator;
+  // A contiguous array of cels. LayerImage keeps its cels in a
+  // CelList sorted by frame so a cel can be found by frame without
+  // walking the whole list.
+  typedef std::vector<Cel*> CelList;
+  typedef std::vector<Cel*>::iterator CelIterator;
+  typedef std::vector<Cel*>::const_iterator CelConstIterator;
 
 } // namespace doc
 
@@ -0,0 +1,62 @@
+// Aseprite Document Library
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/compressed_io.h"
+
+#include "base/exception.h"
+#include "base/serialization.h"
+
+#include "zlib.h"
+
+#include <iostream>
+
+namespace doc {
+
+using namespace base::serialization;
+using namespace base::serialization::little_endian;
+
+void write_compressed_data(std::ostream& os, const uint8_t* data, std::size_t size)
+{
+  uLongf compressedSize = compressBound(uLong(size));
+  std::vector<uint8_t> compressed(compressedSize);
+
+  int err = compress2(&compressed[0], &compressedSize,
+                      data, uLong(size), Z_BEST_SPEED);
+  if (err != Z_OK)
+    throw base::Exception("ZLib error %d in compress2().", err);
+
+  write32(os, uint32_t(size));
+  write32(os, uint32_t(compressedSize));
+  os.write((const char*)&compressed[0], compressedSize);
+}
+
+void read_compressed_data(std::istream& is, std::vector<uint8_t>& data)
+{
+  uLongf size = read32(is);
+  uLong compressedSize = read32(is);
+
+  std::vector<uint8_t> compressed(compressedSize);
+  if (compressedSize > 0)
+    is.read((char*)&compressed[0], compressedSize);
+  if (!is)
+    throw base::Exception("Error reading compressed data.");
+
+  data.resize(size);
+  if (size == 0)
+    return;
+
+  int err = uncompress(&data[0], &size, &compressed[0], compressedSize);
+  if (err != Z_OK)
+    throw base::Exception("ZLib error %d in uncompress().", err);
+  if (size != data.size())
+    throw base::Exception("Bad compressed data.");
+}
+
+} // namespace doc
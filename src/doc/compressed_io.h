@@ -0,0 +1,30 @@
+// Aseprite Document Library
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_COMPRESSED_IO_H_INCLUDED
+#define DOC_COMPRESSED_IO_H_INCLUDED
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <vector>
+
+#include <stdint.h>
+
+namespace doc {
+
+  // Writes the given buffer compressed with zlib (using the fastest
+  // compression level, these functions are used to reduce the memory
+  // of undo information).
+  void write_compressed_data(std::ostream& os, const uint8_t* data, std::size_t size);
+
+  // Reads a buffer written with write_compressed_data(). Throws a
+  // base::Exception if the data is corrupted.
+  void read_compressed_data(std::istream& is, std::vector<uint8_t>& data);
+
+} // namespace doc
+
+#endif
@@ -0,0 +1,168 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/algorithm/floodfill.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+#include "gfx/rect.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace doc;
+
+// Counts how many times each pixel is filled
+static void count_hline(int x1, int y, int x2, void* data)
+{
+  Image* counts = reinterpret_cast<Image*>(data);
+  for (int x=x1; x<=x2; ++x)
+    put_pixel(counts, x, y, get_pixel(counts, x, y)+1);
+}
+
+static bool similar(const Image* image, color_t a, color_t b, int tolerance)
+{
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB:
+      if (rgba_geta(a) == 0 && rgba_geta(b) == 0)
+        return true;
+      return (std::abs(int(rgba_getr(a)) - int(rgba_getr(b))) <= tolerance &&
+              std::abs(int(rgba_getg(a)) - int(rgba_getg(b))) <= tolerance &&
+              std::abs(int(rgba_getb(a)) - int(rgba_getb(b))) <= tolerance &&
+              std::abs(int(rgba_geta(a)) - int(rgba_geta(b))) <= tolerance);
+    case IMAGE_GRAYSCALE:
+      if (graya_geta(a) == 0 && graya_geta(b) == 0)
+        return true;
+      return (std::abs(int(graya_getv(a)) - int(graya_getv(b))) <= tolerance &&
+              std::abs(int(graya_geta(a)) - int(graya_geta(b))) <= tolerance);
+    default:
+      return std::abs(int(a) - int(b)) <= tolerance;
+  }
+}
+
+// Reference flood fill (4-connected pixels) using a queue of pixels.
+static void expected_fill(const Image* image, int x, int y,
+                          const gfx::Rect& bounds, int tolerance,
+                          bool contiguous, Image* counts)
+{
+  color_t color = get_pixel(image, x, y);
+  clear_image(counts, 0);
+
+  if (!contiguous) {
+    for (int v=bounds.y; v<bounds.y2(); ++v)
+      for (int u=bounds.x; u<bounds.x2(); ++u)
+        if (similar(image, get_pixel(image, u, v), color, tolerance))
+          put_pixel(counts, u, v, 1);
+    return;
+  }
+
+  std::vector<gfx::Point> queue(1, gfx::Point(x, y));
+  put_pixel(counts, x, y, 1);
+  while (!queue.empty()) {
+    gfx::Point pt = queue.back();
+    queue.pop_back();
+
+    gfx::Point near[] = {
+      gfx::Point(pt.x-1, pt.y), gfx::Point(pt.x+1, pt.y),
+      gfx::Point(pt.x, pt.y-1), gfx::Point(pt.x, pt.y+1)
+    };
+    for (const gfx::Point& p : near) {
+      if (bounds.contains(p) &&
+          get_pixel(counts, p.x, p.y) == 0 &&
+          similar(image, get_pixel(image, p.x, p.y), color, tolerance)) {
+        put_pixel(counts, p.x, p.y, 1);
+        queue.push_back(p);
+      }
+    }
+  }
+}
+
+static ImageRef create_random_image(PixelFormat format, int w, int h)
+{
+  ImageRef image(Image::create(format, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      // Few different values to create big areas to fill
+      int v = (std::rand() % 3) * 16;
+      int a = (std::rand() % 8 ? 255: 0);
+      color_t c;
+      switch (format) {
+        case IMAGE_RGB: c = rgba(v, v, (std::rand() % 2) * 8, a); break;
+        case IMAGE_GRAYSCALE: c = graya(v, a); break;
+        default: c = v; break;
+      }
+      put_pixel(image.get(), x, y, c);
+    }
+  return image;
+}
+
+TEST(FloodFill, SameResultAsReference)
+{
+  std::srand(1);
+
+  PixelFormat formats[] = { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED };
+  int tolerances[] = { 0, 8, 16 };
+  gfx::Rect boundsList[] = {
+    gfx::Rect(0, 0, 300, 300),  // Big enough to use several threads
+    gfx::Rect(13, 7, 70, 100)
+  };
+
+  for (PixelFormat format : formats) {
+    ImageRef image = create_random_image(format, 300, 300);
+    ImageRef counts(Image::create(IMAGE_GRAYSCALE, 300, 300));
+    ImageRef expected(Image::create(IMAGE_GRAYSCALE, 300, 300));
+
+    for (int tolerance : tolerances) {
+      for (const gfx::Rect& bounds : boundsList) {
+        for (int contiguous=0; contiguous<2; ++contiguous) {
+          int x = bounds.x + bounds.w/2;
+          int y = bounds.y + bounds.h/3;
+
+          clear_image(counts.get(), 0);
+          algorithm::floodfill(image.get(), x, y, bounds, tolerance,
+                               contiguous ? true: false,
+                               counts.get(), count_hline);
+          expected_fill(image.get(), x, y, bounds, tolerance,
+                        contiguous ? true: false, expected.get());
+
+          EXPECT_EQ(0, count_diff_between_images(expected.get(), counts.get()))
+            << "format " << int(format)
+            << " tolerance " << tolerance
+            << " contiguous " << contiguous;
+        }
+      }
+    }
+  }
+}
+
+TEST(FloodFill, OutsideBounds)
+{
+  ImageRef image(Image::create(IMAGE_RGB, 8, 8));
+  ImageRef counts(Image::create(IMAGE_GRAYSCALE, 8, 8));
+  clear_image(image.get(), rgba(0, 0, 0, 255));
+  clear_image(counts.get(), 0);
+
+  algorithm::floodfill(image.get(), 1, 1, gfx::Rect(2, 2, 4, 4), 0, true,
+                       counts.get(), count_hline);
+  algorithm::floodfill(image.get(), 8, 0, gfx::Rect(0, 0, 16, 16), 0, true,
+                       counts.get(), count_hline);
+
+  for (int y=0; y<8; ++y)
+    for (int x=0; x<8; ++x)
+      EXPECT_EQ(color_t(0), get_pixel(counts.get(), x, y));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
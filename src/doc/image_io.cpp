@@ -10,11 +10,15 @@
 
 #include "doc/image_io.h"
 
+#include "base/exception.h"
 #include "base/serialization.h"
 #include "base/unique_ptr.h"
+#include "doc/compressed_io.h"
 #include "doc/image.h"
 
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 namespace doc {
 
@@ -27,11 +31,14 @@ using namespace base::serialization::little_endian;
 //    BYTE              image type
 //    WORD[2]           w, h
 //    DWORD             mask color
-//    for each line     ("h" times)
-//      for each pixel  ("w" times)
-//        BYTE[4]       for RGB images, or
-//        BYTE[2]       for Grayscale images, or
-//        BYTE          for Indexed images
+//    DWORD             uncompressed size of pixels
+//    DWORD             compressed size ("n")
+//    BYTE[n]           pixels compressed with zlib:
+//      for each line     ("h" times)
+//        for each pixel  ("w" times)
+//          BYTE[4]       for RGB images, or
+//          BYTE[2]       for Grayscale images, or
+//          BYTE          for Indexed images
 
 void write_image(std::ostream& os, Image* image)
 {
@@ -41,9 +48,14 @@ void write_image(std::ostream& os, Image* image)
   write16(os, image->height());        // Height
   write32(os, image->maskColor());     // Mask color
 
+  // Pixels are compressed to reduce the memory used by undo
   int size = image->getRowStrideSize();
-  for (int c=0; c<image->height(); c++)
-    os.write((char*)image->getPixelAddress(0, c), size);
+  std::vector<uint8_t> pixels(size * image->height());
+  for (int c=0; c<image->height(); c++) {
+    const uint8_t* row = image->getPixelAddress(0, c);
+    std::copy(row, row+size, pixels.begin()+size*c);
+  }
+  write_compressed_data(os, &pixels[0], pixels.size());
 }
 
 Image* read_image(std::istream& is)
@@ -57,8 +69,14 @@ Image* read_image(std::istream& is)
   base::UniquePtr<Image> image(Image::create(static_cast<PixelFormat>(pixelFormat), width, height));
   int size = image->getRowStrideSize();
 
+  std::vector<uint8_t> pixels;
+  read_compressed_data(is, pixels);
+  if (pixels.size() != std::size_t(size * image->height()))
+    throw base::Exception("Invalid image pixels.");
+
   for (int c=0; c<image->height(); c++)
-    is.read((char*)image->getPixelAddress(0, c), size);
+    std::copy(pixels.begin()+size*c, pixels.begin()+size*(c+1),
+              image->getPixelAddress(0, c));
 
   image->setMaskColor(maskColor);
   image->setId(id);
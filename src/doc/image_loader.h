@@ -0,0 +1,33 @@
+// Aseprite Document Library
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_IMAGE_LOADER_H_INCLUDED
+#define DOC_IMAGE_LOADER_H_INCLUDED
+#pragma once
+
+namespace doc {
+
+  class Image;
+
+  // Creates the image of a CelData the first time it's used. E.g. the
+  // .ase decoder can keep the compressed pixels of each cel and
+  // decompress them only when the cel is rendered or modified.
+  class ImageLoader {
+  public:
+    virtual ~ImageLoader() { }
+
+    // Returns a new image (it's called only once). It cannot throw
+    // exceptions, if the pixels cannot be loaded it must return an
+    // image anyway (e.g. a transparent one).
+    virtual Image* loadImage() = 0;
+
+    // Memory used by this loader (e.g. compressed pixels).
+    virtual int getMemSize() const = 0;
+  };
+
+} // namespace doc
+
+#endif
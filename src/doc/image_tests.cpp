@@ -13,8 +13,11 @@
 #include "base/unique_ptr.h"
 #include "doc/image.h"
 #include "doc/image_bits.h"
+#include "doc/image_io.h"
 #include "doc/primitives.h"
 
+#include <sstream>
+
 using namespace base;
 using namespace doc;
 
@@ -179,6 +182,33 @@ TYPED_TEST(ImageAllTypes, DrawHLine)
   }
 }
 
+TYPED_TEST(ImageAllTypes, WriteAndReadCompressedImage)
+{
+  typedef TypeParam ImageTraits;
+
+  UniquePtr<Image> image(Image::create(ImageTraits::pixel_format, 67, 33));
+  for (int y=0; y<image->height(); ++y)
+    for (int x=0; x<image->width(); ++x)
+      put_pixel(image, x, y, (x*y + x/4) % ImageTraits::max_value);
+  image->setMaskColor(1);
+
+  // The copy doesn't have an ID yet, so it doesn't collide with the
+  // ID of the read image.
+  UniquePtr<Image> copy(Image::createCopy(image));
+
+  std::stringstream stream;
+  write_image(stream, image);
+  ObjectId id = image->id();
+  image.reset(NULL);
+
+  UniquePtr<Image> image2(read_image(stream));
+  EXPECT_EQ(id, image2->id());
+  EXPECT_EQ(color_t(1), image2->maskColor());
+  EXPECT_EQ(copy->width(), image2->width());
+  EXPECT_EQ(copy->height(), image2->height());
+  EXPECT_EQ(0, count_diff_between_images(copy, image2));
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
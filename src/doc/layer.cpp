@@ -124,16 +124,36 @@ void LayerImage::destroyAllCels()
 
 Cel* LayerImage::cel(frame_t frame) const
 {
-  CelConstIterator it = getCelBegin();
-  CelConstIterator end = getCelEnd();
+  CelConstIterator it = findCelIterator(frame);
+  if (it != getCelEnd() && (*it)->frame() == frame)
+    return *it;
+  else
+    return NULL;
+}
 
-  for (; it != end; ++it) {
-    Cel* cel = *it;
-    if (cel->frame() == frame)
-      return cel;
+// Returns the first cel with cel->frame() >= frame.
+CelConstIterator LayerImage::findCelIterator(frame_t frame) const
+{
+  // Fast path for layers with one cel in each frame (the most common
+  // case in animations): the cel is in its frame offset.
+  if (!m_cels.empty()) {
+    frame_t i = frame - m_cels.front()->frame();
+    if (i >= 0 && i < frame_t(m_cels.size()) &&
+        m_cels[i]->frame() == frame)
+      return m_cels.begin() + i;
   }
 
-  return NULL;
+  return std::lower_bound(
+    m_cels.begin(), m_cels.end(), frame,
+    [](const Cel* cel, frame_t frame) {
+      return cel->frame() < frame;
+    });
+}
+
+CelIterator LayerImage::findCelIterator(frame_t frame)
+{
+  CelConstIterator it = const_cast<const LayerImage*>(this)->findCelIterator(frame);
+  return m_cels.begin() + (it - m_cels.cbegin());
 }
 
 void LayerImage::getCels(CelList& cels) const
@@ -157,15 +177,18 @@ void LayerImage::addCel(Cel* cel)
 {
   ASSERT(cel->data() && "The cel doesn't contain CelData");
 
-  CelIterator it = getCelBegin();
-  CelIterator end = getCelEnd();
-
-  for (; it != end; ++it) {
-    if ((*it)->frame() > cel->frame())
-      break;
+  // Cels are usually added in frame order (e.g. loading a file)
+  if (m_cels.empty() || m_cels.back()->frame() <= cel->frame()) {
+    m_cels.push_back(cel);
+  }
+  else {
+    CelIterator it = std::upper_bound(
+      m_cels.begin(), m_cels.end(), cel->frame(),
+      [](frame_t frame, const Cel* cel) {
+        return frame < cel->frame();
+      });
+    m_cels.insert(it, cel);
   }
-
-  m_cels.insert(it, cel);
 
   cel->setParentLayer(this);
 }
@@ -178,9 +201,14 @@ void LayerImage::addCel(Cel* cel)
  */
 void LayerImage::removeCel(Cel* cel)
 {
-  CelIterator it = std::find(m_cels.begin(), m_cels.end(), cel);
+  CelIterator it = findCelIterator(cel->frame());
+  CelIterator end = getCelEnd();
+  while (it != end && *it != cel && (*it)->frame() == cel->frame())
+    ++it;
 
-  ASSERT(it != m_cels.end());
+  ASSERT(it != end && *it == cel);
+  if (it == end || *it != cel)
+    return;
 
   m_cels.erase(it);
 
@@ -216,17 +244,24 @@ void LayerImage::displaceFrames(frame_t fromThis, frame_t delta)
 {
   Sprite* sprite = this->sprite();
 
-  if (delta > 0) {
-    for (frame_t c=sprite->lastFrame(); c>=fromThis; --c) {
-      if (Cel* cel = this->cel(c))
-        moveCel(cel, c+delta);
-    }
+  // All cels in [fromThis, lastFrame] are displaced at once (instead
+  // of calling moveCel() for each one) as they keep their order.
+  CelIterator it = findCelIterator(fromThis);
+  CelIterator end = findCelIterator(sprite->lastFrame()+1);
+  for (; it != end; ++it) {
+    Cel* cel = *it;
+    cel->setParentLayer(NULL);
+    cel->setFrame(cel->frame()+delta);
+    cel->setParentLayer(this);
   }
-  else {
-    for (frame_t c=fromThis; c<=sprite->lastFrame(); ++c) {
-      if (Cel* cel = this->cel(c))
-        moveCel(cel, c+delta);
-    }
+
+  // Displaced cels could be placed before cels that weren't moved
+  if (delta < 0) {
+    std::stable_sort(
+      m_cels.begin(), m_cels.end(),
+      [](const Cel* a, const Cel* b) {
+        return a->frame() < b->frame();
+      });
   }
 }
 
@@ -136,8 +136,10 @@ namespace doc {
 
   private:
     void destroyAllCels();
+    CelIterator findCelIterator(frame_t frame);
+    CelConstIterator findCelIterator(frame_t frame) const;
 
-    CelList m_cels;   // List of all cels inside this layer used by frames.
+    CelList m_cels;   // List of all cels inside this layer sorted by frame.
   };
 
   //////////////////////////////////////////////////////////////////////
@@ -0,0 +1,114 @@
+// Aseprite Document Library
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/cel.h"
+#include "doc/image.h"
+#include "doc/layer.h"
+#include "doc/sprite.h"
+
+using namespace doc;
+
+static Cel* add_cel(LayerImage* layer, frame_t frame)
+{
+  ImageRef image(Image::create(IMAGE_RGB, 4, 4));
+  Cel* cel = new Cel(frame, image);
+  layer->addCel(cel);
+  return cel;
+}
+
+static void expect_sorted_cels(const LayerImage* layer)
+{
+  CelConstIterator it = layer->getCelBegin();
+  CelConstIterator end = layer->getCelEnd();
+  for (; it != end; ++it) {
+    EXPECT_EQ(*it, layer->cel((*it)->frame()));
+    if (it+1 != end) {
+      EXPECT_LT((*it)->frame(), (*(it+1))->frame());
+    }
+  }
+}
+
+TEST(LayerImage, CelLookup)
+{
+  base::UniquePtr<Sprite> spr(new Sprite(IMAGE_RGB, 4, 4, 256));
+  spr->setTotalFrames(10);
+
+  LayerImage* lay = new LayerImage(spr);
+  spr->folder()->addLayer(lay);
+
+  // Added out of order and with holes
+  Cel* cel5 = add_cel(lay, 5);
+  Cel* cel1 = add_cel(lay, 1);
+  Cel* cel9 = add_cel(lay, 9);
+  Cel* cel2 = add_cel(lay, 2);
+
+  EXPECT_EQ(4, lay->getCelsCount());
+  EXPECT_EQ(NULL, lay->cel(0));
+  EXPECT_EQ(cel1, lay->cel(1));
+  EXPECT_EQ(cel2, lay->cel(2));
+  EXPECT_EQ(NULL, lay->cel(3));
+  EXPECT_EQ(NULL, lay->cel(4));
+  EXPECT_EQ(cel5, lay->cel(5));
+  EXPECT_EQ(NULL, lay->cel(8));
+  EXPECT_EQ(cel9, lay->cel(9));
+  EXPECT_EQ(NULL, lay->cel(10));
+  EXPECT_EQ(cel9, lay->getLastCel());
+  expect_sorted_cels(lay);
+
+  lay->moveCel(cel9, 0);
+  EXPECT_EQ(cel9, lay->cel(0));
+  EXPECT_EQ(NULL, lay->cel(9));
+  expect_sorted_cels(lay);
+
+  lay->removeCel(cel2);
+  delete cel2;
+  EXPECT_EQ(NULL, lay->cel(2));
+  EXPECT_EQ(3, lay->getCelsCount());
+  expect_sorted_cels(lay);
+}
+
+TEST(LayerImage, DisplaceFrames)
+{
+  base::UniquePtr<Sprite> spr(new Sprite(IMAGE_RGB, 4, 4, 256));
+  spr->setTotalFrames(100);
+
+  LayerImage* lay = new LayerImage(spr);
+  spr->folder()->addLayer(lay);
+
+  for (frame_t f(0); f<100; ++f)
+    add_cel(lay, f);
+  expect_sorted_cels(lay);
+
+  Cel* cel50 = lay->cel(50);
+  spr->addFrame(10);
+  EXPECT_EQ(NULL, lay->cel(10));
+  EXPECT_EQ(cel50, lay->cel(51));
+  EXPECT_EQ(100, lay->getCelsCount());
+  expect_sorted_cels(lay);
+
+  Cel* cel20 = lay->cel(20);
+  lay->removeCel(cel20);
+  delete cel20;
+  Cel* cel21 = lay->cel(21);
+  spr->removeFrame(20);
+  EXPECT_EQ(cel21, lay->cel(20));
+  EXPECT_EQ(cel50, lay->cel(50));
+  EXPECT_EQ(99, lay->getCelsCount());
+  expect_sorted_cels(lay);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -12,13 +12,116 @@
 
 #include "base/memory.h"
 #include "doc/image.h"
-#include "doc/image_bits.h"
 
+#include <algorithm>
+#include <climits>
 #include <cstdlib>
 #include <cstring>
 
 namespace doc {
 
+namespace {
+
+bool span_less(const MaskSpan& span, int y)
+{
+  return span.y < y;
+}
+
+// Returns the first span of the row "y" (or the first span of the
+// next rows if the row is empty).
+MaskSpans::iterator find_row(MaskSpans& spans, int y)
+{
+  return std::lower_bound(spans.begin(), spans.end(), y, span_less);
+}
+
+const MaskSpan* row_end(const MaskSpan* span, const MaskSpan* end)
+{
+  const int y = span->y;
+  while (span != end && span->y == y)
+    ++span;
+  return span;
+}
+
+// Sets the bits [x1, x2) of a bitmap row.
+void fill_bits(uint8_t* row, int x1, int x2)
+{
+  for (; x1 < x2 && (x1 & 7) != 0; ++x1)
+    row[x1 >> 3] |= (1 << (x1 & 7));
+
+  if (x2 - x1 >= 8) {
+    int n = (x2 - x1) >> 3;
+    std::memset(row + (x1 >> 3), 0xff, n);
+    x1 += n << 3;
+  }
+
+  for (; x1 < x2; ++x1)
+    row[x1 >> 3] |= (1 << (x1 & 7));
+}
+
+// Adds the runs of selected pixels of the bitmap row "v" as spans of
+// the row "y" (adding "dx" to the x coordinates).
+void read_bitmap_row(const Image* bitmap, int v, int y, int dx, MaskSpans& spans)
+{
+  const uint8_t* p = bitmap->getPixelAddress(0, v);
+  const int w = bitmap->width();
+  bool inside = false;
+  int start = 0;
+  int x = 0;
+
+  while (x < w) {
+    // Skip bytes without changes
+    if (x+8 <= w && *p == (inside ? 0xff: 0)) {
+      x += 8;
+      ++p;
+      continue;
+    }
+
+    int n = std::min(8, w-x);
+    for (int bit=0; bit<n; ++bit, ++x) {
+      if (((*p & (1 << bit)) != 0) != inside) {
+        if (inside)
+          spans.push_back(MaskSpan(y, start + dx, x + dx));
+        else
+          start = x;
+        inside = !inside;
+      }
+    }
+    ++p;
+  }
+
+  if (inside)
+    spans.push_back(MaskSpan(y, start + dx, w + dx));
+}
+
+// Adds the spans of pixels of the image where "pred" is true.
+template<typename ImageTraits, typename Pred>
+void read_image_spans(const Image* image, Pred pred, MaskSpans& spans)
+{
+  typedef typename ImageTraits::pixel_t pixel_t;
+  const int w = image->width();
+
+  for (int y=0; y<image->height(); ++y) {
+    const pixel_t* p = (const pixel_t*)image->getPixelAddress(0, y);
+    int start = -1;
+
+    for (int x=0; x<w; ++x, ++p) {
+      if (pred(*p)) {
+        if (start < 0)
+          start = x;
+      }
+      else if (start >= 0) {
+        spans.push_back(MaskSpan(y, start, x));
+        start = -1;
+      }
+    }
+
+    if (start >= 0)
+      spans.push_back(MaskSpan(y, start, w));
+  }
+}
+
+} // anonymous namespace
+
 Mask::Mask()
   : Object(ObjectType::Mask)
 {
@@ -41,11 +144,16 @@ void Mask::initialize()
 {
   m_freeze_count = 0;
   m_bounds = gfx::Rect(0, 0, 0, 0);
+  m_validSpans = true;
+  m_spansOrigin = gfx::Point(0, 0);
+  m_validBitmap = false;
 }
 
 int Mask::getMemSize() const
 {
-  return sizeof(Mask) + (m_bitmap ? m_bitmap->getMemSize(): 0);
+  return sizeof(Mask)
+    + int(m_spans.capacity() * sizeof(MaskSpan))
+    + (m_validBitmap && m_bitmap ? m_bitmap->getMemSize(): 0);
 }
 
 void Mask::setName(const char *name)
@@ -53,6 +161,69 @@ void Mask::setName(const char *name)
   m_name = name;
 }
 
+const Image* Mask::bitmap() const
+{
+  if (m_bounds.isEmpty())
+    return NULL;
+
+  if (!m_validBitmap) {
+    ASSERT(m_validSpans);
+
+    m_bitmap.reset(Image::create(IMAGE_BITMAP, m_bounds.w, m_bounds.h, m_buffer));
+    clear_image(m_bitmap.get(), 0);
+
+    const int dx = m_spansOrigin.x - m_bounds.x;
+    const int dy = m_spansOrigin.y - m_bounds.y;
+    for (const MaskSpan& span : m_spans) {
+      ASSERT(span.y+dy >= 0 && span.y+dy < m_bounds.h);
+      ASSERT(span.x1+dx >= 0 && span.x2+dx <= m_bounds.w);
+      fill_bits(m_bitmap->getPixelAddress(0, span.y+dy), span.x1+dx, span.x2+dx);
+    }
+
+    m_validBitmap = true;
+  }
+
+  return m_bitmap.get();
+}
+
+Image* Mask::editableBitmap()
+{
+  Image* image = const_cast<Image*>(bitmap());
+  if (image)
+    m_validSpans = false;
+  return image;
+}
+
+const MaskSpans& Mask::spans() const
+{
+  updateSpans();
+  return m_spans;
+}
+
+bool Mask::containsPoint(int u, int v) const
+{
+  if (!m_bounds.contains(gfx::Point(u, v)))
+    return false;
+
+  if (m_validBitmap)
+    return (get_pixel(m_bitmap.get(), u-m_bounds.x, v-m_bounds.y) ? true: false);
+
+  const int x = u - m_spansOrigin.x;
+  const int y = v - m_spansOrigin.y;
+
+  // First span after the (x, y) point
+  MaskSpans::const_iterator it =
+    std::upper_bound(m_spans.begin(), m_spans.end(), MaskSpan(y, x, x),
+                     [](const MaskSpan& a, const MaskSpan& b) {
+                       return (a.y < b.y || (a.y == b.y && a.x1 < b.x1));
+                     });
+  if (it == m_spans.begin())
+    return false;
+
+  --it;
+  return (it->y == y && x < it->x2);
+}
+
 void Mask::freeze()
 {
   ASSERT(m_freeze_count >= 0);
@@ -71,14 +242,18 @@ void Mask::unfreeze()
 
 bool Mask::isRectangular() const
 {
-  if (!m_bitmap)
+  if (isEmpty())
     return false;
 
-  LockImageBits<BitmapTraits> bits(m_bitmap);
-  LockImageBits<BitmapTraits>::iterator it = bits.begin(), end = bits.end();
+  updateSpans();
+  if (int(m_spans.size()) != m_bounds.h)
+    return false;
 
-  for (; it != end; ++it) {
-    if (*it == 0)
+  // One span of the whole width in each row
+  const int x1 = m_bounds.x - m_spansOrigin.x;
+  const int x2 = x1 + m_bounds.w;
+  for (const MaskSpan& span : m_spans) {
+    if (span.x1 != x1 || span.x2 != x2)
       return false;
   }
 
@@ -90,197 +265,198 @@ void Mask::copyFrom(const Mask* sourceMask)
   clear();
   setName(sourceMask->name().c_str());
 
-  if (sourceMask->bitmap()) {
-    // Add all the area of "mask"
-    add(sourceMask->bounds());
-
-    // And copy the "mask" bitmap
-    copy_image(m_bitmap, sourceMask->m_bitmap);
-  }
+  // Only the spans are copied (the bitmap is created again if it's
+  // needed), so copies of masks (e.g. to undo them) are small.
+  m_spans = sourceMask->spans();
+  m_spansOrigin = sourceMask->m_spansOrigin;
+  m_bounds = sourceMask->m_bounds;
 }
 
 void Mask::offsetOrigin(int dx, int dy)
 {
   m_bounds.offset(dx, dy);
+  m_spansOrigin.x += dx;
+  m_spansOrigin.y += dy;
 }
 
 void Mask::clear()
 {
-  m_bitmap.reset(nullptr);
+  m_spans.clear();
+  m_validSpans = true;
+  m_spansOrigin = gfx::Point(0, 0);
+  dropBitmap();
   m_bounds = gfx::Rect(0, 0, 0, 0);
 }
 
 void Mask::invert()
 {
-  if (!m_bitmap)
+  if (isEmpty())
     return;
 
-  LockImageBits<BitmapTraits> bits(m_bitmap);
-  LockImageBits<BitmapTraits>::iterator it = bits.begin(), end = bits.end();
+  modifySpans();
+
+  // Complement the spans of each row inside the mask bounds
+  const int x1 = m_bounds.x - m_spansOrigin.x;
+  const int y1 = m_bounds.y - m_spansOrigin.y;
+  const MaskSpan* p = m_spans.data();
+  const MaskSpan* end = p + m_spans.size();
+  MaskSpans result;
 
-  for (; it != end; ++it)
-    *it = (*it ? 0: 1);
+  for (int y=y1; y<y1+m_bounds.h; ++y) {
+    const MaskSpan* q = (p != end && p->y == y ? row_end(p, end): p);
+    MaskSpan full(y, x1, x1+m_bounds.w);
+    combineRow(&full, &full+1, p, q, 0, y, SubtractSpans, result);
+    p = q;
+  }
 
+  m_spans.swap(result);
   shrink();
 }
 
 void Mask::replace(const gfx::Rect& bounds)
 {
-  m_bounds = bounds;
+  clear();
 
-  m_bitmap.reset(Image::create(IMAGE_BITMAP, bounds.w, bounds.h, m_buffer));
-  clear_image(m_bitmap, 1);
+  if (bounds.isEmpty())
+    return;
+
+  m_bounds = bounds;
+  m_spans.reserve(bounds.h);
+  for (int y=bounds.y; y<bounds.y+bounds.h; ++y)
+    m_spans.push_back(MaskSpan(y, bounds.x, bounds.x+bounds.w));
 }
 
 void Mask::add(const gfx::Rect& bounds)
 {
-  if (m_freeze_count == 0)
-    reserve(bounds);
+  gfx::Rect rc = bounds;
+
+  // Frozen masks cannot grow (only reserve() can modify their bounds)
+  if (m_freeze_count > 0)
+    rc = rc.createIntersect(m_bounds);
+
+  if (rc.isEmpty())
+    return;
+
+  modifySpans();
+  applyRect(rc, AddSpans);
 
-  fill_rect(m_bitmap,
-    bounds.x-m_bounds.x,
-    bounds.y-m_bounds.y,
-    bounds.x-m_bounds.x+bounds.w-1,
-    bounds.y-m_bounds.y+bounds.h-1, 1);
+  if (m_freeze_count == 0)
+    m_bounds = m_bounds.createUnion(rc);
 }
 
 void Mask::subtract(const gfx::Rect& bounds)
 {
-  if (!m_bitmap)
+  if (isEmpty() || bounds.isEmpty())
     return;
 
-  fill_rect(m_bitmap,
-    bounds.x-m_bounds.x,
-    bounds.y-m_bounds.y,
-    bounds.x-m_bounds.x+bounds.w-1,
-    bounds.y-m_bounds.y+bounds.h-1, 0);
-
+  modifySpans();
+  applyRect(bounds, SubtractSpans);
   shrink();
 }
 
 void Mask::intersect(const gfx::Rect& bounds)
 {
-  if (!m_bitmap)
+  if (isEmpty())
     return;
 
-  gfx::Rect newBounds = m_bounds.createIntersect(bounds);
+  modifySpans();
+  m_bounds = m_bounds.createIntersect(bounds);
+  applyRect(m_bounds, IntersectSpans);
+  shrink();
+}
+
+void Mask::add(const Mask& mask)
+{
+  if (mask.isEmpty())
+    return;
 
-  Image* image = NULL;
+  modifySpans();
+  applyMask(mask, AddSpans);
 
-  if (!newBounds.isEmpty()) {
-    image = crop_image(m_bitmap,
-      newBounds.x-m_bounds.x,
-      newBounds.y-m_bounds.y,
-      newBounds.w,
-      newBounds.h, 0);
-  }
+  if (m_freeze_count > 0)
+    applyRect(m_bounds, IntersectSpans);
+  else
+    m_bounds = m_bounds.createUnion(mask.bounds());
+}
 
-  m_bitmap.reset(image);
-  m_bounds = newBounds;
+void Mask::subtract(const Mask& mask)
+{
+  if (isEmpty() || mask.isEmpty())
+    return;
 
+  modifySpans();
+  applyMask(mask, SubtractSpans);
   shrink();
 }
 
-void Mask::byColor(const Image *src, int color, int fuzziness)
+void Mask::intersect(const Mask& mask)
 {
-  replace(src->bounds());
+  if (isEmpty())
+    return;
 
-  Image* dst = m_bitmap;
+  modifySpans();
+  m_bounds = m_bounds.createIntersect(mask.bounds());
+  applyMask(mask, IntersectSpans);
+  shrink();
+}
+
+void Mask::byColor(const Image *src, int color, int fuzziness)
+{
+  clear();
+  m_bounds = src->bounds();
 
   switch (src->pixelFormat()) {
 
     case IMAGE_RGB: {
-      const LockImageBits<RgbTraits> srcBits(src);
-      LockImageBits<BitmapTraits> dstBits(dst, Image::WriteLock);
-      LockImageBits<RgbTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
-      LockImageBits<BitmapTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-      LockImageBits<BitmapTraits>::iterator dst_end = dstBits.end();
-#endif
-      int src_r, src_g, src_b, src_a;
-      int dst_r, dst_g, dst_b, dst_a;
-      color_t c;
-
-      dst_r = rgba_getr(color);
-      dst_g = rgba_getg(color);
-      dst_b = rgba_getb(color);
-      dst_a = rgba_geta(color);
-
-      for (; src_it != src_end; ++src_it, ++dst_it) {
-        ASSERT(dst_it != dst_end);
-        c = *src_it;
-
-        src_r = rgba_getr(c);
-        src_g = rgba_getg(c);
-        src_b = rgba_getb(c);
-        src_a = rgba_geta(c);
-
-        if (!((src_r >= dst_r-fuzziness) && (src_r <= dst_r+fuzziness) &&
-              (src_g >= dst_g-fuzziness) && (src_g <= dst_g+fuzziness) &&
-              (src_b >= dst_b-fuzziness) && (src_b <= dst_b+fuzziness) &&
-              (src_a >= dst_a-fuzziness) && (src_a <= dst_a+fuzziness)))
-          *dst_it = 0;
-      }
-      ASSERT(dst_it == dst_end);
+      int dst_r = rgba_getr(color);
+      int dst_g = rgba_getg(color);
+      int dst_b = rgba_getb(color);
+      int dst_a = rgba_geta(color);
+
+      read_image_spans<RgbTraits>(
+        src, [=](color_t c) -> bool {
+          int src_r = rgba_getr(c);
+          int src_g = rgba_getg(c);
+          int src_b = rgba_getb(c);
+          int src_a = rgba_geta(c);
+
+          return ((src_r >= dst_r-fuzziness) && (src_r <= dst_r+fuzziness) &&
+                  (src_g >= dst_g-fuzziness) && (src_g <= dst_g+fuzziness) &&
+                  (src_b >= dst_b-fuzziness) && (src_b <= dst_b+fuzziness) &&
+                  (src_a >= dst_a-fuzziness) && (src_a <= dst_a+fuzziness));
+        }, m_spans);
       break;
     }
 
     case IMAGE_GRAYSCALE: {
-      const LockImageBits<GrayscaleTraits> srcBits(src);
-      LockImageBits<BitmapTraits> dstBits(dst, Image::WriteLock);
-      LockImageBits<GrayscaleTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
-      LockImageBits<BitmapTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-      LockImageBits<BitmapTraits>::iterator dst_end = dstBits.end();
-#endif
-      int src_k, src_a;
-      int dst_k, dst_a;
-      color_t c;
-
-      dst_k = graya_getv(color);
-      dst_a = graya_geta(color);
+      int dst_k = graya_getv(color);
+      int dst_a = graya_geta(color);
 
-      for (; src_it != src_end; ++src_it, ++dst_it) {
-        ASSERT(dst_it != dst_end);
-        c = *src_it;
+      read_image_spans<GrayscaleTraits>(
+        src, [=](color_t c) -> bool {
+          int src_k = graya_getv(c);
+          int src_a = graya_geta(c);
 
-        src_k = graya_getv(c);
-        src_a = graya_geta(c);
-
-        if (!((src_k >= dst_k-fuzziness) && (src_k <= dst_k+fuzziness) &&
-              (src_a >= dst_a-fuzziness) && (src_a <= dst_a+fuzziness)))
-          *dst_it = 0;
-      }
-      ASSERT(dst_it == dst_end);
+          return ((src_k >= dst_k-fuzziness) && (src_k <= dst_k+fuzziness) &&
+                  (src_a >= dst_a-fuzziness) && (src_a <= dst_a+fuzziness));
+        }, m_spans);
       break;
     }
 
     case IMAGE_INDEXED: {
-      const LockImageBits<IndexedTraits> srcBits(src);
-      LockImageBits<BitmapTraits> dstBits(dst, Image::WriteLock);
-      LockImageBits<IndexedTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
-      LockImageBits<BitmapTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-      LockImageBits<BitmapTraits>::iterator dst_end = dstBits.end();
-#endif
-      color_t c, min, max;
+      color_t min = (color > fuzziness ? color-fuzziness: 0);
+      color_t max = color + fuzziness;
 
-      for (; src_it != src_end; ++src_it, ++dst_it) {
-        ASSERT(dst_it != dst_end);
-        c = *src_it;
-
-        if (color > fuzziness)
-          min = color-fuzziness;
-        else
-          min = 0;
-        max = color + fuzziness;
-
-        if (!((c >= min) && (c <= max)))
-          *dst_it = 0;
-      }
-      ASSERT(dst_it == dst_end);
+      read_image_spans<IndexedTraits>(
+        src, [=](color_t c) -> bool {
+          return ((c >= min) && (c <= max));
+        }, m_spans);
       break;
     }
+
+    default:
+      replace(src->bounds());
+      break;
   }
 
   shrink();
@@ -313,7 +489,7 @@ void Mask::crop(const Image *image)
   int done;
   color_t old_color;
 
-  if (!m_bitmap)
+  if (isEmpty())
     return;
 
   beg_x1 = m_bounds.x;
@@ -355,23 +531,12 @@ void Mask::reserve(const gfx::Rect& bounds)
 {
   ASSERT(!bounds.isEmpty());
 
-  if (!m_bitmap) {
-    m_bounds = bounds;
-    m_bitmap.reset(Image::create(IMAGE_BITMAP, bounds.w, bounds.h, m_buffer));
-    clear_image(m_bitmap, 0);
-  }
-  else {
-    gfx::Rect newBounds = m_bounds.createUnion(bounds);
-
-    if (m_bounds != newBounds) {
-      Image* image = crop_image(m_bitmap,
-        newBounds.x-m_bounds.x,
-        newBounds.y-m_bounds.y,
-        newBounds.w,
-        newBounds.h, 0);
-      m_bitmap.reset(image);
-      m_bounds = newBounds;
-    }
+  gfx::Rect newBounds = m_bounds.createUnion(bounds);
+  if (m_bounds != newBounds) {
+    // The bitmap has the size of the old bounds
+    updateSpans();
+    dropBitmap();
+    m_bounds = newBounds;
   }
 }
 
@@ -381,58 +546,174 @@ void Mask::shrink()
   if (m_freeze_count > 0)
     return;
 
-#define SHRINK_SIDE(u_begin, u_op, u_final, u_add,                      \
-                    v_begin, v_op, v_final, v_add, U, V, var)           \
-  {                                                                     \
-    for (u = u_begin; u u_op u_final; u u_add) {                        \
-      for (v = v_begin; v v_op v_final; v v_add) {                      \
-        if (m_bitmap->getPixel(U, V))                                   \
-          break;                                                        \
-      }                                                                 \
-      if (v == v_final)                                                 \
-        var;                                                            \
-      else                                                              \
-        break;                                                          \
-    }                                                                   \
+  updateSpans();
+  if (m_spans.empty()) {
+    clear();
+    return;
+  }
+
+  int x1 = m_spans.front().x1;
+  int x2 = m_spans.front().x2;
+  for (const MaskSpan& span : m_spans) {
+    x1 = std::min(x1, span.x1);
+    x2 = std::max(x2, span.x2);
   }
 
-  int u, v, x1, y1, x2, y2;
+  gfx::Rect newBounds(x1 + m_spansOrigin.x,
+                      m_spans.front().y + m_spansOrigin.y,
+                      x2 - x1,
+                      m_spans.back().y - m_spans.front().y + 1);
 
-  x1 = m_bounds.x;
-  y1 = m_bounds.y;
-  x2 = m_bounds.x+m_bounds.w-1;
-  y2 = m_bounds.y+m_bounds.h-1;
+  if (m_bounds != newBounds) {
+    dropBitmap();
+    m_bounds = newBounds;
+  }
+}
 
-  SHRINK_SIDE(0, <, m_bounds.w, ++,
-              0, <, m_bounds.h, ++, u, v, x1++);
+void Mask::updateSpans() const
+{
+  if (m_validSpans)
+    return;
 
-  SHRINK_SIDE(0, <, m_bounds.h, ++,
-              0, <, m_bounds.w, ++, v, u, y1++);
+  ASSERT(m_validBitmap);
+  m_spans.clear();
 
-  SHRINK_SIDE(m_bounds.w-1, >, 0, --,
-              0, <, m_bounds.h, ++, u, v, x2--);
+  if (m_bitmap) {
+    const int dx = m_bounds.x - m_spansOrigin.x;
+    const int dy = m_bounds.y - m_spansOrigin.y;
+    for (int v=0; v<m_bitmap->height(); ++v)
+      read_bitmap_row(m_bitmap.get(), v, v+dy, dx, m_spans);
+  }
 
-  SHRINK_SIDE(m_bounds.h-1, >, 0, --,
-              0, <, m_bounds.w, ++, v, u, y2--);
+  m_validSpans = true;
+}
 
-  if ((x1 > x2) || (y1 > y2)) {
-    clear();
+// Called before modifying the spans (the bitmap isn't valid anymore).
+void Mask::modifySpans()
+{
+  updateSpans();
+  dropBitmap();
+}
+
+void Mask::dropBitmap()
+{
+  m_bitmap.reset();
+  m_validBitmap = false;
+}
+
+// Modifies only the spans of the rows of the given rectangle.
+void Mask::applyRect(const gfx::Rect& bounds, SpanOp op)
+{
+  ASSERT(m_validSpans);
+
+  const int x1 = bounds.x - m_spansOrigin.x;
+  const int y1 = bounds.y - m_spansOrigin.y;
+  const int y2 = y1 + bounds.h;
+
+  MaskSpans::iterator first = find_row(m_spans, y1);
+  MaskSpans::iterator last = find_row(m_spans, y2);
+  const MaskSpan* p = m_spans.data() + (first - m_spans.begin());
+  const MaskSpan* end = m_spans.data() + (last - m_spans.begin());
+  MaskSpans rows;
+
+  if (op == AddSpans) {
+    rows.reserve((end - p) + bounds.h);
+    for (int y=y1; y<y2; ++y) {
+      const MaskSpan* q = (p != end && p->y == y ? row_end(p, end): p);
+      MaskSpan span(y, x1, x1+bounds.w);
+      combineRow(p, q, &span, &span+1, 0, y, op, rows);
+      p = q;
+    }
   }
-  else if ((x1 != m_bounds.x) || (x2 != m_bounds.x+m_bounds.w-1) ||
-           (y1 != m_bounds.y) || (y2 != m_bounds.y+m_bounds.h-1)) {
-    u = m_bounds.x;
-    v = m_bounds.y;
-
-    m_bounds.x = x1;
-    m_bounds.y = y1;
-    m_bounds.w = x2 - x1 + 1;
-    m_bounds.h = y2 - y1 + 1;
-
-    Image* image = crop_image(m_bitmap, m_bounds.x-u, m_bounds.y-v, m_bounds.w, m_bounds.h, 0);
-    m_bitmap.reset(image);
+  else {
+    // Only rows with spans can be modified
+    rows.reserve(2 * (end - p));
+    while (p != end) {
+      const MaskSpan* q = row_end(p, end);
+      MaskSpan span(p->y, x1, x1+bounds.w);
+      combineRow(p, q, &span, &span+1, 0, p->y, op, rows);
+      p = q;
+    }
   }
 
-#undef SHRINK_SIDE
+  if (op == IntersectSpans) {
+    m_spans.swap(rows);
+  }
+  else {
+    first = m_spans.erase(first, last);
+    m_spans.insert(first, rows.begin(), rows.end());
+  }
+}
+
+void Mask::applyMask(const Mask& mask, SpanOp op)
+{
+  ASSERT(m_validSpans);
+
+  const MaskSpans& other = mask.spans();
+  const int dx = mask.m_spansOrigin.x - m_spansOrigin.x;
+  const int dy = mask.m_spansOrigin.y - m_spansOrigin.y;
+  const MaskSpan* a = m_spans.data();
+  const MaskSpan* aEnd = a + m_spans.size();
+  const MaskSpan* b = other.data();
+  const MaskSpan* bEnd = b + other.size();
+  MaskSpans result;
+  result.reserve(m_spans.size() + other.size());
+
+  while (a != aEnd || b != bEnd) {
+    const int ya = (a != aEnd ? a->y: INT_MAX);
+    const int yb = (b != bEnd ? b->y + dy: INT_MAX);
+    const int y = std::min(ya, yb);
+    const MaskSpan* a2 = (ya == y ? row_end(a, aEnd): a);
+    const MaskSpan* b2 = (yb == y ? row_end(b, bEnd): b);
+
+    combineRow(a, a2, b, b2, dx, y, op, result);
+    a = a2;
+    b = b2;
+  }
+
+  m_spans.swap(result);
+}
+
+// Puts in "out" the result of the operation between the spans [a,
+// aEnd) and [b, bEnd) of the same row "y" ("dx" is added to the x
+// coordinates of the "b" spans).
+// static
+void Mask::combineRow(const MaskSpan* a, const MaskSpan* aEnd,
+                      const MaskSpan* b, const MaskSpan* bEnd,
+                      int dx, int y, SpanOp op, MaskSpans& out)
+{
+  bool inA = false, inB = false, inside = false;
+  int start = 0;
+
+  while (a != aEnd || b != bEnd) {
+    const int ea = (a != aEnd ? (inA ? a->x2: a->x1): INT_MAX);
+    const int eb = (b != bEnd ? (inB ? b->x2: b->x1) + dx: INT_MAX);
+    const int x = std::min(ea, eb);
+
+    if (ea == x) {
+      if (inA) ++a;
+      inA = !inA;
+    }
+    if (eb == x) {
+      if (inB) ++b;
+      inB = !inB;
+    }
+
+    bool result = false;
+    switch (op) {
+      case AddSpans:       result = (inA || inB); break;
+      case SubtractSpans:  result = (inA && !inB); break;
+      case IntersectSpans: result = (inA && inB); break;
+    }
+
+    if (result != inside) {
+      if (result)
+        start = x;
+      else
+        out.push_back(MaskSpan(y, start, x));
+      inside = result;
+    }
+  }
 }
 
 } // namespace doc
@@ -13,13 +13,32 @@
 #include "doc/image_ref.h"
 #include "doc/object.h"
 #include "doc/primitives.h"
+#include "gfx/point.h"
 #include "gfx/rect.h"
 
 #include <string>
+#include <vector>
 
 namespace doc {
 
+  // Run of selected pixels [x1, x2) in the row y of a mask.
+  struct MaskSpan {
+    int y, x1, x2;
+
+    MaskSpan() { }
+    MaskSpan(int y, int x1, int x2) : y(y), x1(x1), x2(x2) { }
+  };
+
+  // Spans sorted by row and column, spans in the same row never
+  // overlap or touch each other.
+  typedef std::vector<MaskSpan> MaskSpans;
+
   // Represents the selection (selected pixels, 0/1, 0=non-selected, 1=selected)
+  //
+  // The selected pixels are stored as a list of spans, so the memory
+  // used by the mask depends on the number of its edges (and not its
+  // area), and the operations with rectangles only modify the spans
+  // of the affected rows. The bitmap is created when it's needed.
   class Mask : public Object {
   public:
     Mask();
@@ -31,28 +50,34 @@ namespace doc {
     void setName(const char *name);
     const std::string& name() const { return m_name; }
 
-    const Image* bitmap() const { return m_bitmap; }
-    Image* bitmap() { return m_bitmap; }
+    // Returns the selection as a bitmap of bounds() size (or NULL if
+    // the mask is empty). The bitmap is kept until the mask is
+    // modified.
+    const Image* bitmap() const;
+
+    // Returns the bitmap to modify the selected pixels directly. The
+    // spans are updated from this bitmap the next time they are
+    // needed, so the bitmap cannot be used after other member
+    // function modifies the mask.
+    Image* editableBitmap();
+
+    // Returns the spans of the selection, relative to spansOrigin().
+    const MaskSpans& spans() const;
+    const gfx::Point& spansOrigin() const { return m_spansOrigin; }
 
     // Returns true if the mask is completely empty (i.e. nothing
     // selected)
     bool isEmpty() const {
-      return (!m_bitmap ? true: false);
+      return m_bounds.isEmpty();
     }
 
     // Returns true if the point is inside the mask
-    bool containsPoint(int u, int v) const {
-      return (m_bitmap &&
-              u >= m_bounds.x && u < m_bounds.x+m_bounds.w &&
-              v >= m_bounds.y && v < m_bounds.y+m_bounds.h &&
-              get_pixel(m_bitmap, u-m_bounds.x, v-m_bounds.y));
-    }
+    bool containsPoint(int u, int v) const;
 
     const gfx::Rect& bounds() const { return m_bounds; }
 
     void setOrigin(int x, int y) {
-      m_bounds.x = x;
-      m_bounds.y = y;
+      offsetOrigin(x - m_bounds.x, y - m_bounds.y);
     }
 
     // These functions can be used to disable the automatic call to
@@ -83,6 +108,12 @@ namespace doc {
     void add(const gfx::Rect& bounds);
     void subtract(const gfx::Rect& bounds);
     void intersect(const gfx::Rect& bounds);
+
+    // Union/difference/intersection with the pixels of other mask
+    void add(const Mask& mask);
+    void subtract(const Mask& mask);
+    void intersect(const Mask& mask);
+
     void byColor(const Image* image, int color, int fuzziness);
     void crop(const Image* image);
 
@@ -98,17 +129,38 @@ namespace doc {
     void offsetOrigin(int dx, int dy);
 
   private:
+    enum SpanOp { AddSpans, SubtractSpans, IntersectSpans };
+
     void initialize();
+    void updateSpans() const;
+    void modifySpans();
+    void dropBitmap();
+    void applyRect(const gfx::Rect& bounds, SpanOp op);
+    void applyMask(const Mask& mask, SpanOp op);
+
+    static void combineRow(const MaskSpan* a, const MaskSpan* aEnd,
+                           const MaskSpan* b, const MaskSpan* bEnd,
+                           int dx, int y, SpanOp op, MaskSpans& out);
 
     int m_freeze_count;
     std::string m_name;           // Mask name
     gfx::Rect m_bounds;           // Region bounds
-    ImageRef m_bitmap;            // Bitmapped image mask
+
+    // Selected pixels (relative to m_spansOrigin, so the origin of
+    // the mask can be changed without modifying each span). These are
+    // mutable because they are updated from m_bitmap (when it was
+    // modified with editableBitmap()) in const member functions.
+    mutable MaskSpans m_spans;
+    mutable bool m_validSpans;
+    gfx::Point m_spansOrigin;
+
+    // Bitmapped image mask created from the spans when it's needed.
+    mutable ImageRef m_bitmap;
+    mutable bool m_validBitmap;
     ImageBufferPtr m_buffer;      // Buffer used in m_bitmap
 
     Mask& operator=(const Mask& mask);
   };
-
 } // namespace doc
 
 #endif
@@ -59,8 +59,10 @@ Mask* read_mask(std::istream& is)
     int size = BitmapTraits::getRowStrideBytes(w);
 
     mask->add(gfx::Rect(x, y, w, h));
+
+    Image* bitmap = mask->editableBitmap();
     for (int c=0; c<mask->bounds().h; c++)
-      is.read((char*)mask->bitmap()->getPixelAddress(0, c), size);
+      is.read((char*)bitmap->getPixelAddress(0, c), size);
   }
 
   return mask.release();
@@ -0,0 +1,327 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/mask.h"
+#include "doc/primitives.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace doc;
+
+// Reference mask: one bool for each pixel of the canvas
+class Pixels {
+public:
+  static const int kX = -20, kY = -20, kW = 120, kH = 110;
+
+  Pixels() : m_pixels(kW*kH, false) { }
+
+  bool get(int x, int y) const {
+    if (x < kX || y < kY || x >= kX+kW || y >= kY+kH)
+      return false;
+    return m_pixels[(y-kY)*kW + (x-kX)];
+  }
+
+  void set(int x, int y, bool state) {
+    ASSERT(x >= kX && y >= kY && x < kX+kW && y < kY+kH);
+    m_pixels[(y-kY)*kW + (x-kX)] = state;
+  }
+
+  gfx::Rect bounds() const {
+    gfx::Rect rc;
+    for (int y=kY; y<kY+kH; ++y)
+      for (int x=kX; x<kX+kW; ++x)
+        if (get(x, y))
+          rc = rc.createUnion(gfx::Rect(x, y, 1, 1));
+    return rc;
+  }
+
+  void add(const gfx::Rect& rc, bool state) {
+    for (int y=rc.y; y<rc.y2(); ++y)
+      for (int x=rc.x; x<rc.x2(); ++x)
+        set(x, y, state);
+  }
+
+  void intersect(const gfx::Rect& rc) {
+    for (int y=kY; y<kY+kH; ++y)
+      for (int x=kX; x<kX+kW; ++x)
+        if (!rc.contains(gfx::Point(x, y)))
+          set(x, y, false);
+  }
+
+private:
+  std::vector<bool> m_pixels;
+};
+
+static gfx::Rect random_rect()
+{
+  return gfx::Rect(std::rand() % 70 - 10,
+                   std::rand() % 60 - 10,
+                   std::rand() % 25 + 1,
+                   std::rand() % 25 + 1);
+}
+
+static void random_mask(Mask& mask, Pixels& pixels)
+{
+  mask.clear();
+  for (int i=0; i<6; ++i) {
+    gfx::Rect rc = random_rect();
+    if (i < 3) {
+      mask.add(rc);
+      pixels.add(rc, true);
+    }
+    else {
+      mask.subtract(rc);
+      pixels.add(rc, false);
+    }
+  }
+}
+
+static void expect_mask(const Pixels& pixels, const Mask& mask)
+{
+  gfx::Rect bounds = pixels.bounds();
+  ASSERT_TRUE(bounds == mask.bounds())
+    << "expected " << bounds.x << "," << bounds.y << " " << bounds.w << "x" << bounds.h
+    << " got " << mask.bounds().x << "," << mask.bounds().y << " "
+    << mask.bounds().w << "x" << mask.bounds().h;
+  EXPECT_EQ(bounds.isEmpty(), mask.isEmpty());
+
+  // Check the spans
+  int n = 0;
+  for (int y=Pixels::kY; y<Pixels::kY+Pixels::kH; ++y)
+    for (int x=Pixels::kX; x<Pixels::kX+Pixels::kW; ++x) {
+      ASSERT_EQ(pixels.get(x, y), mask.containsPoint(x, y))
+        << "pixel " << x << "," << y;
+      n += (pixels.get(x, y) ? 1: 0);
+    }
+
+  int m = 0;
+  for (const MaskSpan& span : mask.spans()) {
+    EXPECT_LT(span.x1, span.x2);
+    m += span.x2 - span.x1;
+  }
+  EXPECT_EQ(n, m);
+
+  // Check the bitmap
+  const Image* bitmap = mask.bitmap();
+  if (bounds.isEmpty()) {
+    EXPECT_TRUE(bitmap == NULL);
+    return;
+  }
+  ASSERT_TRUE(bitmap != NULL);
+  ASSERT_EQ(bounds.w, bitmap->width());
+  ASSERT_EQ(bounds.h, bitmap->height());
+  for (int y=0; y<bounds.h; ++y)
+    for (int x=0; x<bounds.w; ++x)
+      ASSERT_EQ(pixels.get(bounds.x+x, bounds.y+y),
+                get_pixel(bitmap, x, y) ? true: false)
+        << "bitmap pixel " << x << "," << y;
+}
+
+TEST(Mask, Rects)
+{
+  Mask mask;
+  EXPECT_TRUE(mask.isEmpty());
+  EXPECT_TRUE(mask.bitmap() == NULL);
+
+  mask.add(gfx::Rect(2, 3, 4, 5));
+  EXPECT_TRUE(mask.isRectangular());
+  EXPECT_TRUE(gfx::Rect(2, 3, 4, 5) == mask.bounds());
+  EXPECT_EQ(5, int(mask.spans().size()));
+
+  // Touching rectangles are joined in the same span
+  mask.add(gfx::Rect(6, 3, 2, 5));
+  EXPECT_TRUE(mask.isRectangular());
+  EXPECT_EQ(5, int(mask.spans().size()));
+
+  mask.subtract(gfx::Rect(4, 5, 1, 1));
+  EXPECT_FALSE(mask.isRectangular());
+  EXPECT_EQ(6, int(mask.spans().size()));
+  EXPECT_FALSE(mask.containsPoint(4, 5));
+  EXPECT_TRUE(mask.containsPoint(3, 5));
+  EXPECT_TRUE(mask.containsPoint(5, 5));
+
+  mask.intersect(gfx::Rect(0, 0, 4, 4));
+  EXPECT_TRUE(gfx::Rect(2, 3, 2, 1) == mask.bounds());
+  EXPECT_TRUE(mask.isRectangular());
+
+  mask.subtract(mask.bounds());
+  EXPECT_TRUE(mask.isEmpty());
+}
+
+TEST(Mask, RandomOperations)
+{
+  std::srand(1);
+
+  for (int i=0; i<100; ++i) {
+    Mask mask;
+    Pixels pixels;
+    random_mask(mask, pixels);
+    expect_mask(pixels, mask);
+
+    // Use the bitmap before some operations to check that the spans
+    // are regenerated
+    if (i & 1)
+      mask.bitmap();
+
+    gfx::Rect rc = random_rect();
+    switch (i % 4) {
+      case 0:
+        mask.add(rc);
+        pixels.add(rc, true);
+        break;
+      case 1:
+        mask.subtract(rc);
+        pixels.add(rc, false);
+        break;
+      case 2:
+        mask.intersect(rc);
+        pixels.intersect(rc);
+        break;
+      case 3: {
+        gfx::Rect bounds = mask.bounds();
+        mask.invert();
+        for (int y=bounds.y; y<bounds.y2(); ++y)
+          for (int x=bounds.x; x<bounds.x2(); ++x)
+            pixels.set(x, y, !pixels.get(x, y));
+        break;
+      }
+    }
+    expect_mask(pixels, mask);
+  }
+}
+
+TEST(Mask, MaskOperations)
+{
+  std::srand(2);
+
+  for (int i=0; i<60; ++i) {
+    Mask a, b;
+    Pixels pa, pb;
+    random_mask(a, pa);
+    random_mask(b, pb);
+
+    // Different spans origins
+    a.offsetOrigin(3, -2);
+    b.offsetOrigin(-1, 4);
+    Pixels qa, qb;
+    for (int y=Pixels::kY+5; y<Pixels::kY+Pixels::kH-5; ++y)
+      for (int x=Pixels::kX+5; x<Pixels::kX+Pixels::kW-5; ++x) {
+        qa.set(x, y, pa.get(x-3, y+2));
+        qb.set(x, y, pb.get(x+1, y-4));
+      }
+    expect_mask(qa, a);
+    expect_mask(qb, b);
+
+    for (int y=Pixels::kY; y<Pixels::kY+Pixels::kH; ++y)
+      for (int x=Pixels::kX; x<Pixels::kX+Pixels::kW; ++x) {
+        bool u = qa.get(x, y), v = qb.get(x, y);
+        switch (i % 3) {
+          case 0: qa.set(x, y, u || v); break;
+          case 1: qa.set(x, y, u && !v); break;
+          case 2: qa.set(x, y, u && v); break;
+        }
+      }
+
+    switch (i % 3) {
+      case 0: a.add(b); break;
+      case 1: a.subtract(b); break;
+      case 2: a.intersect(b); break;
+    }
+    expect_mask(qa, a);
+  }
+}
+
+TEST(Mask, EditableBitmap)
+{
+  std::srand(3);
+
+  Mask mask;
+  Pixels pixels;
+  random_mask(mask, pixels);
+
+  gfx::Rect bounds = mask.bounds();
+  Image* bitmap = mask.editableBitmap();
+  ASSERT_TRUE(bitmap != NULL);
+  for (int y=0; y<bounds.h; ++y)
+    for (int x=0; x<bounds.w; ++x)
+      if (std::rand() % 3 == 0) {
+        put_pixel(bitmap, x, y, 0);
+        pixels.set(bounds.x+x, bounds.y+y, false);
+      }
+
+  // The spans are read from the modified bitmap
+  mask.shrink();
+  expect_mask(pixels, mask);
+
+  // Reserve, modify and shrink
+  gfx::Rect rc(-10, -10, 100, 90);
+  mask.freeze();
+  mask.reserve(rc);
+  EXPECT_TRUE(rc == mask.bounds());
+  bitmap = mask.editableBitmap();
+  put_pixel(bitmap, 99, 89, 1);
+  pixels.set(89, 79, true);
+  mask.add(gfx::Rect(-20, -20, 12, 12)); // Clipped to the frozen bounds
+  pixels.add(gfx::Rect(-10, -10, 2, 2), true);
+  mask.unfreeze();
+  expect_mask(pixels, mask);
+}
+
+TEST(Mask, CopyAndOrigin)
+{
+  std::srand(4);
+
+  Mask mask;
+  Pixels pixels;
+  random_mask(mask, pixels);
+  mask.bitmap();
+
+  Mask copy(mask);
+  expect_mask(pixels, copy);
+  EXPECT_LT(copy.getMemSize(), mask.getMemSize());
+
+  mask.setOrigin(mask.bounds().x+5, mask.bounds().y-3);
+  Pixels moved;
+  for (int y=Pixels::kY+5; y<Pixels::kY+Pixels::kH-5; ++y)
+    for (int x=Pixels::kX+5; x<Pixels::kX+Pixels::kW-5; ++x)
+      moved.set(x, y, pixels.get(x-5, y+3));
+  expect_mask(moved, mask);
+  expect_mask(pixels, copy);
+}
+
+TEST(Mask, ByColor)
+{
+  ImageRef image(Image::create(IMAGE_INDEXED, 20, 10));
+  clear_image(image.get(), 0);
+  fill_rect(image.get(), 3, 2, 8, 5, 4);
+  put_pixel(image.get(), 12, 9, 5);
+
+  Mask mask;
+  mask.byColor(image.get(), 4, 1);
+  EXPECT_TRUE(gfx::Rect(3, 2, 10, 8) == mask.bounds());
+  EXPECT_TRUE(mask.containsPoint(12, 9));
+  EXPECT_FALSE(mask.containsPoint(11, 9));
+  EXPECT_EQ(5, int(mask.spans().size()));
+
+  mask.byColor(image.get(), 4, 0);
+  EXPECT_TRUE(gfx::Rect(3, 2, 6, 4) == mask.bounds());
+  EXPECT_TRUE(mask.isRectangular());
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -10,6 +10,8 @@
 
 #include "doc/palette.h"
 
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
 #include "gfx/hsv.h"
 #include "gfx/rgb.h"
 #include "doc/image.h"
@@ -23,6 +25,7 @@ using namespace gfx;
 
 Palette::Palette(frame_t frame, int ncolors)
   : Object(ObjectType::Palette)
+  , m_bestfitModifications(-1)
 {
   ASSERT(ncolors >= 0 && ncolors <= MaxColors);
 
@@ -35,6 +38,7 @@ Palette::Palette(frame_t frame, int ncolors)
 
 Palette::Palette(const Palette& palette)
   : Object(palette)
+  , m_bestfitModifications(-1)
 {
   m_frame = palette.m_frame;
   m_colors = palette.m_colors;
@@ -382,6 +386,8 @@ void Palette::sort(int from, int to, SortPalette* sort_palette, std::vector<int>
     m_colors[from+i] = temp[i].color;
     mapping[from+i] = temp[i].index;
   }
+
+  ++m_modifications;
 }
 
 // End of Sort stuff
@@ -413,14 +419,47 @@ static void bestfit_init()
   }
 }
 
+// findBestfit() can be called from several threads at the same time
+// (e.g. RgbMap entries are resolved lazily), so the index is rebuilt
+// with this mutex locked.
+static base::mutex bestfit_mutex;
+
+void Palette::updateBestfitIndex() const
+{
+  if (m_bestfitModifications.load(std::memory_order_acquire) == m_modifications)
+    return;
+
+  base::scoped_lock lock(bestfit_mutex);
+  if (m_bestfitModifications.load(std::memory_order_relaxed) == m_modifications)
+    return;
+
+  m_bestfitIndex.resize(m_colors.size());
+  for (int i=0; i<(int)m_colors.size(); ++i) {
+    color_t rgb = m_colors[i];
+    m_bestfitIndex[i] =
+      ((rgba_getg(rgb)>>3) << 26) |
+      ((rgba_getr(rgb)>>3) << 21) |
+      ((rgba_getb(rgb)>>3) << 16) | i;
+  }
+  std::sort(m_bestfitIndex.begin(), m_bestfitIndex.end());
+
+  int j = 0;
+  for (int g=0; g<32; ++g) {
+    m_bestfitStart[g] = j;
+    while (j < (int)m_bestfitIndex.size() && int(m_bestfitIndex[j] >> 26) == g)
+      ++j;
+  }
+  m_bestfitStart[32] = j;
+
+  m_bestfitModifications.store(m_modifications, std::memory_order_release);
+}
+
+// Returns the same entry as a linear search of the closest color
+// (the first one in case of ties), but only visits the entries with a
+// green component close enough to the best distance found so far.
 int Palette::findBestfit(int r, int g, int b, int mask_index) const
 {
-#ifdef __GNUC__
-  register int bestfit asm("%eax");
-#else
-  register int bestfit;
-#endif
-  int i, coldiff, lowest;
+  int bestfit, lowest;
 
   ASSERT(r >= 0 && r <= 255);
   ASSERT(g >= 0 && g <= 255);
@@ -429,6 +468,8 @@ int Palette::findBestfit(int r, int g, int b, int mask_index) const
   if (col_diff[1] == 0)
     bestfit_init();
 
+  updateBestfitIndex();
+
   bestfit = 0;
   lowest = std::numeric_limits<int>::max();
 
@@ -436,16 +477,29 @@ int Palette::findBestfit(int r, int g, int b, int mask_index) const
   g >>= 3;
   b >>= 3;
 
-  i = 0;
-  while (i < size()) {
-    color_t rgb = m_colors[i];
+  // Visit the green buckets g, g-1, g+1, g-2, g+2, etc.
+  for (int dg=0; dg<32; ++dg) {
+    int gdiff = col_diff[dg];
+    if (gdiff > lowest)
+      break;
+
+    for (int k=0; k<2; ++k) {
+      int gg = (k == 0 ? g-dg: g+dg);
+      if (gg < 0 || gg > 31 || (k == 1 && dg == 0))
+        continue;
+
+      for (int j=m_bestfitStart[gg]; j<m_bestfitStart[gg+1]; ++j) {
+        uint32_t entry = m_bestfitIndex[j];
+        int i = int(entry & 0xffff);
+        if (i == mask_index)
+          continue;
+
+        int coldiff = gdiff + (col_diff + 128) [ (int((entry >> 21) & 31) - r) & 0x7F ];
+        if (coldiff > lowest)
+          continue;
 
-    coldiff = (col_diff + 0) [ ((rgba_getg(rgb)>>3) - g) & 0x7F ];
-    if (coldiff < lowest) {
-      coldiff += (col_diff + 128) [ ((rgba_getr(rgb)>>3) - r) & 0x7F ];
-      if (coldiff < lowest) {
-        coldiff += (col_diff + 256) [ ((rgba_getb(rgb)>>3) - b) & 0x7F ];
-        if (coldiff < lowest && i != mask_index) {
+        coldiff += (col_diff + 256) [ (int((entry >> 16) & 31) - b) & 0x7F ];
+        if (coldiff < lowest || (coldiff == lowest && i < bestfit)) {
           bestfit = i;
           if (coldiff == 0)
             return bestfit;
@@ -453,7 +507,6 @@ int Palette::findBestfit(int r, int g, int b, int mask_index) const
         }
       }
     }
-    i++;
   }
 
   return bestfit;
@@ -12,6 +12,7 @@
 #include "doc/frame.h"
 #include "doc/object.h"
 
+#include <atomic>
 #include <vector>
 #include <string>
 
@@ -94,10 +95,21 @@ namespace doc {
     int findBestfit(int r, int g, int b, int mask_index = 0) const;
 
   private:
+    void updateBestfitIndex() const;
+
     frame_t m_frame;
     std::vector<color_t> m_colors;
     int m_modifications;
     std::string m_filename; // If the palette is associated with a file.
+
+    // Entries sorted by their 5-bit green/red/blue components (and
+    // palette index in the lower 16 bits) to prune findBestfit()
+    // searches. m_bestfitStart[g] is the first entry with the given
+    // green component. The index is rebuilt lazily when
+    // m_bestfitModifications != m_modifications.
+    mutable std::vector<uint32_t> m_bestfitIndex;
+    mutable int m_bestfitStart[33];
+    mutable std::atomic<int> m_bestfitModifications;
   };
 
 } // namespace doc
@@ -22,6 +22,7 @@ RgbMap::RgbMap()
   , m_map(MAPSIZE)
   , m_palette(NULL)
   , m_modifications(0)
+  , m_maskIndex(0)
 {
 }
 
@@ -35,19 +36,10 @@ void RgbMap::regenerate(const Palette* palette, int mask_index)
 {
   m_palette = palette;
   m_modifications = palette->getModifications();
+  m_maskIndex = mask_index;
 
-  int i = 0;
-  for (int r=0; r<32; ++r) {
-    for (int g=0; g<32; ++g) {
-      for (int b=0; b<32; ++b) {
-        m_map[i++] =
-          palette->findBestfit(
-            scale_5bits_to_8bits(r),
-            scale_5bits_to_8bits(g),
-            scale_5bits_to_8bits(b), mask_index);
-      }
-    }
-  }
+  for (auto& entry : m_map)
+    entry.store(-1, std::memory_order_relaxed);
 }
 
 int RgbMap::mapColor(int r, int g, int b) const
@@ -55,7 +47,27 @@ int RgbMap::mapColor(int r, int g, int b) const
   ASSERT(r >= 0 && r < 256);
   ASSERT(g >= 0 && g < 256);
   ASSERT(b >= 0 && b < 256);
-  return m_map[((r>>3) << 10) + ((g>>3) << 5) + (b>>3)];
+
+  int i = ((r>>3) << 10) + ((g>>3) << 5) + (b>>3);
+  int index = m_map[i].load(std::memory_order_relaxed);
+  if (index < 0)
+    index = resolve(i);
+  return index;
+}
+
+int RgbMap::resolve(int i) const
+{
+  ASSERT(m_palette);
+
+  int index = m_palette->findBestfit(
+    scale_5bits_to_8bits((i >> 10) & 31),
+    scale_5bits_to_8bits((i >> 5) & 31),
+    scale_5bits_to_8bits(i & 31), m_maskIndex);
+
+  // Two threads can resolve the same entry, but both store the same
+  // value.
+  m_map[i].store(int16_t(index), std::memory_order_relaxed);
+  return index;
 }
 
 } // namespace doc
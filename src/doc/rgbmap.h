@@ -11,6 +11,7 @@
 #include "base/disable_copying.h"
 #include "doc/object.h"
 
+#include <atomic>
 #include <vector>
 
 namespace doc {
@@ -22,14 +23,24 @@ namespace doc {
     RgbMap();
 
     bool match(const Palette* palette) const;
+
+    // Prepares the map for the given palette. Each entry is
+    // calculated the first time it's used in mapColor(), so the
+    // palette must be alive (and unmodified) while the map is used,
+    // i.e. while match(palette) returns true.
     void regenerate(const Palette* palette, int mask_index);
 
     int mapColor(int r, int g, int b) const;
 
   private:
-    std::vector<uint8_t> m_map;
+    int resolve(int i) const;
+
+    // Palette index of each 5-bit RGB color, or -1 if the entry wasn't
+    // calculated yet. Entries can be resolved from several threads.
+    mutable std::vector<std::atomic<int16_t> > m_map;
     const Palette* m_palette;
     int m_modifications;
+    int m_maskIndex;
 
     DISABLE_COPYING(RgbMap);
   };
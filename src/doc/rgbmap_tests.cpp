@@ -0,0 +1,128 @@
+// Aseprite Document Library
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/color_scales.h"
+#include "doc/palette.h"
+#include "doc/rgbmap.h"
+
+#include <cstdlib>
+#include <limits>
+
+using namespace doc;
+
+// Linear search with the same distance as Palette::findBestfit()
+static int linear_bestfit(const Palette* pal, int r, int g, int b, int mask_index)
+{
+  int bestfit = 0;
+  int lowest = std::numeric_limits<int>::max();
+
+  r >>= 3;
+  g >>= 3;
+  b >>= 3;
+
+  for (int i=0; i<pal->size(); ++i) {
+    color_t c = pal->getEntry(i);
+    int dr = (rgba_getr(c)>>3) - r;
+    int dg = (rgba_getg(c)>>3) - g;
+    int db = (rgba_getb(c)>>3) - b;
+    int coldiff = dg*dg*59*59 + dr*dr*30*30 + db*db*11*11;
+    if (coldiff < lowest && i != mask_index) {
+      bestfit = i;
+      lowest = coldiff;
+    }
+  }
+  return bestfit;
+}
+
+static void fill_random_palette(Palette* pal, int colors)
+{
+  pal->resize(colors);
+  for (int i=0; i<colors; ++i) {
+    // Duplicated entries to test ties
+    if (i > 0 && (std::rand() % 8) == 0)
+      pal->setEntry(i, pal->getEntry(std::rand() % i));
+    else
+      pal->setEntry(i, rgba(std::rand() % 256,
+                            std::rand() % 256,
+                            std::rand() % 256, 255));
+  }
+}
+
+TEST(RgbMap, FindBestfitLikeLinearSearch)
+{
+  std::srand(1);
+  int sizes[] = { 1, 2, 16, 100, 256 };
+
+  for (int colors : sizes) {
+    Palette pal(frame_t(0), colors);
+    fill_random_palette(&pal, colors);
+
+    for (int mask=0; mask<2; ++mask) {
+      for (int c=0; c<2000; ++c) {
+        int r = std::rand() % 256;
+        int g = std::rand() % 256;
+        int b = std::rand() % 256;
+        EXPECT_EQ(linear_bestfit(&pal, r, g, b, mask),
+                  pal.findBestfit(r, g, b, mask))
+          << "colors=" << colors << " rgb=" << r << "," << g << "," << b;
+      }
+    }
+  }
+}
+
+TEST(RgbMap, UpdatedWithPalette)
+{
+  Palette pal(frame_t(0), 2);
+  pal.setEntry(0, rgba(0, 0, 0, 255));
+  pal.setEntry(1, rgba(255, 255, 255, 255));
+  EXPECT_EQ(1, pal.findBestfit(250, 250, 250, -1));
+
+  // Swap black/white
+  pal.setEntry(0, rgba(255, 255, 255, 255));
+  pal.setEntry(1, rgba(0, 0, 0, 255));
+  EXPECT_EQ(0, pal.findBestfit(250, 250, 250, -1));
+
+  RgbMap rgbmap;
+  rgbmap.regenerate(&pal, -1);
+  EXPECT_TRUE(rgbmap.match(&pal));
+  EXPECT_EQ(0, rgbmap.mapColor(250, 250, 250));
+  EXPECT_EQ(1, rgbmap.mapColor(0, 0, 0));
+
+  pal.setEntry(1, rgba(255, 0, 0, 255));
+  EXPECT_FALSE(rgbmap.match(&pal));
+}
+
+TEST(RgbMap, LazyEntries)
+{
+  std::srand(2);
+  Palette pal(frame_t(0), 256);
+  fill_random_palette(&pal, 256);
+
+  RgbMap rgbmap;
+  rgbmap.regenerate(&pal, 0);
+
+  for (int r=0; r<32; ++r)
+    for (int g=0; g<32; ++g)
+      for (int b=0; b<32; ++b) {
+        int r8 = scale_5bits_to_8bits(r);
+        int g8 = scale_5bits_to_8bits(g);
+        int b8 = scale_5bits_to_8bits(b);
+        EXPECT_EQ(linear_bestfit(&pal, r8, g8, b8, 0),
+                  rgbmap.mapColor(r8, g8, b8));
+      }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,206 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/algorithm/rotsprite.h"
+#include "doc/blend.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+
+using namespace doc;
+
+// Scales the whole image 2x with Scale2x (pixels outside the image
+// are equal to the closest pixel in the border).
+static ImageRef scale2x(const Image* src)
+{
+  int w = src->width(), h = src->height();
+  ImageRef dst(Image::create(src->pixelFormat(), w*2, h*2));
+
+  for (int y=0; y<h; ++y) {
+    for (int x=0; x<w; ++x) {
+      color_t P = get_pixel(src, x, y);
+      color_t A = get_pixel(src, x, std::max(y-1, 0));
+      color_t B = get_pixel(src, std::min(x+1, w-1), y);
+      color_t C = get_pixel(src, std::max(x-1, 0), y);
+      color_t D = get_pixel(src, x, std::min(y+1, h-1));
+
+      put_pixel(dst.get(), 2*x,   2*y,   (C == A && C != D && A != B ? A: P));
+      put_pixel(dst.get(), 2*x+1, 2*y,   (A == B && A != C && B != D ? B: P));
+      put_pixel(dst.get(), 2*x,   2*y+1, (D == C && D != B && C != A ? C: P));
+      put_pixel(dst.get(), 2*x+1, 2*y+1, (B == D && B != A && D != C ? D: P));
+    }
+  }
+  return dst;
+}
+
+// Reference implementation: scales the whole source image 8x and
+// samples it for each destination pixel (using the same inverse
+// mapping of rotsprite_image()).
+static void expected_rotsprite(Image* bmp, const Image* spr,
+                               int x1, int y1, int x2, int y2,
+                               int x4, int y4)
+{
+  ImageRef big(Image::createCopy(spr));
+  for (int i=0; i<3; ++i)
+    big = scale2x(big.get());
+
+  double ax = double(x2 - x1) / spr->width();
+  double ay = double(y2 - y1) / spr->width();
+  double bx = double(x4 - x1) / spr->height();
+  double by = double(y4 - y1) / spr->height();
+  double det = ax*by - ay*bx;
+  if (det == 0.0)
+    return;
+
+  double sx = by / det, sy = -bx / det;
+  double tx = -ay / det, ty = ax / det;
+  color_t mask = spr->maskColor();
+
+  for (int v=0; v<bmp->height(); ++v) {
+    for (int u=0; u<bmp->width(); ++u) {
+      double x = u + 0.5/8 - x1;
+      double y = v + 0.5/8 - y1;
+      int S = int(std::floor((x*sx + y*sy) * 8));
+      int T = int(std::floor((x*tx + y*ty) * 8));
+      if (S < 0 || T < 0 || S >= big->width() || T >= big->height())
+        continue;
+
+      color_t c = get_pixel(big.get(), S, T);
+      color_t d = get_pixel(bmp, u, v);
+      switch (bmp->pixelFormat()) {
+        case IMAGE_RGB:
+          if (rgba_geta(mask) == 0 || (c & rgba_rgb_mask) != (mask & rgba_rgb_mask))
+            d = rgba_blenders[BLEND_MODE_NORMAL](d, c, 255);
+          break;
+        case IMAGE_GRAYSCALE:
+          if (graya_geta(mask) == 0 || (c & graya_v_mask) != (mask & graya_v_mask))
+            d = graya_blenders[BLEND_MODE_NORMAL](d, c, 255);
+          break;
+        case IMAGE_INDEXED:
+          if (c != mask)
+            d = c;
+          break;
+        case IMAGE_BITMAP:
+          if (c != 0)
+            d = c;
+          break;
+      }
+      put_pixel(bmp, u, v, d);
+    }
+  }
+}
+
+static ImageRef create_random_image(PixelFormat format, int w, int h)
+{
+  ImageRef image(Image::create(format, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      // Few colors to get more Scale2x patterns
+      int v = (std::rand() % 3) * 100;
+      int a = (std::rand() % 8 ? 255: 0);
+      color_t c;
+      switch (format) {
+        case IMAGE_RGB: c = rgba(v, 255-v, 0, a); break;
+        case IMAGE_GRAYSCALE: c = graya(v, a); break;
+        case IMAGE_INDEXED: c = v/100; break;
+        default: c = (v ? 1: 0); break;
+      }
+      put_pixel(image.get(), x, y, c);
+    }
+  return image;
+}
+
+TEST(RotSprite, SameResultAsReference)
+{
+  std::srand(1);
+
+  PixelFormat formats[] = {
+    IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED, IMAGE_BITMAP
+  };
+
+  // Corners (x1,y1, x2,y2, x4,y4) of the destination parallelogram
+  // for a 100x70 image drawn in a 230x190 image (with random pixels).
+  int cases[][6] = {
+    {   0,   0, 100,   0,   0,  70 }, // Identity
+    { 117,  35, 160, 125, 55,  65 },  // Rotated ~64 degrees
+    { 100,  70,   0,  70, 100,   0 }, // Rotated 180 degrees
+    {  -9, -20, 240, 150, -40, 180 }, // Scaled up and clipped
+    {  30,  40,  50,  44,  27,  55 }, // Scaled down
+    { 201,   3,   3, 181,   3, 181 }, // Empty
+  };
+
+  for (PixelFormat format : formats) {
+    ImageRef src = create_random_image(format, 100, 70);
+    ImageRef bg = create_random_image(format, 230, 190);
+
+    for (auto& c : cases) {
+      ImageRef dst(Image::createCopy(bg.get()));
+      ImageRef expected(Image::createCopy(bg.get()));
+
+      int x3 = c[2] + c[4] - c[0];
+      int y3 = c[3] + c[5] - c[1];
+      algorithm::rotsprite_image(dst.get(), src.get(),
+                                 c[0], c[1], c[2], c[3], x3, y3, c[4], c[5]);
+      expected_rotsprite(expected.get(), src.get(),
+                         c[0], c[1], c[2], c[3], c[4], c[5]);
+
+      EXPECT_EQ(0, count_diff_between_images(expected.get(), dst.get()))
+        << "format " << int(format)
+        << " corners " << c[0] << "," << c[1] << " "
+        << c[2] << "," << c[3] << " " << c[4] << "," << c[5];
+    }
+  }
+}
+
+TEST(RotSprite, SolidImage)
+{
+  ImageRef src(Image::create(IMAGE_INDEXED, 16, 8));
+  ImageRef dst(Image::create(IMAGE_INDEXED, 16, 8));
+  src->setMaskColor(0);
+  clear_image(src.get(), 5);
+  clear_image(dst.get(), 0);
+
+  // Rotated 180 degrees in the same place
+  algorithm::rotsprite_image(dst.get(), src.get(),
+                             16, 8, 0, 8, 0, 0, 16, 0);
+
+  for (int y=0; y<8; ++y)
+    for (int x=0; x<16; ++x)
+      EXPECT_EQ(color_t(5), get_pixel(dst.get(), x, y));
+}
+
+TEST(RotSprite, Canceled)
+{
+  ImageRef src(Image::create(IMAGE_INDEXED, 16, 8));
+  ImageRef dst(Image::create(IMAGE_INDEXED, 16, 8));
+  src->setMaskColor(0);
+  clear_image(src.get(), 5);
+  clear_image(dst.get(), 0);
+
+  std::atomic<bool> cancel(true);
+  algorithm::rotsprite_image(dst.get(), src.get(),
+                             16, 8, 0, 8, 0, 0, 16, 0, &cancel);
+
+  for (int y=0; y<8; ++y)
+    for (int x=0; x<16; ++x)
+      EXPECT_EQ(color_t(0), get_pixel(dst.get(), x, y));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -177,10 +177,10 @@ int Sprite::getMemSize() const
 {
   int size = 0;
 
-  std::vector<Image*> images;
-  getImages(images);
-  for (Image* image : images)
-    size += image->getRowStrideSize() * image->height();
+  // We use CelData::getMemSize() so images that aren't loaded yet
+  // are not loaded here (see doc::ImageLoader).
+  for (const auto& cel : uniqueCels())
+    size += cel->data()->getMemSize();
 
   return size;
 }
@@ -414,8 +414,11 @@ void Sprite::setDurationForAllFrames(int msecs)
 
 ImageRef Sprite::getImageRef(ObjectId imageId)
 {
+  // Images that aren't loaded yet cannot have the given ID, so we
+  // don't need to load them.
   for (Cel* cel : cels()) {
-    if (cel->image()->id() == imageId)
+    if (cel->data()->isImageLoaded() &&
+        cel->image()->id() == imageId)
       return cel->imageRef();
   }
   return ImageRef(nullptr);
@@ -436,7 +439,8 @@ CelDataRef Sprite::getCelDataRef(ObjectId celDataId)
 void Sprite::replaceImage(ObjectId curImageId, const ImageRef& newImage)
 {
   for (Cel* cel : cels()) {
-    if (cel->image()->id() == curImageId)
+    if (cel->data()->isImageLoaded() &&
+        cel->image()->id() == curImageId)
       cel->data()->setImage(newImage);
   }
 }
@@ -11,6 +11,9 @@
 
 #include "filters/convolution_matrix.h"
 
+#include <algorithm>
+#include <cstdlib>
+
 namespace filters {
 
 ConvolutionMatrix::ConvolutionMatrix(int width, int height)
@@ -25,4 +28,80 @@ ConvolutionMatrix::ConvolutionMatrix(int width, int height)
 {
 }
 
+static int gcd(int a, int b)
+{
+  while (b) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return std::abs(a);
+}
+
+bool ConvolutionMatrix::getSeparableTerms(SeparableTerms& terms) const
+{
+  terms.clear();
+
+  // Look for the first non-zero row
+  int py = 0;
+  int g = 0;
+  for (; py<m_height; ++py) {
+    for (int x=0; x<m_width; ++x)
+      g = gcd(g, value(x, py));
+    if (g)
+      break;
+  }
+  if (!g)
+    return false;
+
+  // value(x, y) = f(x)*g(y): All rows must be multiples of the first
+  // non-zero row divided by its gcd (so the factors are integers).
+  SeparableTerm term;
+  term.x.resize(m_width);
+  term.y.resize(m_height);
+
+  int px = -1;
+  for (int x=0; x<m_width; ++x) {
+    term.x[x] = value(x, py) / g;
+    if (px < 0 && term.x[x])
+      px = x;
+  }
+
+  bool product = true;
+  for (int y=0; y<m_height && product; ++y) {
+    if (value(px, y) % term.x[px] != 0) {
+      product = false;
+      break;
+    }
+    term.y[y] = value(px, y) / term.x[px];
+    for (int x=0; x<m_width; ++x) {
+      if (value(x, y) != term.x[x]*term.y[y]) {
+        product = false;
+        break;
+      }
+    }
+  }
+  if (product) {
+    terms.push_back(term);
+    return true;
+  }
+
+  // value(x, y) = f(x)+g(y)
+  for (int y=0; y<m_height; ++y)
+    for (int x=0; x<m_width; ++x)
+      if (value(x, y) != value(x, 0) + value(0, y) - value(0, 0))
+        return false;
+
+  for (int x=0; x<m_width; ++x)
+    term.x[x] = value(x, 0);
+  std::fill(term.y.begin(), term.y.end(), 1);
+  terms.push_back(term);
+
+  std::fill(term.x.begin(), term.x.end(), 1);
+  for (int y=0; y<m_height; ++y)
+    term.y[y] = value(0, y) - value(0, 0);
+  terms.push_back(term);
+  return true;
+}
+
 } // namespace filters
@@ -19,6 +19,13 @@ namespace filters {
   // A convolution matrix which is used by ConvolutionMatrixFilter.
   class ConvolutionMatrix {
   public:
+    // Term of a separable decomposition of the matrix, where
+    // value(i, j) is x[i]*y[j].
+    struct SeparableTerm {
+      std::vector<int> x, y;
+    };
+    typedef std::vector<SeparableTerm> SeparableTerms;
+
     // TODO warning: this number could be dangerous for big filters
     static const int Precision = 256;
 
@@ -55,6 +62,12 @@ namespace filters {
     int& value(int x, int y) { return m_data[y*m_width+x]; }
     const int& value(int x, int y) const { return m_data[y*m_width+x]; }
 
+    // Decomposes the matrix as a sum of separable terms: one term if
+    // value(x, y) = f(x)*g(y) (e.g. blur-3x3), or two terms if
+    // value(x, y) = f(x)+g(y) (e.g. blur-5x5). Returns false if the
+    // matrix cannot be decomposed in one of these ways.
+    bool getSeparableTerms(SeparableTerms& terms) const;
+
   private:
     std::string m_name;          // Name
     int m_width, m_height;       // Size of the matrix
@@ -20,6 +20,9 @@
 #include "doc/primitives_fast.h"
 #include "doc/rgbmap.h"
 
+#include <algorithm>
+#include <vector>
+
 namespace filters {
 
 using namespace doc;
@@ -110,6 +113,113 @@ namespace {
 
   };
 
+  // Splits "n" pixels in "planes" (n values per channel) with the
+  // values of each channel that the GetPixelsDelegate uses (colors of
+  // transparent pixels are ignored), the last plane is 1 for
+  // transparent pixels (to subtract their weight from the divisor).
+  struct SeparableRgba {
+    enum { Channels = 5 };
+
+    static void split(const RgbTraits::pixel_t* line, int n, int* planes) {
+      int* r = planes;
+      int* g = r+n;
+      int* b = g+n;
+      int* a = b+n;
+      int* t = a+n;
+      for (int i=0; i<n; ++i) {
+        RgbTraits::pixel_t c = line[i];
+        int opaque = -int(rgba_geta(c) != 0);
+        r[i] = rgba_getr(c) & opaque;
+        g[i] = rgba_getg(c) & opaque;
+        b[i] = rgba_getb(c) & opaque;
+        a[i] = rgba_geta(c);
+        t[i] = 1 + opaque;
+      }
+    }
+  };
+
+  struct SeparableGrayscale {
+    enum { Channels = 3 };
+
+    static void split(const GrayscaleTraits::pixel_t* line, int n, int* planes) {
+      int* v = planes;
+      int* a = v+n;
+      int* t = a+n;
+      for (int i=0; i<n; ++i) {
+        GrayscaleTraits::pixel_t c = line[i];
+        int opaque = -int(graya_geta(c) != 0);
+        v[i] = graya_getv(c) & opaque;
+        a[i] = graya_geta(c);
+        t[i] = 1 + opaque;
+      }
+    }
+  };
+
+  // dst[i] += src[i]*k (a loop that the compiler can vectorize)
+  inline void mul_add(int* dst, const int* src, int n, int k)
+  {
+    for (int i=0; i<n; ++i)
+      dst[i] += src[i] * k;
+  }
+
+  // Calculates the same sums as the GetPixelsDelegate for "w" pixels
+  // of the row "y" from "x" using the separable terms of the matrix.
+  // Each term is applied first to the columns (vertical pass), and
+  // then to the column results (horizontal pass), so each pixel needs
+  // width+height operations per term instead of width*height.
+  template<typename Traits, typename Separable>
+  void calc_separable_sums(const Image* src, int x, int y, int w,
+                           const ConvolutionMatrix* matrix,
+                           const ConvolutionMatrix::SeparableTerms& terms,
+                           TiledMode tiledMode,
+                           std::vector<int>& sums)
+  {
+    const int N = Separable::Channels;
+    const int cols = w + matrix->getWidth() - 1;
+    const int nterms = int(terms.size());
+    const bool tiledX = ((int(tiledMode) & int(TiledMode::X_AXIS)) != 0);
+    const bool tiledY = ((int(tiledMode) & int(TiledMode::Y_AXIS)) != 0);
+
+    std::vector<int> srcX(cols);
+    for (int i=0; i<cols; ++i)
+      srcX[i] = get_neighboring_coord(x - matrix->getCenterX() + i,
+                                      src->width(), tiledX);
+
+    std::vector<typename Traits::pixel_t> line(cols);
+    std::vector<int> planes(N*cols);
+    std::vector<int> colSums(nterms*N*cols, 0);
+
+    // Vertical pass: each source row is read one time for all terms
+    for (int dy=0; dy<matrix->getHeight(); ++dy) {
+      int v = get_neighboring_coord(y - matrix->getCenterY() + dy,
+                                    src->height(), tiledY);
+      typename Traits::const_address_t row =
+        reinterpret_cast<typename Traits::const_address_t>(src->getPixelAddress(0, v));
+      for (int i=0; i<cols; ++i)
+        line[i] = row[srcX[i]];
+
+      Separable::split(&line[0], cols, &planes[0]);
+
+      for (int t=0; t<nterms; ++t) {
+        int k = terms[t].y[dy];
+        if (k)
+          mul_add(&colSums[t*N*cols], &planes[0], N*cols, k);
+      }
+    }
+
+    // Horizontal pass
+    sums.assign(N*w, 0);
+    for (int t=0; t<nterms; ++t) {
+      for (int c=0; c<N; ++c) {
+        for (int dx=0; dx<matrix->getWidth(); ++dx) {
+          int k = terms[t].x[dx];
+          if (k)
+            mul_add(&sums[c*w], &colSums[(t*N + c)*cols + dx], w, k);
+        }
+      }
+    }
+  }
+
 }
 
 ConvolutionMatrixFilter::ConvolutionMatrixFilter()
@@ -121,7 +231,13 @@ ConvolutionMatrixFilter::ConvolutionMatrixFilter()
 void ConvolutionMatrixFilter::setMatrix(const SharedPtr<ConvolutionMatrix>& matrix)
 {
   m_matrix = matrix;
-  m_lines.resize(matrix->getHeight());
+
+  // Use the separable terms only if they need less operations
+  int w = matrix->getWidth();
+  int h = matrix->getHeight();
+  if (!matrix->getSeparableTerms(m_terms) ||
+      int(m_terms.size())*(w+h) >= w*h)
+    m_terms.clear();
 }
 
 void ConvolutionMatrixFilter::setTiledMode(TiledMode tiledMode)
@@ -145,23 +261,38 @@ void ConvolutionMatrixFilter::applyToRgba(FilterManager* filterMgr)
   uint32_t color;
   GetPixelsDelegateRgba delegate;
   int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
+  int w = filterMgr->getWidth();
+  int x2 = x+w;
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  std::vector<int> sums;
+  if (!m_terms.empty())
+    calc_separable_sums<RgbTraits, SeparableRgba>(
+      src, x, y, w, m_matrix, m_terms, m_tiledMode, sums);
+
+  for (int i=0; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix);
-    get_neighboring_pixels<RgbTraits>(src, x, y,
-                                      m_matrix->getWidth(),
-                                      m_matrix->getHeight(),
-                                      m_matrix->getCenterX(),
-                                      m_matrix->getCenterY(),
-                                      m_tiledMode, delegate);
+    if (!m_terms.empty()) {
+      delegate.r = sums[i];
+      delegate.g = sums[w+i];
+      delegate.b = sums[2*w+i];
+      delegate.a = sums[3*w+i];
+      delegate.div = m_matrix->getDiv() - sums[4*w+i];
+    }
+    else {
+      delegate.reset(m_matrix);
+      get_neighboring_pixels<RgbTraits>(src, x, y,
+                                        m_matrix->getWidth(),
+                                        m_matrix->getHeight(),
+                                        m_matrix->getCenterX(),
+                                        m_matrix->getCenterY(),
+                                        m_tiledMode, delegate);
+    }
 
     color = get_pixel_fast<RgbTraits>(src, x, y);
     if (delegate.div == 0) {
@@ -212,23 +343,36 @@ void ConvolutionMatrixFilter::applyToGrayscale(FilterManager* filterMgr)
   uint16_t color;
   GetPixelsDelegateGrayscale delegate;
   int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
+  int w = filterMgr->getWidth();
+  int x2 = x+w;
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  std::vector<int> sums;
+  if (!m_terms.empty())
+    calc_separable_sums<GrayscaleTraits, SeparableGrayscale>(
+      src, x, y, w, m_matrix, m_terms, m_tiledMode, sums);
+
+  for (int i=0; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix);
-    get_neighboring_pixels<GrayscaleTraits>(src, x, y,
-                                            m_matrix->getWidth(),
-                                            m_matrix->getHeight(),
-                                            m_matrix->getCenterX(),
-                                            m_matrix->getCenterY(),
-                                            m_tiledMode, delegate);
+    if (!m_terms.empty()) {
+      delegate.v = sums[i];
+      delegate.a = sums[w+i];
+      delegate.div = m_matrix->getDiv() - sums[2*w+i];
+    }
+    else {
+      delegate.reset(m_matrix);
+      get_neighboring_pixels<GrayscaleTraits>(src, x, y,
+                                              m_matrix->getWidth(),
+                                              m_matrix->getHeight(),
+                                              m_matrix->getCenterX(),
+                                              m_matrix->getCenterY(),
+                                              m_tiledMode, delegate);
+    }
 
     color = get_pixel_fast<GrayscaleTraits>(src, x, y);
     if (delegate.div == 0) {
@@ -9,16 +9,13 @@
 #define FILTERS_CONVOLUTION_MATRIX_FILTER_H_INCLUDED
 #pragma once
 
-#include <vector>
-
 #include "base/shared_ptr.h"
+#include "filters/convolution_matrix.h"
 #include "filters/filter.h"
 #include "filters/tiled_mode.h"
 
 namespace filters {
 
-  class ConvolutionMatrix;
-
   class ConvolutionMatrixFilter : public Filter {
   public:
     ConvolutionMatrixFilter();
@@ -38,7 +35,10 @@ namespace filters {
   private:
     SharedPtr<ConvolutionMatrix> m_matrix;
     TiledMode m_tiledMode;
-    std::vector<uint8_t*> m_lines;
+
+    // Separable decomposition of m_matrix (empty if the matrix is
+    // not separable, or if it is faster to apply it directly).
+    ConvolutionMatrix::SeparableTerms m_terms;
   };
 
 } // namespace filters
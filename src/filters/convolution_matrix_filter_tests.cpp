@@ -0,0 +1,193 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "filters/convolution_matrix.h"
+#include "filters/convolution_matrix_filter.h"
+#include "filters/filter_engine.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+#include "doc/primitives_fast.h"
+
+#include <cstdlib>
+
+using namespace doc;
+using namespace filters;
+
+static SharedPtr<ConvolutionMatrix> create_matrix(int w, int h, const int* data)
+{
+  SharedPtr<ConvolutionMatrix> matrix(new ConvolutionMatrix(w, h));
+  int div = 0;
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      matrix->value(x, y) = data[y*w+x];
+      div += data[y*w+x];
+    }
+  matrix->setDiv(div ? div: 1);
+  return matrix;
+}
+
+static int source_coord(int v, int size, bool tiled)
+{
+  if (tiled)
+    return ((v % size) + size) % size;
+  else
+    return MID(0, v, size-1);
+}
+
+// Direct convolution (width*height operations per pixel) with the
+// same rules used by ConvolutionMatrixFilter.
+static void convolve_rgba(const Image* src, Image* dst,
+                          const ConvolutionMatrix* matrix, TiledMode tiledMode)
+{
+  bool tiledX = (int(tiledMode) & int(TiledMode::X_AXIS)) != 0;
+  bool tiledY = (int(tiledMode) & int(TiledMode::Y_AXIS)) != 0;
+
+  for (int y=0; y<src->height(); ++y) {
+    for (int x=0; x<src->width(); ++x) {
+      int r = 0, g = 0, b = 0, a = 0;
+      int div = matrix->getDiv();
+
+      for (int dy=0; dy<matrix->getHeight(); ++dy) {
+        for (int dx=0; dx<matrix->getWidth(); ++dx) {
+          int k = matrix->value(dx, dy);
+          color_t c = get_pixel_fast<RgbTraits>(
+            src,
+            source_coord(x - matrix->getCenterX() + dx, src->width(), tiledX),
+            source_coord(y - matrix->getCenterY() + dy, src->height(), tiledY));
+          if (rgba_geta(c) == 0)
+            div -= k;
+          else {
+            r += rgba_getr(c) * k;
+            g += rgba_getg(c) * k;
+            b += rgba_getb(c) * k;
+            a += rgba_geta(c) * k;
+          }
+        }
+      }
+
+      color_t c = get_pixel_fast<RgbTraits>(src, x, y);
+      if (div != 0) {
+        r = MID(0, r / div + matrix->getBias(), 255);
+        g = MID(0, g / div + matrix->getBias(), 255);
+        b = MID(0, b / div + matrix->getBias(), 255);
+        a = MID(0, a / matrix->getDiv() + matrix->getBias(), 255);
+        c = rgba(r, g, b, a);
+      }
+      put_pixel_fast<RgbTraits>(dst, x, y, c);
+    }
+  }
+}
+
+static void apply_filter(ConvolutionMatrixFilter* filter, const Image* src, Image* dst)
+{
+  FilterSpans spans;
+  create_filter_spans(src->bounds(), NULL, gfx::Point(0, 0), spans);
+
+  FilterEngine engine(filter, NULL);
+  engine.addImage(src, dst, TARGET_ALL_CHANNELS, spans);
+  engine.apply();
+}
+
+static const int blur3x3[] = {
+  1, 2, 1,
+  2, 4, 2,
+  1, 2, 1 };
+
+static const int blur5x5[] = {
+  1, 2, 3, 2, 1,
+  2, 3, 4, 3, 2,
+  3, 4, 5, 4, 3,
+  2, 3, 4, 3, 2,
+  1, 2, 3, 2, 1 };
+
+static const int blur5x3[] = {
+  2, 3, 2, 1, 0,
+  6, 4, 3, 2, 1,
+  2, 3, 2, 1, 0 };
+
+static const int sharpen3x3[] = {
+  -1, -1, -1,
+  -1, 16, -1,
+  -1, -1, -1 };
+
+TEST(ConvolutionMatrix, SeparableTerms)
+{
+  ConvolutionMatrix::SeparableTerms terms;
+
+  EXPECT_TRUE(create_matrix(3, 3, blur3x3)->getSeparableTerms(terms));
+  ASSERT_EQ(1, int(terms.size()));
+  EXPECT_TRUE(terms[0].x == std::vector<int>({ 1, 2, 1 }));
+  EXPECT_TRUE(terms[0].y == std::vector<int>({ 1, 2, 1 }));
+
+  EXPECT_TRUE(create_matrix(5, 5, blur5x5)->getSeparableTerms(terms));
+  ASSERT_EQ(2, int(terms.size()));
+  EXPECT_TRUE(terms[0].x == std::vector<int>({ 1, 2, 3, 2, 1 }));
+  EXPECT_TRUE(terms[0].y == std::vector<int>({ 1, 1, 1, 1, 1 }));
+  EXPECT_TRUE(terms[1].x == std::vector<int>({ 1, 1, 1, 1, 1 }));
+  EXPECT_TRUE(terms[1].y == std::vector<int>({ 0, 1, 2, 1, 0 }));
+
+  EXPECT_FALSE(create_matrix(5, 3, blur5x3)->getSeparableTerms(terms));
+  EXPECT_FALSE(create_matrix(3, 3, sharpen3x3)->getSeparableTerms(terms));
+}
+
+TEST(ConvolutionMatrixFilter, SameResultAsDirectConvolution)
+{
+  std::srand(1);
+  ImageRef src(Image::create(IMAGE_RGB, 67, 41));
+  for (int y=0; y<src->height(); ++y)
+    for (int x=0; x<src->width(); ++x)
+      put_pixel(src.get(), x, y,
+                // Some transparent pixels with random RGB values
+                rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256,
+                     (std::rand() % 4) == 0 ? 0: std::rand() % 256));
+
+  struct {
+    int w, h;
+    const int* data;
+  } matrices[] = {
+    { 3, 3, blur3x3 },
+    { 5, 5, blur5x5 },
+    { 5, 3, blur5x3 },
+    { 3, 3, sharpen3x3 },
+  };
+
+  TiledMode tiledModes[] = {
+    TiledMode::NONE, TiledMode::X_AXIS, TiledMode::Y_AXIS, TiledMode::BOTH
+  };
+
+  for (const auto& m : matrices) {
+    SharedPtr<ConvolutionMatrix> matrix = create_matrix(m.w, m.h, m.data);
+    matrix->setCenterX(m.w == 5 && m.h == 3 ? 0: m.w/2);
+
+    for (TiledMode tiledMode : tiledModes) {
+      ConvolutionMatrixFilter filter;
+      filter.setMatrix(matrix);
+      filter.setTiledMode(tiledMode);
+
+      ImageRef expected(Image::create(IMAGE_RGB, src->width(), src->height()));
+      ImageRef dst(Image::create(IMAGE_RGB, src->width(), src->height()));
+      convolve_rgba(src.get(), expected.get(), matrix.get(), tiledMode);
+      apply_filter(&filter, src.get(), dst.get());
+
+      EXPECT_EQ(0, count_diff_between_images(expected.get(), dst.get()))
+        << "matrix " << m.w << "x" << m.h << " tiled mode " << int(tiledMode);
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -15,6 +15,10 @@ namespace filters {
 
   // Interface which applies a filter to a sprite given a FilterManager
   // which indicates where we have to apply the filter.
+  //
+  // The apply*() functions can be called at the same time from several
+  // threads (for different rows/spans, see FilterEngine), so they
+  // cannot modify the state of the filter.
   class Filter {
   public:
     virtual ~Filter() { }
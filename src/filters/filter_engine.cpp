@@ -0,0 +1,301 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "filters/filter_engine.h"
+
+#include "base/mutex.h"
+#include "base/parallel_for.h"
+#include "base/scoped_lock.h"
+#include "doc/image.h"
+#include "doc/primitives_fast.h"
+#include "filters/filter.h"
+#include "filters/filter_indexed_data.h"
+#include "filters/filter_manager.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace filters {
+
+using namespace doc;
+
+void create_filter_spans(const gfx::Rect& bounds,
+                         const Image* maskBitmap,
+                         const gfx::Point& maskOrigin,
+                         FilterSpans& spans)
+{
+  spans.clear();
+
+  for (int y=bounds.y; y<bounds.y2(); ++y) {
+    if (!maskBitmap) {
+      spans.push_back(FilterSpan(bounds.x, y, bounds.w));
+      continue;
+    }
+
+    int v = y - maskOrigin.y;
+    if (v < 0 || v >= maskBitmap->height())
+      continue;
+
+    int x = bounds.x;
+    while (x < bounds.x2()) {
+      // Skip non-selected pixels
+      while (x < bounds.x2()) {
+        int u = x - maskOrigin.x;
+        if (u >= 0 && u < maskBitmap->width() &&
+            get_pixel_fast<BitmapTraits>(maskBitmap, u, v))
+          break;
+        ++x;
+      }
+
+      int x1 = x;
+      while (x < bounds.x2()) {
+        int u = x - maskOrigin.x;
+        if (u < 0 || u >= maskBitmap->width() ||
+            !get_pixel_fast<BitmapTraits>(maskBitmap, u, v))
+          break;
+        ++x;
+      }
+
+      if (x > x1)
+        spans.push_back(FilterSpan(x1, y, x-x1));
+    }
+  }
+}
+
+// Part of the spans of one image: spans in the range [begin, end)
+// clipped to the [x1, x2) columns.
+struct FilterEngine::Tile {
+  int item;
+  int begin, end;
+  int x1, x2;
+  int pixels;
+  gfx::Rect bounds;
+};
+
+// FilterManager used by the filter to process one span. Each thread
+// uses its own SpanManager, so a filter never sees the mask (all
+// pixels of the span must be processed).
+class FilterEngine::SpanManager : public FilterManager {
+public:
+  SpanManager(FilterIndexedData* indexedData)
+    : m_src(NULL), m_dst(NULL), m_target(0)
+    , m_indexedData(indexedData)
+    , m_x(0), m_y(0), m_w(0) {
+  }
+
+  void setImages(const Image* src, Image* dst, Target target) {
+    m_src = src;
+    m_dst = dst;
+    m_target = target;
+  }
+
+  void setSpan(int x, int y, int w) {
+    m_x = x;
+    m_y = y;
+    m_w = w;
+  }
+
+  // FilterManager implementation
+  const void* getSourceAddress() override { return m_src->getPixelAddress(m_x, m_y); }
+  void* getDestinationAddress() override { return m_dst->getPixelAddress(m_x, m_y); }
+  int getWidth() override { return m_w; }
+  Target getTarget() override { return m_target; }
+  FilterIndexedData* getIndexedData() override { return m_indexedData; }
+  bool skipPixel() override { return false; }
+  const Image* getSourceImage() override { return m_src; }
+  int x() override { return m_x; }
+  int y() override { return m_y; }
+
+private:
+  const Image* m_src;
+  Image* m_dst;
+  Target m_target;
+  FilterIndexedData* m_indexedData;
+  int m_x, m_y, m_w;
+};
+
+// The palette and RgbMap are obtained just one time in the thread
+// that creates the engine, because getRgbMap() can regenerate the
+// map (e.g. Sprite::rgbMap()), and it cannot be done from several
+// threads.
+class FilterEngine::FixedIndexedData : public FilterIndexedData {
+public:
+  FixedIndexedData(Palette* palette, RgbMap* rgbmap)
+    : m_palette(palette)
+    , m_rgbmap(rgbmap) {
+  }
+
+  Palette* getPalette() override { return m_palette; }
+  RgbMap* getRgbMap() override { return m_rgbmap; }
+
+private:
+  Palette* m_palette;
+  RgbMap* m_rgbmap;
+};
+
+FilterEngine::FilterEngine(Filter* filter, FilterIndexedData* indexedData)
+  : m_filter(filter)
+  , m_palette(indexedData ? indexedData->getPalette(): NULL)
+  , m_rgbmap(indexedData ? indexedData->getRgbMap(): NULL)
+  , m_threads(0)
+  , m_tileSize(256, 64)
+  , m_hasFocus(false)
+{
+}
+
+void FilterEngine::setFocus(const gfx::Point& focus)
+{
+  m_hasFocus = true;
+  m_focus = focus;
+}
+
+void FilterEngine::addImage(const Image* src, Image* dst,
+                            Target target, const FilterSpans& spans)
+{
+  ASSERT(src->pixelFormat() == dst->pixelFormat());
+  ASSERT(src->width() == dst->width());
+  ASSERT(src->height() == dst->height());
+
+  Item item;
+  item.src = src;
+  item.dst = dst;
+  item.target = target;
+  item.spans = spans;
+  item.done = false;
+  m_items.push_back(item);
+}
+
+bool FilterEngine::apply(const ProgressFunc& progress)
+{
+  // Divide the spans of each image in tiles
+  std::vector<Tile> tiles;
+  std::vector<int> pendingTiles(m_items.size(), 0);
+  double totalPixels = 0.0;
+
+  for (int i=0; i<int(m_items.size()); ++i) {
+    const FilterSpans& spans = m_items[i].spans;
+    int begin = 0;
+
+    while (begin < int(spans.size())) {
+      // Spans of the same band of rows
+      int band = spans[begin].y / m_tileSize.h;
+      int end = begin;
+      int minX = spans[begin].x;
+      int maxX = spans[begin].x + spans[begin].w;
+      while (end < int(spans.size()) && spans[end].y / m_tileSize.h == band) {
+        minX = std::min(minX, spans[end].x);
+        maxX = std::max(maxX, spans[end].x + spans[end].w);
+        ++end;
+      }
+
+      for (int col=minX / m_tileSize.w; col*m_tileSize.w < maxX; ++col) {
+        Tile tile;
+        tile.item = i;
+        tile.begin = begin;
+        tile.end = end;
+        tile.x1 = col * m_tileSize.w;
+        tile.x2 = tile.x1 + m_tileSize.w;
+        tile.pixels = 0;
+        for (int j=begin; j<end; ++j) {
+          int x1 = std::max(tile.x1, spans[j].x);
+          int x2 = std::min(tile.x2, spans[j].x + spans[j].w);
+          if (x2 > x1) {
+            tile.pixels += x2 - x1;
+            tile.bounds = tile.bounds.createUnion(
+              gfx::Rect(x1, spans[j].y, x2-x1, 1));
+          }
+        }
+
+        if (tile.pixels > 0) {
+          tiles.push_back(tile);
+          ++pendingTiles[i];
+          totalPixels += tile.pixels;
+        }
+      }
+
+      begin = end;
+    }
+  }
+
+  if (m_hasFocus) {
+    auto distance = [this](const Tile& tile) -> int {
+      int dx = tile.bounds.x + tile.bounds.w/2 - m_focus.x;
+      int dy = tile.bounds.y + tile.bounds.h/2 - m_focus.y;
+      return dx*dx + dy*dy;
+    };
+    std::stable_sort(tiles.begin(), tiles.end(),
+                     [&distance](const Tile& a, const Tile& b) {
+                       return distance(a) < distance(b);
+                     });
+  }
+
+  FixedIndexedData indexedData(m_palette, m_rgbmap);
+  base::mutex mutex;
+  std::atomic<bool> cancelled(false);
+  double donePixels = 0.0;
+
+  base::parallel_for(
+    0, int(tiles.size()),
+    [&](int i) {
+      if (cancelled)
+        return;
+
+      const Tile& tile = tiles[i];
+      SpanManager mgr(&indexedData);
+      applyTile(tile, mgr);
+
+      base::scoped_lock lock(mutex);
+      --pendingTiles[tile.item];
+      donePixels += tile.pixels;
+
+      if (m_tileFunc)
+        m_tileFunc(tile.item, tile.bounds);
+
+      if (progress && !cancelled &&
+          !progress(float(donePixels / totalPixels)))
+        cancelled = true;
+    },
+    m_threads);
+
+  for (int i=0; i<int(m_items.size()); ++i)
+    m_items[i].done = (pendingTiles[i] == 0);
+
+  return !cancelled;
+}
+
+bool FilterEngine::isImageDone(int i) const
+{
+  return m_items[i].done;
+}
+
+void FilterEngine::applyTile(const Tile& tile, SpanManager& mgr)
+{
+  const Item& item = m_items[tile.item];
+  mgr.setImages(item.src, item.dst, item.target);
+
+  for (int j=tile.begin; j<tile.end; ++j) {
+    const FilterSpan& span = item.spans[j];
+    int x1 = std::max(tile.x1, span.x);
+    int x2 = std::min(tile.x2, span.x + span.w);
+    if (x2 <= x1)
+      continue;
+
+    mgr.setSpan(x1, span.y, x2-x1);
+
+    switch (item.src->pixelFormat()) {
+      case IMAGE_RGB:       m_filter->applyToRgba(&mgr); break;
+      case IMAGE_GRAYSCALE: m_filter->applyToGrayscale(&mgr); break;
+      case IMAGE_INDEXED:   m_filter->applyToIndexed(&mgr); break;
+    }
+  }
+}
+
+} // namespace filters
@@ -0,0 +1,120 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifndef FILTERS_FILTER_ENGINE_H_INCLUDED
+#define FILTERS_FILTER_ENGINE_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+#include "filters/target.h"
+#include "gfx/point.h"
+#include "gfx/rect.h"
+#include "gfx/size.h"
+
+#include <functional>
+#include <vector>
+
+namespace doc {
+  class Image;
+  class Palette;
+  class RgbMap;
+}
+
+namespace filters {
+
+  class Filter;
+  class FilterIndexedData;
+
+  // Horizontal run of pixels in a row where a filter is applied.
+  struct FilterSpan {
+    int x, y, w;
+    FilterSpan(int x, int y, int w) : x(x), y(y), w(w) { }
+  };
+
+  // Spans sorted by y, and by x for spans in the same row.
+  typedef std::vector<FilterSpan> FilterSpans;
+
+  // Creates the spans of the given "bounds" (in image coordinates)
+  // where the filter must be applied. If "maskBitmap" is not NULL,
+  // only the pixels selected in the bitmap (located at "maskOrigin"
+  // in image coordinates) are included.
+  void create_filter_spans(const gfx::Rect& bounds,
+                           const doc::Image* maskBitmap,
+                           const gfx::Point& maskOrigin,
+                           FilterSpans& spans);
+
+  // Applies a Filter to several images. Each image is divided in
+  // tiles, and the tiles of all images are processed by a pool of
+  // threads, so the filter's apply functions must be reentrant (they
+  // can be called at the same time for different spans).
+  class FilterEngine {
+  public:
+    // Called with the progress (from 0.0 to 1.0) from one thread at
+    // a time. If it returns false, the process is cancelled.
+    typedef std::function<bool(float progress)> ProgressFunc;
+
+    // Called each time a tile of the image "i" is completely filtered
+    // (from one thread at a time). "bounds" contains the tile spans.
+    typedef std::function<void(int i, const gfx::Rect& bounds)> TileFunc;
+
+    // The palette and RgbMap of "indexedData" are obtained in the
+    // constructor (in the thread that creates the engine).
+    FilterEngine(Filter* filter, FilterIndexedData* indexedData);
+
+    // Threads used to apply the filter (0 means one per CPU core).
+    void setThreads(int threads) { m_threads = threads; }
+    void setTileSize(const gfx::Size& tileSize) { m_tileSize = tileSize; }
+    void setTileFunc(const TileFunc& tileFunc) { m_tileFunc = tileFunc; }
+
+    // Tiles near this point (in image coordinates) are processed first,
+    // e.g. to filter first the visible area of a preview.
+    void setFocus(const gfx::Point& focus);
+
+    // Adds an image where the filter will be applied: pixels in
+    // "spans" are read from "src" and the result is written in "dst"
+    // (an image with the same format and size of "src").
+    void addImage(const doc::Image* src, doc::Image* dst,
+                  Target target, const FilterSpans& spans);
+
+    // Applies the filter to all images. Returns false if the process
+    // was cancelled. In that case, only the images where isImageDone()
+    // is true are completely filtered.
+    bool apply(const ProgressFunc& progress = ProgressFunc());
+
+    bool isImageDone(int i) const;
+
+  private:
+    struct Item {
+      const doc::Image* src;
+      doc::Image* dst;
+      Target target;
+      FilterSpans spans;
+      bool done;
+    };
+
+    struct Tile;
+    class SpanManager;
+    class FixedIndexedData;
+
+    void applyTile(const Tile& tile, SpanManager& mgr);
+
+    Filter* m_filter;
+    doc::Palette* m_palette;
+    doc::RgbMap* m_rgbmap;
+    int m_threads;
+    gfx::Size m_tileSize;
+    TileFunc m_tileFunc;
+    bool m_hasFocus;
+    gfx::Point m_focus;
+    std::vector<Item> m_items;
+
+    DISABLE_COPYING(FilterEngine);
+  };
+
+} // namespace filters
+
+#endif
@@ -0,0 +1,213 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "filters/filter_engine.h"
+#include "filters/filter_manager.h"
+#include "filters/median_filter.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+#include "doc/primitives_fast.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace doc;
+using namespace filters;
+
+// Applies the filter row by row in one thread, skipping non-selected
+// pixels like the old FilterManagerImpl did.
+class RowManager : public FilterManager {
+public:
+  RowManager(const Image* src, Image* dst, const Image* mask)
+    : m_src(src), m_dst(dst), m_mask(mask), m_y(0), m_u(0) {
+  }
+
+  void apply(Filter* filter) {
+    for (m_y=0; m_y<m_src->height(); ++m_y) {
+      m_u = 0;
+      filter->applyToRgba(this);
+    }
+  }
+
+  const void* getSourceAddress() override { return m_src->getPixelAddress(0, m_y); }
+  void* getDestinationAddress() override { return m_dst->getPixelAddress(0, m_y); }
+  int getWidth() override { return m_src->width(); }
+  Target getTarget() override { return TARGET_ALL_CHANNELS; }
+  FilterIndexedData* getIndexedData() override { return NULL; }
+  bool skipPixel() override {
+    return !get_pixel_fast<BitmapTraits>(m_mask, m_u++, m_y);
+  }
+  const Image* getSourceImage() override { return m_src; }
+  int x() override { return 0; }
+  int y() override { return m_y; }
+
+private:
+  const Image* m_src;
+  Image* m_dst;
+  const Image* m_mask;
+  int m_y, m_u;
+};
+
+static ImageRef create_random_image(int w, int h)
+{
+  ImageRef image(Image::create(IMAGE_RGB, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(image.get(), x, y,
+                rgba(std::rand() % 256, std::rand() % 256,
+                     std::rand() % 256, std::rand() % 256));
+  return image;
+}
+
+static ImageRef create_circle_mask(int w, int h)
+{
+  ImageRef mask(Image::create(IMAGE_BITMAP, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      int dx = x - w/2, dy = y - h/2;
+      put_pixel(mask.get(), x, y, (dx*dx + dy*dy < w*h/5 ? 1: 0));
+    }
+  return mask;
+}
+
+TEST(FilterEngine, Spans)
+{
+  ImageRef mask(Image::create(IMAGE_BITMAP, 4, 2));
+  clear_image(mask.get(), 0);
+  put_pixel(mask.get(), 0, 0, 1);
+  put_pixel(mask.get(), 2, 0, 1);
+  put_pixel(mask.get(), 3, 0, 1);
+  put_pixel(mask.get(), 1, 1, 1);
+
+  FilterSpans spans;
+  create_filter_spans(gfx::Rect(0, 0, 8, 8), mask.get(), gfx::Point(1, 5), spans);
+  ASSERT_EQ(3, int(spans.size()));
+  EXPECT_EQ(1, spans[0].x); EXPECT_EQ(5, spans[0].y); EXPECT_EQ(1, spans[0].w);
+  EXPECT_EQ(3, spans[1].x); EXPECT_EQ(5, spans[1].y); EXPECT_EQ(2, spans[1].w);
+  EXPECT_EQ(2, spans[2].x); EXPECT_EQ(6, spans[2].y); EXPECT_EQ(1, spans[2].w);
+
+  create_filter_spans(gfx::Rect(1, 2, 3, 4), NULL, gfx::Point(0, 0), spans);
+  ASSERT_EQ(4, int(spans.size()));
+  for (int i=0; i<4; ++i) {
+    EXPECT_EQ(1, spans[i].x);
+    EXPECT_EQ(2+i, spans[i].y);
+    EXPECT_EQ(3, spans[i].w);
+  }
+}
+
+TEST(FilterEngine, SameResultAsRows)
+{
+  std::srand(1);
+  const int w = 301, h = 157;
+  ImageRef src = create_random_image(w, h);
+  ImageRef mask = create_circle_mask(w, h);
+
+  MedianFilter filter;
+  filter.setSize(3, 3);
+
+  ImageRef expected(Image::createCopy(src.get()));
+  RowManager(src.get(), expected.get(), mask.get()).apply(&filter);
+
+  ImageRef dst(Image::createCopy(src.get()));
+  FilterSpans spans;
+  create_filter_spans(src->bounds(), mask.get(), gfx::Point(0, 0), spans);
+
+  FilterEngine engine(&filter, NULL);
+  engine.setThreads(4);
+  engine.setTileSize(gfx::Size(32, 16));
+  engine.addImage(src.get(), dst.get(), TARGET_ALL_CHANNELS, spans);
+  EXPECT_TRUE(engine.apply());
+  EXPECT_TRUE(engine.isImageDone(0));
+
+  EXPECT_EQ(0, count_diff_between_images(expected.get(), dst.get()));
+}
+
+TEST(FilterEngine, Cancel)
+{
+  std::srand(2);
+  ImageRef src1 = create_random_image(64, 64);
+  ImageRef src2 = create_random_image(64, 64);
+  ImageRef dst1(Image::createCopy(src1.get()));
+  ImageRef dst2(Image::createCopy(src2.get()));
+
+  MedianFilter filter;
+  filter.setSize(3, 3);
+
+  FilterSpans spans;
+  create_filter_spans(src1->bounds(), NULL, gfx::Point(0, 0), spans);
+
+  FilterEngine engine(&filter, NULL);
+  engine.setThreads(1);
+  engine.setTileSize(gfx::Size(64, 16));
+  engine.addImage(src1.get(), dst1.get(), TARGET_ALL_CHANNELS, spans);
+  engine.addImage(src2.get(), dst2.get(), TARGET_ALL_CHANNELS, spans);
+
+  int calls = 0;
+  float lastProgress = 0.0f;
+  EXPECT_FALSE(engine.apply(
+      [&](float progress) -> bool {
+        EXPECT_GT(progress, lastProgress);
+        lastProgress = progress;
+        // Cancel in the middle of the second image
+        return (++calls < 6);
+      }));
+
+  EXPECT_EQ(6, calls);
+  EXPECT_TRUE(engine.isImageDone(0));
+  EXPECT_FALSE(engine.isImageDone(1));
+}
+
+TEST(FilterEngine, Focus)
+{
+  std::srand(3);
+  ImageRef src = create_random_image(64, 64);
+  ImageRef dst(Image::createCopy(src.get()));
+
+  MedianFilter filter;
+  filter.setSize(3, 3);
+
+  FilterSpans spans;
+  create_filter_spans(src->bounds(), NULL, gfx::Point(0, 0), spans);
+
+  std::vector<gfx::Rect> tiles;
+  FilterEngine engine(&filter, NULL);
+  engine.setThreads(1);
+  engine.setTileSize(gfx::Size(16, 16));
+  engine.setFocus(gfx::Point(40, 56));
+  engine.setTileFunc(
+    [&tiles](int i, const gfx::Rect& bounds) {
+      EXPECT_EQ(0, i);
+      tiles.push_back(bounds);
+    });
+  engine.addImage(src.get(), dst.get(), TARGET_ALL_CHANNELS, spans);
+  EXPECT_TRUE(engine.apply());
+
+  ASSERT_EQ(16, int(tiles.size()));
+  EXPECT_TRUE(gfx::Rect(32, 48, 16, 16) == tiles[0]);
+
+  // Each tile is equal or farther than the previous one from the focus
+  int prev = 0;
+  for (const gfx::Rect& rc : tiles) {
+    int dx = rc.x + rc.w/2 - 40;
+    int dy = rc.y + rc.h/2 - 56;
+    EXPECT_LE(prev, dx*dx + dy*dy);
+    prev = dx*dx + dy*dy;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -22,6 +22,7 @@
 #include "doc/rgbmap.h"
 
 #include <algorithm>
+#include <vector>
 
 namespace filters {
 
@@ -86,6 +87,135 @@ namespace {
       c++;
     }
   };
+
+  // Histogram of the values of one channel in the window. The median
+  // (the value at position "half" of the sorted values) is updated
+  // incrementally as values are added/removed (Huang's algorithm), so
+  // moving the window one pixel needs only one add/remove per row.
+  class MedianHistogram {
+  public:
+    MedianHistogram(int half) : m_half(half), m_median(0), m_lower(0) {
+      std::fill(m_hist, m_hist+256, 0);
+    }
+
+    void add(int v) {
+      ++m_hist[v];
+      if (v < m_median)
+        ++m_lower;
+    }
+
+    void remove(int v) {
+      --m_hist[v];
+      if (v < m_median)
+        --m_lower;
+    }
+
+    int median() {
+      while (m_lower > m_half)
+        m_lower -= m_hist[--m_median];
+      while (m_lower + m_hist[m_median] <= m_half)
+        m_lower += m_hist[m_median++];
+      return m_median;
+    }
+
+  private:
+    int m_hist[256];
+    int m_half;
+    int m_median;
+    int m_lower;                // Number of values < m_median
+  };
+
+  // Channels of each pixel (the same values that GetPixelsDelegate*
+  // put in the "channel" vectors).
+  struct ChannelsRgba {
+    enum { N = 4 };
+    void operator()(RgbTraits::pixel_t color, int* v) const {
+      v[0] = rgba_getr(color);
+      v[1] = rgba_getg(color);
+      v[2] = rgba_getb(color);
+      v[3] = rgba_geta(color);
+    }
+  };
+
+  struct ChannelsGrayscale {
+    enum { N = 2 };
+    void operator()(GrayscaleTraits::pixel_t color, int* v) const {
+      v[0] = graya_getv(color);
+      v[1] = graya_geta(color);
+    }
+  };
+
+  struct ChannelsIndexed {
+    enum { N = 3 };
+    const Palette* pal;
+    Target target;
+
+    ChannelsIndexed(const Palette* pal, Target target)
+      : pal(pal), target(target) { }
+
+    void operator()(IndexedTraits::pixel_t color, int* v) const {
+      if (target & TARGET_INDEX_CHANNEL) {
+        v[0] = color;
+        v[1] = v[2] = 0;
+      }
+      else {
+        v[0] = rgba_getr(pal->getEntry(color));
+        v[1] = rgba_getg(pal->getEntry(color));
+        v[2] = rgba_getb(pal->getEntry(color));
+      }
+    }
+  };
+
+  // Calculates the median of each channel for "w" pixels of the row
+  // "y" from "x" with sliding histograms. Results are in "medians",
+  // "w" values per channel.
+  template<typename Traits, typename Channels>
+  void calc_median_row(const Image* src, int x, int y, int w,
+                       int width, int height, TiledMode tiledMode,
+                       const Channels& channels, std::vector<int>& medians)
+  {
+    const int N = Channels::N;
+    const int cols = w + width - 1;
+    const bool tiledX = ((int(tiledMode) & int(TiledMode::X_AXIS)) != 0);
+    const bool tiledY = ((int(tiledMode) & int(TiledMode::Y_AXIS)) != 0);
+
+    std::vector<int> srcX(cols);
+    for (int i=0; i<cols; ++i)
+      srcX[i] = get_neighboring_coord(x - width/2 + i, src->width(), tiledX);
+
+    std::vector<typename Traits::const_address_t> rows(height);
+    for (int dy=0; dy<height; ++dy)
+      rows[dy] = reinterpret_cast<typename Traits::const_address_t>(
+        src->getPixelAddress(
+          0, get_neighboring_coord(y - height/2 + dy, src->height(), tiledY)));
+
+    std::vector<MedianHistogram> hist(N, MedianHistogram(width*height/2));
+    int v[N];
+
+    for (int i=0; i<cols; ++i) {
+      // Add the column at the right of the window
+      for (int dy=0; dy<height; ++dy) {
+        channels(rows[dy][srcX[i]], v);
+        for (int c=0; c<N; ++c)
+          hist[c].add(v[c]);
+      }
+
+      int j = i - width + 1;
+      if (j < 0)
+        continue;
+
+      for (int c=0; c<N; ++c)
+        medians[c*w + j] = hist[c].median();
+
+      // Remove the column at the left of the window
+      for (int dy=0; dy<height; ++dy) {
+        channels(rows[dy][srcX[j]], v);
+        for (int c=0; c<N; ++c)
+          hist[c].remove(v[c]);
+      }
+    }
+  }
+
 };
 
 MedianFilter::MedianFilter()
@@ -93,7 +223,6 @@ MedianFilter::MedianFilter()
   , m_width(0)
   , m_height(0)
   , m_ncolors(0)
-  , m_channel(4)
 {
 }
 
@@ -107,9 +236,6 @@ void MedianFilter::setSize(int width, int height)
   m_width = width;
   m_height = height;
   m_ncolors = width*height;
-
-  for (int c = 0; c < 4; ++c)
-    m_channel[c].resize(m_ncolors);
 }
 
 const char* MedianFilter::getName()
@@ -124,51 +250,52 @@ void MedianFilter::applyToRgba(FilterManager* filterMgr)
   Target target = filterMgr->getTarget();
   int color;
   int r, g, b, a;
-  GetPixelsDelegateRgba delegate(m_channel);
+  // Local buffers, so the filter can be applied from several threads
+  std::vector<std::vector<uint8_t> > channel;
+  std::vector<int> medians;
+  GetPixelsDelegateRgba delegate(channel);
   int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
+  int w = filterMgr->getWidth();
+  int x2 = x+w;
   int y = filterMgr->y();
+  int i = 0;
 
-  for (; x<x2; ++x) {
+  bool histogram = useHistograms();
+  if (histogram) {
+    medians.resize(ChannelsRgba::N*w);
+    calc_median_row<RgbTraits>(src, x, y, w, m_width, m_height,
+                               m_tiledMode, ChannelsRgba(), medians);
+  }
+  else {
+    // Pixels of the window where the median is selected
+    channel.resize(4, std::vector<uint8_t>(m_ncolors));
+  }
+
+  auto median = [&](int c) -> int {
+    if (histogram)
+      return medians[c*w + i];
+    std::nth_element(channel[c].begin(), channel[c].begin()+m_ncolors/2, channel[c].end());
+    return channel[c][m_ncolors/2];
+  };
+
+  for (; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset();
-    get_neighboring_pixels<RgbTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                      m_tiledMode, delegate);
-
-    color = get_pixel_fast<RgbTraits>(src, x, y);
-
-    if (target & TARGET_RED_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      r = m_channel[0][m_ncolors/2];
-    }
-    else
-      r = rgba_getr(color);
-
-    if (target & TARGET_GREEN_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      g = m_channel[1][m_ncolors/2];
+    if (!histogram) {
+      delegate.reset();
+      get_neighboring_pixels<RgbTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
+                                        m_tiledMode, delegate);
     }
-    else
-      g = rgba_getg(color);
 
-    if (target & TARGET_BLUE_CHANNEL) {
-      std::sort(m_channel[2].begin(), m_channel[2].end());
-      b = m_channel[2][m_ncolors/2];
-    }
-    else
-      b = rgba_getb(color);
-
-    if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[3].begin(), m_channel[3].end());
-      a = m_channel[3][m_ncolors/2];
-    }
-    else
-      a = rgba_geta(color);
+    color = get_pixel_fast<RgbTraits>(src, x, y);
+    r = (target & TARGET_RED_CHANNEL ? median(0): rgba_getr(color));
+    g = (target & TARGET_GREEN_CHANNEL ? median(1): rgba_getg(color));
+    b = (target & TARGET_BLUE_CHANNEL ? median(2): rgba_getb(color));
+    a = (target & TARGET_ALPHA_CHANNEL ? median(3): rgba_geta(color));
 
     *(dst_address++) = rgba(r, g, b, a);
   }
@@ -180,37 +307,49 @@ void MedianFilter::applyToGrayscale(FilterManager* filterMgr)
   uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   int color, k, a;
-  GetPixelsDelegateGrayscale delegate(m_channel);
+  std::vector<std::vector<uint8_t> > channel;
+  std::vector<int> medians;
+  GetPixelsDelegateGrayscale delegate(channel);
   int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
+  int w = filterMgr->getWidth();
+  int x2 = x+w;
   int y = filterMgr->y();
+  int i = 0;
 
-  for (; x<x2; ++x) {
+  bool histogram = useHistograms();
+  if (histogram) {
+    medians.resize(ChannelsGrayscale::N*w);
+    calc_median_row<GrayscaleTraits>(src, x, y, w, m_width, m_height,
+                                     m_tiledMode, ChannelsGrayscale(), medians);
+  }
+  else {
+    // Pixels of the window where the median is selected
+    channel.resize(4, std::vector<uint8_t>(m_ncolors));
+  }
+
+  auto median = [&](int c) -> int {
+    if (histogram)
+      return medians[c*w + i];
+    std::nth_element(channel[c].begin(), channel[c].begin()+m_ncolors/2, channel[c].end());
+    return channel[c][m_ncolors/2];
+  };
+
+  for (; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset();
-    get_neighboring_pixels<GrayscaleTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                            m_tiledMode, delegate);
-
-    color = get_pixel_fast<GrayscaleTraits>(src, x, y);
-
-    if (target & TARGET_GRAY_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      k = m_channel[0][m_ncolors/2];
+    if (!histogram) {
+      delegate.reset();
+      get_neighboring_pixels<GrayscaleTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
+                                              m_tiledMode, delegate);
     }
-    else
-      k = graya_getv(color);
 
-    if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      a = m_channel[1][m_ncolors/2];
-    }
-    else
-      a = graya_geta(color);
+    color = get_pixel_fast<GrayscaleTraits>(src, x, y);
+    k = (target & TARGET_GRAY_CHANNEL ? median(0): graya_getv(color));
+    a = (target & TARGET_ALPHA_CHANNEL ? median(1): graya_geta(color));
 
     *(dst_address++) = graya(k, a);
   }
@@ -224,49 +363,54 @@ void MedianFilter::applyToIndexed(FilterManager* filterMgr)
   const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
   Target target = filterMgr->getTarget();
   int color, r, g, b;
-  GetPixelsDelegateIndexed delegate(pal, m_channel, target);
+  std::vector<std::vector<uint8_t> > channel;
+  std::vector<int> medians;
+  GetPixelsDelegateIndexed delegate(pal, channel, target);
   int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
+  int w = filterMgr->getWidth();
+  int x2 = x+w;
   int y = filterMgr->y();
+  int i = 0;
+
+  bool histogram = useHistograms();
+  if (histogram) {
+    medians.resize(ChannelsIndexed::N*w);
+    calc_median_row<IndexedTraits>(src, x, y, w, m_width, m_height,
+                                   m_tiledMode, ChannelsIndexed(pal, target), medians);
+  }
+  else {
+    // Pixels of the window where the median is selected
+    channel.resize(4, std::vector<uint8_t>(m_ncolors));
+  }
+
+  auto median = [&](int c) -> int {
+    if (histogram)
+      return medians[c*w + i];
+    std::nth_element(channel[c].begin(), channel[c].begin()+m_ncolors/2, channel[c].end());
+    return channel[c][m_ncolors/2];
+  };
 
-  for (; x<x2; ++x) {
+  for (; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset();
-    get_neighboring_pixels<IndexedTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                          m_tiledMode, delegate);
+    if (!histogram) {
+      delegate.reset();
+      get_neighboring_pixels<IndexedTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
+                                            m_tiledMode, delegate);
+    }
 
     if (target & TARGET_INDEX_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      *(dst_address++) = m_channel[0][m_ncolors/2];
+      *(dst_address++) = median(0);
     }
     else {
       color = get_pixel_fast<IndexedTraits>(src, x, y);
-
-      if (target & TARGET_RED_CHANNEL) {
-        std::sort(m_channel[0].begin(), m_channel[0].end());
-        r = m_channel[0][m_ncolors/2];
-      }
-      else
-        r = rgba_getr(pal->getEntry(color));
-
-      if (target & TARGET_GREEN_CHANNEL) {
-        std::sort(m_channel[1].begin(), m_channel[1].end());
-        g = m_channel[1][m_ncolors/2];
-      }
-      else
-        g = rgba_getg(pal->getEntry(color));
-
-      if (target & TARGET_BLUE_CHANNEL) {
-        std::sort(m_channel[2].begin(), m_channel[2].end());
-        b = m_channel[2][m_ncolors/2];
-      }
-      else
-        b = rgba_getb(pal->getEntry(color));
+      r = (target & TARGET_RED_CHANNEL ? median(0): rgba_getr(pal->getEntry(color)));
+      g = (target & TARGET_GREEN_CHANNEL ? median(1): rgba_getg(pal->getEntry(color)));
+      b = (target & TARGET_BLUE_CHANNEL ? median(2): rgba_getb(pal->getEntry(color)));
 
       *(dst_address++) = rgbmap->mapColor(r, g, b);
     }
@@ -12,8 +12,6 @@
 #include "filters/filter.h"
 #include "filters/tiled_mode.h"
 
-#include <vector>
-
 namespace filters {
 
   class MedianFilter : public Filter {
@@ -34,11 +32,14 @@ namespace filters {
     void applyToIndexed(FilterManager* filterMgr);
 
   private:
+    // Sliding histograms are faster than selecting the median of
+    // each window since 3x3 windows.
+    bool useHistograms() const { return m_ncolors >= 9; }
+
     TiledMode m_tiledMode;
     int m_width;
     int m_height;
     int m_ncolors;
-    std::vector<std::vector<uint8_t> > m_channel;
   };
 
 } // namespace filters
@@ -0,0 +1,116 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "filters/filter_engine.h"
+#include "filters/median_filter.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+#include "doc/primitives_fast.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+using namespace doc;
+using namespace filters;
+
+static int source_coord(int v, int size, bool tiled)
+{
+  if (tiled)
+    return ((v % size) + size) % size;
+  else
+    return MID(0, v, size-1);
+}
+
+// Sorts each window to get the median of each channel.
+static void median_rgba(const Image* src, Image* dst, int w, int h, TiledMode tiledMode)
+{
+  bool tiledX = (int(tiledMode) & int(TiledMode::X_AXIS)) != 0;
+  bool tiledY = (int(tiledMode) & int(TiledMode::Y_AXIS)) != 0;
+  std::vector<int> channel[4];
+
+  for (int y=0; y<src->height(); ++y) {
+    for (int x=0; x<src->width(); ++x) {
+      for (int c=0; c<4; ++c)
+        channel[c].clear();
+
+      for (int dy=0; dy<h; ++dy)
+        for (int dx=0; dx<w; ++dx) {
+          color_t color = get_pixel_fast<RgbTraits>(
+            src,
+            source_coord(x - w/2 + dx, src->width(), tiledX),
+            source_coord(y - h/2 + dy, src->height(), tiledY));
+          channel[0].push_back(rgba_getr(color));
+          channel[1].push_back(rgba_getg(color));
+          channel[2].push_back(rgba_getb(color));
+          channel[3].push_back(rgba_geta(color));
+        }
+
+      int v[4];
+      for (int c=0; c<4; ++c) {
+        std::sort(channel[c].begin(), channel[c].end());
+        v[c] = channel[c][w*h/2];
+      }
+      put_pixel_fast<RgbTraits>(dst, x, y, rgba(v[0], v[1], v[2], v[3]));
+    }
+  }
+}
+
+TEST(MedianFilter, SameResultAsSorting)
+{
+  std::srand(1);
+  ImageRef src(Image::create(IMAGE_RGB, 53, 37));
+  for (int y=0; y<src->height(); ++y)
+    for (int x=0; x<src->width(); ++x)
+      put_pixel(src.get(), x, y,
+                rgba(std::rand() % 256, std::rand() % 256,
+                     // Few different values to test repeated values
+                     (std::rand() % 4) * 64, std::rand() % 256));
+
+  FilterSpans spans;
+  create_filter_spans(src->bounds(), NULL, gfx::Point(0, 0), spans);
+
+  // 1x3 uses the sorting path, the rest use sliding histograms
+  static const int sizes[][2] = { { 1, 3 }, { 3, 3 }, { 5, 3 }, { 7, 7 }, { 15, 9 } };
+
+  TiledMode tiledModes[] = {
+    TiledMode::NONE, TiledMode::X_AXIS, TiledMode::Y_AXIS, TiledMode::BOTH
+  };
+
+  for (const auto& size : sizes) {
+    for (TiledMode tiledMode : tiledModes) {
+      MedianFilter filter;
+      filter.setSize(size[0], size[1]);
+      filter.setTiledMode(tiledMode);
+
+      ImageRef expected(Image::create(IMAGE_RGB, src->width(), src->height()));
+      ImageRef dst(Image::create(IMAGE_RGB, src->width(), src->height()));
+      median_rgba(src.get(), expected.get(), size[0], size[1], tiledMode);
+
+      FilterEngine engine(&filter, NULL);
+      engine.addImage(src.get(), dst.get(), TARGET_ALL_CHANNELS, spans);
+      engine.apply();
+
+      EXPECT_EQ(0, count_diff_between_images(expected.get(), dst.get()))
+        << "size " << size[0] << "x" << size[1]
+        << " tiled mode " << int(tiledMode);
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
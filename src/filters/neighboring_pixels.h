@@ -18,6 +18,19 @@
 namespace filters {
   using namespace doc;
 
+  // Returns the coordinate of the source pixel used by
+  // get_neighboring_pixels() for a position "v" outside the image
+  // (it wraps in tiled mode, or it's clamped to the image edges).
+  inline int get_neighboring_coord(int v, int size, bool tiled)
+  {
+    if (v < 0)
+      return (tiled ? size - (-(v+1) % size) - 1: 0);
+    else if (v >= size)
+      return (tiled ? v % size: size-1);
+    else
+      return v;
+  }
+
   // Calls the specified "delegate" for all neighboring pixels in a 2D
   // (width*height) matrix located in (x,y) where its center is the
   // (centerX,centerY) element of the matrix.
@@ -75,12 +88,11 @@ namespace filters {
         delegate(*srcAddress);
 
         // Update X position to get pixel.
-        if (getx < sourceImage->width()-1) {
+        if (addx > 0)
+          --addx;
+        else if (getx < sourceImage->width()-1) {
           ++getx;
-          if (addx == 0)
-            ++srcAddress;
-          else
-            --addx;
+          ++srcAddress;
         }
         else if (int(tiledMode) & int(TiledMode::X_AXIS)) {
           getx = 0;
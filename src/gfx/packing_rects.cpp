@@ -1,5 +1,5 @@
 // Aseprite Gfx Library
-// Copyright (C) 2001-2014 David Capello
+// Copyright (C) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -10,19 +10,251 @@
 
 #include "gfx/packing_rects.h"
 
-#include "gfx/region.h"
+#include "gfx/point.h"
 #include "gfx/size.h"
 
+#include <algorithm>
+#include <climits>
+
 namespace gfx {
 
+namespace {
+
+// Score of a possible position for a rectangle, smaller is better.
+struct Score {
+  int first, second;
+
+  Score() : first(INT_MAX), second(INT_MAX) { }
+  Score(int first, int second) : first(first), second(second) { }
+
+  bool operator<(const Score& o) const {
+    return (first < o.first ||
+            (first == o.first && second < o.second));
+  }
+};
+
+// Keeps a list of maximal free rectangles of the texture: each free
+// rectangle is as big as possible, and they can overlap each other.
+// A rectangle of a given size fits in the texture if and only if it
+// fits in the top-left corner of one of these free rectangles.
+class MaxRectsBin {
+public:
+  MaxRectsBin(const Size& size, bool bestShortSideFit)
+    : m_bestShortSideFit(bestShortSideFit) {
+    m_free.push_back(Rect(size));
+  }
+
+  // Returns the score of the best position for a rectangle of the
+  // given size (or a default Score if it doesn't fit).
+  Score find(const Size& sz, Point& pt) const {
+    Score best;
+    for (const Rect& f : m_free) {
+      if (sz.w > f.w || sz.h > f.h)
+        continue;
+
+      Score score;
+      if (m_bestShortSideFit) {
+        int dw = f.w - sz.w;
+        int dh = f.h - sz.h;
+        score = Score(std::min(dw, dh), std::max(dw, dh));
+      }
+      else
+        score = Score(f.y, f.x);
+
+      // Ties are resolved with the top-left position so the result
+      // doesn't depend on the order of the free rectangles.
+      if (score < best ||
+          (!(best < score) && Score(f.y, f.x) < Score(pt.y, pt.x))) {
+        best = score;
+        pt = f.getOrigin();
+      }
+    }
+    return best;
+  }
+
+  void place(const Rect& used) {
+    // Split each free rectangle that intersects the used area.
+    Rects created;
+    for (std::size_t i=0; i<m_free.size(); ) {
+      Rect f = m_free[i];
+      if (f.createIntersect(used).isEmpty()) {
+        ++i;
+        continue;
+      }
+
+      if (used.x > f.x)
+        created.push_back(Rect(f.x, f.y, used.x - f.x, f.h));
+      if (used.x2() < f.x2())
+        created.push_back(Rect(used.x2(), f.y, f.x2() - used.x2(), f.h));
+      if (used.y > f.y)
+        created.push_back(Rect(f.x, f.y, f.w, used.y - f.y));
+      if (used.y2() < f.y2())
+        created.push_back(Rect(f.x, used.y2(), f.w, f.y2() - used.y2()));
+
+      m_free[i] = m_free.back();
+      m_free.pop_back();
+    }
+
+    // Remove the new rectangles that aren't maximal (contained in
+    // other free rectangles). Only the new ones are compared with the
+    // others, the old ones were already maximal.
+    for (std::size_t i=0; i<created.size(); ) {
+      bool contained = false;
+      for (std::size_t j=0; j<created.size() && !contained; ++j)
+        if (i != j && created[j].contains(created[i]) &&
+            (created[j] != created[i] || j < i))
+          contained = true;
+      for (std::size_t j=0; j<m_free.size() && !contained; ++j)
+        if (m_free[j].contains(created[i]))
+          contained = true;
+
+      if (contained) {
+        created[i] = created.back();
+        created.pop_back();
+      }
+      else
+        ++i;
+    }
+
+    m_free.insert(m_free.end(), created.begin(), created.end());
+  }
+
+private:
+  typedef std::vector<Rect> Rects;
+
+  bool m_bestShortSideFit;
+  Rects m_free;
+};
+
+// Each segment of the skyline is the top edge of the used area in a
+// range of columns.
+class SkylineBin {
+public:
+  SkylineBin(const Size& size) : m_size(size) {
+    m_skyline.push_back(Segment(0, 0, size.w));
+  }
+
+  Score find(const Size& sz, Point& pt) const {
+    Score best;
+    for (std::size_t i=0; i<m_skyline.size(); ++i) {
+      int y;
+      if (fits(i, sz, y)) {
+        // Bottom-left: the lowest top edge, then the left-most
+        Score score(y + sz.h, m_skyline[i].x);
+        if (score < best) {
+          best = score;
+          pt = Point(m_skyline[i].x, y);
+        }
+      }
+    }
+    return best;
+  }
+
+  void place(const Rect& used) {
+    // Insert the new segment and shrink/remove the segments below it
+    std::size_t i = 0;
+    while (i < m_skyline.size() && m_skyline[i].x < used.x)
+      ++i;
+    m_skyline.insert(m_skyline.begin()+i, Segment(used.x, used.y2(), used.w));
+
+    for (++i; i<m_skyline.size(); ) {
+      Segment& seg = m_skyline[i];
+      if (seg.x >= used.x2())
+        break;
+
+      int shrink = used.x2() - seg.x;
+      if (shrink < seg.w) {
+        seg.x += shrink;
+        seg.w -= shrink;
+        break;
+      }
+      m_skyline.erase(m_skyline.begin()+i);
+    }
+
+    // Merge segments with the same height
+    for (i=0; i+1<m_skyline.size(); ) {
+      if (m_skyline[i].y == m_skyline[i+1].y) {
+        m_skyline[i].w += m_skyline[i+1].w;
+        m_skyline.erase(m_skyline.begin()+i+1);
+      }
+      else
+        ++i;
+    }
+  }
+
+private:
+  struct Segment {
+    int x, y, w;
+    Segment(int x, int y, int w) : x(x), y(y), w(w) { }
+  };
+
+  // Returns true if a rectangle of the given size fits with its
+  // left side in the i-th segment. "y" is its top position.
+  bool fits(std::size_t i, const Size& sz, int& y) const {
+    if (m_skyline[i].x + sz.w > m_size.w)
+      return false;
+
+    y = 0;
+    for (int widthLeft=sz.w; widthLeft > 0; ++i) {
+      y = std::max(y, m_skyline[i].y);
+      if (y + sz.h > m_size.h)
+        return false;
+      widthLeft -= m_skyline[i].w;
+    }
+    return true;
+  }
+
+  Size m_size;
+  std::vector<Segment> m_skyline;
+};
+
+template<typename Bin>
+bool pack_rects(Bin& bin, std::vector<Rect*>& rects, std::vector<bool>& rotated,
+                const std::vector<int>& indexes, bool rotation)
+{
+  for (int i : indexes) {
+    Rect& rc = *rects[i];
+    Point pt, ptRotated;
+    Score score = bin.find(rc.getSize(), pt);
+
+    // Rotated rectangles are used only if they are strictly better
+    if (rotation && rc.w != rc.h) {
+      Score scoreRotated = bin.find(Size(rc.h, rc.w), ptRotated);
+      if (scoreRotated < score) {
+        score = scoreRotated;
+        pt = ptRotated;
+        std::swap(rc.w, rc.h);
+        rotated[i] = true;
+      }
+    }
+
+    if (score.first == INT_MAX)
+      return false; // There is not enough room for "rc"
+
+    rc.setOrigin(pt);
+    bin.place(rc);
+  }
+  return true;
+}
+
+} // anonymous namespace
+
+PackingRects::PackingRects()
+  : m_algorithm(DefaultAlgorithm)
+  , m_rotation(false)
+{
+}
+
 void PackingRects::add(const Size& sz)
 {
   m_rects.push_back(Rect(sz));
+  m_rotated.push_back(false);
 }
 
 void PackingRects::add(const Rect& rc)
 {
   m_rects.push_back(rc);
+  m_rotated.push_back(false);
 }
 
 Size PackingRects::bestFit()
@@ -58,41 +290,47 @@ Size PackingRects::bestFit()
   return size;
 }
 
-static bool by_area(const Rect* a, const Rect* b) {
-  return a->w*a->h > b->w*b->h;
-}
-
 bool PackingRects::pack(const Size& size)
 {
   m_bounds = Rect(size);
 
-  // We cannot sort m_rects because we want to 
-  std::vector<Rect*> rectPtrs(m_rects.size());
-  int i = 0;
-  for (auto& rc : m_rects)
-    rectPtrs[i++] = &rc;
-  std::sort(rectPtrs.begin(), rectPtrs.end(), by_area);
-
-  gfx::Region rgn(m_bounds);
-  for (auto rcPtr : rectPtrs) {
-    gfx::Rect& rc = *rcPtr;
-
-    for (int v=0; v<=m_bounds.h-rc.h; ++v) {
-      for (int u=0; u<=m_bounds.w-rc.w; ++u) {
-        gfx::Rect possible(u, v, rc.w, rc.h);
-        Region::Overlap overlap = rgn.contains(possible);
-        if (overlap == Region::In) {
-          rc = possible;
-          rgn.createSubtraction(rgn, gfx::Region(rc));
-          goto next_rc;
-        }
-      }
+  // Restore the original size of rectangles rotated in a previous
+  // pack() call.
+  for (std::size_t i=0; i<m_rects.size(); ++i) {
+    if (m_rotated[i]) {
+      std::swap(m_rects[i].w, m_rects[i].h);
+      m_rotated[i] = false;
     }
-    return false; // There is not enough room for "rc"
-  next_rc:;
   }
 
-  return true;
+  // We cannot sort m_rects because we want to keep the same order
+  // given in add() calls, so we sort indexes (bigger areas first).
+  std::vector<Rect*> rectPtrs(m_rects.size());
+  std::vector<int> indexes(m_rects.size());
+  for (std::size_t i=0; i<m_rects.size(); ++i) {
+    rectPtrs[i] = &m_rects[i];
+    indexes[i] = int(i);
+  }
+  std::stable_sort(indexes.begin(), indexes.end(),
+                   [&rectPtrs](int a, int b) {
+                     return rectPtrs[a]->w*rectPtrs[a]->h > rectPtrs[b]->w*rectPtrs[b]->h;
+                   });
+
+  switch (m_algorithm) {
+    case MaxRectsBestShortSideFit: {
+      MaxRectsBin bin(size, true);
+      return pack_rects(bin, rectPtrs, m_rotated, indexes, m_rotation);
+    }
+    case Skyline: {
+      SkylineBin bin(size);
+      return pack_rects(bin, rectPtrs, m_rotated, indexes, m_rotation);
+    }
+    case MaxRects:
+    default: {
+      MaxRectsBin bin(size, false);
+      return pack_rects(bin, rectPtrs, m_rotated, indexes, m_rotation);
+    }
+  }
 }
 
 } // namespace gfx
@@ -14,12 +14,40 @@
 
 namespace gfx {
 
-  // TODO add support for rotations
   class PackingRects {
   public:
     typedef std::vector<Rect> Rects;
     typedef Rects::const_iterator const_iterator;
 
+    enum Algorithm {
+      // MaxRects placing each rectangle in the top-most/left-most
+      // free position. It gives the same result as an exhaustive
+      // search of the first free position.
+      MaxRects,
+
+      // MaxRects placing each rectangle in the free area where the
+      // shortest leftover side is minimal. It wastes less space than
+      // MaxRects (useful for big sheets with different sizes).
+      MaxRectsBestShortSideFit,
+
+      // Places rectangles over a "skyline" (the top edge of the
+      // already placed rectangles). It's faster than MaxRects but
+      // it wastes more space.
+      Skyline,
+
+      DefaultAlgorithm = MaxRects
+    };
+
+    PackingRects();
+
+    Algorithm algorithm() const { return m_algorithm; }
+    void setAlgorithm(Algorithm algorithm) { m_algorithm = algorithm; }
+
+    // If it's true, rectangles can be rotated 90 degrees to fit
+    // better in the texture (see isRotated()).
+    bool rotation() const { return m_rotation; }
+    void setRotation(bool state) { m_rotation = state; }
+
     // Iterate over all given rectangles (in the same order they where
     // given in addSize() calls).
     const_iterator begin() const { return m_rects.begin(); }
@@ -28,6 +56,10 @@ namespace gfx {
     std::size_t size() const { return m_rects.size(); }
     const Rect& operator[](int i) const { return m_rects[i]; }
 
+    // Returns true if the i-th rectangle was rotated in the last
+    // pack() call (so its width and height are swapped).
+    bool isRotated(int i) const { return m_rotated[i]; }
+
     // Adds a new rectangle.
     void add(const Size& sz);
     void add(const Rect& rc);
@@ -44,8 +76,11 @@ namespace gfx {
     const Rect& bounds() const { return m_bounds; }
 
   private:
+    Algorithm m_algorithm;
+    bool m_rotation;
     Rect m_bounds;
     Rects m_rects;
+    std::vector<bool> m_rotated;
   };
 
 } // namespace gfx
@@ -11,9 +11,12 @@
 #include <gtest/gtest.h>
 
 #include "gfx/packing_rects.h"
+#include "gfx/point.h"
 #include "gfx/rect_io.h"
 #include "gfx/size.h"
 
+#include <vector>
+
 using namespace gfx;
 
 TEST(PackingRects, Simple)
@@ -93,6 +96,79 @@ TEST(PackingRects, KeepSameRectsOrder)
   EXPECT_EQ(Rect(0, 0, 30, 30), pr[2]);
 }
 
+TEST(PackingRects, Rotation)
+{
+  PackingRects pr;
+  pr.setRotation(true);
+  pr.add(Size(100, 10));
+  EXPECT_TRUE(pr.pack(Size(10, 100)));
+  EXPECT_TRUE(pr.isRotated(0));
+  EXPECT_EQ(Rect(0, 0, 10, 100), pr[0]);
+
+  // Not rotated when it's not needed (the original size is restored)
+  EXPECT_TRUE(pr.pack(Size(100, 10)));
+  EXPECT_FALSE(pr.isRotated(0));
+  EXPECT_EQ(Rect(0, 0, 100, 10), pr[0]);
+
+  pr.setRotation(false);
+  EXPECT_FALSE(pr.pack(Size(10, 100)));
+}
+
+static void expect_valid_packing(const PackingRects& pr, const std::vector<Size>& sizes)
+{
+  for (std::size_t i=0; i<pr.size(); ++i) {
+    const Rect& rc = pr[i];
+    Size sz = (pr.isRotated(i) ? Size(sizes[i].h, sizes[i].w): sizes[i]);
+    EXPECT_EQ(Rect(rc.getOrigin(), sz), rc);
+    EXPECT_TRUE(pr.bounds().contains(rc));
+
+    for (std::size_t j=i+1; j<pr.size(); ++j)
+      EXPECT_TRUE(rc.createIntersect(pr[j]).isEmpty()) << rc << " and " << pr[j];
+  }
+}
+
+TEST(PackingRects, Algorithms)
+{
+  // Random sizes (with a simple LCG to get the same sizes always)
+  std::vector<Size> sizes;
+  unsigned int seed = 1;
+  int area = 0;
+  for (int i=0; i<300; ++i) {
+    seed = seed*1103515245 + 12345;
+    int w = 4 + (seed >> 16) % 60;
+    seed = seed*1103515245 + 12345;
+    int h = 4 + (seed >> 16) % 60;
+    sizes.push_back(Size(w, h));
+    area += w*h;
+  }
+
+  PackingRects::Algorithm algorithms[] = {
+    PackingRects::MaxRects,
+    PackingRects::MaxRectsBestShortSideFit,
+    PackingRects::Skyline
+  };
+
+  for (auto algorithm : algorithms) {
+    for (int rotation=0; rotation<2; ++rotation) {
+      PackingRects pr;
+      pr.setAlgorithm(algorithm);
+      pr.setRotation(rotation == 1);
+      for (const auto& sz : sizes)
+        pr.add(sz);
+
+      Size texture = pr.bestFit();
+      EXPECT_EQ(Rect(texture), pr.bounds());
+      expect_valid_packing(pr, sizes);
+
+      // The texture size is a power of two, so at least half of the
+      // texture must be used.
+      double density = double(area) / double(texture.w*texture.h);
+      EXPECT_GT(density, 0.5) << "algorithm " << algorithm
+                              << " rotation " << rotation;
+    }
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -10,7 +10,12 @@
 
 #include "render/render.h"
 
+#include "base/parallel_for.h"
 #include "doc/doc.h"
+#include "render/render_cache.h"
+
+#include <algorithm>
+#include <vector>
 
 namespace render {
 
@@ -304,18 +309,108 @@ static void compose_scaled_image_scale_down(
   }
 }
 
+//////////////////////////////////////////////////////////////////////
+// Unscaled composite (whole scanlines are blended with the span
+// blenders when both images have the same RGB/grayscale format)
+
+static inline void blend_span(int blend_mode,
+                              uint32_t* dst, const uint32_t* back, const uint32_t* front,
+                              int n, int opacity, color_t mask)
+{
+  rgba_blend_span(blend_mode, dst, back, front, n, opacity, mask);
+}
+
+static inline void blend_span(int blend_mode,
+                              uint16_t* dst, const uint16_t* back, const uint16_t* front,
+                              int n, int opacity, color_t mask)
+{
+  graya_blend_span(blend_mode, dst, back, front, n, opacity, uint16_t(mask));
+}
+
+template<class DstTraits, class SrcTraits>
+class ComposeUnscaled {
+public:
+  static bool compose(Image* dst, const Image* src,
+                      gfx::Clip area, int opacity, int blend_mode) {
+    return false;
+  }
+};
+
+template<class Traits>
+class ComposeUnscaledSpans {
+public:
+  static bool compose(Image* dst, const Image* src,
+                      gfx::Clip area, int opacity, int blend_mode) {
+    if (!area.clip(dst->width(), dst->height(), src->width(), src->height()))
+      return true;
+
+    typedef typename Traits::pixel_t pixel_t;
+    for (int y=0; y<area.size.h; ++y) {
+      pixel_t* dstAddr = (pixel_t*)dst->getPixelAddress(area.dst.x, area.dst.y+y);
+      const pixel_t* srcAddr = (const pixel_t*)src->getPixelAddress(area.src.x, area.src.y+y);
+
+      blend_span(blend_mode, dstAddr, dstAddr, srcAddr,
+                 area.size.w, opacity, src->maskColor());
+    }
+    return true;
+  }
+};
+
+template<>
+class ComposeUnscaled<RgbTraits, RgbTraits> : public ComposeUnscaledSpans<RgbTraits> { };
+
+template<>
+class ComposeUnscaled<GrayscaleTraits, GrayscaleTraits> : public ComposeUnscaledSpans<GrayscaleTraits> { };
+
 template<class DstTraits, class SrcTraits>
 static void compose_scaled_image(
   Image* dst, const Image* src, const Palette* pal,
   const gfx::Clip& area,
   int opacity, int blend_mode, Zoom zoom)
 {
+  if (zoom.scale() == 1.0 &&
+      ComposeUnscaled<DstTraits, SrcTraits>::compose(dst, src, area, opacity, blend_mode))
+    return;
+
   if (zoom.scale() >= 1.0)
     compose_scaled_image_scale_up<DstTraits, SrcTraits>(dst, src, pal, area, opacity, blend_mode, zoom);
   else
     compose_scaled_image_scale_down<DstTraits, SrcTraits>(dst, src, pal, area, opacity, blend_mode, zoom);
 }
 
+//////////////////////////////////////////////////////////////////////
+// Bands used to split the render in several threads
+
+// Minimum number of pixels of the area to use more than one thread.
+static const int kMinParallelArea = 128*128;
+
+// Minimum number of rows of each band.
+static const int kMinBandHeight = 16;
+
+// Returns the number of horizontal bands to split the given area
+// between "threads" threads (or 1 if the area is too small).
+static int get_bands_count(const gfx::Clip& area, int threads)
+{
+  if (threads == 1 ||
+      area.size.w*area.size.h < kMinParallelArea)
+    return 1;
+
+  // More bands than threads to balance the work when some bands are
+  // more expensive (e.g. more layers/cels) than others.
+  int bands = 4 * base::parallel_threads(threads);
+  return MID(1, bands, area.size.h / kMinBandHeight);
+}
+
+// Returns the i-th horizontal band of the given area.
+static gfx::Clip get_band(const gfx::Clip& area, int bands, int i)
+{
+  int y1 = area.size.h * i / bands;
+  int y2 = area.size.h * (i+1) / bands;
+  return gfx::Clip(area.dst.x, area.dst.y+y1,
+                   area.src.x, area.src.y+y1,
+                   area.size.w, y2-y1);
+}
+
 Render::Render()
   : m_sprite(NULL)
   , m_currentLayer(NULL)
@@ -325,6 +420,9 @@ Render::Render()
   , m_bgType(BgType::TRANSPARENT)
   , m_bgCheckedSize(16, 16)
   , m_globalOpacity(255)
+  , m_previewImage(NULL)
+  , m_cache(NULL)
+  , m_threads(1)
   , m_onionskinType(OnionskinType::NONE)
 {
 }
@@ -383,6 +481,21 @@ void Render::removeExtraImage()
   m_extraCel = NULL;
 }
 
+void Render::setCache(RenderCache* cache)
+{
+  m_cache = cache;
+}
+
+void Render::removeCache()
+{
+  m_cache = NULL;
+}
+
+void Render::setThreads(int threads)
+{
+  m_threads = threads;
+}
+
 void Render::setOnionskin(OnionskinType type, int prevs, int nexts, int opacityBase, int opacityStep)
 {
   m_onionskinType = type;
@@ -439,6 +552,21 @@ void Render::renderLayer(
   if (!scaled_func)
     return;
 
+  int bands = get_bands_count(area, m_threads);
+  if (bands > 1) {
+    base::parallel_for(
+      0, bands,
+      [&](int i) {
+        // Each band uses its own copy of the render state
+        Render render(*this);
+        render.m_globalOpacity = 255;
+        render.renderLayer(layer, dstImage, get_band(area, bands, i),
+          frame, Zoom(1, 1), scaled_func,
+          true, true, -1);
+      }, m_threads);
+    return;
+  }
+
   m_globalOpacity = 255;
   renderLayer(layer, dstImage, area,
     frame, Zoom(1, 1), scaled_func,
@@ -461,6 +589,34 @@ void Render::renderSprite(
   if (!scaled_func)
     return;
 
+  if (canUseCache(dstImage, zoom)) {
+    renderSpriteFromCache(dstImage, sprite, frame, area, zoom, scaled_func);
+    return;
+  }
+
+  int bands = get_bands_count(area, m_threads);
+  if (bands > 1) {
+    base::parallel_for(
+      0, bands,
+      [&](int i) {
+        // Each band uses its own copy of the render state
+        Render render(*this);
+        render.renderSpriteUncached(dstImage, sprite, frame,
+          get_band(area, bands, i), zoom, scaled_func);
+      }, m_threads);
+  }
+  else
+    renderSpriteUncached(dstImage, sprite, frame, area, zoom, scaled_func);
+}
+
+void Render::renderSpriteUncached(
+  Image* dstImage,
+  const Sprite* sprite,
+  frame_t frame,
+  const gfx::Clip& area,
+  Zoom zoom,
+  RenderScaledImage scaled_func)
+{
   const LayerImage* bgLayer = m_sprite->backgroundLayer();
   color_t bg_color = 0;
   if (m_sprite->pixelFormat() == IMAGE_INDEXED) {
@@ -527,6 +683,195 @@ void Render::renderSprite(
   }
 }
 
+void Render::renderSpriteFromCache(
+  Image* dstImage,
+  const Sprite* sprite,
+  frame_t frame,
+  const gfx::Clip& area,
+  Zoom zoom,
+  RenderScaledImage scaled_func)
+{
+  m_cache->validateFrame(frame, renderStateHash(dstImage, frame));
+
+  const int ts = RenderCache::kTileSize;
+  const gfx::Rect srcBounds = area.srcBounds();
+  if (srcBounds.isEmpty())
+    return;
+
+  // The extra cel changes too often (e.g. it's used to show the brush
+  // preview), so its area is never cached.
+  gfx::Rect extraBounds;
+  if (m_extraCel && m_extraImage) {
+    extraBounds = zoom.apply(
+      gfx::Rect(m_extraCel->x(), m_extraCel->y(),
+                m_extraImage->width(), m_extraImage->height()));
+    extraBounds.enlarge(zoom.apply(1));
+  }
+
+  // Tiles that intersect the area (rounding towards -inf)
+  int u1 = (srcBounds.x >= 0 ? srcBounds.x / ts: (srcBounds.x-ts+1) / ts);
+  int v1 = (srcBounds.y >= 0 ? srcBounds.y / ts: (srcBounds.y-ts+1) / ts);
+  int u2 = (srcBounds.x2()-1 >= 0 ? (srcBounds.x2()-1) / ts: (srcBounds.x2()-ts) / ts);
+  int v2 = (srcBounds.y2()-1 >= 0 ? (srcBounds.y2()-1) / ts: (srcBounds.y2()-ts) / ts);
+
+  struct TileJob {
+    gfx::Rect tileBounds;
+    gfx::Rect part;
+    gfx::Clip partArea;
+    Image* tile;                // NULL if "part" is rendered directly
+    bool renderTile;            // True if "tile" is a new tile
+  };
+  std::vector<TileJob> jobs;
+
+  for (int v=v1; v<=v2; ++v) {
+    for (int u=u1; u<=u2; ++u) {
+      TileJob job;
+      job.tileBounds = gfx::Rect(u*ts, v*ts, ts, ts);
+      job.part = job.tileBounds.createIntersect(srcBounds);
+      if (job.part.isEmpty())
+        continue;
+
+      job.partArea = gfx::Clip(
+        area.dst.x + job.part.x - area.src.x,
+        area.dst.y + job.part.y - area.src.y,
+        job.part);
+      job.tile = NULL;
+      job.renderTile = false;
+
+      if (!job.part.intersects(extraBounds)) {
+        job.tile = m_cache->getTile(frame, zoom, u, v);
+        if (!job.tile) {
+          job.tile = m_cache->createTile(frame, zoom, u, v, dstImage->pixelFormat());
+          job.renderTile = true;
+        }
+      }
+
+      jobs.push_back(job);
+    }
+  }
+
+  // Render new tiles and parts that cannot be cached. Each job
+  // modifies a different part of the destination image.
+  base::parallel_for(
+    0, int(jobs.size()),
+    [&](int i) {
+      const TileJob& job = jobs[i];
+      Render render(*this);
+
+      if (!job.tile) {
+        render.renderSpriteUncached(dstImage, sprite, frame,
+          job.partArea, zoom, scaled_func);
+        return;
+      }
+
+      if (job.renderTile) {
+        render.m_extraCel = NULL;
+        render.renderSpriteUncached(job.tile, sprite, frame,
+          gfx::Clip(0, 0, job.tileBounds), zoom, scaled_func);
+      }
+
+      dstImage->copy(job.tile,
+        gfx::Clip(job.partArea.dst.x, job.partArea.dst.y,
+                  job.part.x - job.tileBounds.x,
+                  job.part.y - job.tileBounds.y,
+                  job.part.w, job.part.h));
+    },
+    // Don't create threads if all tiles are already cached
+    (std::find_if(jobs.begin(), jobs.end(),
+                  [](const TileJob& job) { return !job.tile || job.renderTile; })
+     != jobs.end() ? m_threads: 1));
+
+  m_cache->evictOldTiles();
+}
+
+bool Render::canUseCache(const Image* dstImage, Zoom zoom) const
+{
+  if (!m_cache || m_previewImage)
+    return false;
+
+  // Only integer zoom levels (e.g. 4:1 or 1:4) generate the same
+  // pixels independently of the tile origin.
+  if (zoom.scale() >= 1.0)
+    return (zoom.scale() == double(zoom.apply(1)));
+  else
+    return (1.0 / zoom.scale() == double(zoom.remove(1)));
+}
+
+static inline void hash_combine(std::size_t& seed, std::size_t value)
+{
+  seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+static void hash_layer(std::size_t& seed, const Layer* layer, frame_t frame)
+{
+  hash_combine(seed, layer->id());
+  hash_combine(seed, std::size_t(layer->flags()));
+
+  switch (layer->type()) {
+
+    case ObjectType::LayerImage: {
+      hash_combine(seed, static_cast<const LayerImage*>(layer)->getBlendMode());
+
+      const Cel* cel = layer->cel(frame);
+      if (cel) {
+        // The ID and not the pointer, because a new image can be
+        // allocated in the same address of a deleted one.
+        hash_combine(seed, cel->image()->id());
+        hash_combine(seed, cel->x());
+        hash_combine(seed, cel->y());
+        hash_combine(seed, cel->opacity());
+      }
+      break;
+    }
+
+    case ObjectType::LayerFolder: {
+      LayerConstIterator it = static_cast<const LayerFolder*>(layer)->getLayerBegin();
+      LayerConstIterator end = static_cast<const LayerFolder*>(layer)->getLayerEnd();
+      for (; it != end; ++it)
+        hash_layer(seed, *it, frame);
+      break;
+    }
+  }
+}
+
+std::size_t Render::renderStateHash(const Image* dstImage, frame_t frame) const
+{
+  std::size_t seed = 0;
+  hash_combine(seed, m_sprite->id());
+  hash_combine(seed, m_sprite->pixelFormat());
+  hash_combine(seed, m_sprite->transparentColor());
+  hash_combine(seed, dstImage->pixelFormat());
+
+  hash_combine(seed, int(m_bgType));
+  hash_combine(seed, m_bgZoom);
+  hash_combine(seed, m_bgColor1);
+  hash_combine(seed, m_bgColor2);
+  hash_combine(seed, m_bgCheckedSize.w);
+  hash_combine(seed, m_bgCheckedSize.h);
+
+  frame_t firstFrame = frame;
+  frame_t lastFrame = frame;
+  hash_combine(seed, int(m_onionskinType));
+  if (m_onionskinType != OnionskinType::NONE) {
+    hash_combine(seed, m_onionskinPrevs);
+    hash_combine(seed, m_onionskinNexts);
+    hash_combine(seed, m_onionskinOpacityBase);
+    hash_combine(seed, m_onionskinOpacityStep);
+
+    firstFrame = MAX(0, frame - m_onionskinPrevs);
+    lastFrame = MIN(m_sprite->lastFrame(), frame + m_onionskinNexts);
+  }
+
+  for (frame_t f=firstFrame; f<=lastFrame; ++f) {
+    hash_combine(seed, f);
+    hash_combine(seed, std::size_t(m_sprite->palette(f)));
+    hash_combine(seed, m_sprite->palette(f)->getModifications());
+    hash_layer(seed, m_sprite->folder(), f);
+  }
+
+  return seed;
+}
+
 void Render::renderBackground(Image* image,
   const gfx::Clip& area,
   Zoom zoom)
@@ -551,9 +896,11 @@ void Render::renderBackground(Image* image,
   u = (area.src.x / tile_w);
   v = (area.src.y / tile_h);
 
-  // Position where we start drawing the first tile in "image"
-  int x_start = -(area.src.x % tile_w);
-  int y_start = -(area.src.y % tile_h);
+  // Position where we start drawing the first tile in "image" (the
+  // pattern depends only on "area.src" coordinates, so any part of
+  // the area can be rendered independently, e.g. in tiles or bands)
+  int x_start = area.dst.x - (area.src.x % tile_w);
+  int y_start = area.dst.y - (area.src.y % tile_h);
 
   gfx::Rect dstBounds = area.dstBounds();
 
@@ -15,6 +15,8 @@
 #include "gfx/size.h"
 #include "render/zoom.h"
 
+#include <cstddef>
+
 namespace gfx {
   class Clip;
 }
@@ -28,6 +30,7 @@ namespace doc {
 }
 
 namespace render {
+  class RenderCache;
   using namespace doc;
 
   enum class BgType {
@@ -66,6 +69,17 @@ namespace render {
       frame_t currentFrame);
     void removeExtraImage();
 
+    // Sets a cache of rendered tiles to be used in renderSprite(). The
+    // cache must be associated to the sprite that will be rendered.
+    void setCache(RenderCache* cache);
+    void removeCache();
+
+    // Number of threads used to render big areas (0 means one thread
+    // per CPU core). The area is split in horizontal bands that are
+    // rendered concurrently, the result is the same as rendering it
+    // with only one thread (the default).
+    void setThreads(int threads);
+
     void setOnionskin(OnionskinType type,
       int prevs, int nexts, int opacityBase, int opacityStep);
     void disableOnionskin();
@@ -117,6 +131,25 @@ namespace render {
       const gfx::Clip& area,
       int opacity, int blend_mode, Zoom zoom);
 
+    void renderSpriteUncached(
+      Image* dstImage,
+      const Sprite* sprite,
+      frame_t frame,
+      const gfx::Clip& area,
+      Zoom zoom,
+      RenderScaledImage scaled_func);
+
+    void renderSpriteFromCache(
+      Image* dstImage,
+      const Sprite* sprite,
+      frame_t frame,
+      const gfx::Clip& area,
+      Zoom zoom,
+      RenderScaledImage scaled_func);
+
+    bool canUseCache(const Image* dstImage, Zoom zoom) const;
+    std::size_t renderStateHash(const Image* dstImage, frame_t frame) const;
+
     void renderLayer(
       const Layer* layer,
       Image* image,
@@ -156,6 +189,8 @@ namespace render {
     const Layer* m_selectedLayer;
     frame_t m_selectedFrame;
     Image* m_previewImage;
+    RenderCache* m_cache;
+    int m_threads;
 
     OnionskinType m_onionskinType;
     int m_onionskinPrevs;
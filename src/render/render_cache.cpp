@@ -0,0 +1,172 @@
+// Aseprite Render Library
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "render/render_cache.h"
+
+#include "doc/document_event.h"
+#include "doc/image.h"
+#include "gfx/region.h"
+#include "render/zoom.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace render {
+
+RenderCache::RenderCache(std::size_t maxMemory)
+  : m_maxMemory(maxMemory)
+  , m_useCounter(0)
+{
+}
+
+RenderCache::~RenderCache()
+{
+}
+
+std::size_t RenderCache::memSize() const
+{
+  std::size_t size = 0;
+  for (const auto& it : m_tiles)
+    size += it.second.image->getMemSize();
+  return size;
+}
+
+void RenderCache::invalidate()
+{
+  m_tiles.clear();
+}
+
+void RenderCache::invalidateRegion(const gfx::Region& spriteRgn)
+{
+  if (spriteRgn.isEmpty())
+    return;
+
+  gfx::Rect rgnBounds = spriteRgn.bounds();
+
+  for (Tiles::iterator it=m_tiles.begin(); it!=m_tiles.end(); ) {
+    const TileKey& key = it->first;
+
+    // Tile bounds in sprite coordinates (with one extra pixel in each
+    // side because of the rounding of zoomed cel positions).
+    int x1 = int(std::floor(key.u*kTileSize / key.scale)) - 1;
+    int y1 = int(std::floor(key.v*kTileSize / key.scale)) - 1;
+    int x2 = int(std::ceil((key.u+1)*kTileSize / key.scale)) + 1;
+    int y2 = int(std::ceil((key.v+1)*kTileSize / key.scale)) + 1;
+    gfx::Rect tileBounds(x1, y1, x2-x1, y2-y1);
+
+    if (rgnBounds.intersects(tileBounds) &&
+        spriteRgn.contains(tileBounds) != gfx::Region::Out)
+      it = m_tiles.erase(it);
+    else
+      ++it;
+  }
+}
+
+void RenderCache::validateFrame(frame_t frame, std::size_t stateHash)
+{
+  FrameHashes::iterator it = m_frameHashes.find(frame);
+  if (it == m_frameHashes.end()) {
+    m_frameHashes[frame] = stateHash;
+    invalidateFrame(frame);
+  }
+  else if (it->second != stateHash) {
+    it->second = stateHash;
+    invalidateFrame(frame);
+  }
+}
+
+void RenderCache::invalidateFrame(frame_t frame)
+{
+  for (Tiles::iterator it=m_tiles.begin(); it!=m_tiles.end(); ) {
+    if (it->first.frame == frame)
+      it = m_tiles.erase(it);
+    else
+      ++it;
+  }
+}
+
+Image* RenderCache::getTile(frame_t frame, const Zoom& zoom, int u, int v)
+{
+  Tiles::iterator it = m_tiles.find(TileKey(frame, zoom.scale(), u, v));
+  if (it == m_tiles.end())
+    return NULL;
+
+  it->second.lastUse = ++m_useCounter;
+  return it->second.image.get();
+}
+
+Image* RenderCache::createTile(frame_t frame, const Zoom& zoom, int u, int v,
+                               PixelFormat pixelFormat)
+{
+  Tile& tile = m_tiles[TileKey(frame, zoom.scale(), u, v)];
+  tile.image.reset(Image::create(pixelFormat, kTileSize, kTileSize));
+  tile.lastUse = ++m_useCounter;
+  return tile.image.get();
+}
+
+void RenderCache::evictOldTiles()
+{
+  if (m_tiles.empty())
+    return;
+
+  std::size_t tileSize = m_tiles.begin()->second.image->getMemSize();
+  std::size_t maxTiles = std::max<std::size_t>(1, m_maxMemory / tileSize);
+  if (m_tiles.size() <= maxTiles)
+    return;
+
+  // Remove the least recently used quarter of the cache so we don't
+  // have to do this on each new tile.
+  std::vector<unsigned int> uses;
+  uses.reserve(m_tiles.size());
+  for (const auto& it : m_tiles)
+    uses.push_back(it.second.lastUse);
+
+  std::size_t n = std::max<std::size_t>(m_tiles.size() - maxTiles,
+                                        maxTiles / 4);
+  n = std::min(n, m_tiles.size()-1);
+  std::nth_element(uses.begin(), uses.begin()+n, uses.end());
+  unsigned int threshold = uses[n];
+
+  for (Tiles::iterator it=m_tiles.begin(); it!=m_tiles.end(); ) {
+    if (it->second.lastUse < threshold)
+      it = m_tiles.erase(it);
+    else
+      ++it;
+  }
+}
+
+void RenderCache::onGeneralUpdate(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onAddLayer(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onAddFrame(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onAddCel(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onAfterRemoveLayer(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onRemoveFrame(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onRemoveCel(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onSpriteSizeChanged(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onSpriteTransparentColorChanged(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onLayerRestacked(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onLayerMergedDown(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onCelMoved(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onCelCopied(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onCelFrameChanged(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onCelPositionChanged(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onCelOpacityChanged(DocumentEvent& ev) { invalidate(); }
+void RenderCache::onTotalFramesChanged(DocumentEvent& ev) { invalidate(); }
+
+// The modified image can be used in other frames (linked cels) or
+// be visible in them (onionskin), so we cannot discard only the tiles
+// of ev.frame().
+void RenderCache::onImagePixelsModified(DocumentEvent& ev)
+{
+  invalidateRegion(ev.region());
+}
+
+} // namespace render
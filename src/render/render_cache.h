@@ -0,0 +1,140 @@
+// Aseprite Render Library
+// Copyright (c) 2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef RENDER_RENDER_CACHE_H_INCLUDED
+#define RENDER_RENDER_CACHE_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+#include "doc/document_observer.h"
+#include "doc/frame.h"
+#include "doc/image_ref.h"
+#include "doc/pixel_format.h"
+#include "gfx/rect.h"
+
+#include <cstddef>
+#include <map>
+
+namespace gfx {
+  class Region;
+}
+
+namespace render {
+  using namespace doc;
+
+  class Zoom;
+
+  // Cache of already composited tiles of one sprite. It is used by
+  // Render::renderSprite() (see Render::setCache()) so repaints of
+  // areas that didn't change (scroll, cursor movement, etc.) are
+  // just a copy from the cache instead of a full composition of the
+  // layer tree.
+  //
+  // Tiles are stored in zoomed sprite coordinates, keyed by frame and
+  // zoom level. All tiles of a frame are discarded when its render
+  // state (layers visibility, cels, palette, background, onionskin,
+  // etc.) changes, and specific tiles are discarded through the
+  // doc::DocumentObserver events (e.g. onImagePixelsModified).
+  //
+  // onSpritePixelsModified is not used because it's notified to
+  // repaint the extra cel too (e.g. the brush preview), and the extra
+  // cel area is never cached (see Render::setExtraImage()).
+  class RenderCache : public doc::DocumentObserver {
+  public:
+    static const int kTileSize = 64;
+    static const std::size_t kDefaultMaxMemory = 64*1024*1024;
+
+    RenderCache(std::size_t maxMemory = kDefaultMaxMemory);
+    ~RenderCache();
+
+    std::size_t maxMemory() const { return m_maxMemory; }
+    std::size_t memSize() const;
+    int tilesCount() const { return int(m_tiles.size()); }
+
+    // Discards all tiles.
+    void invalidate();
+
+    // Discards all tiles (of all frames and zoom levels) that
+    // intersect the given region (in sprite coordinates).
+    void invalidateRegion(const gfx::Region& spriteRgn);
+
+    // Called by Render with a hash of the whole render state of the
+    // given frame. If the hash is different from the previous one,
+    // all tiles of the frame are discarded.
+    void validateFrame(frame_t frame, std::size_t stateHash);
+
+    // Returns the cached tile in the given tile position (in tile
+    // units of the zoomed sprite) or NULL if it isn't cached yet.
+    Image* getTile(frame_t frame, const Zoom& zoom, int u, int v);
+
+    // Creates a new tile for the given position. The tile must be
+    // rendered by the caller.
+    Image* createTile(frame_t frame, const Zoom& zoom, int u, int v,
+                      PixelFormat pixelFormat);
+
+    // Discards the least recently used tiles if the cache uses more
+    // memory than maxMemory().
+    void evictOldTiles();
+
+    // doc::DocumentObserver impl
+    void onGeneralUpdate(DocumentEvent& ev) override;
+    void onAddLayer(DocumentEvent& ev) override;
+    void onAddFrame(DocumentEvent& ev) override;
+    void onAddCel(DocumentEvent& ev) override;
+    void onAfterRemoveLayer(DocumentEvent& ev) override;
+    void onRemoveFrame(DocumentEvent& ev) override;
+    void onRemoveCel(DocumentEvent& ev) override;
+    void onSpriteSizeChanged(DocumentEvent& ev) override;
+    void onSpriteTransparentColorChanged(DocumentEvent& ev) override;
+    void onLayerRestacked(DocumentEvent& ev) override;
+    void onLayerMergedDown(DocumentEvent& ev) override;
+    void onCelMoved(DocumentEvent& ev) override;
+    void onCelCopied(DocumentEvent& ev) override;
+    void onCelFrameChanged(DocumentEvent& ev) override;
+    void onCelPositionChanged(DocumentEvent& ev) override;
+    void onCelOpacityChanged(DocumentEvent& ev) override;
+    void onImagePixelsModified(DocumentEvent& ev) override;
+    void onTotalFramesChanged(DocumentEvent& ev) override;
+
+  private:
+    struct TileKey {
+      frame_t frame;
+      double scale;
+      int u, v;
+
+      TileKey(frame_t frame, double scale, int u, int v)
+        : frame(frame), scale(scale), u(u), v(v) {
+      }
+
+      bool operator<(const TileKey& o) const {
+        if (frame != o.frame) return frame < o.frame;
+        if (scale != o.scale) return scale < o.scale;
+        if (v != o.v) return v < o.v;
+        return u < o.u;
+      }
+    };
+
+    struct Tile {
+      ImageRef image;
+      unsigned int lastUse;
+    };
+
+    typedef std::map<TileKey, Tile> Tiles;
+    typedef std::map<frame_t, std::size_t> FrameHashes;
+
+    void invalidateFrame(frame_t frame);
+
+    Tiles m_tiles;
+    std::size_t m_maxMemory;
+    FrameHashes m_frameHashes;
+    unsigned int m_useCounter;
+
+    DISABLE_COPYING(RenderCache);
+  };
+
+} // namespace render
+
+#endif
@@ -13,9 +13,12 @@
 #include "render/render.h"
 
 #include "base/unique_ptr.h"
+#include "gfx/region.h"
+#include "render/render_cache.h"
 #include "doc/cel.h"
 #include "doc/context.h"
 #include "doc/document.h"
+#include "doc/document_event.h"
 #include "doc/image.h"
 #include "doc/layer.h"
 #include "doc/palette.h"
@@ -214,6 +217,169 @@ TEST(Render, ZoomAndDstBounds)
     0, 0, 0, 0);
 }
 
+static bool same_pixels(const Image* a, const Image* b)
+{
+  for (int y=0; y<a->height(); ++y)
+    for (int x=0; x<a->width(); ++x)
+      if (get_pixel(a, x, y) != get_pixel(b, x, y))
+        return false;
+  return true;
+}
+
+TEST(Render, CacheGivesSameResult)
+{
+  Context ctx;
+  Document* doc = ctx.documents().add(150, 130, ColorMode::RGB);
+  Sprite* spr = doc->sprite();
+
+  Image* src = spr->layer(0)->cel(0)->image();
+  for (int y=0; y<src->height(); ++y)
+    for (int x=0; x<src->width(); ++x)
+      put_pixel(src, x, y, rgba(x, y, x^y, (x*y) & 255));
+
+  LayerImage* lay2 = new LayerImage(spr);
+  spr->folder()->addLayer(lay2);
+  ImageRef img2(Image::create(IMAGE_RGB, 70, 33));
+  clear_image(img2.get(), rgba(255, 0, 0, 128));
+  Cel* cel2 = new Cel(frame_t(0), img2);
+  cel2->setPosition(-5, 77);
+  lay2->addCel(cel2);
+
+  Render render;
+  render.setBgType(BgType::CHECKED);
+  render.setBgZoom(false);
+  render.setBgColor1(rgba(255, 255, 255, 255));
+  render.setBgColor2(rgba(128, 128, 128, 255));
+  render.setBgCheckedSize(gfx::Size(7, 7));
+
+  RenderCache cache;
+  Zoom zooms[] = { Zoom(1, 1), Zoom(3, 1), Zoom(1, 2), Zoom(1, 3) };
+
+  for (const Zoom& zoom : zooms) {
+    gfx::Rect bounds(3, 5, zoom.apply(150)-7, zoom.apply(130)-4);
+    base::UniquePtr<Image> expected(Image::create(IMAGE_RGB, bounds.w, bounds.h));
+    base::UniquePtr<Image> cached(Image::create(IMAGE_RGB, bounds.w, bounds.h));
+
+    render.renderSprite(expected, spr, frame_t(0),
+      gfx::Clip(0, 0, bounds), zoom);
+
+    // Render two times, the second one only from the cache
+    render.setCache(&cache);
+    for (int i=0; i<2; ++i) {
+      clear_image(cached, 0);
+      render.renderSprite(cached, spr, frame_t(0),
+        gfx::Clip(0, 0, bounds), zoom);
+      EXPECT_TRUE(same_pixels(expected, cached));
+    }
+    render.removeCache();
+  }
+  EXPECT_LT(0, cache.tilesCount());
+
+  // Notifications to repaint the sprite (e.g. the brush preview in
+  // the extra cel) keep the tiles
+  int tiles = cache.tilesCount();
+  DocumentEvent ev(doc);
+  ev.sprite(spr);
+  ev.region(gfx::Region(gfx::Rect(10, 10, 11, 11)));
+  static_cast<DocumentObserver&>(cache).onSpritePixelsModified(ev);
+  EXPECT_EQ(tiles, cache.tilesCount());
+
+  // Modify pixels and invalidate the region
+  fill_rect(src, 10, 10, 20, 20, rgba(0, 0, 255, 255));
+  ev.image(src);
+  cache.onImagePixelsModified(ev);
+  EXPECT_GT(tiles, cache.tilesCount());
+
+  base::UniquePtr<Image> expected(Image::create(IMAGE_RGB, 150, 130));
+  base::UniquePtr<Image> cached(Image::create(IMAGE_RGB, 150, 130));
+  render.renderSprite(expected, spr, frame_t(0));
+  render.setCache(&cache);
+  render.renderSprite(cached, spr, frame_t(0));
+  render.removeCache();
+  EXPECT_TRUE(same_pixels(expected, cached));
+
+  // Hiding a layer discards the tiles of the frame
+  lay2->setVisible(false);
+  render.renderSprite(expected, spr, frame_t(0));
+  render.setCache(&cache);
+  render.renderSprite(cached, spr, frame_t(0));
+  render.removeCache();
+  EXPECT_TRUE(same_pixels(expected, cached));
+}
+
+TEST(Render, ThreadsGiveSameResult)
+{
+  Context ctx;
+  Document* doc = ctx.documents().add(300, 260, ColorMode::RGB);
+  Sprite* spr = doc->sprite();
+
+  Image* src = spr->layer(0)->cel(0)->image();
+  for (int y=0; y<src->height(); ++y)
+    for (int x=0; x<src->width(); ++x)
+      put_pixel(src, x, y, rgba(x, y, x^y, (x+y) & 255));
+
+  Render render;
+  render.setBgType(BgType::CHECKED);
+  render.setBgZoom(true);
+  render.setBgColor1(rgba(255, 255, 255, 255));
+  render.setBgColor2(rgba(128, 128, 128, 255));
+  render.setBgCheckedSize(gfx::Size(5, 5));
+
+  Zoom zooms[] = { Zoom(1, 1), Zoom(4, 1), Zoom(1, 2) };
+  for (const Zoom& zoom : zooms) {
+    gfx::Rect bounds(1, 3, zoom.apply(300)-2, zoom.apply(260)-5);
+    base::UniquePtr<Image> expected(Image::create(IMAGE_RGB, bounds.w, bounds.h));
+    base::UniquePtr<Image> result(Image::create(IMAGE_RGB, bounds.w, bounds.h));
+
+    render.setThreads(1);
+    render.renderSprite(expected, spr, frame_t(0),
+      gfx::Clip(0, 0, bounds), zoom);
+
+    render.setThreads(4);
+    render.renderSprite(result, spr, frame_t(0),
+      gfx::Clip(0, 0, bounds), zoom);
+    EXPECT_TRUE(same_pixels(expected, result));
+
+    clear_image(expected, 0);
+    clear_image(result, 0);
+    render.setThreads(1);
+    render.renderLayer(expected, spr->layer(0), frame_t(0));
+    render.setThreads(4);
+    render.renderLayer(result, spr->layer(0), frame_t(0));
+    EXPECT_TRUE(same_pixels(expected, result));
+  }
+}
+
+// The span blenders used by the renderer give the same result as
+// the per-pixel blender functions.
+TEST(Render, BlendSpansGiveSameResult)
+{
+  const int w = 300, h = 200;
+  base::UniquePtr<Image> back(Image::create(IMAGE_RGB, w, h));
+  base::UniquePtr<Image> front(Image::create(IMAGE_RGB, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      put_pixel(back, x, y, rgba(x, y, x+y, 255));
+      put_pixel(front, x, y, rgba(y, x, x^y, (x*y) & 255));
+    }
+
+  base::UniquePtr<Image> dst1(Image::createCopy(back));
+  BLEND_COLOR blender = rgba_blenders[BLEND_MODE_NORMAL];
+  for (int y=0; y<h; ++y) {
+    uint32_t* d = (uint32_t*)dst1->getPixelAddress(0, y);
+    const uint32_t* f = (const uint32_t*)front->getPixelAddress(0, y);
+    for (int x=0; x<w; ++x)
+      if (f[x] != 0)
+        d[x] = (*blender)(d[x], f[x], 200);
+  }
+
+  base::UniquePtr<Image> dst2(Image::createCopy(back));
+  Render().renderImage(dst2, front, NULL, 0, 0, Zoom(1, 1),
+                       200, BLEND_MODE_NORMAL);
+
+  EXPECT_TRUE(same_pixels(dst1, dst2));
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
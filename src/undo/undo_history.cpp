@@ -18,8 +18,9 @@
 
 namespace undo {
 
-UndoHistory::UndoHistory()
-  : m_first(nullptr)
+UndoHistory::UndoHistory(UndoHistoryDelegate* delegate)
+  : m_delegate(delegate)
+  , m_first(nullptr)
   , m_last(nullptr)
   , m_cur(nullptr)
 {
@@ -68,7 +69,7 @@ void UndoHistory::clearRedo()
        state && state != m_cur;
        state = prev) {
     prev = state->m_prev;
-    delete state;
+    deleteState(state);
   }
 
   if (m_cur) {
@@ -80,6 +81,32 @@ void UndoHistory::clearRedo()
   }
 }
 
+bool UndoHistory::deleteFirstState()
+{
+  UndoState* first = m_first;
+  if (!first || !m_cur || m_cur == first)
+    return false;
+
+  // All other states must be descendants of the first one, so the
+  // first state can be merged with the initial state of the history
+  // (the "nullptr" parent).
+  for (UndoState* state = first->m_next; state; state = state->m_next) {
+    if (!state->m_parent)
+      return false;
+  }
+
+  for (UndoState* state = first->m_next; state; state = state->m_next) {
+    if (state->m_parent == first)
+      state->m_parent = nullptr;
+  }
+
+  m_first = first->m_next;
+  m_first->m_prev = nullptr;
+
+  deleteState(first);
+  return true;
+}
+
 void UndoHistory::add(UndoCommand* cmd)
 {
   UndoState* state = new UndoState;
@@ -150,4 +177,12 @@ void UndoHistory::moveTo(UndoState* new_state)
   m_cur = new_state;
 }
 
+void UndoHistory::deleteState(UndoState* state)
+{
+  if (m_delegate)
+    m_delegate->onDeleteUndoState(state);
+
+  delete state;
+}
+
 } // namespace undo
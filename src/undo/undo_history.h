@@ -13,9 +13,17 @@ namespace undo {
   class UndoCommand;
   class UndoState;
 
+  class UndoHistoryDelegate {
+  public:
+    virtual ~UndoHistoryDelegate() { }
+    // Called before a state is deleted from the history (e.g. to
+    // delete its command, the history doesn't own commands).
+    virtual void onDeleteUndoState(UndoState* state) = 0;
+  };
+
   class UndoHistory {
   public:
-    UndoHistory();
+    UndoHistory(UndoHistoryDelegate* delegate = nullptr);
     virtual ~UndoHistory();
 
     const UndoState* firstState()   const { return m_first; }
@@ -30,10 +38,18 @@ namespace undo {
 
     void clearRedo();
 
+    // Deletes the oldest state of the history, its command cannot be
+    // undone anymore. Returns false if the state cannot be deleted
+    // because it's not part of the current state (e.g. it is the
+    // current state or it was undone).
+    bool deleteFirstState();
+
   private:
     UndoState* findCommonParent(UndoState* a, UndoState* b);
     void moveTo(UndoState* new_state);
+    void deleteState(UndoState* state);
 
+    UndoHistoryDelegate* m_delegate;
     UndoState* m_first;
     UndoState* m_last;
     UndoState* m_cur;          // Current action that can be undone
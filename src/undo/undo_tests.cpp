@@ -12,6 +12,7 @@
 
 #include "undo/undo_command.h"
 #include "undo/undo_history.h"
+#include "undo/undo_state.h"
 
 #ifdef _WIN32
   #include <functional>
@@ -189,6 +190,86 @@ TEST(Undo, ComplexTree)
   EXPECT_FALSE(history.canRedo());
 }
 
+class Delegate : public UndoHistoryDelegate {
+public:
+  Delegate() : deleted(0) { }
+  void onDeleteUndoState(UndoState* state) override { ++deleted; }
+  int deleted;
+};
+
+TEST(Undo, DeleteFirstState)
+{
+  Delegate delegate;
+  UndoHistory history(&delegate);
+  int model = 0;
+
+  Cmd cmd1([&]{ model = 1; }, [&]{ model = 0; });
+  Cmd cmd2([&]{ model = 2; }, [&]{ model = 1; });
+  Cmd cmd3([&]{ model = 3; }, [&]{ model = 2; });
+
+  cmd1.redo(); history.add(&cmd1);
+  EXPECT_FALSE(history.deleteFirstState()); // cmd1 is the current state
+
+  cmd2.redo(); history.add(&cmd2);
+  cmd3.redo(); history.add(&cmd3);
+  EXPECT_TRUE(history.deleteFirstState());
+  EXPECT_EQ(1, delegate.deleted);
+  EXPECT_EQ(&cmd2, history.firstState()->cmd());
+
+  history.undo();
+  EXPECT_EQ(2, model);
+  history.undo();
+  EXPECT_EQ(1, model);
+  EXPECT_FALSE(history.canUndo());
+  EXPECT_FALSE(history.deleteFirstState()); // cmd2 was undone
+
+  history.redo();
+  EXPECT_EQ(2, model);
+  history.redo();
+  EXPECT_EQ(3, model);
+  EXPECT_FALSE(history.canRedo());
+}
+
+TEST(Undo, DeleteFirstStateOfTree)
+{
+  Delegate delegate;
+  UndoHistory history(&delegate);
+  int model = 0;
+
+  // 1 --- 2 --- 3
+  // |
+  // +---- 4
+  Cmd cmd1([&]{ model = 1; }, [&]{ model = 0; });
+  Cmd cmd2([&]{ model = 2; }, [&]{ model = 1; });
+  Cmd cmd3([&]{ model = 3; }, [&]{ model = 2; });
+  Cmd cmd4([&]{ model = 4; }, [&]{ model = 1; });
+  Cmd cmd5([&]{ model = 5; }, [&]{ model = 1; });
+
+  cmd1.redo(); history.add(&cmd1);
+  cmd2.redo(); history.add(&cmd2);
+  cmd3.redo(); history.add(&cmd3);
+  history.undo();
+  history.undo();
+  cmd4.redo(); history.add(&cmd4);
+
+  EXPECT_TRUE(history.deleteFirstState());
+  EXPECT_EQ(4, model);
+  history.undo();
+  EXPECT_EQ(3, model);
+  history.undo();
+  EXPECT_EQ(2, model);
+  history.undo();
+  EXPECT_EQ(1, model);
+  EXPECT_FALSE(history.canUndo());
+
+  // A new branch from the initial state (cmd5 doesn't depend on the
+  // cmd2 state), so cmd2 cannot be deleted.
+  cmd5.redo();
+  history.add(&cmd5);
+  EXPECT_FALSE(history.deleteFirstState());
+  EXPECT_EQ(1, delegate.deleted);
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);